@@ -34,8 +34,9 @@ documentation and/or software.
 #include "MD5.h"
 
 /* system implementation headers */
+#include <algorithm>
 #include <cstdio>
-#include <sstream>
+#include <vector>
 
 // Constants for MD5Transform routine.
 #define S11 7
@@ -127,9 +128,14 @@ void MD5::init() {
 // decodes input (unsigned char) into output (uint4). Assumes len is a multiple
 // of 4.
 void MD5::decode(uint4 output[], const uint1 input[], size_type len) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  // words are stored in little endian already, input could be unaligned
+  memcpy(output, input, len);
+#else
   for (unsigned int i = 0, j = 0; j < len; i++, j += 4)
     output[i] = ((uint4)input[j]) | (((uint4)input[j + 1]) << 8) |
                 (((uint4)input[j + 2]) << 16) | (((uint4)input[j + 3]) << 24);
+#endif
 }
 
 //////////////////////////////
@@ -229,8 +235,8 @@ void MD5::transform(const uint1 block[blocksize]) {
   state[2] += c;
   state[3] += d;
 
-  // Zeroize sensitive information.
-  memset(x, 0, sizeof x);
+  // x is not zeroized, as hashes are only used to check data integrity and
+  // this is the hot loop of hashing upload buffers
 }
 
 //////////////////////////////
@@ -333,17 +339,34 @@ std::ostream &operator<<(std::ostream &out, MD5 md5) {
 //////////////////////////////
 
 std::string md5(const std::string str) {
-  MD5 md5 = MD5(str);
+  return md5(str.c_str(), str.length());
+}
 
-  return md5.hexdigest();
+std::string md5(const char *buf, size_t len) {
+  MD5 md5;
+  // update takes 32 bit length
+  static const size_t kMaxChunk = 1 << 30;
+  while (len > 0) {
+    size_t chunk = std::min(len, kMaxChunk);
+    md5.update(buf, static_cast<MD5::size_type>(chunk));
+    buf += chunk;
+    len -= chunk;
+  }
+  return md5.finalize().hexdigest();
 }
 
 std::string md5(const boost::shared_ptr<std::iostream> &stream) {
-  std::stringstream ss;
+  // hash in chunks instead of copying the whole stream
+  static const size_t kChunkSize = 64 * 1024;
+  std::vector<char> chunk(kChunkSize);
+  MD5 md5;
+  stream->clear();
   stream->seekg(0, std::ios_base::beg);
-  ss << stream->rdbuf();
-  MD5 md5 = MD5(ss.str());
+  while (stream->read(&chunk[0], kChunkSize) || stream->gcount() > 0) {
+    md5.update(&chunk[0], static_cast<MD5::size_type>(stream->gcount()));
+  }
+  stream->clear();
   stream->seekg(0, std::ios_base::beg);
 
-  return md5.hexdigest();
+  return md5.finalize().hexdigest();
 }
\ No newline at end of file
@@ -93,6 +93,8 @@ class MD5 {
 };
 
 std::string md5(const std::string str);
+// hash a buffer in place, e.g. the buffer of an upload part
+std::string md5(const char *buf, size_t len);
 std::string md5(const boost::shared_ptr<std::iostream> &stream);
 
 #endif  // QSFS_BASE_MD5_H_
\ No newline at end of file
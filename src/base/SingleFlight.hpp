@@ -0,0 +1,144 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#ifndef QSFS_BASE_SINGLEFLIGHT_HPP_
+#define QSFS_BASE_SINGLEFLIGHT_HPP_
+
+#include <map>
+#include <string>
+#include <utility>
+
+#include "boost/function.hpp"
+#include "boost/make_shared.hpp"
+#include "boost/noncopyable.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/thread/condition_variable.hpp"
+#include "boost/thread/locks.hpp"
+#include "boost/thread/mutex.hpp"
+
+namespace QS {
+
+namespace Threading {
+
+//
+// Coalesce concurrent calls of the same key, so only one of them is in flight
+// and the others share its result.
+//
+// Use:
+// SingleFlight<int> flight;
+// std::pair<int, bool> res = flight.Do(key, fn);
+//
+// A call finished is not cached, the next call of the key will run again.
+// Forget calls in flight when their results become stale, e.g. the object is
+// changed, so that later callers don't share them.
+//
+template <typename Result>
+class SingleFlight : private boost::noncopyable {
+ public:
+  SingleFlight() {}
+
+  // Run the function for the key, or wait for the call of the key in flight
+  //
+  // @param  : key, function
+  // @return : a pair of {result, bool denotes if the result is shared from
+  //           another caller}
+  //
+  // If the call in flight throws, the waiting callers run the function by
+  // themselves.
+  std::pair<Result, bool> Do(const std::string &key,
+                             const boost::function<Result()> &fn) {
+    boost::shared_ptr<Call> call;
+    {
+      boost::unique_lock<boost::mutex> lock(m_mutex);
+      typename CallMap::iterator it = m_calls.find(key);
+      if (it != m_calls.end()) {
+        call = it->second;
+        while (!call->done) {
+          m_cond.wait(lock);
+        }
+        if (call->succeed) {
+          return std::make_pair(call->result, true);
+        }
+        lock.unlock();
+        return std::make_pair(fn(), false);
+      }
+      call = boost::make_shared<Call>();
+      m_calls[key] = call;
+    }
+
+    try {
+      Result result = fn();
+      Finish(key, call, result, true);
+      return std::make_pair(result, false);
+    } catch (...) {
+      Finish(key, call, Result(), false);
+      throw;
+    }
+  }
+
+  // Forget calls in flight, later callers of the keys will run again
+  //
+  // @param  : key prefix
+  // @return : void
+  //
+  // Callers already waiting for the forgotten calls still share their results.
+  void Forget(const std::string &keyPrefix) {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    typename CallMap::iterator it = m_calls.lower_bound(keyPrefix);
+    while (it != m_calls.end() &&
+           it->first.compare(0, keyPrefix.size(), keyPrefix) == 0) {
+      m_calls.erase(it++);
+    }
+  }
+
+  // Return the number of calls in flight
+  size_t GetNumCalls() const {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_calls.size();
+  }
+
+ private:
+  struct Call {
+    bool done;
+    bool succeed;
+    Result result;
+    Call() : done(false), succeed(false), result() {}
+  };
+  typedef std::map<std::string, boost::shared_ptr<Call> > CallMap;
+
+  void Finish(const std::string &key, const boost::shared_ptr<Call> &call,
+              const Result &result, bool succeed) {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    call->result = result;
+    call->succeed = succeed;
+    call->done = true;
+    typename CallMap::iterator it = m_calls.find(key);
+    if (it != m_calls.end() && it->second == call) {  // not forgotten
+      m_calls.erase(it);
+    }
+    m_cond.notify_all();
+  }
+
+ private:
+  mutable boost::mutex m_mutex;
+  boost::condition_variable m_cond;
+  CallMap m_calls;
+};
+
+}  // namespace Threading
+}  // namespace QS
+
+#endif  // QSFS_BASE_SINGLEFLIGHT_HPP_
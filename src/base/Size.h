@@ -25,9 +25,12 @@ namespace QS {
 namespace Size {
 
 static const uint64_t KB1 = 1 * 1024;
+static const uint64_t KB4 = 4 * 1024;
 static const uint64_t KB8 = 8 * 1024;
 static const uint64_t KB10 = 10 * 1024;
+static const uint64_t KB64 = 64 * 1024;
 static const uint64_t KB100 = 100 * 1024;
+static const uint64_t KB256 = 256 * 1024;
 
 static const uint64_t MB1 = 1 * 1024 * 1024;
 static const uint64_t MB4 = 4 * 1024 * 1024;
@@ -40,6 +40,7 @@
 namespace QS {
 namespace Data {
 class Cache;
+class DirectoryListing;
 class DirectoryTree;
 class FileMetaData;
 }  // namespace Data
@@ -114,15 +115,18 @@ class Client : private boost::noncopyable {
 
   // Download file
   //
-  // @param  : file path, contenct range, buffer(input), *eTag
+  // @param  : file path, contenct range, buffer(input), *eTag, etag to match
   // @return : ClinetError
   //
   // If range is empty, then the whole file will be downloaded.
   // The file data will be written to buffer.
+  // If etag to match is given, the download fails with PRECONDITION_FAILED
+  // when the object has been changed to another etag.
   virtual ClientError<QSError::Value> DownloadFile(
       const std::string &filePath,
       boost::shared_ptr<std::iostream> buffer,
-      const std::string &range = std::string(), std::string *eTag = NULL) = 0;
+      const std::string &range = std::string(), std::string *eTag = NULL,
+      const std::string &ifMatch = std::string()) = 0;
 
   // Initiate multipart upload id
   //
@@ -133,12 +137,13 @@ class Client : private boost::noncopyable {
 
   // Upload multipart
   //
-  // @param  : file path, upload id, part number, content len, buffer
+  // @param  : file path, upload id, part number, content len, buffer,
+  //           content md5 (computed from buffer if empty)
   // @return : ClientError
   virtual ClientError<QSError::Value> UploadMultipart(
       const std::string &filePath, const std::string &uploadId, int partNumber,
-      uint64_t contentLength,
-      boost::shared_ptr<std::iostream> buffer) = 0;
+      uint64_t contentLength, boost::shared_ptr<std::iostream> buffer,
+      const std::string &contentMD5 = std::string()) = 0;
 
   // Complete multipart upload
   //
@@ -157,11 +162,13 @@ class Client : private boost::noncopyable {
 
   // Upload file using PutObject
   //
-  // @param  : file path, file size, buffer
+  // @param  : file path, file size, buffer, content md5 (computed from
+  //           buffer if empty)
   // @return : ClientError
   virtual ClientError<QSError::Value> UploadFile(
       const std::string &filePath, uint64_t fileSize,
-      boost::shared_ptr<std::iostream> buffer) = 0;
+      boost::shared_ptr<std::iostream> buffer,
+      const std::string &contentMD5 = std::string()) = 0;
 
   // Create a symbolic link to a file
   //
@@ -176,16 +183,21 @@ class Client : private boost::noncopyable {
 
   // List directory
   //
-  // @param  : dir path,dir tree
+  // @param  : dir path, dir tree, listing to fill (optional)
   // @return : ClientError
   //
   // ListDirectory will update directory in tree if dir exists and is modified
   // or grow the tree if the directory is not existing in tree.
   //
+  // The tree is grown page by page, and the children of each page are added
+  // to the listing if given, it's finished when the list is done or fails.
+  //
   // Notice the dirPath should end with delimiter.
   virtual ClientError<QSError::Value> ListDirectory(
       const std::string &dirPath,
-      const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree) = 0;
+      const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree,
+      const boost::shared_ptr<QS::Data::DirectoryListing> &listing =
+          boost::shared_ptr<QS::Data::DirectoryListing>()) = 0;
 
   // Get object meta data
   //
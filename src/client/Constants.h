@@ -31,6 +31,13 @@ namespace Constants {
 // default value is 200, but test shows 500 give better performance
 static const uint16_t BucketListObjectsLimit = 500;
 
+// A directory still truncated after this num of list pages is taken as a
+// very large one, the rest of it is listed in key ranges concurrently
+static const uint16_t ParallelListThresholdPages = 10;
+
+// Max num of executor threads helping to list a very large directory
+static const uint16_t ParallelListMaxHelpers = 4;
+
 // limitation for per tranasction of DeleteMulitipleObjects
 // https://docs.qingcloud.com/qingstor/api/bucket/delete_multiple.html
 static const uint16_t BucketDeleteMultipleObjectsLimit = 200;
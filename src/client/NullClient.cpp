@@ -22,6 +22,7 @@
 
 #include "client/QSError.h"
 #include "data/Cache.h"
+#include "data/DirectoryListing.h"
 #include "data/DirectoryTree.h"
 #include "data/FileMetaData.h"
 
@@ -66,7 +67,7 @@ ClientError<QSError::Value> NullClient::MoveDirectory(
 
 ClientError<QSError::Value> NullClient::DownloadFile(
     const string &filePath, shared_ptr<std::iostream> buffer,
-    const string &range, string *eTag) {
+    const string &range, string *eTag, const string &ifMatch) {
   return GoodState();
 }
 
@@ -77,7 +78,8 @@ ClientError<QSError::Value> NullClient::InitiateMultipartUpload(
 
 ClientError<QSError::Value> NullClient::UploadMultipart(
     const string &filePath, const string &uploadId, int partNumber,
-    uint64_t contentLength, shared_ptr<std::iostream> buffer) {
+    uint64_t contentLength, shared_ptr<std::iostream> buffer,
+    const string &contentMD5) {
   return GoodState();
 }
 
@@ -94,7 +96,7 @@ ClientError<QSError::Value> NullClient::AbortMultipartUpload(
 
 ClientError<QSError::Value> NullClient::UploadFile(
     const string &filePath, uint64_t fileSize,
-    shared_ptr<std::iostream> buffer) {
+    shared_ptr<std::iostream> buffer, const string &contentMD5) {
   return GoodState();
 }
 
@@ -104,7 +106,11 @@ ClientError<QSError::Value> NullClient::SymLink(const string &filePath,
 }
 
 ClientError<QSError::Value> NullClient::ListDirectory(
-    const string &dirPath, const shared_ptr<QS::Data::DirectoryTree> &dirTree) {
+    const string &dirPath, const shared_ptr<QS::Data::DirectoryTree> &dirTree,
+    const shared_ptr<QS::Data::DirectoryListing> &listing) {
+  if (listing) {
+    listing->Finish();
+  }
   return GoodState();
 }
 
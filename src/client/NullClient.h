@@ -25,6 +25,7 @@
 namespace QS {
 namespace Data {
 class Cache;
+class DirectoryListing;
 class DirectoryTree;
 class FileMetaData;
 }  // namespace Data
@@ -53,14 +54,15 @@ class NullClient : public Client {
   ClientError<QSError::Value> DownloadFile(
       const std::string &filePath,
       boost::shared_ptr<std::iostream> buffer, const std::string &range,
-      std::string *eTag);
+      std::string *eTag, const std::string &ifMatch);
 
   ClientError<QSError::Value> InitiateMultipartUpload(
       const std::string &filePath, std::string *uploadId);
 
   ClientError<QSError::Value> UploadMultipart(
       const std::string &filePath, const std::string &uploadId, int partNumber,
-      uint64_t contentLength, boost::shared_ptr<std::iostream> buffer);
+      uint64_t contentLength, boost::shared_ptr<std::iostream> buffer,
+      const std::string &contentMD5 = std::string());
 
   ClientError<QSError::Value> SymLink(const std::string &filePath,
                                       const std::string &linkPath);
@@ -74,11 +76,14 @@ class NullClient : public Client {
 
   ClientError<QSError::Value> UploadFile(
       const std::string &filePath, uint64_t fileSize,
-      boost::shared_ptr<std::iostream> buffer);
+      boost::shared_ptr<std::iostream> buffer,
+      const std::string &contentMD5 = std::string());
 
   ClientError<QSError::Value> ListDirectory(
       const std::string &dirPath,
-      const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree);
+      const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree,
+      const boost::shared_ptr<QS::Data::DirectoryListing> &listing =
+          boost::shared_ptr<QS::Data::DirectoryListing>());
 
   ClientError<QSError::Value> Stat(
       const std::string &path,
@@ -39,7 +39,8 @@ class NullTransferManager : public TransferManager {
  public:
   boost::shared_ptr<TransferHandle> DownloadFile(
       const std::string &filePath, off_t offset, uint64_t size,
-      boost::shared_ptr<std::iostream> downStream, bool async = false) {
+      boost::shared_ptr<std::iostream> downStream, bool async = false,
+      const std::string &ifMatch = std::string()) {
     return boost::shared_ptr<TransferHandle>();
   }
 
@@ -0,0 +1,234 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include "client/PartitionedListing.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+
+#include "boost/foreach.hpp"
+#include "boost/thread/locks.hpp"
+
+#include "data/FileMetaData.h"
+
+namespace QS {
+
+namespace Client {
+
+using boost::lock_guard;
+using boost::mutex;
+using boost::shared_ptr;
+using boost::unique_lock;
+using QS::Data::FileMetaData;
+using std::deque;
+using std::map;
+using std::string;
+
+// --------------------------------------------------------------------------
+string MarkerBefore(const string &key) {
+  assert(!key.empty());
+  string marker = key.substr(0, key.size() - 1);
+  marker.push_back(static_cast<char>(key[key.size() - 1] - 1));
+  marker.append("\xf4\x8f\xbf\xbf");
+  return marker;
+}
+
+// --------------------------------------------------------------------------
+deque<ListRange> SplitListRanges(const string &prefix, const string &marker,
+                                 const string &stopKey) {
+  // ranges at the last chars of the marker are too small to list alone
+  static const size_t SKIP_DEPTH = 3;
+  deque<ListRange> ranges;
+  string start = marker;
+  string startMarker = marker;
+  size_t depth = marker.size() > prefix.size() + SKIP_DEPTH
+                     ? marker.size() - SKIP_DEPTH
+                     : prefix.size();
+  bool stopped = false;
+  for (size_t i = depth + 1; i-- > prefix.size() && !stopped;) {
+    int first = i < marker.size() ? static_cast<unsigned char>(marker[i]) : 0;
+    for (int c = std::max(first + 1, 0x20); c <= 0xf4; ++c) {
+      if (c >= 0x7f && c < 0xc2) {
+        continue;
+      }
+      string bound = marker.substr(0, i) + static_cast<char>(c);
+      if (!stopKey.empty() && bound >= stopKey) {
+        stopped = true;
+        break;
+      }
+      ranges.push_back(ListRange(start, startMarker, bound));
+      start = bound;
+      startMarker = MarkerBefore(bound);
+    }
+  }
+  ranges.push_back(ListRange(start, startMarker, stopKey));
+  return ranges;
+}
+
+// --------------------------------------------------------------------------
+PartitionedListing::PartitionedListing(const string &prefix,
+                                       const string &marker,
+                                       const ListPageFunction &listPage,
+                                       const ApplyMetasFunction &applyMetas)
+    : m_prefix(prefix),
+      m_listPage(listPage),
+      m_applyMetas(applyMetas),
+      m_ranges(SplitListRanges(prefix, marker, string())),
+      m_numRunning(0),
+      m_numSplittable(0),
+      m_numIdle(0),
+      m_error(QSError::GOOD, false) {}
+
+// --------------------------------------------------------------------------
+void PartitionedListing::ListRanges(bool waitForAll) {
+  ListRange range("", "", "");
+  while (TakeRange(&range, waitForAll)) {
+    string keyBeyond;
+    ClientError<QSError::Value> err = DoListRange(&range, &keyBeyond);
+    FinishRange(range, keyBeyond, err);
+  }
+}
+
+// --------------------------------------------------------------------------
+ClientError<QSError::Value> PartitionedListing::GetError() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_error;
+}
+
+// --------------------------------------------------------------------------
+bool PartitionedListing::TakeRange(ListRange *range, bool waitForAll) {
+  unique_lock<mutex> lock(m_mutex);
+  while (true) {
+    while (!m_ranges.empty()) {
+      ListRange front = m_ranges.front();
+      m_ranges.pop_front();
+      if (!IsKnownEmpty(front)) {
+        *range = front;
+        range->splittable = true;
+        ++m_numRunning;
+        ++m_numSplittable;
+        return true;
+      }
+    }
+    if (m_numRunning == 0) {
+      m_rangeChanged.notify_all();
+      return false;
+    }
+    // no more ranges will be split out for a helper
+    if (!waitForAll && m_numSplittable == 0) {
+      return false;
+    }
+    ++m_numIdle;
+    m_rangeChanged.wait(lock);
+    --m_numIdle;
+  }
+}
+
+// --------------------------------------------------------------------------
+bool PartitionedListing::IsKnownEmpty(const ListRange &range) const {
+  map<string, string>::const_iterator it =
+      m_absentKeys.upper_bound(range.startKey);
+  if (it == m_absentKeys.begin()) {
+    return false;
+  }
+  --it;  // the last interval starting no later than the range
+  if (it->second.empty()) {
+    return true;
+  }
+  return !range.stopKey.empty() && range.stopKey <= it->second;
+}
+
+// --------------------------------------------------------------------------
+void PartitionedListing::SplitRange(const string &marker, ListRange *range) {
+  lock_guard<mutex> lock(m_mutex);
+  if (!range->splittable || m_numIdle == 0 || !m_ranges.empty() ||
+      !IsGoodQSError(m_error)) {
+    return;
+  }
+  deque<ListRange> ranges = SplitListRanges(m_prefix, marker, range->stopKey);
+  if (ranges.size() > 1) {
+    range->stopKey = ranges.front().stopKey;
+    m_ranges.insert(m_ranges.end(), ranges.begin() + 1, ranges.end());
+  } else {
+    // the rest is even smaller after later markers
+    range->splittable = false;
+    --m_numSplittable;
+  }
+  m_rangeChanged.notify_all();
+}
+
+// --------------------------------------------------------------------------
+void PartitionedListing::FinishRange(const ListRange &range,
+                                     const string &keyBeyond,
+                                     const ClientError<QSError::Value> &err) {
+  lock_guard<mutex> lock(m_mutex);
+  --m_numRunning;
+  if (range.splittable) {
+    --m_numSplittable;
+  }
+  if (!IsGoodQSError(err)) {
+    if (IsGoodQSError(m_error)) {
+      m_error = err;
+    }
+    m_ranges.clear();  // stop listing
+  } else if (!range.stopKey.empty()) {
+    // no key from the stop key to the key beyond, or to the end if none
+    string &absentStop = m_absentKeys[range.stopKey];
+    if (absentStop.empty() || keyBeyond < absentStop) {
+      absentStop = keyBeyond;
+    }
+  }
+  m_rangeChanged.notify_all();
+}
+
+// --------------------------------------------------------------------------
+ClientError<QSError::Value> PartitionedListing::DoListRange(
+    ListRange *range, string *keyBeyond) {
+  string marker = range->marker;
+  bool resultTruncated = false;
+  do {
+    FileMetaDataList metas;
+    string nextMarker;
+    ClientError<QSError::Value> err =
+        m_listPage(marker, &metas, &nextMarker, &resultTruncated);
+    if (!IsGoodQSError(err)) {
+      return err;
+    }
+
+    FileMetaDataList metasInRange;
+    BOOST_FOREACH (const shared_ptr<FileMetaData> &meta, metas) {
+      string key = meta->GetFilePath().substr(1);
+      if (range->stopKey.empty() || key < range->stopKey) {
+        metasInRange.push_back(meta);
+      } else if (keyBeyond->empty() || key < *keyBeyond) {
+        *keyBeyond = key;
+      }
+    }
+    m_applyMetas(metasInRange);
+    marker = nextMarker;
+    if (resultTruncated && keyBeyond->empty()) {
+      SplitRange(marker, range);
+    }
+  } while (resultTruncated && keyBeyond->empty());
+  return ClientError<QSError::Value>(QSError::GOOD, false);
+}
+
+}  // namespace Client
+}  // namespace QS
@@ -0,0 +1,169 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#ifndef QSFS_CLIENT_PARTITIONEDLISTING_H_
+#define QSFS_CLIENT_PARTITIONEDLISTING_H_
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "boost/function.hpp"
+#include "boost/noncopyable.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/thread/condition_variable.hpp"
+#include "boost/thread/mutex.hpp"
+
+#include "client/ClientError.hpp"
+#include "client/QSError.h"
+
+namespace QS {
+
+namespace Data {
+class FileMetaData;
+}  // namespace Data
+
+namespace Client {
+
+// Key range [startKey, stopKey) of a partitioned listing, which is listed
+// from the marker. An empty stop key means no upper bound.
+struct ListRange {
+  std::string startKey;
+  std::string marker;
+  std::string stopKey;
+  bool splittable;  // whether the rest of it could be split when listing
+
+  ListRange(const std::string &startKey_, const std::string &marker_,
+            const std::string &stopKey_)
+      : startKey(startKey_),
+        marker(marker_),
+        stopKey(stopKey_),
+        splittable(true) {}
+};
+
+typedef std::vector<boost::shared_ptr<QS::Data::FileMetaData> >
+    FileMetaDataList;
+
+// List a page of the objects after the marker
+//
+// @param  : marker, metas(output), next marker(output), truncated(output)
+// @return : ClientError
+typedef boost::function<ClientError<QSError::Value>(
+    const std::string &, FileMetaDataList *, std::string *, bool *)>
+    ListPageFunction;
+
+// Receive the metas listed in a range
+typedef boost::function<void(const FileMetaDataList &)> ApplyMetasFunction;
+
+// Return a marker right before the key
+//
+// Any key starting with the key minus its last char sorts before the marker,
+// as the max utf-8 code point U+10FFFF is appended.
+std::string MarkerBefore(const std::string &key);
+
+// Split the keys from the marker (exclusive) to the stop key (exclusive, empty
+// for no upper bound) under the prefix into adjacent ranges in order
+//
+// The distribution of keys is unknown before listing them, so the key space is
+// split at each char of the marker after the prefix: the keys sharing the
+// marker up to the char but greater at it form one range per char, so the
+// ranges grow from the marker to the prefix. E.g. after 'img_0005000', ranges
+// are 'img_0006', ..., 'img_001', ..., 'img_01', ..., 'img_1', ... Chars are
+// the printable ascii chars and utf-8 leading bytes.
+std::deque<ListRange> SplitListRanges(const std::string &prefix,
+                                      const std::string &marker,
+                                      const std::string &stopKey);
+
+// Ranges of a partitioned listing shared by the lister threads
+//
+// Ranges are taken in order by the listers. A range stops once a key beyond
+// it is listed, and the keys from its stop key to that key are known to be
+// absent, so the ranges in between are skipped without listing them. When
+// there are idle listers, a lister splits the rest of its range for them.
+class PartitionedListing : private boost::noncopyable {
+ public:
+  // Construct partitioned listing
+  //
+  // @param  : prefix, marker to list after, function to list a page,
+  //           function to receive the listed metas
+  // @return :
+  PartitionedListing(const std::string &prefix, const std::string &marker,
+                     const ListPageFunction &listPage,
+                     const ApplyMetasFunction &applyMetas);
+
+ public:
+  // List ranges until all of them are listed
+  //
+  // @param  : whether to wait for the ranges listed by others
+  // @return : void
+  //
+  // The owner of the listing waits until all ranges are listed. A helper
+  // returns once no range is left to take, and none of the ranges being
+  // listed could be split for it any more.
+  void ListRanges(bool waitForAll = true);
+
+  // Return the first error of the ranges
+  ClientError<QSError::Value> GetError() const;
+
+ private:
+  PartitionedListing() {}
+
+  // Take a range to list, wait if there is none while other ranges are being
+  // listed as they could be split
+  bool TakeRange(ListRange *range, bool waitForAll);
+
+  // Whether the keys of the range are known to be absent, lock is held
+  bool IsKnownEmpty(const ListRange &range) const;
+
+  // Split the rest of a range after the marker for idle listers
+  void SplitRange(const std::string &marker, ListRange *range);
+
+  void FinishRange(const ListRange &range, const std::string &keyBeyond,
+                   const ClientError<QSError::Value> &err);
+
+  // List a range page by page
+  //
+  // @param  : range, key beyond the range(output), empty if there is none
+  // @return : ClientError
+  //
+  // The stop key of the range could be lowered when it's split.
+  ClientError<QSError::Value> DoListRange(ListRange *range,
+                                          std::string *keyBeyond);
+
+ private:
+  std::string m_prefix;
+  ListPageFunction m_listPage;
+  ApplyMetasFunction m_applyMetas;
+
+  mutable boost::mutex m_mutex;
+  boost::condition_variable m_rangeChanged;
+  std::deque<ListRange> m_ranges;  // ranges not taken yet
+  int m_numRunning;                // num of ranges being listed
+  int m_numSplittable;             // num of ranges being listed splittable
+  int m_numIdle;                   // num of listers waiting for ranges
+  ClientError<QSError::Value> m_error;
+  // absent key intervals of [start, stop) keyed by start, an empty stop means
+  // no key after the start at all
+  std::map<std::string, std::string> m_absentKeys;
+
+  friend class PartitionedListingTest;
+};
+
+}  // namespace Client
+}  // namespace QS
+
+#endif  // QSFS_CLIENT_PARTITIONEDLISTING_H_
@@ -18,9 +18,12 @@
 
 #include <assert.h>
 #include <stdint.h>  // for uint64_t
+#include <time.h>
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <set>
 #include <sstream>
 #include <string>
 #include <utility>
@@ -38,8 +41,11 @@
 #include "boost/exception/to_string.hpp"
 #include "boost/foreach.hpp"
 #include "boost/make_shared.hpp"
+#include "boost/noncopyable.hpp"
 #include "boost/scope_exit.hpp"
 #include "boost/shared_ptr.hpp"
+#include "boost/thread/locks.hpp"
+#include "boost/thread/mutex.hpp"
 #include "boost/thread/once.hpp"
 
 #include "base/LogMacros.h"
@@ -51,12 +57,14 @@
 #include "client/ClientConfiguration.h"
 #include "client/ClientImpl.h"
 #include "client/Constants.h"
+#include "client/PartitionedListing.h"
 #include "client/Protocol.h"
 #include "client/QSClientConverter.h"
 #include "client/QSClientImpl.h"
 #include "client/QSClientOutcome.h"
 #include "client/QSError.h"
 #include "data/Cache.h"
+#include "data/DirectoryListing.h"
 #include "data/DirectoryTree.h"
 #include "data/FileMetaData.h"
 #include "data/Node.h"
@@ -68,7 +76,9 @@ namespace Client {
 
 using boost::bind;
 using boost::call_once;
+using boost::lock_guard;
 using boost::make_shared;
+using boost::mutex;
 using boost::shared_ptr;
 using boost::to_string;
 using QingStor::AbortMultipartUploadInput;
@@ -89,6 +99,7 @@ using QingStor::QsConfig;  // sdk config
 using QingStor::UploadMultipartInput;
 using QS::Data::BuildDefaultDirectoryMeta;
 using QS::Data::Cache;
+using QS::Data::DirectoryListing;
 using QS::Data::DirectoryTree;
 using QS::Data::FileMetaData;
 using QS::Data::Node;
@@ -105,6 +116,9 @@ using QS::Utils::GetBaseName;
 using QS::Utils::GetDirName;
 using QS::Utils::IsRootDirectory;
 using std::iostream;
+using std::make_pair;
+using std::pair;
+using std::set;
 using std::string;
 using std::stringstream;
 using std::vector;
@@ -130,6 +144,94 @@ const char *GetSDKLogDir() {
   return logdir.c_str();
 }
 
+// --------------------------------------------------------------------------
+// Apply the pages of a directory listing to the dir tree and the listing
+//
+// Pages could be applied by multiple lister threads concurrently.
+class ListedPages : private boost::noncopyable {
+ public:
+  ListedPages(const string &dirPath, const shared_ptr<DirectoryTree> &dirTree,
+              const shared_ptr<DirectoryListing> &listing, bool collectIds)
+      : m_dirPath(dirPath),
+        m_dirTree(dirTree),
+        m_listing(listing),
+        m_collectIds(collectIds) {}
+
+  void Apply(const vector<shared_ptr<FileMetaData> > &metas) {
+    m_dirTree->Grow(metas);
+
+    vector<string> entries;
+    lock_guard<mutex> lock(m_mutex);
+    BOOST_FOREACH (const shared_ptr<FileMetaData> &meta, metas) {
+      string filePath = meta->GetFilePath();
+      if (filePath == m_dirPath) {
+        continue;
+      }
+      if (m_collectIds) {
+        m_listedIds.insert(filePath);
+      }
+      if (m_listing) {
+        entries.push_back(filePath);
+      }
+    }
+    if (m_listing) {
+      m_listing->AddEntries(entries);
+    }
+  }
+
+  // Return file paths of the children listed, only collected if asked
+  const set<string> &GetListedIds() const { return m_listedIds; }
+
+ private:
+  string m_dirPath;
+  shared_ptr<DirectoryTree> m_dirTree;
+  shared_ptr<DirectoryListing> m_listing;
+  bool m_collectIds;
+  mutex m_mutex;
+  set<string> m_listedIds;
+};
+
+// List a page of the objects under the prefix for a partitioned listing
+struct ListObjectsPage {
+  string prefix;
+  shared_ptr<QSClientImpl> clientImpl;
+
+  ListObjectsPage(const string &prefix_,
+                  const shared_ptr<QSClientImpl> &clientImpl_)
+      : prefix(prefix_), clientImpl(clientImpl_) {}
+
+  ClientError<QSError::Value> operator()(const string &marker,
+                                         FileMetaDataList *metas,
+                                         string *nextMarker,
+                                         bool *resultTruncated) {
+    ListObjectsInput listObjInput;
+    listObjInput.SetLimit(Constants::BucketListObjectsLimit);
+    listObjInput.SetDelimiter(QS::Utils::GetPathDelimiter());
+    listObjInput.SetPrefix(prefix);
+    listObjInput.SetMarker(marker);
+    ListObjectsOutcome outcome =
+        clientImpl->ListObjects(&listObjInput, resultTruncated, NULL,
+                                Constants::BucketListObjectsLimit);
+    if (!outcome.IsSuccess()) {
+      return outcome.GetError();
+    }
+    BOOST_FOREACH (ListObjectsOutput &listObjOutput, outcome.GetResult()) {
+      FileMetaDataList fileMetaDatas =
+          QSClientConverter::ListObjectsOutputToFileMetaDatas(listObjOutput,
+                                                              false);
+      metas->insert(metas->end(), fileMetaDatas.begin(), fileMetaDatas.end());
+      *nextMarker = listObjOutput.GetNextMarker();
+    }
+    return ClientError<QSError::Value>(QSError::GOOD, false);
+  }
+};
+
+// --------------------------------------------------------------------------
+void ListPartitionedRanges(shared_ptr<PartitionedListing> partitioned) {
+  // helpers return once there is nothing left for them
+  partitioned->ListRanges(false);
+}
+
 }  // namespace
 
 // --------------------------------------------------------------------------
@@ -167,6 +269,7 @@ ClientError<QSError::Value> QSClient::HeadBucket() {
 // DeleteFile is used to delete a file or an empty directory.
 ClientError<QSError::Value> QSClient::DeleteFile(const string &filePath) {
   DeleteObjectOutcome outcome = GetQSClientImpl()->DeleteObject(filePath);
+  ForgetHeadsInFlight(filePath);
   if (outcome.IsSuccess()) {
     return ClientError<QSError::Value>(QSError::GOOD, false);
   } else {
@@ -182,6 +285,7 @@ ClientError<QSError::Value> QSClient::MakeFile(const string &filePath) {
   // input.SetContentType(LookupMimeType(filePath));
 
   PutObjectOutcome outcome = GetQSClientImpl()->PutObject(filePath, &input);
+  ForgetHeadsInFlight(filePath);
 
   if (outcome.IsSuccess()) {
     return ClientError<QSError::Value>(QSError::GOOD, false);
@@ -198,6 +302,7 @@ ClientError<QSError::Value> QSClient::MakeDirectory(const string &dirPath) {
   string dir = AppendPathDelim(dirPath);
 
   PutObjectOutcome outcome = GetQSClientImpl()->PutObject(dir, &input);
+  ForgetHeadsInFlight(dir);
 
   if (outcome.IsSuccess()) {
     return ClientError<QSError::Value>(QSError::GOOD, false);
@@ -286,6 +391,8 @@ ClientError<QSError::Value> QSClient::MoveObject(const string &sourcePath,
   }
 
   PutObjectOutcome outcome = GetQSClientImpl()->PutObject(targetPath, &input);
+  ForgetHeadsInFlight(sourcePath);
+  ForgetHeadsInFlight(targetPath);
 
   if (outcome.IsSuccess()) {
     return ClientError<QSError::Value>(QSError::GOOD, false);
@@ -298,11 +405,15 @@ ClientError<QSError::Value> QSClient::MoveObject(const string &sourcePath,
 ClientError<QSError::Value> QSClient::DownloadFile(const string &filePath,
                                                    shared_ptr<iostream> buffer,
                                                    const string &range,
-                                                   string *eTag) {
+                                                   string *eTag,
+                                                   const string &ifMatch) {
   GetObjectInput input;
   if (!range.empty()) {
     input.SetRange(range);
   }
+  if (!ifMatch.empty()) {
+    input.SetIfMatch(ifMatch);
+  }
 
   GetObjectOutcome outcome = GetQSClientImpl()->GetObject(filePath, &input);
 
@@ -359,7 +470,8 @@ ClientError<QSError::Value> QSClient::InitiateMultipartUpload(
 // --------------------------------------------------------------------------
 ClientError<QSError::Value> QSClient::UploadMultipart(
     const string &filePath, const string &uploadId, int partNumber,
-    uint64_t contentLength, shared_ptr<iostream> buffer) {
+    uint64_t contentLength, shared_ptr<iostream> buffer,
+    const string &contentMD5) {
   UploadMultipartInput input;
   input.SetUploadID(uploadId);
   input.SetPartNumber(partNumber);
@@ -367,7 +479,8 @@ ClientError<QSError::Value> QSClient::UploadMultipart(
   if (contentLength > 0) {
     input.SetBody(buffer.get());
     if (ClientConfiguration::Instance().IsEnableContentMD5()) {
-      input.SetContentMD5(md5(buffer));  // set buffer content md5
+      // set buffer content md5
+      input.SetContentMD5(contentMD5.empty() ? md5(buffer) : contentMD5);
     }
   }
 
@@ -400,6 +513,7 @@ ClientError<QSError::Value> QSClient::CompleteMultipartUpload(
 
   CompleteMultipartUploadOutcome outcome =
       GetQSClientImpl()->CompleteMultipartUpload(filePath, &input);
+  ForgetHeadsInFlight(filePath);
 
   if (outcome.IsSuccess()) {
     string msg = "Completed multipart upload [id: " + uploadId;
@@ -436,18 +550,21 @@ ClientError<QSError::Value> QSClient::AbortMultipartUpload(
 // --------------------------------------------------------------------------
 ClientError<QSError::Value> QSClient::UploadFile(const string &filePath,
                                                  uint64_t fileSize,
-                                                 shared_ptr<iostream> buffer) {
+                                                 shared_ptr<iostream> buffer,
+                                                 const string &contentMD5) {
   PutObjectInput input;
   input.SetContentLength(fileSize);
   // input.SetContentType(LookupMimeType(filePath));
   if (fileSize > 0) {
     input.SetBody(buffer.get());
     if (ClientConfiguration::Instance().IsEnableContentMD5()) {
-      input.SetContentMD5(md5(buffer));  // set buffer content md5
+      // set buffer content md5
+      input.SetContentMD5(contentMD5.empty() ? md5(buffer) : contentMD5);
     }
   }
 
   PutObjectOutcome outcome = GetQSClientImpl()->PutObject(filePath, &input);
+  ForgetHeadsInFlight(filePath);
 
   if (outcome.IsSuccess()) {
     DebugInfo("Uploaded file " + FormatPath(filePath));
@@ -467,6 +584,7 @@ ClientError<QSError::Value> QSClient::SymLink(const string &filePath,
   input.SetBody(ss.get());
 
   PutObjectOutcome outcome = GetQSClientImpl()->PutObject(linkPath, &input);
+  ForgetHeadsInFlight(linkPath);
 
   if (outcome.IsSuccess()) {
     DebugInfo("Created symlink " + FormatPath(filePath, linkPath));
@@ -478,23 +596,37 @@ ClientError<QSError::Value> QSClient::SymLink(const string &filePath,
 
 // --------------------------------------------------------------------------
 ClientError<QSError::Value> QSClient::ListDirectory(
-    const string &dirPath, const shared_ptr<DirectoryTree> &dirTree) {
+    const string &dirPath, const shared_ptr<DirectoryTree> &dirTree,
+    const shared_ptr<DirectoryListing> &listing) {
   assert(dirTree);
+  BOOST_SCOPE_EXIT((&listing)) {
+    if (listing) {
+      listing->Finish();
+    }
+  }
+  BOOST_SCOPE_EXIT_END
+
   uint64_t maxListCount = ClientConfiguration::Instance().GetMaxListCount();
   bool listAll = maxListCount <= 0;
 
   // Set maxCount for a single list operation.
-  // This will request for ListObjects seperately, so we can construct
-  // directory tree gradually. This will be helpful for the performance
-  // if there are a huge number of objects to list.
+  // This will request for ListObjects page by page, so we can construct
+  // directory tree gradually and hand the children over to the listing as
+  // soon as a page arrives. This will be helpful for the performance if
+  // there are a huge number of objects to list.
   uint64_t maxCountPerList =
-      static_cast<uint64_t>(Constants::BucketListObjectsLimit * 2);
+      static_cast<uint64_t>(Constants::BucketListObjectsLimit);
   if (!listAll && maxListCount < maxCountPerList) {
     maxCountPerList = maxListCount;
   }
 
   shared_ptr<Node> dirNode = dirTree->Find(dirPath);
-  vector<shared_ptr<FileMetaData> > allFileMetaDatas;
+  bool dirExisting = dirNode && *dirNode;
+  // Children not listed are removed from an existing directory at the end
+  bool pruneDir = dirExisting && !dirNode->IsEmpty();
+  bool addSelf = !dirExisting;
+  shared_ptr<ListedPages> pages =
+      make_shared<ListedPages>(dirPath, dirTree, listing, pruneDir);
 
   ListObjectsInput listObjInput;
   uint64_t limit = Constants::BucketListObjectsLimit;
@@ -510,7 +642,10 @@ ClientError<QSError::Value> QSClient::ListDirectory(
   listObjInput.SetPrefix(prefix);
 
   bool resultTruncated = false;
+  bool partitioned = false;
   uint64_t resCount = 0;
+  int numPages = 0;
+  string nextMarker;
 
   do {
     uint64_t countListed = 0;
@@ -523,30 +658,50 @@ ClientError<QSError::Value> QSClient::ListDirectory(
 
     resCount += countListed;
     BOOST_FOREACH (ListObjectsOutput &listObjOutput, outcome.GetResult()) {
-      vector<shared_ptr<FileMetaData> > fileMetaDatas;
-      if (!(dirNode && *dirNode)) {  // directory not existing
-        // Add its children to dir tree
-        fileMetaDatas = QSClientConverter::ListObjectsOutputToFileMetaDatas(
-            listObjOutput, true);  // add dir itself
-      } else {                     // directory existing
-        fileMetaDatas = QSClientConverter::ListObjectsOutputToFileMetaDatas(
-            listObjOutput, false);  // not add dir itself
-      }
-      allFileMetaDatas.insert(allFileMetaDatas.end(), fileMetaDatas.begin(),
-                              fileMetaDatas.end());
+      // Add dir itself with the first page if directory not existing
+      pages->Apply(QSClientConverter::ListObjectsOutputToFileMetaDatas(
+          listObjOutput, addSelf));
+      addSelf = false;
+      nextMarker = listObjOutput.GetNextMarker();
+      ++numPages;
     }  // for list object output
-  } while (resultTruncated && (listAll || resCount < maxListCount));
 
-  if (!(dirNode && *dirNode)) {  // directory not existing
-    dirTree->Grow(allFileMetaDatas);
-  } else {  // directory existing
-    if (dirNode->IsEmpty()) {
-      dirTree->Grow(allFileMetaDatas);
-    } else {
-      dirTree->UpdateDirectory(dirPath, allFileMetaDatas);
+    // List the rest of a very large directory in key ranges concurrently
+    partitioned = listAll && resultTruncated &&
+                  numPages >= Constants::ParallelListThresholdPages;
+  } while (!partitioned && resultTruncated &&
+           (listAll || resCount < maxListCount));
+
+  if (partitioned) {
+    shared_ptr<PartitionedListing> partitionedListing =
+        make_shared<PartitionedListing>(
+            prefix, nextMarker, ListObjectsPage(prefix, GetQSClientImpl()),
+            bind(&ListedPages::Apply, pages, _1));
+    // This thread lists ranges too, so it never waits for the listers which
+    // are still queued in a busy executor. Part of the executor is left for
+    // the transfers.
+    uint16_t poolSize = ClientConfiguration::Instance().GetPoolSize();
+    uint16_t numHelpers = std::min(
+        Constants::ParallelListMaxHelpers, static_cast<uint16_t>(poolSize / 2));
+    for (uint16_t i = 0; i < numHelpers; ++i) {
+      GetExecutor()->SubmitPrioritized(ListPartitionedRanges,
+                                       partitionedListing);
+    }
+    partitionedListing->ListRanges();
+    ClientError<QSError::Value> err = partitionedListing->GetError();
+    if (!IsGoodQSError(err)) {
+      return err;
     }
   }
 
+  if (pruneDir) {
+    dirTree->PruneDirectory(dirPath, pages->GetListedIds());
+  }
+  if (dirExisting) {
+    // The dir is synchronized by the listing
+    dirNode->SetCachedTime(time(NULL));
+  }
+
   return ClientError<QSError::Value>(QSError::GOOD, false);
 }
 
@@ -568,6 +723,24 @@ ClientError<QSError::Value> QSClient::Stat(
     return ClientError<QSError::Value>(QSError::GOOD, false);
   }
 
+  // Callers waiting for the request in flight share its result, the dir tree
+  // has been updated by the caller sending the request.
+  pair<ClientError<QSError::Value>, bool> res =
+      m_statFlight
+          .Do(path + " " + to_string(modifiedSince),
+              bind(boost::type<pair<ClientError<QSError::Value>, bool> >(),
+                   &QSClient::DoStat, this, path, dirTree, modifiedSince))
+          .first;
+  if (modified != NULL) {
+    *modified = res.second;
+  }
+  return res.first;
+}
+
+// --------------------------------------------------------------------------
+pair<ClientError<QSError::Value>, bool> QSClient::DoStat(
+    const string &path, const shared_ptr<DirectoryTree> &dirTree,
+    time_t modifiedSince) {
   HeadObjectInput input;
   if (modifiedSince > 0) {
     input.SetIfModifiedSince(SecondsToRFC822GMT(modifiedSince));
@@ -579,18 +752,16 @@ ClientError<QSError::Value> QSClient::Stat(
     HeadObjectOutput &res = outcome.GetResult();
     if (res.GetResponseCode() == QingStor::Http::NOT_MODIFIED) {
       // if is not modified, no meta is returned, so just return directly
-      return ClientError<QSError::Value>(QSError::GOOD, false);
+      return make_pair(ClientError<QSError::Value>(QSError::GOOD, false),
+                       false);
     }
 
-    if (modified != NULL) {
-      *modified = true;
-    }
     shared_ptr<FileMetaData> fileMetaData =
         QSClientConverter::HeadObjectOutputToFileMetaData(path, res);
     if (fileMetaData) {
       dirTree->Grow(fileMetaData);  // add/update node in dir tree
     }
-    return ClientError<QSError::Value>(QSError::GOOD, false);
+    return make_pair(ClientError<QSError::Value>(QSError::GOOD, false), true);
   } else {
     // Handle following special case.
     // As for object storage, there is no concept of directory.
@@ -622,22 +793,32 @@ ClientError<QSError::Value> QSClient::Stat(
           }
 
           if (dirExist) {
-            if (modified != NULL) {
-              *modified = true;
-            }
             dirTree->Grow(BuildDefaultDirectoryMeta(path));  // add dir node
-            return ClientError<QSError::Value>(QSError::GOOD, false);
+            return make_pair(
+                ClientError<QSError::Value>(QSError::GOOD, false), true);
           }  // if dir exist
         }    // if outcome is success
       }      // if path is dir
     }
 
-    return err;
+    return make_pair(err, false);
   }
 }
 
 // --------------------------------------------------------------------------
 shared_ptr<FileMetaData> QSClient::GetObjectMeta(const std::string &path) {
+  pair<shared_ptr<FileMetaData>, bool> res = m_objectMetaFlight.Do(
+      path + " ", bind(boost::type<shared_ptr<FileMetaData> >(),
+                 &QSClient::DoGetObjectMeta, this, path));
+  // Callers may add the meta into dir tree, so don't share the same one
+  if (res.second && res.first) {
+    return make_shared<FileMetaData>(*res.first);
+  }
+  return res.first;
+}
+
+// --------------------------------------------------------------------------
+shared_ptr<FileMetaData> QSClient::DoGetObjectMeta(const string &path) {
   HeadObjectInput input;
 
   HeadObjectOutcome outcome = GetQSClientImpl()->HeadObject(path, &input);
@@ -649,6 +830,12 @@ shared_ptr<FileMetaData> QSClient::GetObjectMeta(const std::string &path) {
   }
 }
 
+// --------------------------------------------------------------------------
+void QSClient::ForgetHeadsInFlight(const string &path) {
+  m_statFlight.Forget(path + " ");
+  m_objectMetaFlight.Forget(path + " ");
+}
+
 // --------------------------------------------------------------------------
 ClientError<QSError::Value> QSClient::Statvfs(struct statvfs *stvfs) {
   assert(stvfs != NULL);
@@ -18,12 +18,14 @@
 #define QSFS_CLIENT_QSCLIENT_H_
 
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "boost/shared_ptr.hpp"
 
 #include "qingstor/QingStor.h"
 
+#include "base/SingleFlight.hpp"
 #include "client/Client.h"
 
 
@@ -36,6 +38,7 @@ namespace QS {
 
 namespace Data {
 class Cache;
+class DirectoryListing;
 class DirectoryTree;
 class FileMetaData;
 }  // namespace Data
@@ -99,7 +102,8 @@ class QSClient : public Client {
 
   // Download file
   //
-  // @param  : file path, buffer(input), contenct range, eTag (output)
+  // @param  : file path, buffer(input), contenct range, eTag (output),
+  //           etag to match
   // @return : ClinetError
   //
   // If range is empty, then the whole file will be downloaded.
@@ -107,7 +111,8 @@ class QSClient : public Client {
   ClientError<QSError::Value> DownloadFile(
       const std::string &filePath,
       boost::shared_ptr<std::iostream> buffer,
-      const std::string &range = std::string(), std::string *eTag = NULL);
+      const std::string &range = std::string(), std::string *eTag = NULL,
+      const std::string &ifMatch = std::string());
 
   // Initiate multipart upload id
   //
@@ -118,11 +123,13 @@ class QSClient : public Client {
 
   // Upload multipart
   //
-  // @param  : file path, upload id, part number, content len, buffer
+  // @param  : file path, upload id, part number, content len, buffer,
+  //           content md5 (computed from buffer if empty)
   // @return : ClientError
   ClientError<QSError::Value> UploadMultipart(
       const std::string &filePath, const std::string &uploadId, int partNumber,
-      uint64_t contentLength, boost::shared_ptr<std::iostream> buffer);
+      uint64_t contentLength, boost::shared_ptr<std::iostream> buffer,
+      const std::string &contentMD5 = std::string());
 
   // Complete multipart upload
   //
@@ -141,11 +148,13 @@ class QSClient : public Client {
 
   // Upload file using PutObject
   //
-  // @param  : file path, file size, buffer
+  // @param  : file path, file size, buffer, content md5 (computed from
+  //           buffer if empty)
   // @return : ClientError
   ClientError<QSError::Value> UploadFile(
       const std::string &filePath, uint64_t fileSize,
-      boost::shared_ptr<std::iostream> buffer);
+      boost::shared_ptr<std::iostream> buffer,
+      const std::string &contentMD5 = std::string());
 
   // Create a symbolic link to a file
   //
@@ -160,16 +169,21 @@ class QSClient : public Client {
 
   // List directory
   //
-  // @param  : dir path, directory tree
+  // @param  : dir path, directory tree, listing to fill (optional)
   // @return : ClientError
   //
   // ListDirectory will update directory in tree if dir exists and is modified
   // or grow the tree if the directory is not existing in tree.
   //
+  // The tree is grown page by page, and the children of each page are added
+  // to the listing if given, it's finished when the list is done or fails.
+  //
   // Notice the dirPath should end with delimiter.
   ClientError<QSError::Value> ListDirectory(
       const std::string &dirPath,
-      const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree);
+      const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree,
+      const boost::shared_ptr<QS::Data::DirectoryListing> &listing =
+          boost::shared_ptr<QS::Data::DirectoryListing>());
 
   // Get object meta data
   //
@@ -184,13 +198,22 @@ class QSClient : public Client {
   //
   // Notes: the meta will be return if object is modified, otherwise
   // the response code will be 304 (NOT MODIFIED) and no meta returned.
+  //
+  // Concurrent Stat of the same path and modifiedSince share one request.
   ClientError<QSError::Value> Stat(
       const std::string &path,
       const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree,
       time_t modifiedSince = 0, bool *modified = NULL);
 
+  // Get object meta data
+  //
+  // @param  : file path
+  // @return : meta data, null if fail to head the object
+  //
+  // Concurrent GetObjectMeta of the same path share one request.
   boost::shared_ptr<QS::Data::FileMetaData> GetObjectMeta(
       const std::string &path);
+
   // Get information about mounted bucket
   //
   // @param  : *stvfs(output)
@@ -223,10 +246,32 @@ class QSClient : public Client {
   void CloseQSService();
   void InitializeClientImpl();
 
+  // Head the object and update dir tree, which is shared by concurrent Stat
+  //
+  // @param  : file path, directory tree, modifiedSince
+  // @return : a pair of {ClientError, bool denotes if modified}
+  std::pair<ClientError<QSError::Value>, bool> DoStat(
+      const std::string &path,
+      const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree,
+      time_t modifiedSince);
+
+  boost::shared_ptr<QS::Data::FileMetaData> DoGetObjectMeta(
+      const std::string &path);
+
+  // Forget head requests in flight of the object which is changed, so that
+  // callers after the change don't share the stale results.
+  void ForgetHeadsInFlight(const std::string &path);
+
  private:
   static QingStor::SDKOptions m_sdkOptions;
   static boost::shared_ptr<QingStor::QsConfig> m_qingStorConfig;
   boost::shared_ptr<QSClientImpl> m_qsClientImpl;
+
+  // head object requests in flight
+  QS::Threading::SingleFlight<std::pair<ClientError<QSError::Value>, bool> >
+      m_statFlight;
+  QS::Threading::SingleFlight<boost::shared_ptr<QS::Data::FileMetaData> >
+      m_objectMetaFlight;
 };
 
 }  // namespace Client
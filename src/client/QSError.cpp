@@ -115,6 +115,9 @@ QSError::Value StringToQSError(const char *err) {
   if (strcmp(err, "NotFound") == 0) {
     return QSError::NOT_FOUND;
   }
+  if (strcmp(err, "PreconditionFailed") == 0) {
+    return QSError::PRECONDITION_FAILED;
+  }
 
   return QSError::UNKNOWN;
 }
@@ -136,6 +139,7 @@ std::string QSErrorToString(QSError::Value err) {
       make_pair(QSError::SDK_UNEXPECTED_RESPONSE, "SDKUnexpectedResponse"),
       make_pair(QSError::SDK_SIGN_WITH_INVAILD_KEY, "SDKSignWithInvalidKey"),
       make_pair(QSError::NOT_FOUND, "NotFound"),
+      make_pair(QSError::PRECONDITION_FAILED, "PreconditionFailed"),
   };
 
   int n = sizeof(errToNames) / sizeof(errToNames[0]);
@@ -212,6 +216,8 @@ QSError::Value SDKResponseToQSError(QsError sdkErr, HttpResponseCode code) {
 
   if (code == NOT_FOUND ) {
     return QSError::NOT_FOUND;
+  } else if (code == PRECONDITION_FAILED) {
+    return QSError::PRECONDITION_FAILED;
   } else if (SDKResponseCodeSuccess(code)) {
     return QSError::GOOD;
   } else {
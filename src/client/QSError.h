@@ -51,7 +51,8 @@ struct QSError {
     SDK_SIGN_WITH_INVAILD_KEY,   // invalid key
 
     // specifics for http response
-    NOT_FOUND  // Not Found (404)
+    NOT_FOUND,           // Not Found (404)
+    PRECONDITION_FAILED  // Precondition Failed (412)
   };
 };
 
@@ -33,6 +33,7 @@
 #include "boost/tuple/tuple.hpp"
 
 #include "base/LogMacros.h"
+#include "base/MD5.h"
 #include "base/StringUtils.h"
 #include "client/Client.h"
 #include "client/ClientConfiguration.h"
@@ -73,6 +74,26 @@ using std::pair;
 using std::string;
 using std::vector;
 
+namespace {
+
+// Hash the part in the worker thread which uploads it, so parts are hashed
+// in parallel and overlapped with the transfers of others. The buffer is
+// hashed in place, return empty to let client hash the stream if it is not
+// backed by a buffer.
+string GetContentMD5(const shared_ptr<IOStream> &stream, size_t len) {
+  if (!ClientConfiguration::Instance().IsEnableContentMD5() || len == 0) {
+    return string();
+  }
+  const StreamBuf *streamBuf = dynamic_cast<StreamBuf *>(stream->rdbuf());
+  if (streamBuf == NULL || !streamBuf->GetBuffer() ||
+      streamBuf->GetBuffer()->size() < len) {
+    return string();
+  }
+  return md5(&(*streamBuf->GetBuffer())[0], len);
+}
+
+}  // namespace
+
 // --------------------------------------------------------------------------
 struct ReceivedHandlerSingleDownload {
   shared_ptr<TransferHandle> handle;
@@ -251,7 +272,7 @@ struct ReceivedHandlerMultipleUpload {
 // --------------------------------------------------------------------------
 shared_ptr<TransferHandle> QSTransferManager::DownloadFile(
     const string &filePath, off_t offset, uint64_t size,
-    shared_ptr<iostream> bufStream, bool async) {
+    shared_ptr<iostream> bufStream, bool async, const string &ifMatch) {
   // Drive::ReadFile has checked the object existence, so no check here.
   // Drive::ReadFile has already ajust the download size, so no ajust here.
   if (!bufStream) {
@@ -263,6 +284,7 @@ shared_ptr<TransferHandle> QSTransferManager::DownloadFile(
   shared_ptr<TransferHandle> handle = make_shared<TransferHandle>(
       bucket, filePath, offset, size, TransferDirection::Download);
   handle->SetDownloadStream(bufStream);
+  handle->SetIfMatch(ifMatch);
 
   DoDownload(handle, async);
   return handle;
@@ -281,7 +303,8 @@ shared_ptr<TransferHandle> QSTransferManager::RetryDownload(
 
   if (handle->GetStatus() == TransferStatus::Aborted) {
     return DownloadFile(handle->GetObjectKey(), handle->GetContentRangeBegin(),
-                        handle->GetBytesTotalSize(), bufStream, async);
+                        handle->GetBytesTotalSize(), bufStream, async,
+                        handle->GetIfMatch());
   } else {
     handle->UpdateStatus(TransferStatus::NotStarted);
     handle->Restart();
@@ -561,13 +584,13 @@ void QSTransferManager::DoSinglePartUpload(
   Buffer buf = Buffer(new vector<char>(fileSize));
   string objKey = handle->GetObjectKey();
   pair<size_t, ContentRangeDeque> res =
-      file->ReadNoLoad(0, fileSize, &(*buf)[0]);
+      file->ReadThrough(0, fileSize, &(*buf)[0], GetClient());
   size_t readSize = res.first;
   if (readSize != fileSize) {
     string msg =
         "Fail to read, stop upload [offset:0, len:" + to_string(fileSize) +
         ", readedsize:" + to_string(readSize) +
-        ", unloaded ranges:" + ContentRangeDequeToString(res.second) + "]";
+        ", failed ranges:" + ContentRangeDequeToString(res.second) + "]";
     if (file) {
       msg += file->ToString();
     }
@@ -619,8 +642,8 @@ void QSTransferManager::DoMultiPartUpload(
     }
 
     pair<size_t, ContentRangeDeque> res =
-        file->ReadNoLoad(part->GetRangeBegin(), part->GetSize(),
-                    &(*buffer)[0]);
+        file->ReadThrough(part->GetRangeBegin(), part->GetSize(),
+                          &(*buffer)[0], GetClient());
     size_t readSize = res.first;
     if (readSize != part->GetSize()) {
       string msg =
@@ -628,7 +651,7 @@ void QSTransferManager::DoMultiPartUpload(
           to_string(part->GetRangeBegin()) +
           ", len:" + to_string(part->GetSize()) +
           ", readedsize:" + to_string(readSize) +
-          ", unloaded ranges:" + ContentRangeDequeToString(res.second) + "]";
+          ", failed ranges:" + ContentRangeDequeToString(res.second) + "]";
       if (file) {
         msg += file->ToString();
       }
@@ -694,7 +717,8 @@ QSTransferManager::SingleDownloadWrapper(
   string eTag;
   ClientError<QSError::Value> err = GetClient()->DownloadFile(
       handle->GetObjectKey(), handle->GetDownloadStream(),
-      BuildRequestRange(part->GetRangeBegin(), part->GetSize()), &eTag);
+      BuildRequestRange(part->GetRangeBegin(), part->GetSize()), &eTag,
+      handle->GetIfMatch());
   return make_pair(err, eTag);
 }
 
@@ -705,7 +729,8 @@ QSTransferManager::MultipleDownloadWrapper(
   string eTag;
   ClientError<QSError::Value> err = GetClient()->DownloadFile(
       handle->GetObjectKey(), part->GetDownloadPartStream(),
-      BuildRequestRange(part->GetRangeBegin(), part->GetSize()), &eTag);
+      BuildRequestRange(part->GetRangeBegin(), part->GetSize()), &eTag,
+      handle->GetIfMatch());
   return make_pair(err, eTag);
 }
 
@@ -713,8 +738,9 @@ QSTransferManager::MultipleDownloadWrapper(
 ClientError<QSError::Value> QSTransferManager::SingleUploadWrapper(
     const shared_ptr<TransferHandle> &handle,
     const shared_ptr<IOStream> &stream) {
-  return GetClient()->UploadFile(handle->GetObjectKey(),
-                                 handle->GetBytesTotalSize(), stream);
+  return GetClient()->UploadFile(
+      handle->GetObjectKey(), handle->GetBytesTotalSize(), stream,
+      GetContentMD5(stream, handle->GetBytesTotalSize()));
 }
 
 // --------------------------------------------------------------------------
@@ -723,7 +749,7 @@ ClientError<QSError::Value> QSTransferManager::MultipleUploadWrapper(
     const shared_ptr<IOStream> &stream) {
   return GetClient()->UploadMultipart(
       handle->GetObjectKey(), handle->GetMultiPartId(), part->GetPartId(),
-      part->GetSize(), stream);
+      part->GetSize(), stream, GetContentMD5(stream, part->GetSize()));
 }
 
 // --------------------------------------------------------------------------
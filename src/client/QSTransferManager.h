@@ -47,11 +47,12 @@ class QSTransferManager : public TransferManager {
  public:
   // Download a file
   //
-  // @param  : file path, file offset, size, bufStream
+  // @param  : file path, file offset, size, bufStream, etag to match
   // @return : transfer handle
   boost::shared_ptr<TransferHandle> DownloadFile(
       const std::string &filePath, off_t offset, uint64_t size,
-      boost::shared_ptr<std::iostream> bufStream, bool async = false);
+      boost::shared_ptr<std::iostream> bufStream, bool async = false,
+      const std::string &ifMatch = std::string());
 
   // Retry a failed download
   //
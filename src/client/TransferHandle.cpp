@@ -165,6 +165,7 @@ TransferHandle::TransferHandle(const string &bucket, const string &objKey,
       m_objectKey(objKey),
       m_contentRangeBegin(contentRangeBegin),
       m_contentType(),
+      m_ifMatch(),
       m_error(ClientError<QSError::Value>(QSError::GOOD, false)) {}
 
 // --------------------------------------------------------------------------
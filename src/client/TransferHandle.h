@@ -171,6 +171,7 @@ class TransferHandle : private boost::noncopyable {
   const std::string &GetObjectKey() const { return m_objectKey; }
   size_t GetContentRangeBegin() const { return m_contentRangeBegin; }
   const std::string &GetContentType() const { return m_contentType; }
+  const std::string &GetIfMatch() const { return m_ifMatch; }
   const std::map<std::string, std::string> &GetMetadata() const {
     return m_metadata;
   }
@@ -235,6 +236,7 @@ class TransferHandle : private boost::noncopyable {
   void SetContentType(const std::string &contentType) {
     m_contentType = contentType;
   }
+  void SetIfMatch(const std::string &eTag) { m_ifMatch = eTag; }
   void SetMetadata(const std::map<std::string, std::string> &metadata) {
     m_metadata = metadata;
   }
@@ -283,6 +285,8 @@ class TransferHandle : private boost::noncopyable {
   size_t m_contentRangeBegin;
   // content type of object being transferred
   std::string m_contentType;
+  // In case of a download, the etag the object should match, empty for any.
+  std::string m_ifMatch;
   // In case of an upload, this is the metadata that was placed on the object.
   // In case of a download, this is the object metadata from the GET operation.
   std::map<std::string, std::string> m_metadata;
@@ -95,11 +95,16 @@ class TransferManager : private boost::noncopyable {
  public:
   // Download a file
   //
-  // @param  : file path, file offset, size, bufStream, falg asynchornizely
+  // @param  : file path, file offset, size, bufStream, falg asynchornizely,
+  //           etag to match
   // @return : transfer handle
+  //
+  // If etag to match is given, the download fails with PRECONDITION_FAILED
+  // when the object has been changed to another etag.
   virtual boost::shared_ptr<TransferHandle> DownloadFile(
       const std::string &filePath, off_t offset, uint64_t size,
-      boost::shared_ptr<std::iostream> bufStream, bool async = false) = 0;
+      boost::shared_ptr<std::iostream> bufStream, bool async = false,
+      const std::string &ifMatch = std::string()) = 0;
 
   // Retry a failed download
   //
@@ -45,6 +45,7 @@ static const char* const QSFS_DEFAULT_LOG_DIR = "/var/log/qsfs/";
 static const char* const QSFS_DEFAULT_LOGLEVEL_NAME = "WARN";
 static const char* const QSFS_DEFAULT_HOST = "qingstor.com";
 static const char* const QSFS_DEFAULT_PROTOCOL = "https";
+static const char* const QSFS_DEFAULT_CACHE_POLICY = "lru";
 static const char* const MIME_FILE_DEFAULT = "/etc/mime.types";
 static uint16_t const QSFS_DEFAULT_TRANSACTION_RETRIES = 3;
 static const int CLIENT_DEFAULT_POOL_SIZE = 5;
@@ -93,6 +94,8 @@ uint16_t GetDefaultPort(const string& protocolName) {
 
 string GetDefaultProtocolName() { return QSFS_DEFAULT_PROTOCOL; }
 
+string GetDefaultCachePolicyName() { return QSFS_DEFAULT_CACHE_POLICY; }
+
 vector<string> GetMimeFiles() {
   vector<string> mimes;
   mimes.push_back(MIME_FILE_DEFAULT);
@@ -167,6 +170,34 @@ uint16_t GetDefaultPrefetchSizeInMB() {
   return 20;  // 20MB
 }
 
+uint32_t GetDefaultWriteBackDelay() {
+  return 0;  // upload at flush
+}
+
+uint32_t GetDefaultWriteBackThresholdInMB() {
+  return 64;  // 64MB
+}
+
+uint32_t GetDefaultNegativeLookupExpire() {
+  return 10;  // 10 seconds
+}
+
+size_t GetMaxNegativeLookupCount() {
+  return QS::Size::K10;
+}
+
+uint32_t GetDefaultCacheBlockSizeInKB() {
+  return QS::Size::KB256 / QS::Size::KB1;  // 256KB
+}
+
+uint32_t GetMinCacheBlockSizeInKB() {
+  return QS::Size::KB64 / QS::Size::KB1;  // 64KB
+}
+
+uint32_t GetMaxCacheBlockSizeInKB() {
+  return QS::Size::MB4 / QS::Size::KB1;  // 4MB
+}
+
 uint64_t GetUploadMultipartMinPartSize() {
   // qs qingstor sepcific
   return QS::Size::MB4;
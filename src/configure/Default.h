@@ -72,6 +72,15 @@ uint64_t GetDefaultTransferMaxBufHeapSize();
 uint64_t GetDefaultTransferBufSize();
 uint16_t GetDefaultPrefetchSizeInMB();
 
+uint32_t GetDefaultCacheBlockSizeInKB();  // File data cache block size
+uint32_t GetMinCacheBlockSizeInKB();
+uint32_t GetMaxCacheBlockSizeInKB();
+std::string GetDefaultCachePolicyName();  // Eviction policy of data cache
+uint32_t GetDefaultWriteBackDelay();  // in seconds, 0 disables write-back
+uint32_t GetDefaultWriteBackThresholdInMB();
+uint32_t GetDefaultNegativeLookupExpire();  // in seconds, 0 disables it
+size_t GetMaxNegativeLookupCount();         // max count of absent paths
+
 uint64_t GetUploadMultipartMinPartSize();
 uint64_t GetUploadMultipartMaxPartSize();
 uint64_t GetUploadMultipartThresholdSize();
@@ -48,6 +48,11 @@ using QS::Configure::Default::GetDefaultProtocolName;
 using QS::Configure::Default::GetDefaultParallelTransfers;
 using QS::Configure::Default::GetDefaultTransferBufSize;
 using QS::Configure::Default::GetDefaultPrefetchSizeInMB;
+using QS::Configure::Default::GetDefaultCacheBlockSizeInKB;
+using QS::Configure::Default::GetDefaultCachePolicyName;
+using QS::Configure::Default::GetDefaultWriteBackDelay;
+using QS::Configure::Default::GetDefaultWriteBackThresholdInMB;
+using QS::Configure::Default::GetDefaultNegativeLookupExpire;
 using QS::Configure::Default::GetMaxCacheSize;
 using QS::Configure::Default::GetMaxListObjectsCount;
 using QS::Configure::Default::GetMaxStatCount;
@@ -84,6 +89,11 @@ Options::Options()
       m_transferBufferSizeInMB(GetDefaultTransferBufSize() /
                                QS::Size::MB1),
       m_prefetchSizeInMB(GetDefaultPrefetchSizeInMB()),
+      m_cacheBlockSizeInKB(GetDefaultCacheBlockSizeInKB()),
+      m_cachePolicy(GetDefaultCachePolicyName()),
+      m_writeBackDelay(GetDefaultWriteBackDelay()),
+      m_writeBackThresholdInMB(GetDefaultWriteBackThresholdInMB()),
+      m_negativeLookupExpire(GetDefaultNegativeLookupExpire()),
       m_clientPoolSize(GetClientDefaultPoolSize()),
       m_host(GetDefaultHostName()),
       m_protocol(GetDefaultProtocolName()),
@@ -93,6 +103,8 @@ Options::Options()
       m_enableContentMD5(false),
       m_clearLogDir(false),
       m_noDataCache(false),
+      m_persistDiskCache(false),
+      m_streamUpload(false),
       m_foreground(false),
       m_singleThread(false),
       m_qsfsSingleThread(false),
@@ -156,6 +168,11 @@ ostream &operator<<(ostream &os, const Options &opts) {
          << "[num transfers: " << to_string(opts.m_parallelTransfers) << "] "
          << "[transfer buf(MB): " << to_string(opts.m_transferBufferSizeInMB) <<"] "  // NOLINT
          << "[prefetch size(MB): " << to_string(opts.m_prefetchSizeInMB) << "] "
+         << "[cache block size(KB): " << to_string(opts.m_cacheBlockSizeInKB) << "] "  // NOLINT
+         << "[cache policy: " << opts.m_cachePolicy << "] "
+         << "[write-back delay(s): " << to_string(opts.m_writeBackDelay) << "] "  // NOLINT
+         << "[write-back threshold(MB): " << to_string(opts.m_writeBackThresholdInMB) << "] "  // NOLINT
+         << "[negative lookup expire(s): " << to_string(opts.m_negativeLookupExpire) << "] "  // NOLINT
          << "[pool size: " << to_string(opts.m_clientPoolSize) << "] "
          << "[host: " << opts.m_host << "] "
          << "[protocol: " << opts.m_protocol << "] "
@@ -166,6 +183,8 @@ ostream &operator<<(ostream &os, const Options &opts) {
          << "[enable content md5: " << opts.m_enableContentMD5 << "] "
          << "[clear logdir: " << opts.m_clearLogDir << "] "
          << "[no datacache: " << opts.m_noDataCache << "]"
+         << "[persist diskcache: " << opts.m_persistDiskCache << "] "
+         << "[stream upload: " << opts.m_streamUpload << "] "
          << "[foreground: " << opts.m_foreground << "] "
          << "[FUSE single thread: " << opts.m_singleThread << "] "
          << "[qsfs single thread: " << opts.m_qsfsSingleThread << "] "
@@ -83,6 +83,13 @@ class Options : public Singleton<Options> {
   uint16_t GetPrefetchSizeInMB() const {
     return m_prefetchSizeInMB;
   }
+  uint32_t GetCacheBlockSizeInKB() const { return m_cacheBlockSizeInKB; }
+  const std::string &GetCachePolicy() const { return m_cachePolicy; }
+  uint32_t GetWriteBackDelay() const { return m_writeBackDelay; }
+  uint32_t GetWriteBackThresholdInMB() const {
+    return m_writeBackThresholdInMB;
+  }
+  uint32_t GetNegativeLookupExpire() const { return m_negativeLookupExpire; }
   uint16_t GetClientPoolSize() const { return m_clientPoolSize; }
   const std::string &GetHost() const { return m_host; }
   const std::string &GetProtocol() const { return m_protocol; }
@@ -92,6 +99,8 @@ class Options : public Singleton<Options> {
   bool IsEnableContentMD5() const { return m_enableContentMD5; }
   bool IsClearLogDir() const { return m_clearLogDir; }
   bool IsNoDataCache() const { return m_noDataCache; }
+  bool IsPersistDiskCache() const { return m_persistDiskCache; }
+  bool IsStreamUpload() const { return m_streamUpload; }
   bool IsForeground() const { return m_foreground; }
   bool IsSingleThread() const { return m_singleThread; }
   bool IsQsfsSingleThread() const { return m_qsfsSingleThread; }
@@ -145,6 +154,15 @@ class Options : public Singleton<Options> {
   void SetPrefetchSizeInMB(uint16_t size) {
     m_prefetchSizeInMB = size;
   }
+  void SetCacheBlockSizeInKB(uint32_t size) { m_cacheBlockSizeInKB = size; }
+  void SetCachePolicy(const char *policy) { m_cachePolicy = policy; }
+  void SetWriteBackDelay(uint32_t delay) { m_writeBackDelay = delay; }
+  void SetWriteBackThresholdInMB(uint32_t threshold) {
+    m_writeBackThresholdInMB = threshold;
+  }
+  void SetNegativeLookupExpire(uint32_t expire) {
+    m_negativeLookupExpire = expire;
+  }
   void SetClientPoolSize(uint32_t poolsize) { m_clientPoolSize = poolsize; }
   void SetHost(const char *host) { m_host = host; }
   void SetProtocol(const char *protocol) { m_protocol = protocol; }
@@ -154,6 +172,8 @@ class Options : public Singleton<Options> {
   void SetEnableContentMD5(bool contentMD5) { m_enableContentMD5 = contentMD5; }
   void SetClearLogDir(bool clearLogDir) { m_clearLogDir = clearLogDir; }
   void SetNoDataCache(bool noDataCache) { m_noDataCache = noDataCache; }
+  void SetPersistDiskCache(bool persist) { m_persistDiskCache = persist; }
+  void SetStreamUpload(bool stream) { m_streamUpload = stream; }
   void SetForeground(bool foreground) { m_foreground = foreground; }
   void SetSingleThread(bool singleThread) { m_singleThread = singleThread; }
   void SetQsfsSingleThread(bool singleThread) {
@@ -197,6 +217,11 @@ class Options : public Singleton<Options> {
   uint16_t m_parallelTransfers;  // count of file transfers in parallel
   uint32_t m_transferBufferSizeInMB;
   uint16_t m_prefetchSizeInMB;
+  uint32_t m_cacheBlockSizeInKB;  // power of 2, from 64KB to 4MB
+  std::string m_cachePolicy;      // eviction policy of data cache
+  uint32_t m_writeBackDelay;      // in seconds, 0 disables write-back
+  uint32_t m_writeBackThresholdInMB;
+  uint32_t m_negativeLookupExpire;  // in seconds, 0 disables negative lookup
   uint16_t m_clientPoolSize;
   std::string m_host;
   std::string m_protocol;
@@ -206,6 +231,8 @@ class Options : public Singleton<Options> {
   bool m_enableContentMD5;
   bool m_clearLogDir;
   bool m_noDataCache;
+  bool m_persistDiskCache;  // keep disk cache across remounts
+  bool m_streamUpload;      // upload parts while files are being written
   bool m_foreground;        // FUSE foreground option
   bool m_singleThread;      // FUSE single threaded option
   bool m_qsfsSingleThread;  // qsfs single threaded option
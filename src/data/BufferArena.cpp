@@ -0,0 +1,187 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include "data/BufferArena.h"
+
+#include <stdlib.h>
+
+#include <vector>
+
+#include "boost/exception/to_string.hpp"
+#include "boost/thread/locks.hpp"
+
+#include "base/LogMacros.h"
+#include "base/Size.h"
+#include "configure/Default.h"
+
+namespace QS {
+
+namespace Data {
+
+using boost::lock_guard;
+using boost::mutex;
+using boost::to_string;
+using QS::Configure::Default::GetMaxCacheBlockSizeInKB;
+using std::vector;
+
+namespace {
+
+// --------------------------------------------------------------------------
+size_t GetMinClassSize() { return QS::Size::KB4; }
+
+// --------------------------------------------------------------------------
+size_t GetMaxClassSize() {
+  return GetMaxCacheBlockSizeInKB() * QS::Size::KB1;
+}
+
+// --------------------------------------------------------------------------
+size_t GetNumSizeClasses() {
+  size_t num = 1;
+  for (size_t sz = GetMinClassSize(); sz < GetMaxClassSize(); sz <<= 1) {
+    ++num;
+  }
+  return num;
+}
+
+}  // namespace
+
+// --------------------------------------------------------------------------
+BufferArena::BufferArena(size_t limit)
+    : m_limit(limit),
+      m_sizeInUse(0),
+      m_pooledSize(0),
+      m_freeLists(GetNumSizeClasses()) {}
+
+// --------------------------------------------------------------------------
+BufferArena::~BufferArena() {
+  Trim();
+  DebugWarningIf(GetSizeInUse() > 0,
+                 "Arena destroyed with buffers in use [size:" +
+                     to_string(GetSizeInUse()) + "]");
+}
+
+// --------------------------------------------------------------------------
+size_t BufferArena::GetAllocSize(size_t size) {
+  size_t minSz = GetMinClassSize();
+  if (size > GetMaxClassSize()) {
+    return (size + minSz - 1) / minSz * minSz;  // round up to min class
+  }
+  size_t allocSize = minSz;
+  while (allocSize < size) {
+    allocSize <<= 1;
+  }
+  return allocSize;
+}
+
+// --------------------------------------------------------------------------
+size_t BufferArena::GetSizeClass(size_t allocSize) {
+  if (allocSize > GetMaxClassSize()) {
+    return GetNumSizeClasses();
+  }
+  size_t index = 0;
+  for (size_t sz = GetMinClassSize(); sz < allocSize; sz <<= 1) {
+    ++index;
+  }
+  return index;
+}
+
+// --------------------------------------------------------------------------
+char *BufferArena::Allocate(size_t size) {
+  size_t allocSize = GetAllocSize(size);
+  size_t sizeClass = GetSizeClass(allocSize);
+  {
+    lock_guard<mutex> lock(m_mutex);
+    if (sizeClass < m_freeLists.size() && !m_freeLists[sizeClass].empty()) {
+      char *buffer = m_freeLists[sizeClass].back();
+      m_freeLists[sizeClass].pop_back();
+      m_pooledSize -= allocSize;
+      m_sizeInUse += allocSize;
+      return buffer;
+    }
+    // give pooled buffers of other classes back to make room for new one
+    if (m_sizeInUse + m_pooledSize + allocSize > m_limit) {
+      UnguardedTrim(m_sizeInUse + m_pooledSize + allocSize - m_limit);
+    }
+    m_sizeInUse += allocSize;
+  }
+
+  void *buffer = NULL;
+  if (posix_memalign(&buffer, GetMinClassSize(), allocSize) != 0) {
+    lock_guard<mutex> lock(m_mutex);
+    m_sizeInUse -= allocSize;
+    DebugError("Fail to allocate buffer [size:" + to_string(allocSize) + "]");
+    return NULL;
+  }
+  return static_cast<char *>(buffer);
+}
+
+// --------------------------------------------------------------------------
+void BufferArena::Deallocate(char *buffer, size_t size) {
+  if (buffer == NULL) {
+    return;
+  }
+  size_t allocSize = GetAllocSize(size);
+  size_t sizeClass = GetSizeClass(allocSize);
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_sizeInUse -= allocSize;
+    if (sizeClass < m_freeLists.size() &&
+        m_sizeInUse + m_pooledSize + allocSize <= m_limit) {
+      m_freeLists[sizeClass].push_back(buffer);
+      m_pooledSize += allocSize;
+      return;
+    }
+  }
+  free(buffer);
+}
+
+// --------------------------------------------------------------------------
+void BufferArena::Trim() {
+  lock_guard<mutex> lock(m_mutex);
+  UnguardedTrim(m_pooledSize);
+}
+
+// --------------------------------------------------------------------------
+void BufferArena::UnguardedTrim(size_t size) {
+  size_t freedSize = 0;
+  size_t allocSize = GetMaxClassSize();
+  // release large buffers first
+  for (size_t i = m_freeLists.size(); i > 0 && freedSize < size; --i) {
+    vector<char *> &freeList = m_freeLists[i - 1];
+    while (!freeList.empty() && freedSize < size) {
+      free(freeList.back());
+      freeList.pop_back();
+      freedSize += allocSize;
+    }
+    allocSize >>= 1;
+  }
+  m_pooledSize -= freedSize;
+}
+
+// --------------------------------------------------------------------------
+size_t BufferArena::GetSizeInUse() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_sizeInUse;
+}
+
+// --------------------------------------------------------------------------
+size_t BufferArena::GetPooledSize() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_pooledSize;
+}
+
+}  // namespace Data
+}  // namespace QS
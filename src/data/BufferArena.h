@@ -0,0 +1,108 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#ifndef QSFS_DATA_BUFFERARENA_H_
+#define QSFS_DATA_BUFFERARENA_H_
+
+#include <stddef.h>  // for size_t
+
+#include <vector>
+
+#include "boost/noncopyable.hpp"
+#include "boost/thread/mutex.hpp"
+
+namespace QS {
+
+namespace Data {
+
+/**
+ * Size class buffer arena for in-memory pages.
+ *
+ * Buffers are handed out in size classes which are power of 2, from the
+ * minimum class (4KB) to the maximum class (the max cache block size).
+ * Buffers are aligned to the minimum class. A released buffer is kept in the
+ * free list of its size class for reuse, as long as the sum of the buffers in
+ * use and the pooled buffers does not surpass the limit of the arena.
+ * Request larger than the maximum class is served directly without pooling.
+ */
+class BufferArena : private boost::noncopyable {
+ public:
+  // Construct arena
+  //
+  // @param  : limit size in bytes of buffers in use and pooled buffers
+  // @return :
+  //
+  // A limit of zero means no pooled buffers are kept.
+  explicit BufferArena(size_t limit = 0);
+
+  ~BufferArena();
+
+ public:
+  // Return the size of the buffer allocated for a request
+  //
+  // @param  : request size
+  // @return : size of the size class fitting the request
+  static size_t GetAllocSize(size_t size);
+
+  // Allocate a buffer
+  //
+  // @param  : request size
+  // @return : buffer of GetAllocSize(size) bytes, or NULL if fail
+  //
+  // Content of the buffer is not initialized.
+  char *Allocate(size_t size);
+
+  // Release a buffer
+  //
+  // @param  : buffer, request size or alloc size of the buffer
+  // @return : void
+  void Deallocate(char *buffer, size_t size);
+
+  // Release all pooled buffers
+  void Trim();
+
+  // Return sum of size of the buffers in use
+  size_t GetSizeInUse() const;
+
+  // Return sum of size of the pooled buffers
+  size_t GetPooledSize() const;
+
+  size_t GetLimit() const { return m_limit; }
+
+ private:
+  // Return the index of size class for alloc size
+  // Return the number of size class if it is not pooled
+  static size_t GetSizeClass(size_t allocSize);
+
+  // Release pooled buffers until size bytes are freed,
+  // without checking input.
+  void UnguardedTrim(size_t size);
+
+ private:
+  size_t m_limit;
+  size_t m_sizeInUse;
+  size_t m_pooledSize;
+
+  mutable boost::mutex m_mutex;
+  std::vector<std::vector<char *> > m_freeLists;  // indexed by size class
+
+  friend class BufferArenaTest;
+};
+
+}  // namespace Data
+}  // namespace QS
+
+#endif  // QSFS_DATA_BUFFERARENA_H_
@@ -24,17 +24,24 @@
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
 #include "boost/exception/to_string.hpp"
+#include "boost/foreach.hpp"
+#include "boost/function.hpp"
 #include "boost/make_shared.hpp"
 #include "boost/shared_ptr.hpp"
 #include "boost/thread/locks.hpp"
+#include "boost/thread/recursive_mutex.hpp"
 
 #include "base/LogMacros.h"
 #include "base/StringUtils.h"
 #include "base/Utils.h"
 #include "base/UtilsWithLog.h"
 #include "configure/Options.h"
+#include "data/BufferArena.h"
 #include "data/DirectoryTree.h"
+#include "data/DiskCache.h"
+#include "data/EvictionPolicy.h"
 #include "data/File.h"
 #include "data/Node.h"
 
@@ -42,87 +49,160 @@ namespace QS {
 
 namespace Data {
 
+using boost::bind;
+using boost::function;
 using boost::lock_guard;
 using boost::make_shared;
 using boost::mutex;
 using boost::recursive_mutex;
 using boost::shared_ptr;
 using boost::to_string;
+using boost::unique_lock;
 using QS::StringUtils::FormatPath;
 using QS::UtilsWithLog::IsSafeDiskSpace;
-using std::make_pair;
+using std::max;
+using std::min;
 using std::pair;
 using std::string;
 using std::vector;
 
+namespace {
+
+// Boost.Atomic is not available with boost 1.49, use the gcc builtins.
+uint64_t AtomicLoad(const uint64_t *value) {
+  return __sync_add_and_fetch(const_cast<uint64_t *>(value), 0);
+}
+
+// Num of entries taken from the back of each shard at the first round of
+// discarding files, it is doubled every round if files are not enough.
+const size_t kNumCandidatesPerShard = 4;
+
+// Fraction of capacity freed at least when discarding blocks
+const uint64_t kFreeBatchDivisor = 32;
+
+struct Candidate {
+  size_t shardIndex;
+  std::string fileId;
+  shared_ptr<File> file;
+  uint64_t lastAccess;
+};
+
+bool LessRecentlyUsed(const Candidate &a, const Candidate &b) {
+  return a.lastAccess < b.lastAccess;
+}
+
+
+}  // namespace
+
+// --------------------------------------------------------------------------
+Cache::Cache(uint64_t capacity)
+    : m_size(0),
+      m_capacity(capacity),
+      m_clock(0),
+      m_numHits(0),
+      m_numMisses(0),
+      m_numDiscardedBlocks(0),
+      m_policy(make_shared<LRUPolicy>()),
+      m_arena(make_shared<BufferArena>(static_cast<size_t>(capacity))) {}
+
+// --------------------------------------------------------------------------
+void Cache::SetEvictionPolicy(const shared_ptr<EvictionPolicy> &policy) {
+  if (policy) {
+    m_policy = policy;
+    Info("Cache eviction policy is " + string(policy->GetName()));
+  }
+}
+
+// --------------------------------------------------------------------------
+uint64_t Cache::GetNumHits() const { return AtomicLoad(&m_numHits); }
+
+// --------------------------------------------------------------------------
+uint64_t Cache::GetNumMisses() const { return AtomicLoad(&m_numMisses); }
+
+// --------------------------------------------------------------------------
+uint64_t Cache::GetNumDiscardedBlocks() const {
+  return AtomicLoad(&m_numDiscardedBlocks);
+}
+
+// --------------------------------------------------------------------------
+string Cache::StatisticsToString() const {
+  uint64_t numHits = GetNumHits();
+  uint64_t numLookups = numHits + GetNumMisses();
+  uint64_t hitRate = numLookups > 0 ? numHits * 100 / numLookups : 0;
+  return "[policy:" + string(m_policy->GetName()) +
+         ", hits:" + to_string(numHits) +
+         ", misses:" + to_string(numLookups - numHits) +
+         ", hitrate:" + to_string(hitRate) + "%" +
+         ", discarded blocks:" + to_string(GetNumDiscardedBlocks()) + "]";
+}
+
 // --------------------------------------------------------------------------
 bool Cache::HasFreeSpace(size_t size) const {
-  lock_guard<recursive_mutex> locker(m_mutex);
   return GetSize() + size <= GetCapacity();
 }
 
 // --------------------------------------------------------------------------
 bool Cache::HasFile(const string &filePath) const {
-  lock_guard<recursive_mutex> locker(m_mutex);
-  return m_map.find(filePath) != m_map.end();
+  const Shard &shard = GetShard(filePath);
+  lock_guard<mutex> locker(shard.mutex);
+  return shard.map.find(filePath) != shard.map.end();
 }
 
 // --------------------------------------------------------------------------
 size_t Cache::GetNumFile() const {
-  lock_guard<recursive_mutex> locker(m_mutex);
-  return m_map.size();
+  size_t num = 0;
+  for (size_t i = 0; i < kNumShards; ++i) {
+    lock_guard<mutex> locker(m_shards[i].mutex);
+    num += m_shards[i].map.size();
+  }
+  return num;
 }
 
 // --------------------------------------------------------------------------
-uint64_t Cache::GetSize() const {
-  lock_guard<recursive_mutex> locker(m_mutex);
-  return m_size;
-}
+uint64_t Cache::GetSize() const { return AtomicLoad(&m_size); }
 
 // --------------------------------------------------------------------------
 shared_ptr<File> Cache::FindFile(const string &filePath) {
-  lock_guard<recursive_mutex> locker(m_mutex);
-  CacheMapIterator it = m_map.find(filePath);
-  CacheListIterator pos;
-  if (it != m_map.end()) {
-    pos = UnguardedMakeFileMostRecentlyUsed(it->second);
-    return pos->second;
+  Shard &shard = GetShard(filePath);
+  lock_guard<mutex> locker(shard.mutex);
+  FileIdToEntryListIteratorMap::iterator it = shard.map.find(filePath);
+  if (it != shard.map.end()) {
+    shard.files.splice(shard.files.begin(), shard.files, it->second);
+    it->second->lastAccess = Tick();
+    return it->second->file;
   } else {
     return shared_ptr<File>();
   }
 }
 
-// --------------------------------------------------------------------------
-CacheListIterator Cache::Begin() {
-  lock_guard<recursive_mutex> locker(m_mutex);
-  return m_cache.begin();
-}
-
-// --------------------------------------------------------------------------
-CacheListIterator Cache::End() {
-  lock_guard<recursive_mutex> locker(m_mutex);
-  return m_cache.end();
-}
-
 // --------------------------------------------------------------------------
 boost::shared_ptr<File> Cache::MakeFile(const string &fileId) {
-  lock_guard<recursive_mutex> locker(m_mutex);
-  shared_ptr<File> f = FindFile(fileId);
-  if (f) {
-    return f;
-  } else {
-    CacheListIterator pos = UnguardedNewEmptyFile(fileId);
-    if (pos != m_cache.end()) {
-      return pos->second;
-    } else {
-      return shared_ptr<File>();
-    }
+  Shard &shard = GetShard(fileId);
+  lock_guard<mutex> locker(shard.mutex);
+  FileIdToEntryListIteratorMap::iterator it = shard.map.find(fileId);
+  if (it != shard.map.end()) {
+    shard.files.splice(shard.files.begin(), shard.files, it->second);
+    it->second->lastAccess = Tick();
+    return it->second->file;
   }
+
+  Entry entry;
+  entry.fileId = fileId;
+  entry.file = make_shared<File>(fileId, 0, m_arena);
+  entry.lastAccess = Tick();
+  shard.files.push_front(entry);
+  pair<FileIdToEntryListIteratorMap::iterator, bool> res =
+      shard.map.emplace(fileId, shard.files.begin());
+  if (!res.second) {
+    shard.files.pop_front();
+    DebugError("Fail to create empty file in cache " + FormatPath(fileId));
+    return shared_ptr<File>();
+  }
+  return entry.file;
 }
 
 // --------------------------------------------------------------------------
 bool Cache::Free(size_t size, const string &fileUnfreeable) {
-  lock_guard<recursive_mutex> locker(m_mutex);
   if (size > GetCapacity()) {
     DebugInfo("Try to free cache of " + to_string(size) +
               " bytes which surpass the maximum cache size(" +
@@ -130,50 +210,25 @@ bool Cache::Free(size_t size, const string &fileUnfreeable) {
     return false;
   }
   if (HasFreeSpace(size)) {
-    // DebugInfo("Try to free cache of " + to_string(size) +
-    //           " bytes while free space is still available. Go on");
     return true;
   }
 
-  assert(!m_cache.empty());
-  size_t freedSpace = 0;
-  size_t freedDiskSpace = 0;
-
-  CacheList::reverse_iterator it = m_cache.rbegin();
-  // Discards the least recently used File first, which is put at back.
-  while (!m_cache.empty() && it != m_cache.rend() && !HasFreeSpace(size)) {
-    // Notice do NOT store a reference of the File supposed to be removed.
-    string fileId = it->first;
-    CacheList::iterator iit = m_cache.end();
-    if (fileId != fileUnfreeable && it->second && !it->second->IsOpen()) {
-      size_t fileCacheSz = it->second->GetCachedSize();
-      freedSpace += fileCacheSz;
-      freedDiskSpace += it->second->GetDataSize() - fileCacheSz;
-      SubtractSize(fileCacheSz);
-      it->second->Clear();
-      iit = (++it).base();
-      if (iit != m_cache.end()) {
-        m_cache.erase(iit);
-        m_map.erase(fileId);
-      } else {
-        DebugWarning("Invalid iterator" + FormatPath(fileId));
-      }
-    } else {
-      if (!it->second) {
-        DebugInfo("file in cache is null " + FormatPath(fileId));
-        iit = (++it).base();
-        if (iit != m_cache.end()) {
-          m_cache.erase(iit);
-          m_map.erase(fileId);
-        } else {
-          DebugWarning("Invalid iterator" + FormatPath(fileId));
-        }
-      } else {
-        ++it;
-      }
-    }
+  uint64_t freedBlockSpace = DiscardColdBlocks(size, fileUnfreeable);
+  if (freedBlockSpace > 0) {
+    Info("Has freed cache of blocks of " + to_string(freedBlockSpace) +
+         " bytes " + StatisticsToString() + " for file " +
+         FormatPath(fileUnfreeable));
+  }
+  if (HasFreeSpace(size)) {
+    return true;
   }
 
+  uint64_t freedSpace = 0;
+  uint64_t freedDiskSpace = 0;
+  bool success = DiscardLeastRecentlyUsedFiles(
+      fileUnfreeable, bind(&Cache::HasFreeSpace, this, size), &freedSpace,
+      &freedDiskSpace);
+
   if (freedSpace > 0) {
     Info("Has freed cache of " + to_string(freedSpace) + " bytes for file " +
          FormatPath(fileUnfreeable));
@@ -182,13 +237,12 @@ bool Cache::Free(size_t size, const string &fileUnfreeable) {
     Info("Has freed disk file of " + to_string(freedDiskSpace) +
          " bytes for file " + FormatPath(fileUnfreeable));
   }
-  return HasFreeSpace(size);
+  return success;
 }
 
 // --------------------------------------------------------------------------
 bool Cache::FreeDiskCacheFiles(const string &diskfolder, size_t size,
                                const string &fileUnfreeable) {
-  lock_guard<recursive_mutex> locker(m_mutex);
   assert(diskfolder ==
          QS::Configure::Options::Instance().GetDiskCacheDirectory());
   // diskfolder should be cache disk dir
@@ -196,45 +250,11 @@ bool Cache::FreeDiskCacheFiles(const string &diskfolder, size_t size,
     return true;
   }
 
-  assert(!m_cache.empty());
-  size_t freedSpace = 0;
-  size_t freedDiskSpace = 0;
-
-  CacheList::reverse_iterator it = m_cache.rbegin();
-  // Discards the least recently used File first, which is put at back.
-  while (!m_cache.empty() && it != m_cache.rend() &&
-         !IsSafeDiskSpace(diskfolder, size)) {
-    // Notice do NOT store a reference of the File supposed to be removed.
-    string fileId = it->first;
-    CacheList::iterator iit = m_cache.end();
-    if (fileId != fileUnfreeable && it->second && !it->second->IsOpen()) {
-      size_t fileCacheSz = it->second->GetCachedSize();
-      freedSpace += fileCacheSz;
-      freedDiskSpace += it->second->GetDataSize() - fileCacheSz;
-      SubtractSize(fileCacheSz);
-      it->second->Clear();
-      iit = (++it).base();
-      if (iit != m_cache.end()) {
-        m_cache.erase(iit);
-        m_map.erase(fileId);
-      } else {
-        DebugWarning("Invalid iterator" + FormatPath(fileId));
-      }
-    } else {
-      if (!it->second) {
-        DebugInfo("file in cache is null " + FormatPath(fileId));
-        iit = (++it).base();
-        if (iit != m_cache.end()) {
-          m_cache.erase(iit);
-          m_map.erase(fileId);
-        } else {
-          DebugWarning("Invalid iterator" + FormatPath(fileId));
-        }
-      } else {
-        ++it;
-      }
-    }
-  }
+  uint64_t freedSpace = 0;
+  uint64_t freedDiskSpace = 0;
+  bool success = DiscardLeastRecentlyUsedFiles(
+      fileUnfreeable, bind(&IsSafeDiskSpace, diskfolder, size),
+      &freedSpace, &freedDiskSpace);
 
   if (freedSpace > 0) {
     Info("Has freed cache of " + to_string(freedSpace) + " bytes for file " +
@@ -244,47 +264,85 @@ bool Cache::FreeDiskCacheFiles(const string &diskfolder, size_t size,
     Info("Has freed disk file of " + to_string(freedDiskSpace) +
          " bytes for file" + FormatPath(fileUnfreeable));
   }
-  return IsSafeDiskSpace(diskfolder, size);
+  return success;
 }
 
 // --------------------------------------------------------------------------
-CacheListIterator Cache::Erase(const string &fileId) {
-  lock_guard<recursive_mutex> locker(m_mutex);
-  CacheMapIterator it = m_map.find(fileId);
-  if (it != m_map.end()) {
-    DebugInfo("Erase cache " + FormatPath(fileId));
-    return UnguardedErase(it);
-  } else {
-    DebugInfo("File not exist, no remove " + FormatPath(fileId));
-    return m_cache.end();
+bool Cache::Erase(const string &fileId) {
+  shared_ptr<File> file;
+  {
+    Shard &shard = GetShard(fileId);
+    lock_guard<mutex> locker(shard.mutex);
+    FileIdToEntryListIteratorMap::iterator it = shard.map.find(fileId);
+    if (it == shard.map.end()) {
+      DebugInfo("File not exist, no remove " + FormatPath(fileId));
+      return false;
+    }
+    file = it->second->file;
+    shard.files.erase(it->second);
+    shard.map.erase(it);
   }
+  DebugInfo("Erase cache " + FormatPath(fileId));
+  ClearDetachedFile(file);
+  return true;
 }
 
 // --------------------------------------------------------------------------
 void Cache::Rename(const string &oldFileId, const string &newFileId) {
-  lock_guard<recursive_mutex> locker(m_mutex);
   if (oldFileId == newFileId) {
     DebugInfo("File exists, no rename " + FormatPath(oldFileId));
     return;
   }
-  CacheMapIterator iter = m_map.find(newFileId);
-  if (iter != m_map.end()) {
-    DebugWarning("File exist, Just remove it from cache " +
-                 FormatPath(newFileId));
-    UnguardedErase(iter);
+  if (m_diskCache) {
+    m_diskCache->Rename(oldFileId, newFileId);
   }
 
-  CacheMapIterator it = m_map.find(oldFileId);
-  if (it != m_map.end()) {
-    it->second->first = newFileId;
-    CacheListIterator pos = UnguardedMakeFileMostRecentlyUsed(it->second);
-    pos->second->Rename(newFileId);
+  size_t oldIndex = GetShardIndex(oldFileId);
+  size_t newIndex = GetShardIndex(newFileId);
+  Shard &oldShard = m_shards[oldIndex];
+  Shard &newShard = m_shards[newIndex];
+  shared_ptr<File> file;
+  shared_ptr<File> replacedFile;
+  {
+    // lock shards in order of index to avoid dead lock
+    unique_lock<mutex> firstLocker(m_shards[min(oldIndex, newIndex)].mutex);
+    unique_lock<mutex> secondLocker(m_shards[max(oldIndex, newIndex)].mutex,
+                                    boost::defer_lock);
+    if (oldIndex != newIndex) {
+      secondLocker.lock();
+    }
+
+    FileIdToEntryListIteratorMap::iterator iter = newShard.map.find(newFileId);
+    if (iter != newShard.map.end()) {
+      DebugWarning("File exist, Just remove it from cache " +
+                   FormatPath(newFileId));
+      replacedFile = iter->second->file;
+      newShard.files.erase(iter->second);
+      newShard.map.erase(iter);
+    }
 
-    pair<CacheMapIterator, bool> res = m_map.emplace(newFileId, pos);
-    if (!res.second) {
-      DebugWarning("Fail to rename " + FormatPath(oldFileId, newFileId));
+    FileIdToEntryListIteratorMap::iterator it = oldShard.map.find(oldFileId);
+    if (it != oldShard.map.end()) {
+      file = it->second->file;
+      newShard.files.splice(newShard.files.begin(), oldShard.files,
+                            it->second);
+      oldShard.map.erase(it);
+      EntryList::iterator pos = newShard.files.begin();
+      pos->fileId = newFileId;
+      pos->lastAccess = Tick();
+      pair<FileIdToEntryListIteratorMap::iterator, bool> res =
+          newShard.map.emplace(newFileId, pos);
+      if (!res.second) {
+        DebugWarning("Fail to rename " + FormatPath(oldFileId, newFileId));
+      }
     }
-    m_map.erase(it);
+  }
+
+  if (replacedFile) {
+    ClearDetachedFile(replacedFile);
+  }
+  if (file) {
+    file->Rename(newFileId);
     DebugInfo("Renamed file in cache" + FormatPath(oldFileId, newFileId));
   } else {
     DebugInfo("File not exists, no rename " + FormatPath(oldFileId, newFileId));
@@ -293,63 +351,208 @@ void Cache::Rename(const string &oldFileId, const string &newFileId) {
 
 // --------------------------------------------------------------------------
 void Cache::MakeFileMostRecentlyUsed(const string &filePath) {
-  lock_guard<recursive_mutex> locker(m_mutex);
-  CacheMapIterator it = m_map.find(filePath);
-  if (it != m_map.end()) {
-    m_cache.splice(m_cache.begin(), m_cache, it->second);
+  Shard &shard = GetShard(filePath);
+  lock_guard<mutex> locker(shard.mutex);
+  FileIdToEntryListIteratorMap::iterator it = shard.map.find(filePath);
+  if (it != shard.map.end()) {
+    shard.files.splice(shard.files.begin(), shard.files, it->second);
+    it->second->lastAccess = Tick();
   }
 }
 
 // --------------------------------------------------------------------------
-void Cache::AddSize(uint64_t delta) {
-  lock_guard<recursive_mutex> locker(m_mutex);
-  m_size += delta;
-}
+void Cache::AddSize(uint64_t delta) { __sync_add_and_fetch(&m_size, delta); }
 
 // --------------------------------------------------------------------------
 void Cache::SubtractSize(uint64_t delta) {
-  lock_guard<recursive_mutex> locker(m_mutex);
-  m_size -= delta;
+  __sync_sub_and_fetch(&m_size, delta);
+}
+
+// --------------------------------------------------------------------------
+Cache::Shard &Cache::GetShard(const string &fileId) {
+  return m_shards[GetShardIndex(fileId)];
+}
+
+// --------------------------------------------------------------------------
+const Cache::Shard &Cache::GetShard(const string &fileId) const {
+  return m_shards[GetShardIndex(fileId)];
+}
+
+// --------------------------------------------------------------------------
+size_t Cache::GetShardIndex(const string &fileId) const {
+  HashUtils::StringHash hash;
+  return static_cast<size_t>(static_cast<unsigned>(hash(fileId))) &
+         (kNumShards - 1);
 }
 
 // --------------------------------------------------------------------------
-CacheListIterator Cache::UnguardedNewEmptyFile(const string &fileId) {
-  lock_guard<recursive_mutex> locker(m_mutex);
-  m_cache.push_front(make_pair(fileId, make_shared<File>(fileId)));
-  if (m_cache.begin()->first == fileId) {  // insert to cache sucessfully
-    pair<CacheMapIterator, bool> res = m_map.emplace(fileId, m_cache.begin());
-    if (res.second) {
-      return m_cache.begin();
-    } else {
-      DebugError("Fail to create empty file in cache " + FormatPath(fileId));
-      return m_cache.end();
+uint64_t Cache::Tick() { return __sync_add_and_fetch(&m_clock, 1); }
+
+// --------------------------------------------------------------------------
+void Cache::RecordBlockAccess(const string &fileId, size_t blockNo) {
+  m_policy->RecordAccess(fileId, blockNo);
+}
+
+// --------------------------------------------------------------------------
+void Cache::RecordLookup(size_t numHits, size_t numMisses) {
+  if (numHits > 0) {
+    __sync_add_and_fetch(&m_numHits, static_cast<uint64_t>(numHits));
+  }
+  if (numMisses > 0) {
+    __sync_add_and_fetch(&m_numMisses, static_cast<uint64_t>(numMisses));
+  }
+}
+
+// --------------------------------------------------------------------------
+uint64_t Cache::DiscardColdBlocks(size_t size, const string &fileUnfreeable) {
+  uint64_t targetSize =
+      min(GetCapacity(),
+          max(static_cast<uint64_t>(size), GetCapacity() / kFreeBatchDivisor));
+  vector<Entry> files;
+  for (size_t i = 0; i < kNumShards; ++i) {
+    lock_guard<mutex> locker(m_shards[i].mutex);
+    BOOST_FOREACH (const Entry &entry, m_shards[i].files) {
+      // blocks of the file in writing could be read later by the writer
+      if (entry.file && entry.fileId != fileUnfreeable) {
+        files.push_back(entry);
+      }
+    }
+  }
+
+  // files are visited without holding any lock of shard
+  EvictionCandidates candidates;
+  BlockAccessList blocks;
+  BOOST_FOREACH (const Entry &entry, files) {
+    blocks.clear();
+    entry.file->CollectCleanBlocks(&blocks);
+    BOOST_FOREACH (const BlockAccessList::value_type &block, blocks) {
+      EvictionCandidate candidate;
+      candidate.fileId = entry.fileId;
+      candidate.blockNo = block.second;
+      candidate.lastAccess = block.first;
+      candidate.file = entry.file;
+      candidates.push_back(candidate);
+    }
+  }
+  m_policy->Sort(&candidates);
+
+  uint64_t freedSize = 0;
+  for (EvictionCandidates::iterator it = candidates.begin();
+       it != candidates.end() && !HasFreeSpace(targetSize); ++it) {
+    size_t removedSize =
+        it->file->DiscardCleanBlock(it->blockNo, it->lastAccess);
+    if (removedSize > 0) {
+      SubtractSize(removedSize);
+      freedSize += removedSize;
+      __sync_add_and_fetch(&m_numDiscardedBlocks, 1);
     }
-  } else {
-    DebugError("Fail to create empty file in cache " + FormatPath(fileId));
-    return m_cache.end();
   }
+  return freedSize;
 }
 
 // --------------------------------------------------------------------------
-CacheListIterator Cache::UnguardedErase(
-    FileIdToCacheListIteratorMap::iterator pos) {
-  lock_guard<recursive_mutex> locker(m_mutex);
-  CacheListIterator cachePos = pos->second;
-  shared_ptr<File> &file = cachePos->second;
-  SubtractSize(file->GetCachedSize());
-  file->Clear();
-  CacheListIterator next = m_cache.erase(cachePos);
-  m_map.erase(pos);
-  return next;
+bool Cache::DiscardLeastRecentlyUsedFiles(const string &fileUnfreeable,
+                                          const function<bool()> &isEnough,
+                                          uint64_t *freedSize,
+                                          uint64_t *freedDiskSize) {
+  size_t numPerShard = kNumCandidatesPerShard;
+  while (!isEnough()) {
+    // Take a snapshot of the least recently used files of every shard,
+    // files are checked and cleared without holding any lock of shard.
+    vector<Candidate> candidates;
+    bool truncated = false;
+    for (size_t i = 0; i < kNumShards; ++i) {
+      const Shard &shard = m_shards[i];
+      lock_guard<mutex> locker(shard.mutex);
+      size_t num = 0;
+      for (EntryList::const_reverse_iterator it = shard.files.rbegin();
+           it != shard.files.rend(); ++it) {
+        if (it->fileId == fileUnfreeable) {
+          continue;
+        }
+        if (num == numPerShard) {
+          truncated = true;
+          break;
+        }
+        Candidate candidate;
+        candidate.shardIndex = i;
+        candidate.fileId = it->fileId;
+        candidate.file = it->file;
+        candidate.lastAccess = it->lastAccess;
+        candidates.push_back(candidate);
+        ++num;
+      }
+    }
+    std::sort(candidates.begin(), candidates.end(), LessRecentlyUsed);
+
+    bool discarded = false;
+    for (vector<Candidate>::iterator it = candidates.begin();
+         it != candidates.end() && !isEnough(); ++it) {
+      // The lock of file is only tried, as the caller could hold the lock of
+      // the file in writing, waiting for others could deadlock with them.
+      // A file locked by others is in use, it is skipped.
+      unique_lock<recursive_mutex> fileLock;
+      if (it->file) {
+        fileLock = unique_lock<recursive_mutex>(it->file->m_mutex,
+                                                boost::try_to_lock);
+        if (!fileLock.owns_lock()) {
+          continue;
+        }
+      }
+      // dirty files are kept until written back, and files are kept until
+      // transfers referring to them are done
+      if (it->file && (it->file->IsOpen() || it->file->IsDirty() ||
+                       it->file->HasTransfers())) {
+        continue;
+      }
+      Entry entry;
+      entry.fileId = it->fileId;
+      entry.file = it->file;
+      entry.lastAccess = it->lastAccess;
+      if (!DetachIfNotUsed(it->shardIndex, entry)) {
+        continue;  // used by others since the snapshot
+      }
+      discarded = true;
+      if (!it->file) {
+        DebugInfo("file in cache is null " + FormatPath(it->fileId));
+        continue;
+      }
+      *freedSize += it->file->GetCachedSize();
+      *freedDiskSize += it->file->GetDiskCachedSize();
+      ClearDetachedFile(it->file);
+    }
+
+    if (!discarded && !truncated) {
+      break;  // all files left are unfreeable
+    }
+    if (!discarded) {
+      numPerShard *= 2;
+    }
+  }
+  return isEnough();
+}
+
+// --------------------------------------------------------------------------
+bool Cache::DetachIfNotUsed(size_t shardIndex, const Entry &entry) {
+  Shard &shard = m_shards[shardIndex];
+  lock_guard<mutex> locker(shard.mutex);
+  FileIdToEntryListIteratorMap::iterator it = shard.map.find(entry.fileId);
+  if (it == shard.map.end() || it->second->file != entry.file ||
+      it->second->lastAccess != entry.lastAccess) {
+    return false;
+  }
+  shard.files.erase(it->second);
+  shard.map.erase(it);
+  return true;
 }
 
 // --------------------------------------------------------------------------
-CacheListIterator Cache::UnguardedMakeFileMostRecentlyUsed(
-    CacheListIterator pos) {
-  lock_guard<recursive_mutex> locker(m_mutex);
-  m_cache.splice(m_cache.begin(), m_cache, pos);
-  // no iterators or references become invalidated, so no need to update m_map.
-  return m_cache.begin();
+void Cache::ClearDetachedFile(const shared_ptr<File> &file) {
+  if (!file) {
+    return;
+  }
+  SubtractSize(file->GetCachedSize());
+  file->Clear();
 }
 
 }  // namespace Data
@@ -28,10 +28,10 @@
 #include <string>
 #include <utility>
 
+#include "boost/function.hpp"
 #include "boost/noncopyable.hpp"
 #include "boost/shared_ptr.hpp"
 #include "boost/thread/mutex.hpp"
-#include "boost/thread/recursive_mutex.hpp"
 #include "boost/unordered_map.hpp"
 
 #include "base/HashUtils.h"
@@ -51,25 +51,31 @@ struct RemoveFileCallback;
 
 namespace Data {
 
+class BufferArena;
 class DirectoryTree;
+class DiskCache;
+class EvictionPolicy;
 class File;
 
-typedef std::pair<std::string, boost::shared_ptr<File> > FileIdToFilePair;
-typedef std::list<FileIdToFilePair> CacheList;
-typedef CacheList::iterator CacheListIterator;
-typedef CacheList::const_iterator CacheListConstIterator;
-typedef boost::unordered_map<std::string, CacheListIterator,
-                             HashUtils::StringHash>
-    FileIdToCacheListIteratorMap;
-typedef FileIdToCacheListIteratorMap::iterator CacheMapIterator;
-typedef FileIdToCacheListIteratorMap::const_iterator CacheMapConstIterator;
-
 //
 // Cache (FileManager)
 //
+// Files are distributed into shards by the hash of file path, each shard has
+// its own lock and its own LRU list, so accessing different files does not
+// contend on a single lock. Cache size is maintained atomically, and eviction
+// picks the blocks across all shards in the order given by eviction policy.
+//
 class Cache : private boost::noncopyable {
  public:
-  explicit Cache(uint64_t capacity) : m_size(0), m_capacity(capacity) {}
+  // Construct Cache
+  //
+  // @param  : capacity in bytes
+  // @return :
+  //
+  // Buffers of in-memory file pages are allocated from the arena owned by
+  // cache, and buffers released by pages are pooled for reuse within the
+  // capacity.
+  explicit Cache(uint64_t capacity);
 
   ~Cache() {}
 
@@ -98,30 +104,71 @@ class Cache : private boost::noncopyable {
   // Get cache Capacity
   uint64_t GetCapacity() const { return m_capacity; }
 
+  // Get the arena of file pages' buffers
+  const boost::shared_ptr<BufferArena> &GetArena() const { return m_arena; }
+
+  // Get the persistent disk cache, null if it is not enabled
+  const boost::shared_ptr<DiskCache> &GetDiskCache() const {
+    return m_diskCache;
+  }
+
+  // Set the persistent disk cache
+  //
+  // @param  : disk cache
+  // @return : void
+  //
+  // Downloaded blocks are stored into disk cache, and blocks not loaded are
+  // read from disk cache before downloading them.
+  void SetDiskCache(const boost::shared_ptr<DiskCache> &diskCache) {
+    m_diskCache = diskCache;
+  }
+
+  // Get the eviction policy
+  const boost::shared_ptr<EvictionPolicy> &GetEvictionPolicy() const {
+    return m_policy;
+  }
+
+  // Set the eviction policy
+  //
+  // @param  : eviction policy
+  // @return : void
+  //
+  // Policy is LRU by default. It should be set before cache is used, as it
+  // is not protected by lock.
+  void SetEvictionPolicy(const boost::shared_ptr<EvictionPolicy> &policy);
+
+  // Return num of blocks found in cache when reading
+  uint64_t GetNumHits() const;
+
+  // Return num of blocks not found in cache when reading
+  uint64_t GetNumMisses() const;
+
+  // Return num of blocks discarded to free cache
+  uint64_t GetNumDiscardedBlocks() const;
+
+  // Return statistics of hit rate and eviction
+  std::string StatisticsToString() const;
+
   // Find the file
   //
   // @param  : file path (absolute path)
   // @return : shared_ptr<File>
   boost::shared_ptr<File> FindFile(const std::string &filePath);
 
-  // Begin of cache list
-  CacheListIterator Begin();
-
-  // End of cache list
-  CacheListIterator End();
-
   // Make a new file
   boost::shared_ptr<File> MakeFile(const std::string &fileId);
 
  private:
-
   // Free cache space
   //
   // @param  : size need to be freed, file should not be freed
   // @return : bool
   //
-  // Discard the least recently used File to make sure
-  // there will be number of size avaiable cache space.
+  // Discard the least recently used clean blocks of all files, including the
+  // open ones, to make sure there will be number of size avaiable cache
+  // space. If it is not enough, discard the least recently used closed File
+  // which has no dirty blocks waiting for write-back nor transfers in
+  // progress.
   bool Free(size_t size, const std::string &fileUnfreeable);  // size in byte
 
   // Remove disk files used to cache file content
@@ -137,9 +184,8 @@ class Cache : private boost::noncopyable {
   // Remove file from cache
   //
   // @param  : file id
-  // @return : iterator pointing to next file in cache list if remove
-  // sucessfully, otherwise return past-the-end iterator.
-  CacheListIterator Erase(const std::string &fildId);
+  // @return : bool
+  bool Erase(const std::string &fileId);
 
   // Rename a file
   //
@@ -150,6 +196,29 @@ class Cache : private boost::noncopyable {
   //  Move the file into the front of the cache
   void MakeFileMostRecentlyUsed(const std::string &fileId);
 
+ private:
+  struct Entry {
+    std::string fileId;
+    boost::shared_ptr<File> file;
+    uint64_t lastAccess;  // access clock when the file is used last time
+  };
+
+  typedef std::list<Entry> EntryList;
+  typedef boost::unordered_map<std::string, EntryList::iterator,
+                               HashUtils::StringHash>
+      FileIdToEntryListIteratorMap;
+
+  struct Shard {
+    mutable boost::mutex mutex;
+    // Most recently used File is put at front,
+    // Least recently used File is put at back.
+    EntryList files;
+    FileIdToEntryListIteratorMap map;
+  };
+
+  // Number of shards, the power of 2
+  static const size_t kNumShards = 64;
+
  private:
   // Add size
   void AddSize(uint64_t delta);
@@ -157,29 +226,75 @@ class Cache : private boost::noncopyable {
   // Subtract size
   void SubtractSize(uint64_t delta);
 
-  // Create an empty File with fileId in cache, without checking input.
-  // If success return reference to insert file, else return m_cache.end().
-  CacheListIterator UnguardedNewEmptyFile(const std::string &fileId);
+  // Return the shard the file belongs to
+  Shard &GetShard(const std::string &fileId);
+  const Shard &GetShard(const std::string &fileId) const;
+  size_t GetShardIndex(const std::string &fileId) const;
+
+  // Return the next value of access clock
+  uint64_t Tick();
+
+  // Report the access of a block to eviction policy
+  void RecordBlockAccess(const std::string &fileId, size_t blockNo);
+
+  // Record the result of looking up blocks when reading
+  void RecordLookup(size_t numHits, size_t numMisses);
+
+  // Discard the cold clean blocks of all files
+  //
+  // @param  : size need to be available, file should not be freed
+  // @return : freed cache size
+  //
+  // Blocks of all files are ordered by eviction policy, e.g. the access clock
+  // for LRU. A bit more than the needed size is freed, so the cost of
+  // collecting blocks is shared by the following writes.
+  uint64_t DiscardColdBlocks(size_t size, const std::string &fileUnfreeable);
 
-  // Erase the file denoted by pos, without checking input.
-  CacheListIterator UnguardedErase(FileIdToCacheListIteratorMap::iterator pos);
+  // Discard the least recently used files of all shards
+  //
+  // @param  : file should not be freed, predicate telling there is enough
+  //           space, output freed cache size, output freed disk file size
+  // @return : result of the predicate
+  //
+  // Files are not cleared under the lock of shard, as the lock of file is
+  // acquired before the lock of shard when file calls back into cache. Files
+  // locked by others are skipped, as the caller could hold the lock of the
+  // file in writing.
+  bool DiscardLeastRecentlyUsedFiles(const std::string &fileUnfreeable,
+                                     const boost::function<bool()> &isEnough,
+                                     uint64_t *freedSize,
+                                     uint64_t *freedDiskSize);
+
+  // Remove the entry from shard if it is not used since the snapshot
+  //
+  // @param  : shard index, snapshot of entry
+  // @return : bool
+  bool DetachIfNotUsed(size_t shardIndex, const Entry &entry);
 
-  // Move the file denoted by pos into the front of the cache,
-  // without checking input.
-  CacheListIterator UnguardedMakeFileMostRecentlyUsed(CacheListIterator pos);
+  // Release the content of a file which has been removed from shard
+  void ClearDetachedFile(const boost::shared_ptr<File> &file);
 
  private:
-  // Record sum of the cache files' size, not including disk file
+  // Record sum of the cache files' buffer size allocated from arena,
+  // not including disk file. Updated atomically.
   uint64_t m_size;
 
   uint64_t m_capacity;  // in bytes
 
-  mutable boost::recursive_mutex m_mutex;
-  // Most recently used File is put at front,
-  // Least recently used File is put at back.
-  CacheList m_cache;
+  // Increased atomically every time a file is used
+  uint64_t m_clock;
+
+  // Statistics, updated atomically
+  uint64_t m_numHits;
+  uint64_t m_numMisses;
+  uint64_t m_numDiscardedBlocks;
+
+  boost::shared_ptr<EvictionPolicy> m_policy;
+
+  boost::shared_ptr<BufferArena> m_arena;
+  boost::shared_ptr<DiskCache> m_diskCache;  // null if not enabled
 
-  FileIdToCacheListIteratorMap m_map;
+  Shard m_shards[kNumShards];
 
   friend class QS::Data::File;
   friend class QS::Client::QSClient;
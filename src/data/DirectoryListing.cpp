@@ -0,0 +1,81 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include "data/DirectoryListing.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "boost/thread/locks.hpp"
+
+namespace QS {
+
+namespace Data {
+
+using boost::lock_guard;
+using boost::mutex;
+using boost::unique_lock;
+using std::string;
+using std::vector;
+
+// --------------------------------------------------------------------------
+DirectoryListing::DirectoryListing() : m_finished(false) {}
+
+// --------------------------------------------------------------------------
+bool DirectoryListing::IsFinished() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_finished;
+}
+
+// --------------------------------------------------------------------------
+size_t DirectoryListing::GetNumEntries() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_entries.size();
+}
+
+// --------------------------------------------------------------------------
+void DirectoryListing::AddEntries(const vector<string> &filePaths) {
+  if (filePaths.empty()) {
+    return;
+  }
+  lock_guard<mutex> lock(m_mutex);
+  m_entries.insert(m_entries.end(), filePaths.begin(), filePaths.end());
+  m_entriesAdded.notify_all();
+}
+
+// --------------------------------------------------------------------------
+void DirectoryListing::Finish() {
+  lock_guard<mutex> lock(m_mutex);
+  m_finished = true;
+  m_entriesAdded.notify_all();
+}
+
+// --------------------------------------------------------------------------
+vector<string> DirectoryListing::WaitForEntries(size_t pos, size_t maxCount) {
+  unique_lock<mutex> lock(m_mutex);
+  while (pos >= m_entries.size() && !m_finished) {
+    m_entriesAdded.wait(lock);
+  }
+  if (pos >= m_entries.size()) {
+    return vector<string>();
+  }
+  size_t stop = pos + std::min(maxCount, m_entries.size() - pos);
+  return vector<string>(m_entries.begin() + pos, m_entries.begin() + stop);
+}
+
+}  // namespace Data
+}  // namespace QS
@@ -0,0 +1,81 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#ifndef QSFS_DATA_DIRECTORYLISTING_H_
+#define QSFS_DATA_DIRECTORYLISTING_H_
+
+#include <stddef.h>  // for size_t
+
+#include <string>
+#include <vector>
+
+#include "boost/noncopyable.hpp"
+#include "boost/thread/condition_variable.hpp"
+#include "boost/thread/mutex.hpp"
+
+namespace QS {
+
+namespace Data {
+
+/**
+ * Listing of an open directory handle.
+ *
+ * The directory is listed page by page in background, the file paths of the
+ * children are appended as each page arrives. The position of an entry never
+ * changes once it is added, so it serves as the offset of readdir, and the
+ * entries already listed can be read while the later pages are fetched.
+ */
+class DirectoryListing : private boost::noncopyable {
+ public:
+  DirectoryListing();
+
+ public:
+  // Whether all pages have been listed
+  bool IsFinished() const;
+
+  // Return the number of entries listed so far
+  size_t GetNumEntries() const;
+
+  // Append the file paths of a page of children
+  //
+  // @param  : file paths
+  // @return : void
+  void AddEntries(const std::vector<std::string> &filePaths);
+
+  // Mark the listing as finished, no more entries will be added
+  void Finish();
+
+  // Wait for the entries from a position
+  //
+  // @param  : position, max count of entries to return
+  // @return : entries from the position, empty if there is no more
+  //
+  // Block only if no entry is available from the position and the listing is
+  // not finished, the entries available are returned without waiting for the
+  // rest of the pages.
+  std::vector<std::string> WaitForEntries(size_t pos, size_t maxCount);
+
+ private:
+  mutable boost::mutex m_mutex;
+  boost::condition_variable m_entriesAdded;
+  std::vector<std::string> m_entries;
+  bool m_finished;
+};
+
+}  // namespace Data
+}  // namespace QS
+
+#endif  // QSFS_DATA_DIRECTORYLISTING_H_
@@ -32,12 +32,14 @@
 #include "boost/shared_ptr.hpp"
 #include "boost/thread/locks.hpp"
 #include "boost/thread/recursive_mutex.hpp"
+#include "boost/thread/shared_mutex.hpp"
 #include "boost/weak_ptr.hpp"
 
 #include "base/LogMacros.h"
 #include "base/StringUtils.h"
 #include "base/TimeUtils.h"
 #include "base/Utils.h"
+#include "data/Entry.h"
 #include "data/FileMetaData.h"
 #include "data/Node.h"
 
@@ -48,13 +50,17 @@ namespace Data {
 using boost::lock_guard;
 using boost::make_shared;
 using boost::recursive_mutex;
+using boost::shared_lock;
+using boost::shared_mutex;
 using boost::shared_ptr;
 using boost::weak_ptr;
 using QS::StringUtils::FormatPath;
 using QS::TimeUtils::SecondsToRFC822GMT;
 using QS::Utils::AppendPathDelim;
+using QS::Utils::GetDirName;
 using QS::Utils::IsRootDirectory;
 using std::deque;
+using std::min;
 using std::pair;
 using std::queue;
 using std::set;
@@ -62,6 +68,8 @@ using std::string;
 using std::vector;
 
 static const char *const ROOT_PATH = "/";
+// num of entries applied at a time, so lookups are not blocked by a listing
+static const size_t GROW_BATCH_SIZE = 256;
 
 // --------------------------------------------------------------------------
 string RemoveNodeTypeToString(RemoveNodeType::Value type) {
@@ -89,7 +97,7 @@ string RemoveNodeTypeToString(RemoveNodeType::Value type) {
 
 // --------------------------------------------------------------------------
 shared_ptr<Node> DirectoryTree::GetRoot() const {
-  lock_guard<recursive_mutex> lock(m_mutex);
+  shared_lock<shared_mutex> lock(m_recordsMutex);
   return m_root;
 }
 
@@ -101,7 +109,12 @@ shared_ptr<Node> DirectoryTree::GetRoot() const {
 
 // --------------------------------------------------------------------------
 shared_ptr<Node> DirectoryTree::Find(const string &filePath) const {
-  lock_guard<recursive_mutex> lock(m_mutex);
+  shared_lock<shared_mutex> lock(m_recordsMutex);
+  return FindNoLock(filePath);
+}
+
+// --------------------------------------------------------------------------
+shared_ptr<Node> DirectoryTree::FindNoLock(const string &filePath) const {
   TreeNodeMapConstIterator it = m_map.find(filePath);
   if (it != m_map.end()) {
     return it->second;
@@ -114,36 +127,37 @@ shared_ptr<Node> DirectoryTree::Find(const string &filePath) const {
 
 // --------------------------------------------------------------------------
 bool DirectoryTree::Has(const string &filePath) const {
-  lock_guard<recursive_mutex> lock(m_mutex);
+  shared_lock<shared_mutex> lock(m_recordsMutex);
   return m_map.find(filePath) != m_map.end();
 }
 
 // --------------------------------------------------------------------------
 vector<weak_ptr<Node> > DirectoryTree::FindChildren(
     const string &dirName) const {
-  lock_guard<recursive_mutex> lock(m_mutex);
+  shared_lock<shared_mutex> lock(m_recordsMutex);
   vector<weak_ptr<Node> > childs;
-  for (pair<ChildrenMultiMapConstIterator, ChildrenMultiMapConstIterator>
-           range = m_parentToChildrenMap.equal_range(dirName);
-       range.first != range.second; ++range.first) {
-    childs.push_back(range.first->second);
+  TreeNodeMapConstIterator it = m_map.find(dirName);
+  if (it != m_map.end() && it->second && *(it->second)) {
+    BOOST_FOREACH(const ChildNameToNodeUnorderedMap::value_type &p,
+                  it->second->GetChildren()) {
+      childs.push_back(p.second);
+    }
+  }
+  DirPathToOrphansUnorderedMap::const_iterator orphans =
+      m_orphans.find(dirName);
+  if (orphans != m_orphans.end()) {
+    BOOST_FOREACH(const weak_ptr<Node> &orphan, orphans->second) {
+      if (!orphan.expired()) {
+        childs.push_back(orphan);
+      }
+    }
   }
   return childs;
 }
 
-// --------------------------------------------------------------------------
-ChildrenMultiMapConstIterator DirectoryTree::CBeginParentToChildrenMap() const {
-  lock_guard<recursive_mutex> lock(m_mutex);
-  return m_parentToChildrenMap.cbegin();
-}
-
-// --------------------------------------------------------------------------
-ChildrenMultiMapConstIterator DirectoryTree::CEndParentToChildrenMap() const {
-  lock_guard<recursive_mutex> lock(m_mutex);
-  return m_parentToChildrenMap.cend();
-}
 // --------------------------------------------------------------------------
 vector<string> DirectoryTree::GetNodeIds() const{
+  shared_lock<shared_mutex> lock(m_recordsMutex);
   vector<string> keyToPaths;
   if (m_map.empty()) {
     return keyToPaths;
@@ -163,42 +177,49 @@ vector<string> DirectoryTree::GetNodeIds() const{
 }
 
 // --------------------------------------------------------------------------
-vector<string> DirectoryTree::GetParentToChildrenIds() const {
-  vector<string> parentToChildIds;
-  if (m_parentToChildrenMap.empty()) {
-    return parentToChildIds;
-  }
-
-  BOOST_FOREACH(const ParentFilePathToChildrenMultiMap::value_type &p,
-                    m_parentToChildrenMap) {
-    shared_ptr<Node> node = p.second.lock();
-    if (!node) {
-      continue;
+vector<string> DirectoryTree::GetOrphanIds() const {
+  shared_lock<shared_mutex> lock(m_recordsMutex);
+  vector<string> orphanIds;
+  BOOST_FOREACH(const DirPathToOrphansUnorderedMap::value_type &p,
+                m_orphans) {
+    BOOST_FOREACH(const weak_ptr<Node> &orphan, p.second) {
+      shared_ptr<Node> node = orphan.lock();
+      if (!node) {
+        continue;
+      }
+      string str = p.first;
+      str.append(" : ");
+      str.append(node->GetFilePath());
+      orphanIds.push_back(str);
     }
-    string str = p.first;
-    str.append(" : ");
-    str.append(node->GetFilePath());
-    parentToChildIds.push_back(str);
   }
-  return parentToChildIds;
+  return orphanIds;
 }
 
-
 // --------------------------------------------------------------------------
 shared_ptr<Node> DirectoryTree::Grow(const shared_ptr<FileMetaData> &fileMeta) {
-  lock_guard<recursive_mutex> lock(m_mutex);
   if (!fileMeta) {
     return shared_ptr<Node>();
   }
+  lock_guard<recursive_mutex> lock(m_mutex);
+  // add meta data into manager before locking records, as the manager could
+  // remove nodes to free meta datas
+  Entry entry(fileMeta);
+  lock_guard<shared_mutex> recordsLock(m_recordsMutex);
+  return GrowNoLock(fileMeta, entry);
+}
 
+// --------------------------------------------------------------------------
+shared_ptr<Node> DirectoryTree::GrowNoLock(
+    const shared_ptr<FileMetaData> &fileMeta, const Entry &entry) {
   string filePath = fileMeta->GetFilePath();
 
-  shared_ptr<Node> node = Find(filePath);
+  shared_ptr<Node> node = FindNoLock(filePath);
   if (node && *node) {
     time_t timein = fileMeta->GetMTime();
     time_t timecur = node->GetMTime();
     DebugInfo("Update node " + FormatPath(filePath));
-    node->SetEntry(Entry(fileMeta));  // update entry
+    node->SetEntry(entry);  // update entry
     if (timein < timecur) {
       if(!node->IsDirectory()) {
         DebugWarning("file mtime is old " + FormatPath(filePath) +
@@ -208,49 +229,17 @@ shared_ptr<Node> DirectoryTree::Grow(const shared_ptr<FileMetaData> &fileMeta) {
     }
   } else {
     DebugInfo("Add node " + FormatPath(filePath));
-    bool isDir = fileMeta->IsDirectory();
-    string dirName = fileMeta->MyDirName();
-    node = make_shared<Node>(Entry(fileMeta));
+    node = make_shared<Node>(entry);
     pair<TreeNodeMapIterator, bool> res = m_map.emplace(filePath, node);
     if(!res.second) {
       DebugError("Fail to add node " + fileMeta->ToString());
       return shared_ptr<Node>();
     }
-
-    // hook up with parent
-    assert(!dirName.empty());
-    TreeNodeMapIterator it = m_map.find(dirName);
-    if (it != m_map.end()) {
-      shared_ptr<Node> &parent = it->second;
-      if (parent && *parent) {
-        if (parent->HaveChild(filePath)) {
-          parent->Remove(filePath);
-        }
-        parent->Insert(node);
-        node->SetParent(parent);
-      } else {
-        DebugInfo("Parent node not exist " + FormatPath(filePath));
-      }
-    }
-
-    // hook up with children
-    if (isDir) {
-      vector<weak_ptr<Node> > childs = FindChildren(filePath);
-      BOOST_FOREACH(weak_ptr<Node> &child, childs) {
-        shared_ptr<Node> childNode = child.lock();
-        if (childNode && *childNode) {
-          childNode->SetParent(node);
-          node->Insert(childNode);
-        }
-      }
-    }
-
-    // record parent to children map
-    if (m_parentToChildrenMap.emplace(dirName, node) ==
-        m_parentToChildrenMap.end()) {
-      DebugError("Fail to add node " + fileMeta->ToString());
-      return shared_ptr<Node>();
-    }
+    HookUpParent(node);
+  }
+  // hook up with children added before
+  if (node->IsDirectory()) {
+    AdoptOrphans(node);
   }
   // m_currentNode = node;
 
@@ -260,8 +249,19 @@ shared_ptr<Node> DirectoryTree::Grow(const shared_ptr<FileMetaData> &fileMeta) {
 // --------------------------------------------------------------------------
 void DirectoryTree::Grow(const vector<shared_ptr<FileMetaData> > &fileMetas) {
   lock_guard<recursive_mutex> lock(m_mutex);
-  BOOST_FOREACH(const shared_ptr<FileMetaData> &meta, fileMetas) {
-    Grow(meta);
+  vector<Entry> entries;
+  for (size_t start = 0; start < fileMetas.size(); start += GROW_BATCH_SIZE) {
+    size_t stop = min(start + GROW_BATCH_SIZE, fileMetas.size());
+    entries.clear();
+    for (size_t i = start; i < stop; ++i) {
+      entries.push_back(fileMetas[i] ? Entry(fileMetas[i]) : Entry());
+    }
+    lock_guard<shared_mutex> recordsLock(m_recordsMutex);
+    for (size_t i = start; i < stop; ++i) {
+      if (fileMetas[i]) {
+        GrowNoLock(fileMetas[i], entries[i - start]);
+      }
+    }
   }
 }
 
@@ -300,8 +300,8 @@ shared_ptr<Node> DirectoryTree::UpdateDirectory(
     newChildrenMetas.push_back(child);
   }
 
-  // Update
-  shared_ptr<Node> node = Find(path);
+  // Update, the records are only changed by writers
+  shared_ptr<Node> node = FindNoLock(path);
   if (node && *node) {
     if (!node->IsDirectory()) {
       DebugWarning("Not a directory " + FormatPath(path));
@@ -309,31 +309,7 @@ shared_ptr<Node> DirectoryTree::UpdateDirectory(
     }
 
     // Do deleting
-    set<string> oldChildrenIds = node->GetChildrenIds();
-    set<string> deleteChildrenIds;
-    std::set_difference(
-        oldChildrenIds.begin(), oldChildrenIds.end(), newChildrenIds.begin(),
-        newChildrenIds.end(),
-        std::inserter(deleteChildrenIds, deleteChildrenIds.end()));
-    if (!deleteChildrenIds.empty()) {
-      vector<weak_ptr<Node> > childs = FindChildren(path);
-      m_parentToChildrenMap.erase(path);
-      BOOST_FOREACH(weak_ptr<Node> &child, childs) {
-        shared_ptr<Node> childNode = child.lock();
-        if (childNode && (*childNode)) {
-          if (deleteChildrenIds.find(childNode->GetFilePath()) ==
-              deleteChildrenIds.end()) {
-            if (m_parentToChildrenMap.emplace(path, child) ==
-                m_parentToChildrenMap.end()) {
-                DebugWarning("Fail to update node " + FormatPath(path));
-            }
-          }
-        }
-      }
-      BOOST_FOREACH(const string &childId, deleteChildrenIds) {
-        Remove(childId, RemoveNodeType::IncludeDescendant);
-      }
-    }
+    PruneDirectory(path, newChildrenIds);
 
     // Do updating
     Grow(newChildrenMetas);
@@ -346,6 +322,26 @@ shared_ptr<Node> DirectoryTree::UpdateDirectory(
   return node;
 }
 
+// --------------------------------------------------------------------------
+void DirectoryTree::PruneDirectory(const string &dirPath,
+                                   const set<string> &childIds) {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  shared_ptr<Node> node = FindNoLock(AppendPathDelim(dirPath));
+  if (!(node && *node && node->IsDirectory())) {
+    return;
+  }
+
+  set<string> oldChildrenIds = node->GetChildrenIds();
+  set<string> deleteChildrenIds;
+  std::set_difference(
+      oldChildrenIds.begin(), oldChildrenIds.end(), childIds.begin(),
+      childIds.end(),
+      std::inserter(deleteChildrenIds, deleteChildrenIds.end()));
+  BOOST_FOREACH(const string &childId, deleteChildrenIds) {
+    Remove(childId, RemoveNodeType::IncludeDescendant);
+  }
+}
+
 // --------------------------------------------------------------------------
 shared_ptr<Node> DirectoryTree::Rename(const string &oldFilePath,
                                        const string &newFilePath) {
@@ -359,10 +355,10 @@ shared_ptr<Node> DirectoryTree::Rename(const string &oldFilePath,
   }
 
   lock_guard<recursive_mutex> lock(m_mutex);
-  shared_ptr<Node> node = Find(oldFilePath);
+  shared_ptr<Node> node = FindNoLock(oldFilePath);
   if (node && *node) {
     // Check parameter
-    if (Find(newFilePath)) {
+    if (FindNoLock(newFilePath)) {
       DebugWarning("Node exist, no rename " + FormatPath(newFilePath));
       return node;
     }
@@ -372,18 +368,35 @@ shared_ptr<Node> DirectoryTree::Rename(const string &oldFilePath,
     }
 
     // Do Renaming
-    // Node::Rename will rename it's all descendents
-    // here we only need to update records of map and parent to child map
+    // Node::Rename will rename it's all descendents, which are stored by name
+    // in their parents, here we only need to update records of map
     DebugInfo("Rename node " + FormatPath(oldFilePath, newFilePath));
-    string parentName = node->MyDirName();
     deque<string> oldDescendants;  // record old desendants path before rename
     if (node->IsDirectory()) {
       oldDescendants = node->GetDescendantIds();
     }
-    node->Rename(newFilePath);  // still need as parent maybe not added yet
+    string oldDirName = node->MyDirName();
     shared_ptr<Node> parent = node->GetParent();
-    if (parent && *parent) {
-      parent->RenameChild(oldFilePath, newFilePath);
+    lock_guard<shared_mutex> recordsLock(m_recordsMutex);
+    if (oldDirName == GetDirName(newFilePath)) {
+      if (parent && *parent) {
+        parent->RenameChild(oldFilePath, newFilePath);
+      } else {
+        node->Rename(newFilePath);  // orphan keeps its record of dir
+      }
+    } else {
+      // move to the new parent
+      if (parent && *parent) {
+        parent->Remove(oldFilePath);
+        if (node->IsDirectory()) {
+          parent->GetEntry().DecreaseNumLink();
+        }
+      } else {
+        RemoveOrphan(oldDirName, node);
+      }
+      node->SetParent(shared_ptr<Node>());
+      node->Rename(newFilePath);
+      HookUpParent(node);
     }
     // update records
     pair<TreeNodeMapIterator, bool> res = m_map.emplace(newFilePath, node);
@@ -392,64 +405,22 @@ shared_ptr<Node> DirectoryTree::Rename(const string &oldFilePath,
                    FormatPath(oldFilePath, newFilePath));
     }
     m_map.erase(oldFilePath);
-    if (!node->IsDirectory()) {
-      return node;
-    }
-    vector<weak_ptr<Node> > childs = FindChildren(oldFilePath);
-    BOOST_FOREACH (weak_ptr<Node> &child, childs) {
-      if (m_parentToChildrenMap.emplace(newFilePath, child) ==
-          m_parentToChildrenMap.end()) {
-        DebugWarning(
-            "Fail to insert new node in parent to children map when rename " +
-            FormatPath(oldFilePath, newFilePath));
-      }
-    }
-    m_parentToChildrenMap.erase(oldFilePath);
 
     // update descendants' records
-    if (oldDescendants.empty()) {
-      return node;
-    }
     size_t len = oldFilePath.size();
-    deque<string> targetDescendants;
-    BOOST_FOREACH (const string &path, oldDescendants) {
-      targetDescendants.push_back(newFilePath + path.substr(len));
-    }
-    deque<string>::reverse_iterator pOld = oldDescendants.rbegin();
-    deque<string>::reverse_iterator pTarget = targetDescendants.rbegin();
-    while (pOld != oldDescendants.rend() &&
-           pTarget != targetDescendants.rend()) {
-      // update desendants in map
-      string source = *pOld;
-      string target = *pTarget;
+    BOOST_FOREACH (const string &source, oldDescendants) {
+      string target = newFilePath + source.substr(len);
       if (source == target) {
-        DebugInfo("No need to upate in records, same path " +
-                  FormatPath(source));
         continue;
       }
-      shared_ptr<Node> nodeChild = Find(source);
-      if (nodeChild) {
+      TreeNodeMapIterator it = m_map.find(source);
+      if (it != m_map.end()) {
+        shared_ptr<Node> nodeChild = it->second;
+        m_map.erase(it);
         m_map.emplace(target, nodeChild);
-        m_map.erase(source);
       } else {
         DebugWarning("Not found the node in records " + FormatPath(source));
       }
-      // update descendants in parent to children records
-      for (pair<ChildrenMultiMapConstIterator, ChildrenMultiMapConstIterator>
-               range = m_parentToChildrenMap.equal_range(source);
-           range.first != range.second; ++range.first) {
-        weak_ptr<Node> child = range.first->second;
-        if (m_parentToChildrenMap.emplace(target, range.first->second) ==
-            m_parentToChildrenMap.end()) {
-          DebugWarning(
-              "Fail to insert new node in parent to children records when "
-              "rename " +
-              FormatPath(source, target));
-        }
-      }
-      m_parentToChildrenMap.erase(source);
-      ++pOld;
-      ++pTarget;
     }
 
     // m_currentNode = node;
@@ -468,7 +439,8 @@ void DirectoryTree::Remove(const string &path, RemoveNodeType::Value type) {
   }
 
   lock_guard<recursive_mutex> lock(m_mutex);
-  shared_ptr<Node> node = Find(path);
+  // node is destructed after unlocking records
+  shared_ptr<Node> node = FindNoLock(path);
   if (!(node && *node)) {
     DebugInfo("No such file or directory, no remove " + FormatPath(path));
     return;
@@ -476,31 +448,17 @@ void DirectoryTree::Remove(const string &path, RemoveNodeType::Value type) {
 
   DebugInfo("Remove node (" + RemoveNodeTypeToString(type) + ") " +
             FormatPath(path));
+  lock_guard<shared_mutex> recordsLock(m_recordsMutex);
   shared_ptr<Node> parent = node->GetParent();
   if (parent && *parent) {
     // if path is a directory, when go out of this function, destructor
     // will recursively delete all its children, as there is no references
     // to the node now.
     parent->Remove(path);
+  } else {
+    RemoveOrphan(node->MyDirName(), node);
   }
   m_map.erase(path);
-  string nodeDir = node->MyDirName();
-  for (ChildrenMultiMapIterator it = m_parentToChildrenMap.begin();
-       it != m_parentToChildrenMap.end();) {
-    if (it->first == nodeDir) {
-      shared_ptr<Node> n = it->second.lock();
-      if (n && n->GetFilePath() == path) {
-        // erase will invalidate iterator, so should not increment it after that
-        it = m_parentToChildrenMap.erase(it);
-        break;
-      } else {
-        ++it;
-      }
-    } else {
-      ++it;
-    }
-  }
-  m_parentToChildrenMap.erase(path);
 
   if (!node->IsDirectory()) {
     // Do not need to reset, destructor will be invoked at end
@@ -508,11 +466,17 @@ void DirectoryTree::Remove(const string &path, RemoveNodeType::Value type) {
   }
 
   if (type == RemoveNodeType::SelfOnly) {
+    // children are still in records, they will be hooked up again once the
+    // directory is added back
+    BOOST_FOREACH(const ChildNameToNodeUnorderedMap::value_type &p,
+                  node->GetChildren()) {
+      m_orphans[path].push_back(p.second);
+    }
     return;
   }
 
   std::queue<shared_ptr<Node> > deleteNodes;
-  BOOST_FOREACH(const FilePathToNodeUnorderedMap::value_type &p,
+  BOOST_FOREACH(const ChildNameToNodeUnorderedMap::value_type &p,
                  node->GetChildren()) {
     deleteNodes.push(p.second);
   }
@@ -520,17 +484,15 @@ void DirectoryTree::Remove(const string &path, RemoveNodeType::Value type) {
     shared_ptr<Node> node_ = deleteNodes.front();
     deleteNodes.pop();
 
-    string path_ = node_->GetFilePath();
-    m_map.erase(path_);
-    m_parentToChildrenMap.erase(path_);
+    m_map.erase(node_->GetFilePath());
 
     if (type == RemoveNodeType::IncludeChild) {
       continue;
     }
     // else IncludeDescendant
     // recursively remove all children references
-    if (node->IsDirectory()) {
-      BOOST_FOREACH(const FilePathToNodeUnorderedMap::value_type &p,
+    if (node_->IsDirectory()) {
+      BOOST_FOREACH(const ChildNameToNodeUnorderedMap::value_type &p,
                      node_->GetChildren()) {
         deleteNodes.push(p.second);
       }
@@ -538,6 +500,64 @@ void DirectoryTree::Remove(const string &path, RemoveNodeType::Value type) {
   }
 }
 
+// --------------------------------------------------------------------------
+void DirectoryTree::HookUpParent(const shared_ptr<Node> &node) {
+  string dirName = node->MyDirName();
+  assert(!dirName.empty());
+  TreeNodeMapIterator it = m_map.find(dirName);
+  if (it != m_map.end() && it->second && *(it->second)) {
+    shared_ptr<Node> &parent = it->second;
+    string filePath = node->GetFilePath();
+    if (parent->HaveChild(filePath)) {
+      parent->Remove(filePath);
+    }
+    parent->Insert(node);
+    node->SetParent(parent);
+  } else {
+    m_orphans[dirName].push_back(node);
+  }
+}
+
+// --------------------------------------------------------------------------
+void DirectoryTree::AdoptOrphans(const shared_ptr<Node> &node) {
+  OrphansMapIterator it = m_orphans.find(node->GetFilePath());
+  if (it == m_orphans.end()) {
+    return;
+  }
+  vector<weak_ptr<Node> > orphans;
+  orphans.swap(it->second);
+  m_orphans.erase(it);
+  BOOST_FOREACH(weak_ptr<Node> &orphan, orphans) {
+    shared_ptr<Node> child = orphan.lock();
+    if (child && *child) {
+      child->SetParent(node);
+      node->Insert(child);
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+void DirectoryTree::RemoveOrphan(const string &dirName,
+                                 const shared_ptr<Node> &node) {
+  OrphansMapIterator it = m_orphans.find(dirName);
+  if (it == m_orphans.end()) {
+    return;
+  }
+  vector<weak_ptr<Node> > &orphans = it->second;
+  for (vector<weak_ptr<Node> >::iterator orphan = orphans.begin();
+       orphan != orphans.end();) {
+    shared_ptr<Node> n = orphan->lock();
+    if (!n || n == node) {
+      orphan = orphans.erase(orphan);
+    } else {
+      ++orphan;
+    }
+  }
+  if (orphans.empty()) {
+    m_orphans.erase(it);
+  }
+}
+
 // --------------------------------------------------------------------------
 DirectoryTree::DirectoryTree(time_t mtime, uid_t uid, gid_t gid, mode_t mode) {
   lock_guard<recursive_mutex> lock(m_mutex);
@@ -21,6 +21,7 @@
 
 #include <unistd.h>
 
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
@@ -28,6 +29,7 @@
 #include "boost/noncopyable.hpp"
 #include "boost/shared_ptr.hpp"
 #include "boost/thread/recursive_mutex.hpp"
+#include "boost/thread/shared_mutex.hpp"
 #include "boost/unordered_map.hpp"
 #include "boost/weak_ptr.hpp"
 
@@ -51,6 +53,7 @@ struct RenameFileCallback;
 
 namespace Data {
 
+class Entry;
 class FileMetaData;
 class FileMetaDataManager;
 class Node;
@@ -62,12 +65,11 @@ typedef boost::unordered_map<std::string, boost::shared_ptr<Node>,
 typedef FilePathToNodeUnorderedMap::iterator TreeNodeMapIterator;
 typedef FilePathToNodeUnorderedMap::const_iterator TreeNodeMapConstIterator;
 
-typedef boost::unordered_multimap<std::string, boost::weak_ptr<Node>,
-                                  HashUtils::StringHash>
-    ParentFilePathToChildrenMultiMap;
-typedef ParentFilePathToChildrenMultiMap::iterator ChildrenMultiMapIterator;
-typedef ParentFilePathToChildrenMultiMap::const_iterator
-    ChildrenMultiMapConstIterator;
+typedef boost::unordered_map<std::string,
+                             std::vector<boost::weak_ptr<Node> >,
+                             HashUtils::StringHash>
+    DirPathToOrphansUnorderedMap;
+typedef DirPathToOrphansUnorderedMap::iterator OrphansMapIterator;
 
 struct RemoveNodeType {
   enum Value { SelfOnly, IncludeChild, IncludeDescendant };
@@ -77,6 +79,11 @@ std::string RemoveNodeTypeToString(RemoveNodeType::Value type);
 
 /**
  * Representation of the filesystem's directory tree.
+ *
+ * Lookups only take the records lock shared, so they run in parallel and are
+ * not blocked by a listing being applied. Writers are serialized by another
+ * lock, and take the records lock exclusively only while applying changes,
+ * e.g. a listing is applied in batches.
  */
 class DirectoryTree : private boost::noncopyable {
  public:
@@ -109,22 +116,18 @@ class DirectoryTree : private boost::noncopyable {
   // @param  : dir name which should be ending with "/"
   // @return : node list
   // Notes: FindChildren do not find children recursively
+  //
+  // Children of a directory not added yet are the orphans recorded for it.
   std::vector<boost::weak_ptr<Node> > FindChildren(
       const std::string &dirName) const;
 
-  // Const iterator point to begin of the parent to children map
-  ChildrenMultiMapConstIterator CBeginParentToChildrenMap() const;
-
-  // Const iterator point to end of the parent to children map
-  ChildrenMultiMapConstIterator CEndParentToChildrenMap() const;
-
   // For debug or log
   // Return all recorded nodes' id pair (key : node file path)
   std::vector<std::string> GetNodeIds() const;
 
   // For debug or log
-  // Return all recorded 'key : child node file path'
-  std::vector<std::string> GetParentToChildrenIds() const;
+  // Return all recorded 'dir name : orphan node file path'
+  std::vector<std::string> GetOrphanIds() const;
 
  private:
   // Grow the directory tree
@@ -152,6 +155,13 @@ class DirectoryTree : private boost::noncopyable {
       const std::string &dirPath,
       const std::vector<boost::shared_ptr<FileMetaData> > &childrenMetas);
 
+  // Remove the children of a directory which are not listed
+  //
+  // @param  : dirpath, file paths of the children listed
+  // @return : void
+  void PruneDirectory(const std::string &dirPath,
+                      const std::set<std::string> &childIds);
+
   // Rename node
   //
   // @param  : old file path, new file path (absolute path)
@@ -165,20 +175,48 @@ class DirectoryTree : private boost::noncopyable {
   // @return : void
   void Remove(const std::string &path, RemoveNodeType::Value type);
 
+ private:
+  // Find node without lock, the records lock or the writer lock should be
+  // held by the calling thread
+  boost::shared_ptr<Node> FindNoLock(const std::string &filePath) const;
+
+  // Grow the directory tree with the entry of the meta data, which has been
+  // added into meta data manager. The records lock should be held exclusively.
+  boost::shared_ptr<Node> GrowNoLock(
+      const boost::shared_ptr<FileMetaData> &fileMeta, const Entry &entry);
+
+  // Hook up a node with its parent, or record it as an orphan if the parent
+  // is not added yet. The lock should be held.
+  void HookUpParent(const boost::shared_ptr<Node> &node);
+
+  // Hook up a directory node with the orphans recorded for it.
+  // The lock should be held.
+  void AdoptOrphans(const boost::shared_ptr<Node> &node);
+
+  // Remove the orphan record of a node. The lock should be held.
+  void RemoveOrphan(const std::string &dirName,
+                    const boost::shared_ptr<Node> &node);
+
  private:
   DirectoryTree() {}
 
   boost::shared_ptr<Node> m_root;
   // boost::shared_ptr<Node> m_currentNode;
+  // Writer lock, it is recursive as meta data manager could remove nodes when
+  // the meta data of a node is added.
   mutable boost::recursive_mutex m_mutex;
+  // Records lock, guards the map, the orphans and the children of nodes
+  mutable boost::shared_mutex m_recordsMutex;
   FilePathToNodeUnorderedMap m_map;  // record all nodes map
 
   // As we grow directory tree gradually, that means the directory tree can
   // be a partial part of the entire tree, at some point some nodes haven't
-  // built the reference to its parent or children because which have not been
-  // added to the tree yet.
-  // So, the dirName to children map which will help to update these references.
-  ParentFilePathToChildrenMultiMap m_parentToChildrenMap;
+  // built the reference to its parent because which have not been added to
+  // the tree yet.
+  // So, the dirName to orphans map which will help to update these references
+  // once the parent is added. Children hooked up are only stored once in their
+  // parent by name.
+  DirPathToOrphansUnorderedMap m_orphans;
 
   friend class QS::Client::QSClient;
   friend class QS::Data::FileMetaDataManager;
@@ -0,0 +1,558 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include "data/DiskCache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/exception/to_string.hpp"
+#include "boost/lexical_cast.hpp"
+#include "boost/thread/locks.hpp"
+#include "boost/unordered_set.hpp"
+
+#include "base/LogMacros.h"
+#include "base/StringUtils.h"
+#include "base/Utils.h"
+
+namespace QS {
+
+namespace Data {
+
+using boost::lock_guard;
+using boost::mutex;
+using boost::to_string;
+using QS::StringUtils::FormatPath;
+using std::ifstream;
+using std::istringstream;
+using std::make_pair;
+using std::ostringstream;
+using std::pair;
+using std::string;
+using std::vector;
+
+namespace {
+
+const char *const kIndexFileName = "index";
+const char *const kIndexTmpFileName = "index.tmp";
+const char *const kIndexMagic = "qsfs-diskcache";
+const int kIndexVersion = 1;
+
+// --------------------------------------------------------------------------
+bool PReadFully(int fd, char *buffer, size_t len, off_t offset) {
+  size_t readSize = 0;
+  while (readSize < len) {
+    ssize_t n = pread(fd, buffer + readSize, len - readSize,
+                      offset + static_cast<off_t>(readSize));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    readSize += static_cast<size_t>(n);
+  }
+  return readSize == len;
+}
+
+// --------------------------------------------------------------------------
+bool PWriteFully(int fd, const char *buffer, size_t len, off_t offset) {
+  size_t writtenSize = 0;
+  while (writtenSize < len) {
+    ssize_t n = pwrite(fd, buffer + writtenSize, len - writtenSize,
+                       offset + static_cast<off_t>(writtenSize));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    writtenSize += static_cast<size_t>(n);
+  }
+  return writtenSize == len;
+}
+
+// --------------------------------------------------------------------------
+// Write content to file and sync it to disk
+bool WriteFileSync(const string &path, const string &content) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    return false;
+  }
+  bool success = PWriteFully(fd, content.data(), content.size(), 0) &&
+                 fsync(fd) == 0;
+  close(fd);
+  return success;
+}
+
+// --------------------------------------------------------------------------
+// Blocks are stored as a string of '0' and '1', of which the last char is for
+// the first block
+string BlocksToString(const vector<bool> &blocks) {
+  string str(blocks.size(), '0');
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    if (blocks[i]) {
+      str[blocks.size() - 1 - i] = '1';
+    }
+  }
+  return str;
+}
+
+// --------------------------------------------------------------------------
+bool StringToBlocks(const string &str, vector<bool> *blocks) {
+  if (str.find_first_not_of("01") != string::npos) {
+    return false;
+  }
+  blocks->assign(str.size(), false);
+  for (size_t i = 0; i < str.size(); ++i) {
+    (*blocks)[i] = str[str.size() - 1 - i] == '1';
+  }
+  return true;
+}
+
+// --------------------------------------------------------------------------
+void RemoveFiles(const vector<string> &paths) {
+  for (vector<string>::const_iterator it = paths.begin(); it != paths.end();
+       ++it) {
+    QS::Utils::RemoveFileIfExists(*it);
+  }
+}
+
+}  // namespace
+
+// --------------------------------------------------------------------------
+DiskCache::DiskCache(const string &directory, size_t blockSize)
+    : m_directory(QS::Utils::AppendPathDelim(directory)),
+      m_blockSize(blockSize),
+      m_size(0),
+      m_nextFileId(0) {}
+
+// --------------------------------------------------------------------------
+bool DiskCache::Load() {
+  lock_guard<mutex> lock(m_mutex);
+  m_entries.clear();
+  m_map.clear();
+  m_size = 0;
+  m_nextFileId = 0;
+  if (!QS::Utils::CreateDirectoryIfNotExists(m_directory)) {
+    Error("Unable to mkdir for disk cache " + FormatPath(m_directory));
+    return false;
+  }
+
+  bool validIndex = false;
+  {
+    ifstream in(GetIndexPath().c_str());
+    string line;
+    if (in && std::getline(in, line)) {
+      istringstream header(line);
+      string magic;
+      int version = 0;
+      size_t blockSize = 0;
+      header >> magic >> version >> blockSize >> m_nextFileId;
+      validIndex = !header.fail() && magic == kIndexMagic &&
+                   version == kIndexVersion && blockSize == m_blockSize;
+    }
+    // entry: fileName \t eTag \t size \t blocks \t key
+    while (validIndex && std::getline(in, line)) {
+      size_t pos[4];
+      size_t start = 0;
+      bool validLine = true;
+      for (int i = 0; i < 4; ++i) {
+        pos[i] = line.find('\t', start);
+        if (pos[i] == string::npos) {
+          validLine = false;
+          break;
+        }
+        start = pos[i] + 1;
+      }
+      if (!validLine) {
+        DebugWarning("Skip invalid disk cache index entry " + line);
+        continue;
+      }
+      string key = line.substr(pos[3] + 1);
+      Entry entry;
+      entry.fileName = line.substr(0, pos[0]);
+      entry.eTag = line.substr(pos[0] + 1, pos[1] - pos[0] - 1);
+      bool validBlocks = StringToBlocks(
+          line.substr(pos[2] + 1, pos[3] - pos[2] - 1), &entry.blocks);
+      try {
+        entry.size = boost::lexical_cast<uint64_t>(
+            line.substr(pos[1] + 1, pos[2] - pos[1] - 1));
+      } catch (...) {
+        validBlocks = false;
+      }
+      if (!validBlocks) {
+        DebugWarning("Skip invalid disk cache index entry " + FormatPath(key));
+        continue;
+      }
+      if (key.empty() || m_map.find(key) != m_map.end() ||
+          !QS::Utils::FileExists(GetDataFilePath(entry.fileName))) {
+        continue;
+      }
+      // index is saved from the most recently used one
+      m_entries.push_back(make_pair(key, entry));
+      m_map.emplace(key, --m_entries.end());
+      m_size += entry.size;
+    }
+  }
+  // index is removed once loaded, it will be saved again at unmount
+  QS::Utils::RemoveFileIfExists(GetIndexPath());
+
+  if (!validIndex) {
+    DebugInfo("No valid disk cache index, discard disk cache " +
+              FormatPath(m_directory));
+    UnguardedClear();
+    return true;
+  }
+
+  // remove data files not in index
+  boost::unordered_set<string> fileNames;
+  for (EntryList::iterator it = m_entries.begin(); it != m_entries.end();
+       ++it) {
+    fileNames.insert(it->second.fileName);
+  }
+  DIR *dir = opendir(m_directory.c_str());
+  if (dir) {
+    struct dirent *nextDir = NULL;
+    while ((nextDir = readdir(dir)) != NULL) {
+      if (strcmp(nextDir->d_name, ".") == 0 ||
+          strcmp(nextDir->d_name, "..") == 0 ||
+          fileNames.find(nextDir->d_name) != fileNames.end()) {
+        continue;
+      }
+      QS::Utils::RemoveFileIfExists(m_directory + nextDir->d_name);
+    }
+    closedir(dir);
+  }
+
+  Info("Load disk cache [objects:" + to_string(m_entries.size()) +
+       ", size:" + to_string(m_size) + "] " + FormatPath(m_directory));
+  return true;
+}
+
+// --------------------------------------------------------------------------
+bool DiskCache::Save() {
+  EntryList entries;
+  uint64_t nextFileId = 0;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    entries = m_entries;
+    nextFileId = m_nextFileId;
+  }
+  if (!QS::Utils::CreateDirectoryIfNotExists(m_directory)) {
+    return false;
+  }
+  ostringstream index;
+  index << kIndexMagic << " " << kIndexVersion << " " << m_blockSize << " "
+        << nextFileId << "\n";
+  for (EntryList::iterator it = entries.begin(); it != entries.end(); ++it) {
+    const Entry &entry = it->second;
+    // key is stored in a line of index
+    if (it->first.find('\n') != string::npos) {
+      continue;
+    }
+    // blocks must be in disk before they are referenced by index
+    int fd = open(GetDataFilePath(entry.fileName).c_str(), O_WRONLY);
+    if (fd < 0) {
+      continue;
+    }
+    bool synced = fdatasync(fd) == 0;
+    close(fd);
+    if (!synced) {
+      continue;
+    }
+    index << entry.fileName << "\t" << entry.eTag << "\t" << entry.size << "\t"
+          << BlocksToString(entry.blocks) << "\t" << it->first << "\n";
+  }
+
+  string tmpPath = m_directory + kIndexTmpFileName;
+  if (!WriteFileSync(tmpPath, index.str()) ||
+      rename(tmpPath.c_str(), GetIndexPath().c_str()) != 0) {
+    QS::Utils::RemoveFileIfExists(tmpPath);
+    return false;
+  }
+  return true;
+}
+
+// --------------------------------------------------------------------------
+bool DiskCache::HasBlock(const string &key, const string &eTag,
+                         size_t blockNo) const {
+  lock_guard<mutex> lock(m_mutex);
+  KeyToEntryListIteratorMap::const_iterator it = m_map.find(key);
+  if (it == m_map.end() || eTag.empty()) {
+    return false;
+  }
+  const Entry &entry = it->second->second;
+  return entry.eTag == eTag && blockNo < entry.blocks.size() &&
+         entry.blocks[blockNo];
+}
+
+// --------------------------------------------------------------------------
+bool DiskCache::ReadBlock(const string &key, const string &eTag,
+                          size_t blockNo, char *buffer, size_t len) {
+  if (buffer == NULL || len == 0 || len > m_blockSize) {
+    return false;
+  }
+  string fileName;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    KeyToEntryListIteratorMap::iterator it = m_map.find(key);
+    if (it == m_map.end() || eTag.empty()) {
+      return false;
+    }
+    const Entry &entry = it->second->second;
+    if (entry.eTag != eTag || !(blockNo < entry.blocks.size()) ||
+        !entry.blocks[blockNo]) {
+      return false;
+    }
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    fileName = entry.fileName;
+  }
+
+  // the block is kept in the data file even if the entry is removed meanwhile
+  int fd = open(GetDataFilePath(fileName).c_str(), O_RDONLY);
+  if (fd < 0) {
+    DebugWarning("Fail to open disk cache file " + FormatPath(key));
+    vector<string> filesToRemove;
+    {
+      lock_guard<mutex> lock(m_mutex);
+      KeyToEntryListIteratorMap::iterator it = m_map.find(key);
+      if (it != m_map.end() && it->second->second.fileName == fileName) {
+        UnguardedErase(it, &filesToRemove);
+      }
+    }
+    RemoveFiles(filesToRemove);
+    return false;
+  }
+  bool success = PReadFully(fd, buffer, len,
+                            static_cast<off_t>(blockNo * m_blockSize));
+  close(fd);
+  DebugWarningIf(!success, "Fail to read disk cache [block:" +
+                               to_string(blockNo) + "] " + FormatPath(key));
+  return success;
+}
+
+// --------------------------------------------------------------------------
+bool DiskCache::WriteBlock(const string &key, const string &eTag,
+                           size_t blockNo, const char *buffer, size_t len) {
+  // key and etag are stored in a line of index
+  if (key.empty() || key.find('\n') != string::npos || eTag.empty() ||
+      eTag.find('\t') != string::npos || eTag.find('\n') != string::npos ||
+      buffer == NULL || len == 0 || len > m_blockSize) {
+    return false;
+  }
+  string fileName;
+  vector<string> filesToRemove;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    KeyToEntryListIteratorMap::iterator it = m_map.find(key);
+    if (it != m_map.end()) {
+      if (it->second->second.eTag != eTag) {
+        // object has been changed, blocks are stale
+        UnguardedErase(it, &filesToRemove);
+      } else if (blockNo < it->second->second.blocks.size() &&
+                 it->second->second.blocks[blockNo]) {
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return true;
+      }
+    }
+
+    if (!QS::Utils::IsSafeDiskSpace(m_directory, len).first &&
+        !UnguardedFree(len, key, &filesToRemove)) {
+      DebugWarning("No available free disk space for disk cache " +
+                   FormatPath(key));
+    } else {
+      it = m_map.find(key);
+      if (it == m_map.end()) {
+        Entry entry;
+        entry.eTag = eTag;
+        entry.fileName = to_string(m_nextFileId++);
+        entry.size = 0;
+        m_entries.push_front(make_pair(key, entry));
+        it = m_map.emplace(key, m_entries.begin()).first;
+      } else {
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+      }
+      fileName = it->second->second.fileName;
+    }
+  }
+  RemoveFiles(filesToRemove);
+  filesToRemove.clear();
+  if (fileName.empty()) {
+    return false;
+  }
+
+  string path = GetDataFilePath(fileName);
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0600);
+  if (fd < 0) {
+    DebugWarning("Fail to open disk cache file " + FormatPath(key));
+    return false;
+  }
+  bool success = PWriteFully(fd, buffer, len,
+                             static_cast<off_t>(blockNo * m_blockSize));
+  close(fd);
+  if (!success) {
+    DebugWarning("Fail to write disk cache [block:" + to_string(blockNo) +
+                 "] " + FormatPath(key));
+    return false;
+  }
+
+  {
+    lock_guard<mutex> lock(m_mutex);
+    KeyToEntryListIteratorMap::iterator it = m_map.find(key);
+    if (it != m_map.end() && it->second->second.fileName == fileName) {
+      Entry &entry = it->second->second;
+      if (entry.blocks.size() <= blockNo) {
+        entry.blocks.resize(blockNo + 1);
+      }
+      if (!entry.blocks[blockNo]) {
+        entry.blocks[blockNo] = true;
+        entry.size += len;
+        m_size += len;
+      }
+    } else {
+      // entry is removed while writing, the data file could be recreated
+      filesToRemove.push_back(path);
+      success = false;
+    }
+  }
+  RemoveFiles(filesToRemove);
+  return success;
+}
+
+// --------------------------------------------------------------------------
+void DiskCache::Erase(const string &key) {
+  vector<string> filesToRemove;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    KeyToEntryListIteratorMap::iterator it = m_map.find(key);
+    if (it != m_map.end()) {
+      UnguardedErase(it, &filesToRemove);
+    }
+  }
+  RemoveFiles(filesToRemove);
+}
+
+// --------------------------------------------------------------------------
+void DiskCache::Rename(const string &oldKey, const string &newKey) {
+  if (oldKey == newKey) {
+    return;
+  }
+  vector<string> filesToRemove;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    KeyToEntryListIteratorMap::iterator iter = m_map.find(newKey);
+    if (iter != m_map.end()) {
+      UnguardedErase(iter, &filesToRemove);
+    }
+    KeyToEntryListIteratorMap::iterator it = m_map.find(oldKey);
+    if (it != m_map.end()) {
+      EntryList::iterator pos = it->second;
+      m_map.erase(it);
+      pos->first = newKey;
+      m_map.emplace(newKey, pos);
+    }
+  }
+  RemoveFiles(filesToRemove);
+}
+
+// --------------------------------------------------------------------------
+bool DiskCache::Free(size_t size, const string &keyUnfreeable) {
+  vector<string> filesToRemove;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    UnguardedFree(size, keyUnfreeable, &filesToRemove);
+  }
+  RemoveFiles(filesToRemove);
+  return QS::Utils::IsSafeDiskSpace(m_directory, size).first;
+}
+
+// --------------------------------------------------------------------------
+uint64_t DiskCache::GetSize() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_size;
+}
+
+// --------------------------------------------------------------------------
+size_t DiskCache::GetNumObjects() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_map.size();
+}
+
+// --------------------------------------------------------------------------
+string DiskCache::GetIndexPath() const { return m_directory + kIndexFileName; }
+
+// --------------------------------------------------------------------------
+string DiskCache::GetDataFilePath(const string &fileName) const {
+  return m_directory + fileName;
+}
+
+// --------------------------------------------------------------------------
+bool DiskCache::UnguardedFree(size_t size, const string &keyUnfreeable,
+                              vector<string> *filesToRemove) {
+  // files are removed after unlocking, so count the space they will release
+  uint64_t freeSpace = QS::Utils::GetFreeDiskSpace(m_directory).first;
+  uint64_t freedSize = 0;
+  EntryList::iterator it = m_entries.end();
+  // Discards the least recently used object first, which is put at back.
+  while (it != m_entries.begin() && freeSpace + freedSize <= size) {
+    EntryList::iterator cur = --it;
+    if (cur->first == keyUnfreeable) {
+      continue;
+    }
+    ++it;  // the next one is still valid after erasing current one
+    freedSize += cur->second.size;
+    UnguardedErase(m_map.find(cur->first), filesToRemove);
+  }
+  if (freedSize > 0) {
+    Info("Has freed disk cache of " + to_string(freedSize) + " bytes for " +
+         FormatPath(keyUnfreeable));
+  }
+  return freeSpace + freedSize > size;
+}
+
+// --------------------------------------------------------------------------
+void DiskCache::UnguardedErase(KeyToEntryListIteratorMap::iterator pos,
+                               vector<string> *filesToRemove) {
+  EntryList::iterator it = pos->second;
+  filesToRemove->push_back(GetDataFilePath(it->second.fileName));
+  m_size -= it->second.size;
+  m_entries.erase(it);
+  m_map.erase(pos);
+}
+
+// --------------------------------------------------------------------------
+void DiskCache::UnguardedClear() {
+  m_entries.clear();
+  m_map.clear();
+  m_size = 0;
+  m_nextFileId = 0;
+  QS::Utils::DeleteFilesInDirectory(m_directory, false);
+}
+
+}  // namespace Data
+}  // namespace QS
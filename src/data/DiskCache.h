@@ -0,0 +1,179 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#ifndef QSFS_DATA_DISKCACHE_H_
+#define QSFS_DATA_DISKCACHE_H_
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include "boost/noncopyable.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/unordered_map.hpp"
+
+#include "base/HashUtils.h"
+
+namespace QS {
+
+namespace Data {
+
+/**
+ * Persistent block cache of object content in disk.
+ *
+ * Blocks of an object are stored in a sparse data file at the offset of the
+ * block. The index records the object key, the etag of the object when the
+ * blocks are downloaded and which blocks are stored. A block is only served
+ * when the etag given by caller is the same with the recorded one.
+ *
+ * The index is saved into the cache directory when unmounting, and is loaded
+ * (then removed) when mounting, so blocks written by an unclean shutdown are
+ * never trusted.
+ */
+class DiskCache : private boost::noncopyable {
+ public:
+  // Construct disk cache
+  //
+  // @param  : cache directory, block size
+  // @return :
+  DiskCache(const std::string &directory, size_t blockSize);
+
+  ~DiskCache() {}
+
+ private:
+  struct Entry {
+    std::string eTag;
+    std::string fileName;            // data file name in cache directory
+    std::vector<bool> blocks;        // blocks stored in data file
+    uint64_t size;                   // sum of size of the stored blocks
+  };
+
+  typedef std::pair<std::string, Entry> KeyToEntryPair;
+  typedef std::list<KeyToEntryPair> EntryList;
+  typedef boost::unordered_map<std::string, EntryList::iterator,
+                               HashUtils::StringHash>
+      KeyToEntryListIteratorMap;
+
+ public:
+  // Load index from cache directory
+  //
+  // @param  : void
+  // @return : bool
+  //
+  // Data files not in index are removed. All of the cache is discarded if the
+  // index is missing or is built with a different block size.
+  bool Load();
+
+  // Save index into cache directory
+  //
+  // @param  : void
+  // @return : bool
+  //
+  // Data files are synced to disk before the index is written, and the index
+  // is replaced atomically.
+  bool Save();
+
+  // Whether the block of object with the etag is cached
+  bool HasBlock(const std::string &key, const std::string &eTag,
+                size_t blockNo) const;
+
+  // Read a block
+  //
+  // @param  : object key, etag, block number, buffer, len of block
+  // @return : bool
+  //
+  // Fail if the block is not cached with the etag.
+  bool ReadBlock(const std::string &key, const std::string &eTag,
+                 size_t blockNo, char *buffer, size_t len);
+
+  // Write a block
+  //
+  // @param  : object key, etag, block number, buffer, len of block
+  // @return : bool
+  //
+  // Blocks cached with another etag are discarded at first. The least recently
+  // used objects are discarded if there is no safe disk space.
+  bool WriteBlock(const std::string &key, const std::string &eTag,
+                  size_t blockNo, const char *buffer, size_t len);
+
+  // Remove the blocks of object
+  void Erase(const std::string &key);
+
+  // Move the blocks of object to new key
+  void Rename(const std::string &oldKey, const std::string &newKey);
+
+  // Free disk space
+  //
+  // @param  : size need to be freed, object should not be freed
+  // @return : bool
+  //
+  // Discard the least recently used objects until there is safe disk space
+  // for the size.
+  bool Free(size_t size, const std::string &keyUnfreeable);
+
+  // Return sum of size of cached blocks
+  uint64_t GetSize() const;
+
+  // Return num of cached objects
+  size_t GetNumObjects() const;
+
+  const std::string &GetDirectory() const { return m_directory; }
+  size_t GetBlockSize() const { return m_blockSize; }
+
+ private:
+  std::string GetIndexPath() const;
+  std::string GetDataFilePath(const std::string &fileName) const;
+
+  // Discard entries to free disk space without lock
+  //
+  // @param  : size need to be freed, object should not be freed,
+  //           data files of the discarded entries(output)
+  // @return : whether there will be safe disk space once the files are removed
+  bool UnguardedFree(size_t size, const std::string &keyUnfreeable,
+                     std::vector<std::string> *filesToRemove);
+
+  // Remove the entry denoted by pos without checking input, its data file is
+  // appended to files to remove, which should be removed after unlocking.
+  void UnguardedErase(KeyToEntryListIteratorMap::iterator pos,
+                      std::vector<std::string> *filesToRemove);
+
+  // Remove all entries and the files in cache directory
+  void UnguardedClear();
+
+ private:
+  std::string m_directory;  // end with '/'
+  size_t m_blockSize;
+  uint64_t m_size;
+  uint64_t m_nextFileId;  // used to name data file
+
+  // Guard the index only, data files are read and written without it as a
+  // data file is never reused once its entry is removed
+  mutable boost::mutex m_mutex;
+  // Most recently used object is put at front,
+  // Least recently used object is put at back.
+  EntryList m_entries;
+  KeyToEntryListIteratorMap m_map;
+
+  friend class DiskCacheTest;
+};
+
+}  // namespace Data
+}  // namespace QS
+
+#endif  // QSFS_DATA_DISKCACHE_H_
@@ -0,0 +1,139 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include "data/DiskFile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "boost/exception/to_string.hpp"
+
+#include "base/LogMacros.h"
+#include "base/StringUtils.h"
+#include "base/Utils.h"
+
+namespace QS {
+
+namespace Data {
+
+using boost::to_string;
+using QS::StringUtils::FormatPath;
+using std::string;
+
+// --------------------------------------------------------------------------
+DiskFile::DiskFile(const string &path) : m_path(path), m_fd(-1) {
+  m_fd = open(m_path.c_str(), O_RDWR | O_CREAT, 0600);
+  if (m_fd < 0) {
+    DebugError("Fail to open file " + FormatPath(m_path));
+    return;
+  }
+#ifdef POSIX_FADV_RANDOM
+  // pages are accessed in any order, readahead of kernel does not help
+  posix_fadvise(m_fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+  DebugInfo("Open file " + FormatPath(m_path));
+}
+
+// --------------------------------------------------------------------------
+DiskFile::~DiskFile() {
+  if (m_fd >= 0) {
+    close(m_fd);
+    m_fd = -1;
+  }
+}
+
+// --------------------------------------------------------------------------
+bool DiskFile::Reserve(off_t offset, size_t len) {
+  if (!IsOpen()) {
+    return false;
+  }
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+  int ret = 0;
+  do {
+    ret = fallocate(m_fd, FALLOC_FL_KEEP_SIZE, offset, static_cast<off_t>(len));
+  } while (ret != 0 && errno == EINTR);
+  if (ret != 0) {
+    if (errno == EOPNOTSUPP || errno == ENOSYS) {
+      return true;  // not supported by file system, just write directly
+    }
+    DebugError("Fail to reserve disk space [offset:" + to_string(offset) +
+               ", len:" + to_string(len) + "] " + FormatPath(m_path));
+    return false;
+  }
+#endif
+  return true;
+}
+
+// --------------------------------------------------------------------------
+bool DiskFile::Write(off_t offset, size_t len, const char *buffer) {
+  if (!IsOpen() || buffer == NULL) {
+    return false;
+  }
+  size_t writtenSize = 0;
+  while (writtenSize < len) {
+    ssize_t n = pwrite(m_fd, buffer + writtenSize, len - writtenSize,
+                       offset + static_cast<off_t>(writtenSize));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    writtenSize += static_cast<size_t>(n);
+  }
+  DebugErrorIf(writtenSize != len,
+               "Fail to write file [offset:" + to_string(offset) +
+                   ", len:" + to_string(len) + "] " + FormatPath(m_path));
+  return writtenSize == len;
+}
+
+// --------------------------------------------------------------------------
+size_t DiskFile::Read(off_t offset, size_t len, char *buffer) const {
+  if (!IsOpen() || buffer == NULL) {
+    return 0;
+  }
+  size_t readSize = 0;
+  while (readSize < len) {
+    ssize_t n = pread(m_fd, buffer + readSize, len - readSize,
+                      offset + static_cast<off_t>(readSize));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    readSize += static_cast<size_t>(n);
+  }
+  return readSize;
+}
+
+// --------------------------------------------------------------------------
+void DiskFile::AdviseWillNeed(off_t offset, size_t len) const {
+#ifdef POSIX_FADV_WILLNEED
+  if (IsOpen()) {
+    posix_fadvise(m_fd, offset, static_cast<off_t>(len), POSIX_FADV_WILLNEED);
+  }
+#endif
+}
+
+// --------------------------------------------------------------------------
+bool DiskFile::Remove() { return QS::Utils::RemoveFileIfExists(m_path); }
+
+}  // namespace Data
+}  // namespace QS
@@ -0,0 +1,103 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#ifndef QSFS_DATA_DISKFILE_H_
+#define QSFS_DATA_DISKFILE_H_
+
+#include <stddef.h>  // for size_t
+
+#include <sys/types.h>  // for off_t
+
+#include <string>
+
+#include "boost/noncopyable.hpp"
+
+namespace QS {
+
+namespace Data {
+
+/**
+ * Sparse disk file storing the pages of a cached object.
+ *
+ * The disk file is an image of the whole object, a page is stored at its
+ * file offset. The file descriptor is kept open during the life time of the
+ * disk file, and it is accessed with pread/pwrite, so pages sharing the disk
+ * file need not to open it or seek it for every access.
+ */
+class DiskFile : private boost::noncopyable {
+ public:
+  // Open the disk file, create it if not exists
+  //
+  // @param  : file absolute path
+  // @return :
+  //
+  // The kernel is advised that the file will be accessed randomly.
+  explicit DiskFile(const std::string &path);
+
+  // Close the disk file
+  ~DiskFile();
+
+ public:
+  bool IsOpen() const { return m_fd >= 0; }
+  const std::string &GetPath() const { return m_path; }
+
+  // Return the file descriptor, which is valid during the life time of the
+  // disk file
+  int GetFd() const { return m_fd; }
+
+  // Reserve disk space for the range
+  //
+  // @param  : file offset, len
+  // @return : false if there is no enough disk space
+  //
+  // File size is not changed. It is a no-op if it is not supported by the
+  // platform or the file system.
+  bool Reserve(off_t offset, size_t len);
+
+  // Write bytes at the offset
+  //
+  // @param  : file offset, len, buffer
+  // @return : bool
+  bool Write(off_t offset, size_t len, const char *buffer);
+
+  // Read bytes at the offset
+  //
+  // @param  : file offset, len, buffer
+  // @return : size of read bytes
+  size_t Read(off_t offset, size_t len, char *buffer) const;
+
+  // Advise the kernel the range will be read soon
+  void AdviseWillNeed(off_t offset, size_t len) const;
+
+  // Remove the disk file
+  //
+  // @param  : void
+  // @return : bool
+  //
+  // The file descriptor is still valid until the disk file is destructed.
+  bool Remove();
+
+ private:
+  DiskFile() : m_fd(-1) {}
+
+  std::string m_path;
+  int m_fd;
+};
+
+}  // namespace Data
+}  // namespace QS
+
+#endif  // QSFS_DATA_DISKFILE_H_
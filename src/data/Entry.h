@@ -101,6 +101,7 @@ class Entry {
   void IncreaseNumLink() { ++m_metaData.lock()->m_numLink; }
   void SetFileSize(uint64_t size) { m_metaData.lock()->m_fileSize = size; }
   void SetFileOpen(bool fileOpen) { m_metaData.lock()->m_fileOpen = fileOpen; }
+  void SetCachedTime(time_t t) { m_metaData.lock()->m_cachedTime = t; }
 
   void Rename(const std::string &newFilePath);
 
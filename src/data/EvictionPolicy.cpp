@@ -0,0 +1,186 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include "data/EvictionPolicy.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/make_shared.hpp"
+#include "boost/shared_ptr.hpp"
+
+#include "base/HashUtils.h"
+
+namespace QS {
+
+namespace Data {
+
+using boost::make_shared;
+using boost::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+const uint8_t kMaxFrequency = 15;
+const size_t kMinSketchWidth = 1024;
+const size_t kWindowPercent = 1;
+
+// Seeds of hash functions of count-min sketch
+const uint64_t kSeeds[] = {0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+                           0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL};
+
+// Finalizer of splitmix64
+uint64_t Mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+uint64_t HashBlock(const string &fileId, size_t blockNo) {
+  HashUtils::StringHash hash;
+  uint64_t h = static_cast<uint32_t>(hash(fileId));
+  return Mix((h << 32) ^ static_cast<uint64_t>(blockNo));
+}
+
+bool LessRecentlyUsed(const EvictionCandidate &a, const EvictionCandidate &b) {
+  return a.lastAccess < b.lastAccess;
+}
+
+}  // namespace
+
+// --------------------------------------------------------------------------
+void LRUPolicy::Sort(EvictionCandidates *candidates) const {
+  if (candidates != NULL) {
+    std::sort(candidates->begin(), candidates->end(), LessRecentlyUsed);
+  }
+}
+
+// --------------------------------------------------------------------------
+TinyLFUPolicy::TinyLFUPolicy(size_t numBlocks)
+    : m_width(kMinSketchWidth), m_numAccesses(0) {
+  while (m_width < 4 * numBlocks) {
+    m_width <<= 1;
+  }
+  m_sampleSize = 10 * static_cast<uint64_t>(m_width);
+  m_table.resize(kDepth * m_width);
+}
+
+// --------------------------------------------------------------------------
+void TinyLFUPolicy::RecordAccess(const string &fileId, size_t blockNo) {
+  uint64_t hash = HashBlock(fileId, blockNo);
+  // Counters are updated without lock, a lost increment only makes the
+  // estimation a bit lower.
+  for (size_t row = 0; row < kDepth; ++row) {
+    uint8_t *counter = &m_table[GetIndex(hash, row)];
+    uint8_t value = *counter;
+    while (value < kMaxFrequency) {
+      uint8_t old = __sync_val_compare_and_swap(counter, value, value + 1);
+      if (old == value) {
+        break;
+      }
+      value = old;
+    }
+  }
+  if (__sync_add_and_fetch(&m_numAccesses, 1) == m_sampleSize) {
+    Age();
+    __sync_fetch_and_sub(&m_numAccesses, m_sampleSize);
+  }
+}
+
+// --------------------------------------------------------------------------
+void TinyLFUPolicy::Sort(EvictionCandidates *candidates) const {
+  if (candidates == NULL || candidates->empty()) {
+    return;
+  }
+  // move the window of most recently used blocks to the back
+  std::sort(candidates->begin(), candidates->end(), LessRecentlyUsed);
+  size_t windowSize = candidates->size() * kWindowPercent / 100;
+  size_t numSorted = candidates->size() - windowSize;
+
+  // take a snapshot of frequency, as counters could be changed by others
+  // {frequency, position in recency order}
+  vector<std::pair<unsigned, size_t> > keys(numSorted);
+  for (size_t i = 0; i < numSorted; ++i) {
+    const EvictionCandidate &candidate = (*candidates)[i];
+    keys[i] =
+        std::make_pair(Frequency(candidate.fileId, candidate.blockNo), i);
+  }
+  std::sort(keys.begin(), keys.end());
+  EvictionCandidates sorted;
+  sorted.reserve(candidates->size());
+  for (size_t i = 0; i < numSorted; ++i) {
+    sorted.push_back((*candidates)[keys[i].second]);
+  }
+  sorted.insert(sorted.end(), candidates->begin() + numSorted,
+                candidates->end());
+  candidates->swap(sorted);
+}
+
+// --------------------------------------------------------------------------
+unsigned TinyLFUPolicy::Frequency(const string &fileId, size_t blockNo) const {
+  uint64_t hash = HashBlock(fileId, blockNo);
+  unsigned frequency = kMaxFrequency;
+  for (size_t row = 0; row < kDepth; ++row) {
+    frequency = std::min(
+        frequency, static_cast<unsigned>(m_table[GetIndex(hash, row)]));
+  }
+  return frequency;
+}
+
+// --------------------------------------------------------------------------
+void TinyLFUPolicy::Age() {
+  for (vector<uint8_t>::iterator it = m_table.begin(); it != m_table.end();
+       ++it) {
+    uint8_t value = *it;
+    uint8_t old = 0;
+    while ((old = __sync_val_compare_and_swap(&*it, value, value >> 1)) !=
+           value) {
+      value = old;
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+size_t TinyLFUPolicy::GetIndex(uint64_t hash, size_t row) const {
+  return row * m_width +
+         static_cast<size_t>(Mix(hash + kSeeds[row]) & (m_width - 1));
+}
+
+// --------------------------------------------------------------------------
+shared_ptr<EvictionPolicy> MakeEvictionPolicy(const string &name,
+                                              size_t numBlocks) {
+  if (name == "lru") {
+    return make_shared<LRUPolicy>();
+  } else if (name == "tinylfu") {
+    return make_shared<TinyLFUPolicy>(numBlocks);
+  } else {
+    return shared_ptr<EvictionPolicy>();
+  }
+}
+
+// --------------------------------------------------------------------------
+bool IsValidEvictionPolicyName(const string &name) {
+  return name == "lru" || name == "tinylfu";
+}
+
+}  // namespace Data
+}  // namespace QS
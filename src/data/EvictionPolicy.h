@@ -0,0 +1,134 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#ifndef QSFS_DATA_EVICTIONPOLICY_H_
+#define QSFS_DATA_EVICTIONPOLICY_H_
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "boost/noncopyable.hpp"
+#include "boost/shared_ptr.hpp"
+
+namespace QS {
+
+namespace Data {
+
+class File;
+
+// Clean block which could be discarded to free cache
+struct EvictionCandidate {
+  std::string fileId;
+  size_t blockNo;
+  uint64_t lastAccess;  // access clock of cache
+  boost::shared_ptr<File> file;
+};
+
+typedef std::vector<EvictionCandidate> EvictionCandidates;
+
+/**
+ * Policy deciding which blocks of cache are discarded first.
+ *
+ * Cache reports every access of blocks to the policy, and asks the policy to
+ * order the collected candidates when it needs to free space. Candidates are
+ * discarded from the front until there is enough space.
+ */
+class EvictionPolicy : private boost::noncopyable {
+ public:
+  virtual ~EvictionPolicy() {}
+
+  // Return the policy name, which is used by the mount option
+  virtual const char *GetName() const = 0;
+
+  // Record an access of a block
+  //
+  // @param  : file id, block number
+  // @return : void
+  //
+  // A block is reported once for each time the file is opened, so reading
+  // a block with a lot of small requests is still one access.
+  virtual void RecordAccess(const std::string &fileId, size_t blockNo) = 0;
+
+  // Order candidates, the one should be discarded first is put at front
+  virtual void Sort(EvictionCandidates *candidates) const = 0;
+};
+
+/**
+ * Least recently used blocks are discarded first.
+ */
+class LRUPolicy : public EvictionPolicy {
+ public:
+  const char *GetName() const { return "lru"; }
+  void RecordAccess(const std::string &fileId, size_t blockNo) {}
+  void Sort(EvictionCandidates *candidates) const;
+};
+
+/**
+ * Scan resistant policy with the idea of W-TinyLFU.
+ *
+ * Access frequency of blocks is estimated by a count-min sketch with counters
+ * saturated at 15, which are halved periodically so the history fades out.
+ * The most recently used blocks (1% of candidates) are kept as a window, the
+ * others are discarded in order of frequency, then of recency. So blocks
+ * touched only once by a scan are discarded before the working set.
+ */
+class TinyLFUPolicy : public EvictionPolicy {
+ public:
+  // Construct policy
+  //
+  // @param  : expected num of blocks in cache
+  // @return :
+  explicit TinyLFUPolicy(size_t numBlocks);
+
+  const char *GetName() const { return "tinylfu"; }
+  void RecordAccess(const std::string &fileId, size_t blockNo);
+  void Sort(EvictionCandidates *candidates) const;
+
+  // Return the estimated access frequency of the block, at most 15
+  unsigned Frequency(const std::string &fileId, size_t blockNo) const;
+
+ private:
+  // Halve all counters
+  void Age();
+
+  size_t GetIndex(uint64_t hash, size_t row) const;
+
+ private:
+  static const size_t kDepth = 4;  // num of hash functions
+
+  size_t m_width;                // counters per row, power of 2
+  uint64_t m_sampleSize;         // counters are halved after num of accesses
+  uint64_t m_numAccesses;        // since last aging, updated atomically
+  std::vector<uint8_t> m_table;  // kDepth rows of counters
+};
+
+// Create eviction policy by name
+//
+// @param  : policy name, expected num of blocks in cache
+// @return : null if the name is unknown
+boost::shared_ptr<EvictionPolicy> MakeEvictionPolicy(const std::string &name,
+                                                     size_t numBlocks);
+
+// Whether the eviction policy name is known
+bool IsValidEvictionPolicyName(const std::string &name);
+
+}  // namespace Data
+}  // namespace QS
+
+#endif  // QSFS_DATA_EVICTIONPOLICY_H_
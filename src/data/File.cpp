@@ -17,7 +17,9 @@
 #include "data/File.h"
 
 #include <assert.h>
+#include <string.h>
 
+#include <algorithm>
 #include <iterator>
 #include <list>
 #include <string>
@@ -34,9 +36,11 @@
 #include "boost/tuple/tuple.hpp"
 
 #include "base/LogMacros.h"
+#include "base/MD5.h"
 #include "base/Size.h"
 #include "base/StringUtils.h"
 #include "base/ThreadPool.h"
+#include "base/TimeUtils.h"
 #include "base/Utils.h"
 #include "base/UtilsWithLog.h"
 #include "client/Client.h"
@@ -44,11 +48,20 @@
 #include "client/QSError.h"
 #include "client/TransferHandle.h"
 #include "client/TransferManager.h"
+#include "client/Utils.h"
+#include "configure/Default.h"
 #include "configure/Options.h"
+#include "data/BufferArena.h"
 #include "data/Cache.h"
 #include "data/DirectoryTree.h"
+#include "data/DiskCache.h"
+#include "data/DiskFile.h"
+#include "data/FileMetaData.h"
 #include "data/IOStream.h"
 #include "data/Node.h"
+#include "data/Readahead.h"
+#include "data/StreamBuf.h"
+#include "data/StreamUpload.h"
 #include "data/StreamUtils.h"
 #include "filesystem/Drive.h"
 
@@ -65,10 +78,18 @@ using boost::scoped_ptr;
 using boost::shared_ptr;
 using boost::to_string;
 using boost::tuple;
+using boost::weak_ptr;
 using QS::Client::Client;
 using QS::Client::ClientError;
+using QS::Client::GetMessageForQSError;
+using QS::Client::IsGoodQSError;
+using QS::Client::QSError;
 using QS::Client::TransferHandle;
 using QS::Client::TransferManager;
+using QS::Client::Utils::BuildRequestRange;
+using QS::Configure::Default::GetUploadMultipartMinPartSize;
+using QS::Configure::Default::GetUploadMultipartThresholdSize;
+using QS::Configure::Options;
 using QS::Data::Cache;
 using QS::Data::DirectoryTree;
 using QS::Data::IOStream;
@@ -78,13 +99,16 @@ using QS::StringUtils::BoolToString;
 using QS::StringUtils::ContentRangeDequeToString;
 using QS::StringUtils::FormatPath;
 using QS::StringUtils::PointerAddress;
+using QS::StringUtils::ToLower;
+using QS::StringUtils::Trim;
 using QS::UtilsWithLog::CreateDirectoryIfNotExists;
 using QS::UtilsWithLog::IsSafeDiskSpace;
 using std::iostream;
 using std::list;
 using std::make_pair;
+using std::max;
+using std::min;
 using std::pair;
-using std::reverse_iterator;
 using std::string;
 using std::vector;
 
@@ -104,17 +128,37 @@ string BuildDiskFilePath(const string &basename) {
 // --------------------------------------------------------------------------
 string PrintFileName(const string &file) { return "[file=" + file + "]"; }
 
+// --------------------------------------------------------------------------
+bool HasAnyBlock(const BlockBitmap &blocks) {
+  return std::find(blocks.begin(), blocks.end(), true) != blocks.end();
+}
+
+// max times to load blocks without holding the lock, as they could be
+// discarded before the lock is taken again
+const int kMaxLoadAttempts = 3;
+
 }  // namespace
 
 // --------------------------------------------------------------------------
-File::File(const string &filePath, size_t size)
+File::File(const string &filePath, size_t size,
+           const shared_ptr<BufferArena> &arena)
     : m_filePath(filePath),
       m_baseName(QS::Utils::GetBaseName(filePath)),
       m_dataSize(size),
       m_cacheSize(size),
+      m_size(0),
+      m_blockSize(Options::Instance().GetCacheBlockSizeInKB() *
+                  QS::Size::KB1),
       m_useDiskFile(false),
-      m_inPrefetching(false),
-      m_open(false) {}
+      m_open(false),
+      m_numFlushing(0),
+      m_numPrefetching(0),
+      m_hasRemoteMeta(false),
+      m_remoteSize(0),
+      m_remoteMetaTime(0),
+      m_remoteMetaStale(false),
+      m_generation(0),
+      m_arena(arena ? arena : make_shared<BufferArena>()) {}
 
 // --------------------------------------------------------------------------
 File::~File() {
@@ -124,62 +168,44 @@ File::~File() {
 }
 
 // --------------------------------------------------------------------------
-size_t File::GetSize() const {
+bool File::IsRemoteMetaValid() const {
   lock_guard<recursive_mutex> lock(m_mutex);
-  if (m_pages.empty()) {
-    return 0;
+  if (!m_hasRemoteMeta || m_remoteMetaStale) {
+    return false;
   }
-  reverse_iterator<PageSetConstIterator> riter = m_pages.rbegin();
-  return static_cast<size_t>((*riter)->Next());
+  return !QS::TimeUtils::IsExpire(
+      m_remoteMetaTime,
+      QS::Configure::Options::Instance().GetStatExpireInMin());
 }
 
 // --------------------------------------------------------------------------
-string File::AskDiskFilePath() const { return BuildDiskFilePath(m_baseName); }
-
-// --------------------------------------------------------------------------
-pair<PageSetConstIterator, PageSetConstIterator>
-File::ConsecutivePageRangeAtFront() const {
+size_t File::GetDiskCachedSize() const {
   lock_guard<recursive_mutex> lock(m_mutex);
-  if (m_pages.empty()) {
-    return make_pair(m_pages.begin(), m_pages.begin());
-  }
-  PageSetConstIterator cur = m_pages.begin();
-  PageSetConstIterator next = m_pages.begin();
-  while (++next != m_pages.end()) {
-    if ((*cur)->Next() < (*next)->Offset()) {
-      break;
+  size_t size = 0;
+  BOOST_FOREACH (const shared_ptr<Page> &page, m_blocks) {
+    if (page && page->UseDiskFile()) {
+      size += page->Size();
     }
-    ++cur;
   }
-  return make_pair(m_pages.begin(), next);
+  return size;
 }
 
+// --------------------------------------------------------------------------
+string File::AskDiskFilePath() const { return BuildDiskFilePath(m_baseName); }
+
 // --------------------------------------------------------------------------
 bool File::HasData(off_t start, size_t size) const {
   lock_guard<recursive_mutex> lock(m_mutex);
-  off_t stop = static_cast<off_t>(start + size);
-  pair<PageSetConstIterator, PageSetConstIterator> range =
-      IntesectingRange(start, stop);
-  if (range.first == range.second) {
-    if (range.first == m_pages.end()) {
-      if (size == 0 && start <= static_cast<off_t>(GetSize())) {
-        return true;
-      }
-    }
-    return false;
+  if (size == 0) {
+    return start <= static_cast<off_t>(GetSize());
   }
-  // find the consecutive pages at front [beg to cur]
-  PageSetConstIterator beg = range.first;
-  PageSetConstIterator cur = beg;
-  PageSetConstIterator next = beg;
-  while (++next != range.second) {
-    if ((*cur)->Next() < (*next)->Offset()) {
-      break;
+  size_t lastBlockNo = GetBlockNo(start + size - 1);
+  for (size_t blockNo = GetBlockNo(start); blockNo <= lastBlockNo; ++blockNo) {
+    if (!IsBlockLoaded(blockNo)) {
+      return false;
     }
-    ++cur;
   }
-
-  return ((*beg)->Offset() <= start && stop <= (*cur)->Next());
+  return true;
 }
 
 // --------------------------------------------------------------------------
@@ -190,66 +216,39 @@ ContentRangeDeque File::GetUnloadedRanges(off_t start, size_t size) const {
     return ranges;
   }
 
-  if (GetSize() == 0 || m_pages.empty()) {
-    ranges.push_back(make_pair(start, size));
-    return ranges;
-  }
-
   off_t stop = static_cast<off_t>(start + size);
-  pair<PageSetConstIterator, PageSetConstIterator> range =
-      IntesectingRange(start, stop);
-
-  if (range.first == range.second) {
-    ranges.push_back(make_pair(start, size));
-    return ranges;
-  }
-
-  PageSetConstIterator cur = range.first;
-  PageSetConstIterator next = range.first;
-  // the beginning
-  if (start < (*cur)->Offset()) {
-    off_t off = start;
-    size_t sz = static_cast<size_t>((*cur)->Offset() - off);
-    ranges.push_back(make_pair(off, sz));
-  }
-  // the middle
-  while (++next != range.second) {
-    if ((*cur)->Next() < (*next)->Offset()) {
-      if ((*next)->Offset() > stop) {
-        break;
-      }
-      off_t off = (*cur)->Next();
-      size_t size = static_cast<size_t>((*next)->Offset() - off);
-      ranges.push_back(make_pair(off, size));
+  size_t lastBlockNo = GetBlockNo(stop - 1);
+  for (size_t blockNo = GetBlockNo(start); blockNo <= lastBlockNo; ++blockNo) {
+    if (IsBlockLoaded(blockNo)) {
+      continue;
+    }
+    off_t off = max(GetBlockOffset(blockNo), start);
+    size_t len = static_cast<size_t>(
+        min(GetBlockOffset(blockNo + 1), stop) - off);
+    // merge the consecutive unloaded blocks
+    if (!ranges.empty() &&
+        ranges.back().first + static_cast<off_t>(ranges.back().second) ==
+            off) {
+      ranges.back().second += len;
+    } else {
+      ranges.push_back(make_pair(off, len));
     }
-    ++cur;
-  }
-  // the ending
-  if ((*cur)->Next() < stop) {
-    off_t off = (*cur)->Next();
-    size_t size = static_cast<size_t>(stop - off);
-    ranges.push_back(make_pair(off, size));
   }
 
   return ranges;
 }
 
 // --------------------------------------------------------------------------
-PageSetConstIterator File::BeginPage() const {
+size_t File::GetNumBlocks() const {
   lock_guard<recursive_mutex> lock(m_mutex);
-  return m_pages.begin();
+  return static_cast<size_t>(
+      std::count(m_loadedBlocks.begin(), m_loadedBlocks.end(), true));
 }
 
 // --------------------------------------------------------------------------
-PageSetConstIterator File::EndPage() const {
+bool File::IsDirty() const {
   lock_guard<recursive_mutex> lock(m_mutex);
-  return m_pages.end();
-}
-
-// --------------------------------------------------------------------------
-size_t File::GetNumPages() const {
-  lock_guard<recursive_mutex> lock(m_mutex);
-  return m_pages.size();
+  return HasAnyBlock(m_dirtyBlocks);
 }
 
 // --------------------------------------------------------------------------
@@ -259,7 +258,8 @@ string File::ToString() const {
          ", cachedsize:" + to_string(GetCachedSize()) +
          ", useDisk:" + BoolToString(m_useDiskFile) +
          ", open:" + BoolToString(m_open) +
-         ", pages:" + PageSetToString(m_pages) + "]";
+         ", blocksize:" + to_string(m_blockSize) +
+         ", blocks:" + to_string(GetNumBlocks()) + "]";
 }
 
 // --------------------------------------------------------------------------
@@ -267,8 +267,9 @@ pair<size_t, ContentRangeDeque> File::Read(
     off_t offset, size_t len, char *buf,
     shared_ptr<TransferManager> transferManager,
     shared_ptr<DirectoryTree> dirTree, shared_ptr<Cache> cache,
-    shared_ptr<Client> client, bool async) {
-  lock_guard<recursive_mutex> lock(m_mutex);
+    shared_ptr<Client> client, Readahead *readahead,
+    DiskRangeList *diskRanges) {
+  boost::unique_lock<recursive_mutex> lock(m_mutex);
   shared_ptr<Node> node = dirTree->Find(GetFilePath());
   if (!node) {
     Error("Not found node in directory tree " + FormatPath(GetFilePath()));
@@ -295,12 +296,44 @@ pair<size_t, ContentRangeDeque> File::Read(
     return make_pair(0, unloadedRanges);
   }
 
-  // load and read
-  Load(offset, readSize, transferManager, dirTree, cache, client, false);
-  pair<size_t, ContentRangeDeque> outcome = ReadNoLoad(offset, readSize, buf);
+  if (cache) {
+    size_t firstBlockNo = GetBlockNo(offset);
+    size_t numBlocks = GetBlockNo(offset + readSize - 1) - firstBlockNo + 1;
+    size_t numHits = 0;
+    for (size_t i = 0; i < numBlocks; ++i) {
+      if (IsBlockLoaded(firstBlockNo + i)) {
+        ++numHits;
+      }
+    }
+    cache->RecordLookup(numHits, numBlocks - numHits);
+  }
+
+  // load without holding the lock, so others could access the file during
+  // downloading
+  for (int i = 1;; ++i) {
+    lock.unlock();
+    Load(offset, readSize, transferManager, dirTree, cache, client, false);
+    lock.lock();
+    off_t remoteStop = min(offset + static_cast<off_t>(readSize),
+                           static_cast<off_t>(m_remoteSize));
+    if (i >= kMaxLoadAttempts || offset >= remoteStop ||
+        HasData(offset, remoteStop - offset)) {
+      break;
+    }
+  }
+  pair<size_t, ContentRangeDeque> outcome;
+  if (diskRanges != NULL && GetDiskRanges(offset, readSize, diskRanges)) {
+    outcome.first = readSize;  // content is referred by the disk file
+  } else {
+    outcome = ReadNoLoad(offset, readSize, buf);
+  }
+  MarkAccessedBlocks(offset, readSize, cache);
 
-  // Prefetch
-  Prefetch(transferManager, dirTree, cache, client, async);
+  // read ahead according to the access pattern of the file handle
+  if (readahead != NULL) {
+    Prefetch(readahead->OnRead(offset, readSize, fileSize), transferManager,
+             dirTree, cache);
+  }
   return outcome;
 }
 
@@ -308,9 +341,6 @@ pair<size_t, ContentRangeDeque> File::Read(
 pair<size_t, ContentRangeDeque> File::ReadNoLoad(off_t offset, size_t len,
                                                  char *buf) const {
   lock_guard<recursive_mutex> lock(m_mutex);
-  if (buf != NULL) {
-    memset(buf, 0, len);
-  }
   ContentRangeDeque unloadedRanges;
   size_t readSize = 0;
   bool isValidInput = offset >= 0 && len >= 0;
@@ -325,65 +355,229 @@ pair<size_t, ContentRangeDeque> File::ReadNoLoad(off_t offset, size_t len,
     return make_pair(readSize, unloadedRanges);
   }
 
-  // If pages is empty.
-  if (m_pages.empty()) {
-    unloadedRanges.push_back(make_pair(offset, len));
-    return make_pair(readSize, unloadedRanges);
+  if (m_diskFile && buf != NULL &&
+      GetBlockNo(offset) != GetBlockNo(offset + len - 1)) {
+    // let kernel read ahead the pages in disk file
+    m_diskFile->AdviseWillNeed(offset, len);
   }
 
-  pair<PageSetConstIterator, PageSetConstIterator> range =
-      IntesectingRange(offset, offset + len);
-  PageSetConstIterator it1 = range.first;
-  PageSetConstIterator it2 = range.second;
+  off_t stop = static_cast<off_t>(offset + len);
   off_t offset_ = offset;
-  size_t len_ = len;
-  // For pages which are not completely ahead of 'offset'
-  // but ahead of 'offset + len'.
-  while (it1 != it2) {
-    if (len_ <= 0) break;
-    const shared_ptr<Page> &page = *it1;
-    if (offset_ < page->m_offset) {
-      // Add unloaded page for bytes not present
-      size_t lenNewPage = static_cast<size_t>(page->m_offset - offset_);
-      unloadedRanges.push_back(make_pair(offset_, lenNewPage));
-      offset_ = page->m_offset;
-      len_ -= lenNewPage;
-    } else {  // Collect existing pages.
-      if (len_ <= static_cast<size_t>(page->Next() - offset_)) {
-        if (buf != NULL) {
-          page->Read(offset_, len_, buf + offset_ - offset);
+  while (offset_ < stop) {
+    size_t blockNo = GetBlockNo(offset_);
+    off_t blockStop = min(GetBlockOffset(blockNo + 1), stop);
+    size_t len_ = static_cast<size_t>(blockStop - offset_);
+    char *buf_ = buf != NULL ? buf + (offset_ - offset) : NULL;
+    if (IsBlockLoaded(blockNo)) {
+      // bytes beyond the page are hole
+      const shared_ptr<Page> &page = m_blocks[blockNo];
+      size_t dataLen =
+          page->Next() > offset_
+              ? min(len_, static_cast<size_t>(page->Next() - offset_))
+              : 0;
+      if (buf_ != NULL) {
+        if (dataLen > 0) {
+          page->Read(offset_, dataLen, buf_);
         }
-        readSize += len_;
-        return make_pair(readSize, unloadedRanges);
-      } else {
-        if (buf != NULL) {
-          page->Read(offset_, buf + offset_ - offset);
+        if (dataLen < len_) {
+          memset(buf_ + dataLen, 0, len_ - dataLen);
         }
-        readSize += page->Next() - offset_;
-        len_ -= page->Next() - offset_;
-        offset_ = page->Next();
-        ++it1;
+      }
+      readSize += len_;
+    } else {
+      if (buf_ != NULL) {
+        memset(buf_, 0, len_);
+      }
+      // Add unloaded range for bytes not present.
+      if (!unloadedRanges.empty() &&
+          unloadedRanges.back().first +
+                  static_cast<off_t>(unloadedRanges.back().second) ==
+              offset_) {
+        unloadedRanges.back().second += len_;
+      } else {
+        unloadedRanges.push_back(make_pair(offset_, len_));
       }
     }
-  }  // end of while
-  // Add unloaded range for bytes not present.
-  if (len_ > 0) {
-    unloadedRanges.push_back(make_pair(offset_, len_));
+    offset_ = blockStop;
   }
 
   return make_pair(readSize, unloadedRanges);
 }
 
+// --------------------------------------------------------------------------
+bool File::GetDiskRanges(off_t offset, size_t len,
+                         DiskRangeList *ranges) const {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  if (ranges == NULL) {
+    return false;
+  }
+  ranges->clear();
+  off_t stop = static_cast<off_t>(offset + len);
+  off_t offset_ = offset;
+  while (offset_ < stop) {
+    size_t blockNo = GetBlockNo(offset_);
+    off_t blockStop = min(GetBlockOffset(blockNo + 1), stop);
+    if (!IsBlockLoaded(blockNo)) {
+      ranges->clear();
+      return false;
+    }
+    const shared_ptr<Page> &page = m_blocks[blockNo];
+    // bytes beyond the page are hole, which are not stored in disk file
+    if (!page->UseDiskFile() || page->Next() < blockStop) {
+      ranges->clear();
+      return false;
+    }
+    size_t len_ = static_cast<size_t>(blockStop - offset_);
+    if (!ranges->empty() && ranges->back().diskFile == page->GetDiskFile() &&
+        ranges->back().offset + static_cast<off_t>(ranges->back().size) ==
+            offset_) {
+      ranges->back().size += len_;
+    } else {
+      DiskRange range;
+      range.offset = offset_;
+      range.size = len_;
+      range.diskFile = page->GetDiskFile();
+      ranges->push_back(range);
+    }
+    offset_ = blockStop;
+  }
+  return !ranges->empty();
+}
+
+// --------------------------------------------------------------------------
+pair<size_t, ContentRangeDeque> File::ReadThrough(
+    off_t offset, size_t len, char *buf,
+    const shared_ptr<Client> &client) const {
+  pair<size_t, ContentRangeDeque> res = ReadNoLoad(offset, len, buf);
+  if (len == 0 || res.second.empty() || !client || buf == NULL) {
+    return res;
+  }
+
+  uint64_t remoteSize = 0;
+  string remoteETag;
+  {
+    lock_guard<recursive_mutex> lock(m_mutex);
+    remoteSize = m_hasRemoteMeta ? m_remoteSize : 0;
+    remoteETag = m_hasRemoteMeta ? m_remoteETag : string();
+  }
+  size_t readSize = res.first;
+  ContentRangeDeque failedRanges;
+  bool modified = false;
+  BOOST_FOREACH (const ContentRangeDeque::value_type &range, res.second) {
+    if (modified ||
+        static_cast<uint64_t>(range.first + range.second) > remoteSize) {
+      failedRanges.push_back(range);
+      continue;
+    }
+    // range is not cached, the buffer is released once copied
+    // the object must be the one the snapshot is taken from, otherwise the
+    // bytes would be mixed with the ones of another object
+    shared_ptr<IOStream> stream = make_shared<IOStream>(range.second);
+    ClientError<QSError::Value> err = client->DownloadFile(
+        GetFilePath(), stream, BuildRequestRange(range.first, range.second),
+        NULL, remoteETag);
+    if (err.GetError() == QSError::PRECONDITION_FAILED) {
+      Error("Object has been modified [etag:" + remoteETag + "] " +
+            FormatPath(GetFilePath()));
+      modified = true;
+      failedRanges.push_back(range);
+      continue;
+    }
+    if (!IsGoodQSError(err)) {
+      Error(GetMessageForQSError(err));
+      failedRanges.push_back(range);
+      continue;
+    }
+    stream->seekg(0, std::ios_base::beg);
+    stream->read(buf + (range.first - offset), range.second);
+    if (static_cast<size_t>(stream->gcount()) != range.second) {
+      failedRanges.push_back(range);
+      continue;
+    }
+    readSize += range.second;
+  }
+  return make_pair(readSize, failedRanges);
+}
+
+// --------------------------------------------------------------------------
+tuple<bool, size_t, size_t> File::Write(
+    off_t offset, size_t len, const char *buffer,
+    const shared_ptr<TransferManager> &transferManager,
+    const shared_ptr<DirectoryTree> &dirTree, const shared_ptr<Cache> &cache,
+    const shared_ptr<Client> &client) {
+  uint64_t remoteSize = AskRemoteSize(client, cache);
+  boost::unique_lock<recursive_mutex> lock(m_mutex);
+  for (int i = 0; len > 0; ++i) {
+    // only the first and the last block could be partially covered
+    ContentRangeDeque ranges;
+    off_t stop = static_cast<off_t>(offset + len);
+    size_t edgeBlocks[2] = {GetBlockNo(offset), GetBlockNo(stop - 1)};
+    for (int j = 0; j < 2; ++j) {
+      size_t blockNo = edgeBlocks[j];
+      if (j == 1 && blockNo == edgeBlocks[0]) {
+        break;
+      }
+      off_t blockOffset = GetBlockOffset(blockNo);
+      off_t blockStop = min(GetBlockOffset(blockNo + 1),
+                            static_cast<off_t>(remoteSize));
+      bool partiallyCovered = offset > blockOffset || stop < blockStop;
+      if (!IsBlockLoaded(blockNo) && blockOffset < blockStop &&
+          partiallyCovered) {
+        ranges.push_back(make_pair(blockOffset, blockStop - blockOffset));
+      }
+    }
+    if (ranges.empty()) {
+      break;
+    }
+    if (i >= kMaxLoadAttempts || !transferManager) {
+      Error("Fail to load blocks before write " +
+            ContentRangeDequeToString(ranges) + FormatPath(GetFilePath()));
+      return make_tuple(false, 0, 0);
+    }
+    // download without holding the lock
+    lock.unlock();
+    BOOST_FOREACH (const ContentRangeDeque::value_type &range, ranges) {
+      Fetch(range.first, range.second, transferManager, dirTree, cache,
+            client);
+    }
+    lock.lock();
+  }
+  return Write(offset, len, buffer, dirTree, cache);
+}
+
 // --------------------------------------------------------------------------
 tuple<bool, size_t, size_t> File::Write(
     off_t offset, size_t len, const char *buffer,
     const shared_ptr<DirectoryTree> &dirTree, const shared_ptr<Cache> &cache) {
   lock_guard<recursive_mutex> lock(m_mutex);
-  if (PreWrite(len, cache)) {
+  if (PreWrite(GetCacheSizeToWrite(offset, len), cache)) {
+    size_t oldCacheSize = m_cacheSize;
     tuple<bool, size_t, size_t> res = DoWrite(offset, len, buffer);
     bool success = boost::get<0>(res);
+    // buffers of pages moved to disk file are given back to cache
+    size_t releasedCacheSize = oldCacheSize + boost::get<1>(res) - m_cacheSize;
+    if (cache && releasedCacheSize > 0) {
+      cache->SubtractSize(releasedCacheSize);
+    }
     if (success) {
+      MarkDirtyBlocks(offset, len);
+      if (m_streamUpload) {
+        m_streamUpload->OnWrite(offset, len);
+      }
       PostWrite(offset, len, boost::get<1>(res), dirTree, cache);
+    } else if (len > 0) {
+      // blocks written before the failure keep the new bytes
+      size_t lastBlockNo = GetBlockNo(offset + len - 1);
+      for (size_t blockNo = GetBlockNo(offset);
+           blockNo <= lastBlockNo && IsBlockLoaded(blockNo); ++blockNo) {
+        m_dirtyBlocks[blockNo] = true;
+      }
+      if (m_streamUpload) {
+        m_streamUpload->OnWrite(offset, len);
+      }
+      if (cache) {
+        cache->AddSize(boost::get<1>(res));
+      }
     }
     return res;
   } else {
@@ -396,11 +590,13 @@ tuple<bool, size_t, size_t> File::Write(
     off_t offset, size_t len, const shared_ptr<iostream> &stream,
     const shared_ptr<DirectoryTree> &dirTree, const shared_ptr<Cache> &cache) {
   lock_guard<recursive_mutex> lock(m_mutex);
-  if (PreWrite(len, cache)) {
+  if (PreWrite(GetCacheSizeToWrite(offset, len, true), cache)) {
     tuple<bool, size_t, size_t> res = DoWrite(offset, len, stream);
     bool success = boost::get<0>(res);
     if (success) {
       PostWrite(offset, len, boost::get<1>(res), dirTree, cache);
+    } else if (cache) {
+      cache->AddSize(boost::get<1>(res));
     }
     return res;
   } else {
@@ -409,15 +605,78 @@ tuple<bool, size_t, size_t> File::Write(
 }
 
 // --------------------------------------------------------------------------
-bool File::PreWrite(size_t len, const shared_ptr<Cache> &cache) {
+tuple<bool, size_t, size_t> File::WriteDownloaded(
+    off_t offset, size_t len, const shared_ptr<iostream> &stream,
+    uint64_t generation, const shared_ptr<DirectoryTree> &dirTree,
+    const shared_ptr<Cache> &cache) {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  if (generation != m_generation) {
+    DebugInfo("Drop downloaded range of file truncated [offset:" +
+              to_string(offset) + ", len:" + to_string(len) + "] " +
+              FormatPath(GetFilePath()));
+    return make_tuple(true, 0, 0);
+  }
+  return Write(offset, len, stream, dirTree, cache);
+}
+
+// --------------------------------------------------------------------------
+tuple<bool, size_t, size_t> File::WriteUnloaded(
+    off_t offset, size_t len, const char *buffer,
+    const shared_ptr<DirectoryTree> &dirTree, const shared_ptr<Cache> &cache) {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  if (PreWrite(GetCacheSizeToWrite(offset, len, true), cache)) {
+    tuple<bool, size_t, size_t> res = DoWrite(offset, len, buffer, true);
+    bool success = boost::get<0>(res);
+    if (success) {
+      PostWrite(offset, len, boost::get<1>(res), dirTree, cache);
+    } else if (cache) {
+      cache->AddSize(boost::get<1>(res));
+    }
+    return res;
+  } else {
+    return make_tuple(false, 0, 0);
+  }
+}
+
+// --------------------------------------------------------------------------
+size_t File::GetCacheSizeToWrite(off_t offset, size_t len,
+                                 bool onlyUnloaded) const {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  if (len == 0) {
+    return 0;
+  }
+  size_t needSize = 0;
+  off_t stop = static_cast<off_t>(offset + len);
+  size_t lastBlockNo = GetBlockNo(stop - 1);
+  for (size_t blockNo = GetBlockNo(offset); blockNo <= lastBlockNo; ++blockNo) {
+    off_t blockOffset = GetBlockOffset(blockNo);
+    off_t blockStop = min(GetBlockOffset(blockNo + 1), stop);
+    if (!IsBlockLoaded(blockNo)) {
+      needSize += BufferArena::GetAllocSize(blockStop - blockOffset);
+    } else if (!onlyUnloaded) {
+      const shared_ptr<Page> &page = m_blocks[blockNo];
+      if (!page->UseDiskFile()) {
+        size_t allocSize = BufferArena::GetAllocSize(
+            max(page->Next(), blockStop) - blockOffset);
+        if (allocSize > page->Capacity()) {
+          needSize += allocSize - page->Capacity();
+        }
+      }
+    }
+  }
+  return needSize;
+}
+
+// --------------------------------------------------------------------------
+bool File::PreWrite(size_t needSize, const shared_ptr<Cache> &cache) {
   lock_guard<recursive_mutex> lock(m_mutex);
   if (!cache) {
     return false;
   }
   cache->MakeFileMostRecentlyUsed(GetFilePath());
   bool availableFreeSpace = true;
-  if (!cache->HasFreeSpace(len)) {
-    availableFreeSpace = cache->Free(len, GetFilePath());
+  if (!cache->HasFreeSpace(needSize)) {
+    availableFreeSpace = cache->Free(needSize, GetFilePath());
     if (!availableFreeSpace) {
       string diskfolder =
           QS::Configure::Options::Instance().GetDiskCacheDirectory();
@@ -425,9 +684,9 @@ bool File::PreWrite(size_t len, const shared_ptr<Cache> &cache) {
         Error("Unable to mkdir for cache" + FormatPath(diskfolder));
         return false;
       }
-      if (!IsSafeDiskSpace(diskfolder, len)) {
-        if (!cache->FreeDiskCacheFiles(diskfolder, len, GetFilePath())) {
-          Error("No available free disk space (" + to_string(len) +
+      if (!IsSafeDiskSpace(diskfolder, needSize)) {
+        if (!cache->FreeDiskCacheFiles(diskfolder, needSize, GetFilePath())) {
+          Error("No available free disk space (" + to_string(needSize) +
                 "bytes) for folder " + FormatPath(diskfolder));
           return false;
         }
@@ -445,6 +704,7 @@ void File::PostWrite(off_t offset, size_t len, size_t addedCacheSize,
   lock_guard<recursive_mutex> lock(m_mutex);
   if (cache) {
     cache->AddSize(addedCacheSize);
+    MarkAccessedBlocks(offset, len, cache);
   }
   if (dirTree) {
     shared_ptr<Node> node = dirTree->Find(GetFilePath());
@@ -457,7 +717,8 @@ void File::PostWrite(off_t offset, size_t len, size_t addedCacheSize,
 
 // --------------------------------------------------------------------------
 tuple<bool, size_t, size_t> File::DoWrite(off_t offset, size_t len,
-                                          const char *buffer) {
+                                          const char *buffer,
+                                          bool onlyUnloaded) {
   lock_guard<recursive_mutex> lock(m_mutex);
   bool isValidInput = offset >= 0 && len >= 0 && buffer != NULL;
   assert(isValidInput);
@@ -472,80 +733,30 @@ tuple<bool, size_t, size_t> File::DoWrite(off_t offset, size_t len,
 
   size_t addedSizeInCache = 0;
   size_t addedSize = 0;
-  // If pages is empty.
-  if (m_pages.empty()) {
-    tuple<PageSetConstIterator, bool, size_t, size_t> res =
-        UnguardedAddPage(offset, len, buffer);
-    if (boost::get<1>(res)) {
-      addedSizeInCache += boost::get<2>(res);
-      addedSize += boost::get<3>(res);
-    }
-
-    return make_tuple(boost::get<1>(res), addedSizeInCache, addedSize);
-  }
+  off_t stop = static_cast<off_t>(offset + len);
+  ReserveBlocks(GetBlockNo(stop - 1) + 1);
 
-  bool success = true;
-  pair<PageSetConstIterator, PageSetConstIterator> range =
-      IntesectingRange(offset, offset + len);
-  PageSetConstIterator it1 = range.first;
-  PageSetConstIterator it2 = range.second;
   off_t offset_ = offset;
-  size_t start_ = 0;
-  size_t len_ = len;
-  // For pages which are not completely ahead of 'offset'
-  // but ahead of 'offset + len'.
-  while (it1 != it2) {
-    if (len_ <= 0) break;
-    const shared_ptr<Page> &page = *it1;
-    if (offset_ < page->m_offset) {  // Insert new page for bytes not present.
-      size_t lenNewPage = static_cast<size_t>(page->m_offset - offset_);
-      tuple<PageSetConstIterator, bool, size_t, size_t> res =
-          UnguardedAddPage(offset_, lenNewPage, buffer + start_);
-      if (!boost::get<1>(res)) {
-        success = false;
+  while (offset_ < stop) {
+    size_t blockNo = GetBlockNo(offset_);
+    off_t blockStop = min(GetBlockOffset(blockNo + 1), stop);
+    if (!(onlyUnloaded && IsBlockLoaded(blockNo))) {
+      tuple<bool, size_t, size_t> res =
+          UnguardedWriteBlock(blockNo, offset_, blockStop - offset_,
+                              buffer + (offset_ - offset));
+      addedSizeInCache += boost::get<1>(res);
+      addedSize += boost::get<2>(res);
+      if (!boost::get<0>(res)) {
         return make_tuple(false, addedSizeInCache, addedSize);
-      } else {
-        addedSizeInCache += boost::get<2>(res);
-        addedSize += boost::get<3>(res);
       }
-
-      offset_ = page->m_offset;
-      start_ += lenNewPage;
-      len_ -= lenNewPage;
-    } else {  // Refresh the overlapped page's content.
-      if (len_ <= static_cast<size_t>(page->Next() - offset_)) {
-        return make_tuple(page->Refresh(offset_, len_, buffer + start_),
-                          addedSizeInCache, addedSize);
-      } else {
-        size_t refLen = page->Next() - offset_;
-        bool refresh = page->Refresh(offset_, refLen, buffer + start_);
-        if (!refresh) {
-          success = false;
-          return make_tuple(false, addedSizeInCache, addedSize);
-        }
-
-        offset_ += refLen;
-        start_ += refLen;
-        len_ -= refLen;
-        ++it1;
+      if (static_cast<size_t>(blockStop) > m_size) {
+        m_size = blockStop;
       }
     }
-  }  // end of while
-  // Insert new page for bytes not present.
-  if (len_ > 0) {
-    tuple<PageSetConstIterator, bool, size_t, size_t> res =
-        UnguardedAddPage(offset_, len_, buffer + start_);
-    if (boost::get<1>(res)) {
-      success = true;
-
-      addedSizeInCache += boost::get<2>(res);
-      addedSize += boost::get<3>(res);
-    } else {
-      success = false;
-    }
+    offset_ = blockStop;
   }
 
-  return make_tuple(success, addedSizeInCache, addedSize);
+  return make_tuple(true, addedSizeInCache, addedSize);
 }
 
 // --------------------------------------------------------------------------
@@ -562,11 +773,48 @@ tuple<bool, size_t, size_t> File::DoWrite(off_t offset, size_t len,
     return make_tuple(false, 0, 0);
   }
 
+  if (len == 0) {
+    return make_tuple(true, 0, 0);
+  }
+
   scoped_ptr<vector<char> > buf(new vector<char>(len));
   stream->seekg(0, std::ios_base::beg);
   stream->read(&(*buf)[0], len);
 
-  return DoWrite(offset, len, &(*buf)[0]);
+  return DoWrite(offset, len, &(*buf)[0], true);  // only unloaded blocks
+}
+
+// --------------------------------------------------------------------------
+bool File::IsSameAsRemote(size_t fileSize) const {
+  string eTag;
+  {
+    lock_guard<recursive_mutex> lock(m_mutex);
+    if (!m_hasRemoteMeta || m_remoteSize != fileSize) {
+      return false;
+    }
+    eTag = ToLower(Trim(m_remoteETag, '"'));
+  }
+  if (fileSize > GetUploadMultipartThresholdSize() || eTag.size() != 32 ||
+      eTag.find_first_not_of("0123456789abcdef") != string::npos ||
+      !GetUnloadedRanges(0, fileSize).empty()) {
+    return false;
+  }
+
+  // hash in chunks, writes during hashing mark blocks as dirty again
+  MD5 hash;
+  vector<char> buf(min(fileSize, static_cast<size_t>(QS::Size::MB1)));
+  size_t hashedSize = 0;
+  while (hashedSize < fileSize) {
+    size_t len = min(fileSize - hashedSize, buf.size());
+    pair<size_t, ContentRangeDeque> outcome =
+        ReadNoLoad(static_cast<off_t>(hashedSize), len, &buf[0]);
+    if (outcome.first != len || !outcome.second.empty()) {
+      return false;
+    }
+    hash.update(&buf[0], static_cast<MD5::size_type>(len));
+    hashedSize += len;
+  }
+  return hash.finalize().hexdigest() == eTag;
 }
 
 // --------------------------------------------------------------------------
@@ -577,36 +825,73 @@ struct FlushCallback {
   shared_ptr<DirectoryTree> dirTree;
   shared_ptr<Client> client;
   bool updateMeta;
+  File *file;
+  // set if uploading in background, to keep the file alive until done as it
+  // is read during uploading
+  shared_ptr<File> owner;
+  BlockBitmap dirtyBlocks;  // blocks to be uploaded
 
   FlushCallback(const string &filePath_, uint64_t fileSize_,
                 const shared_ptr<TransferManager> &transferManager_,
                 const shared_ptr<DirectoryTree> &dirTree_,
-                const shared_ptr<Client> &client_, bool updateMeta_)
+                const shared_ptr<Client> &client_, bool updateMeta_,
+                File *file_, const shared_ptr<File> &owner_,
+                const BlockBitmap &dirtyBlocks_)
       : filePath(filePath_),
         fileSize(fileSize_),
         transferManager(transferManager_),
         dirTree(dirTree_),
         client(client_),
-        updateMeta(updateMeta_) {}
+        updateMeta(updateMeta_),
+        file(file_),
+        owner(owner_),
+        dirtyBlocks(dirtyBlocks_) {}
 
   void operator()(const shared_ptr<TransferHandle> &handle) {
     if (handle && client) {
       handle->WaitUntilFinished();
-      if (handle->DoneTransfer() && !handle->HasFailedParts()) {
-        Info("Done Upload file [size:" + to_string(fileSize) + "] " +
-             FormatPath(filePath));
-        // update meta
-        if (updateMeta) {
-          if (dirTree) {
-            dirTree->Grow(client->GetObjectMeta(handle->GetObjectKey()));
-          }
+      bool uploaded = handle->DoneTransfer() && !handle->HasFailedParts();
+      if (!uploaded && handle->IsMultipart()) {
+        transferManager->m_unfinishedMultipartUploadHandles.emplace(
+            handle->GetObjectKey(), handle);
+      }
+      Commit(uploaded);
+    }
+    if (file) {
+      file->FinishFlush();
+    }
+  }
+
+  // for stream upload
+  void operator()(bool uploaded) {
+    if (client) {
+      Commit(uploaded);
+    }
+    if (file) {
+      file->FinishFlush();
+    }
+  }
+
+  void Commit(bool uploaded) {
+    if (uploaded) {
+      Info("Done Upload file [size:" + to_string(fileSize) + "] " +
+           FormatPath(filePath));
+      // update meta
+      if (updateMeta) {
+        shared_ptr<FileMetaData> meta = client->GetObjectMeta(filePath);
+        if (dirTree) {
+          dirTree->Grow(meta);
         }
-      } else {
-        if (handle->IsMultipart()) {
-          transferManager->m_unfinishedMultipartUploadHandles.emplace(
-              handle->GetObjectKey(), handle);
+        if (file) {
+          file->SetRemoteMeta(meta);
         }
-      }  // Done Transfer
+      } else if (file) {
+        // etag of the new object is unknown until next head
+        file->SetRemoteMeta(fileSize, string());
+      }
+    } else if (file) {
+      // blocks keep dirty as they are not uploaded
+      file->MarkDirtyBlocks(dirtyBlocks);
     }
   }
 };
@@ -616,23 +901,65 @@ void File::Flush(size_t fileSize, shared_ptr<TransferManager> transferManager,
                  shared_ptr<DirectoryTree> dirTree, shared_ptr<Cache> cache,
                  shared_ptr<Client> client, bool releaseFile, bool updateMeta,
                  bool async) {
-  lock_guard<recursive_mutex> lock(m_mutex);
   DebugInfo("[filesize:" + to_string(fileSize) + "]" +
             FormatPath(GetFilePath()));
   if (!transferManager || !dirTree || !cache) {
     DebugWarning("Invalid input");
     return;
   }
-  // download unloaded pages for file
-  // this is need as user could open a file and edit a part of it,
-  // but you need the completed file in order to upload it.
-  Load(0, fileSize, transferManager, dirTree, cache, client, async);
-
-  if (releaseFile) {
-    SetOpen(false, dirTree);
+  // blocks are read by uploading, they should not be discarded until done
+  {
+    lock_guard<recursive_mutex> lock(m_mutex);
+    ++m_numFlushing;
   }
+  // the object is rebuilt from blocks in cache and ranges of the object,
+  // which are read through into upload buffers instead of loaded into cache,
+  // so a partially modified file is not downloaded as a whole before upload
+  AskRemoteSize(client, cache);
+
+  BlockBitmap dirtyBlocks;
+  shared_ptr<StreamUpload> streamUpload;
+  {
+    lock_guard<recursive_mutex> lock(m_mutex);
+    if (releaseFile) {
+      SetOpen(false, dirTree);
+    }
+    // clear dirty blocks before upload, as blocks could be modified during
+    // uploading; they will be marked back if fail to upload
+    dirtyBlocks = m_dirtyBlocks;
+    m_dirtyBlocks.assign(m_dirtyBlocks.size(), false);
+    // writes since now start a new stream upload
+    if (m_streamUpload && m_streamUpload->IsStarted()) {
+      streamUpload = m_streamUpload;
+    }
+    m_streamUpload.reset();
+  }
+  // a file rewritten with the same bytes, e.g. saved by an editor without
+  // changes, need not to be uploaded again
+  if (!streamUpload && HasAnyBlock(dirtyBlocks) &&
+      IsSameAsRemote(fileSize)) {
+    Info("Skip uploading file identical to object " +
+         FormatPath(GetFilePath()));
+    FinishFlush();
+    return;
+  }
+  // upload without holding the lock, the file is read block by block
+  shared_ptr<File> owner = async ? shared_from_this() : shared_ptr<File>();
   FlushCallback callback(GetFilePath(), fileSize, transferManager, dirTree,
-                         client, updateMeta);
+                         client, updateMeta, this, owner, dirtyBlocks);
+  if (streamUpload) {
+    // only the rest of the file is left to upload
+    if (async) {
+      transferManager->GetExecutor()->SubmitAsync(
+          bind(boost::type<void>(), callback, _1),
+          bind(boost::type<bool>(), &File::FlushStream, owner, _1, fileSize,
+               transferManager, client),
+          streamUpload);
+    } else {
+      callback(FlushStream(streamUpload, fileSize, transferManager, client));
+    }
+    return;
+  }
   if (async) {
     transferManager->GetExecutor()->SubmitAsync(
         bind(boost::type<void>(), callback, _1),
@@ -650,32 +977,34 @@ void File::Load(off_t offset, size_t size,
                 shared_ptr<TransferManager> transferManager,
                 shared_ptr<DirectoryTree> dirTree, shared_ptr<Cache> cache,
                 shared_ptr<Client> client, bool async) {
-  lock_guard<recursive_mutex> lock(m_mutex);
   DebugInfo("[offset:" + to_string(offset) + ", len:" + to_string(size) + "] " +
             FormatPath(GetFilePath()));
   if (size == 0) {
     return;
   }
 
-  // head real size
-  uint64_t fileSz;
-  shared_ptr<FileMetaData> fileMeta = client->GetObjectMeta(GetFilePath());
-  if (fileMeta) {
-    fileSz = fileMeta->m_fileSize;
-  }
+  // real size from the snapshot of object meta
+  uint64_t fileSz = AskRemoteSize(client, cache);
   if (offset > 0 && fileSz <= offset) {
     return;
   }
 
   // download unloaded ranges
   size_t sizeT = fileSz > offset + size ? size : fileSz - offset;
-  ContentRangeDeque ranges = GetUnloadedRanges(offset, sizeT);
-  if (!ranges.empty()) {
-    DebugInfo("Download unloaded ranges:" + ContentRangeDequeToString(ranges));
-    DownloadRanges(ranges, transferManager, dirTree, cache, async);
+  if (async) {
+    lock_guard<recursive_mutex> lock(m_mutex);
+    ContentRangeDeque ranges = GetUnloadedRanges(offset, sizeT);
+    if (!ranges.empty()) {
+      DebugInfo("Download unloaded ranges:" +
+                ContentRangeDequeToString(ranges));
+      DownloadRanges(ranges, transferManager, dirTree, cache, async);
+    }
+  } else {
+    Fetch(offset, sizeT, transferManager, dirTree, cache, client);
   }
 
   // if surpass real file size, fill it
+  lock_guard<recursive_mutex> lock(m_mutex);
   if (offset + size > fileSz) {
     ContentRangeDeque ranges =
         GetUnloadedRanges(fileSz, offset + size - fileSz);
@@ -694,39 +1023,204 @@ void File::Load(off_t offset, size_t size,
 }
 
 // --------------------------------------------------------------------------
-void File::Prefetch(shared_ptr<TransferManager> transferManager,
-                    shared_ptr<DirectoryTree> dirTree, shared_ptr<Cache> cache,
-                    shared_ptr<Client> client, bool async) {
+void File::Prefetch(const ContentRangeDeque &ranges,
+                    shared_ptr<TransferManager> transferManager,
+                    shared_ptr<DirectoryTree> dirTree,
+                    shared_ptr<Cache> cache) {
   lock_guard<recursive_mutex> lock(m_mutex);
-  QS::Configure::Options &opts = QS::Configure::Options::Instance();
-  if (!opts.IsEnablePrefetch() || m_inPrefetching) {
+  if (ranges.empty() || !transferManager) {
     return;
   }
-  m_inPrefetching = true;
-  // head real size
-  uint64_t relSize;
-  shared_ptr<FileMetaData> fileMeta = client->GetObjectMeta(GetFilePath());
-  if (fileMeta) {
-    relSize = fileMeta->m_fileSize;
+  // real size from the snapshot of object meta, which is refreshed by the
+  // read, so no head is sent while holding the lock
+  off_t remoteStop = static_cast<off_t>(m_remoteSize);
+  BOOST_FOREACH (const ContentRangeDeque::value_type &range, ranges) {
+    off_t stop =
+        min(range.first + static_cast<off_t>(range.second), remoteStop);
+    if (range.first >= stop) {
+      continue;
+    }
+    ContentRangeDeque unloadedRanges =
+        GetUnloadedRanges(range.first, stop - range.first);
+    BOOST_FOREACH (const ContentRangeDeque::value_type &unloaded,
+                   unloadedRanges) {
+      DebugInfo("Prefetch [offset:" + to_string(unloaded.first) +
+                ", len:" + to_string(unloaded.second) + "] " +
+                FormatPath(GetFilePath()));
+      DownloadRange(unloaded.first, unloaded.second, transferManager, dirTree,
+                    cache, true, true);
+    }
   }
-  ContentRangeDeque ranges = GetUnloadedRanges(0, relSize);
-  if (ranges.empty()) {
+}
+
+// --------------------------------------------------------------------------
+void File::UploadStreamParts(shared_ptr<TransferManager> transferManager,
+                             shared_ptr<Client> client) {
+  if (!transferManager || !client) {
     return;
   }
-  // prefetch ranges
-  int64_t remaining = opts.GetPrefetchSizeInMB() * QS::Size::MB1;
-  BOOST_FOREACH (const ContentRangeDeque::value_type &range, ranges) {
-    if (remaining <= 0) {
-      break;
+  shared_ptr<StreamUpload> streamUpload;
+  StreamPartList parts;
+  {
+    lock_guard<recursive_mutex> lock(m_mutex);
+    if (!m_streamUpload) {
+      m_streamUpload = make_shared<StreamUpload>(
+          transferManager->GetBufferSize(), GetUploadMultipartMinPartSize(),
+          GetUploadMultipartThresholdSize());
+      m_streamTransferManager = transferManager;
+      m_streamClient = client;
     }
-    off_t off = range.first;
-    // to avoid leave small range
-    size_t len =
-        range.second < remaining + QS::Size::MB1 ? range.second : remaining;
-    DownloadRange(off, len, transferManager, dirTree, cache, false);
-    remaining -= len;
+    streamUpload = m_streamUpload;
+    parts = streamUpload->TakeReadyParts(GetSize());
+  }
+  if (parts.empty()) {
+    return;
+  }
+
+  if (streamUpload->IsInitiated()) {
+    SubmitStreamParts(streamUpload, parts, transferManager, client);
+  } else {
+    // initiate the multipart upload in background, not to block the write
+    transferManager->GetExecutor()->SubmitToThread(
+        bind(boost::type<void>(), &File::StartStreamUpload, shared_from_this(),
+             streamUpload, parts, transferManager, client));
+  }
+}
+
+// --------------------------------------------------------------------------
+void File::StartStreamUpload(const shared_ptr<StreamUpload> &streamUpload,
+                             const StreamPartList &parts,
+                             const shared_ptr<TransferManager> &transferManager,
+                             const shared_ptr<Client> &client) {
+  string uploadId;
+  if (!streamUpload->IsBroken()) {
+    ClientError<QSError::Value> err =
+        client->InitiateMultipartUpload(GetFilePath(), &uploadId);
+    if (IsGoodQSError(err)) {
+      DebugInfo("Start stream upload [uploadid:" + uploadId + "] " +
+                FormatPath(GetFilePath()));
+    } else {
+      Error(GetMessageForQSError(err));
+      uploadId.clear();
+    }
+  }
+  streamUpload->FinishInitiate(uploadId);
+  SubmitStreamParts(streamUpload, parts, transferManager, client);
+}
+
+// --------------------------------------------------------------------------
+void File::SubmitStreamParts(const shared_ptr<StreamUpload> &streamUpload,
+                             const StreamPartList &parts,
+                             const shared_ptr<TransferManager> &transferManager,
+                             const shared_ptr<Client> &client) {
+  BOOST_FOREACH (const StreamPart &part, parts) {
+    if (streamUpload->IsBroken()) {
+      streamUpload->FinishPart(part.partId, false);
+      continue;
+    }
+    transferManager->GetExecutor()->SubmitAsync(
+        bind(boost::type<void>(), &StreamUpload::FinishPart, streamUpload,
+             part.partId, _1),
+        bind(boost::type<bool>(), &File::UploadStreamPart, shared_from_this(),
+             _1, part.partId, part.offset, part.size, client),
+        streamUpload);
+  }
+}
+
+// --------------------------------------------------------------------------
+void File::AbortStreamUpload(const shared_ptr<StreamUpload> &streamUpload,
+                             const shared_ptr<Client> &client) {
+  // parts in flight would recreate the parts of an aborted upload
+  streamUpload->WaitForParts();
+  string uploadId = streamUpload->GetUploadId();
+  if (uploadId.empty()) {
+    return;
+  }
+  ClientError<QSError::Value> err =
+      client->AbortMultipartUpload(GetFilePath(), uploadId);
+  if (IsGoodQSError(err)) {
+    DebugInfo("Abort broken stream upload [uploadid:" + uploadId + "] " +
+              FormatPath(GetFilePath()));
+  } else {
+    Error(GetMessageForQSError(err));
+  }
+}
+
+// --------------------------------------------------------------------------
+bool File::RefreshRemoteMeta(const shared_ptr<Client> &client) {
+  if (!client) {
+    return false;
+  }
+  // head without holding the lock
+  shared_ptr<FileMetaData> meta = client->GetObjectMeta(GetFilePath());
+  if (!meta) {
+    DebugWarning("Unable to head object meta " + FormatPath(GetFilePath()));
+    return false;
+  }
+  return UpdateRemoteMeta(meta);
+}
+
+// --------------------------------------------------------------------------
+bool File::UpdateRemoteMeta(const shared_ptr<FileMetaData> &meta) {
+  if (!meta) {
+    return false;
+  }
+  lock_guard<recursive_mutex> lock(m_mutex);
+  bool modified = m_hasRemoteMeta && !m_remoteETag.empty() &&
+                  !meta->m_eTag.empty() && m_remoteETag != meta->m_eTag;
+  SetRemoteMeta(meta);
+  return modified;
+}
+
+// --------------------------------------------------------------------------
+uint64_t File::AskRemoteSize(const shared_ptr<Client> &client,
+                             const shared_ptr<Cache> &cache) {
+  if (!IsRemoteMetaValid() && RefreshRemoteMeta(client)) {
+    // cached content is stale, as the object has been changed remotely
+    DropStaleContent(cache);
+  }
+  lock_guard<recursive_mutex> lock(m_mutex);
+  return m_remoteSize;
+}
+
+// --------------------------------------------------------------------------
+void File::DropStaleContent(const shared_ptr<Cache> &cache) {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  // local changes are kept, and so are blocks referred by transfers
+  if (HasAnyBlock(m_dirtyBlocks) || m_streamUpload || m_numFlushing > 0 ||
+      m_numPrefetching > 0 || HasAnyBlock(m_fetchingBlocks)) {
+    return;
   }
-  m_inPrefetching = false;
+  Info("Object has been modified, discard cache " + FormatPath(GetFilePath()));
+  if (cache) {
+    cache->SubtractSize(GetCachedSize());
+  }
+  Clear();
+}
+
+// --------------------------------------------------------------------------
+void File::MarkRemoteMetaStale(const string &eTag) {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  if (m_hasRemoteMeta && m_remoteETag == eTag) {
+    m_remoteMetaStale = true;
+  }
+}
+
+// --------------------------------------------------------------------------
+void File::SetRemoteMeta(const shared_ptr<FileMetaData> &meta) {
+  if (meta) {
+    SetRemoteMeta(meta->m_fileSize, meta->m_eTag);
+  }
+}
+
+// --------------------------------------------------------------------------
+void File::SetRemoteMeta(uint64_t size, const string &eTag) {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  m_hasRemoteMeta = true;
+  m_remoteSize = size;
+  m_remoteETag = eTag;
+  m_remoteMetaTime = time(NULL);
+  m_remoteMetaStale = false;
 }
 
 // --------------------------------------------------------------------------
@@ -735,59 +1229,58 @@ void File::Truncate(size_t newSize,
                     const shared_ptr<DirectoryTree> &dirTree,
                     const shared_ptr<Cache> &cache,
                     const shared_ptr<Client> &client) {
-  lock_guard<recursive_mutex> lock(m_mutex);
   DebugInfo(to_string(newSize));
-  size_t oldFileSize = GetSize();
+  // content could be in local blocks or still in object storage
+  uint64_t remoteSize = AskRemoteSize(client, cache);
+  boost::unique_lock<recursive_mutex> lock(m_mutex);
+  size_t oldFileSize = max(GetSize(), static_cast<size_t>(remoteSize));
   if (newSize == oldFileSize) {
     return;
   }
   if (newSize > oldFileSize) {
-    // fill the hole
+    // fill the hole, edge block is loaded without holding the lock
+    lock.unlock();
     size_t holeSize = newSize - oldFileSize;
     vector<char> hole(holeSize);  // value initialization with '\0'
     DebugInfo("Fill hole [offset:" + to_string(oldFileSize) + ", len:" +
               to_string(holeSize) + "] " + FormatPath(GetFilePath()));
-    Write(oldFileSize, holeSize, &hole[0], dirTree, cache);
+    Write(oldFileSize, holeSize, &hole[0], transferManager, dirTree, cache,
+          client);
   } else {
-    // resize to smaller size
-    while (!m_pages.empty() && newSize < GetSize()) {
-      PageSetConstIterator lastPage = --m_pages.end();
-      size_t lastPageSize = (*lastPage)->Size();
-      if (newSize <= (*lastPage)->Offset()) {
-        if (!(*lastPage)->UseDiskFile()) {
-          m_cacheSize -= lastPageSize;
-        }
-        m_dataSize -= lastPageSize;
-        m_pages.erase(lastPage);
-        if (cache) {
-          cache->SubtractSize(lastPageSize);
-        }
-      } else {
-        size_t delta = GetSize() - newSize;
-        // Do a lazy remove for last page.
-        (*lastPage)->ResizeToSmallerSize(lastPageSize - delta);
-        if (!(*lastPage)->UseDiskFile()) {
-          m_cacheSize -= delta;
-        }
+    // resize to smaller size, downloads in flight are dropped when done
+    ++m_generation;
+    size_t blockNo = GetBlockNo(newSize);
+    off_t blockOffset = GetBlockOffset(blockNo);
+    pair<size_t, size_t> removedSize = UnguardedRemoveBlocks(
+        static_cast<off_t>(newSize) == blockOffset ? blockNo : blockNo + 1);
+    size_t removedSizeInCache = removedSize.first;
+
+    // Do a lazy remove for the last block, its buffer is kept
+    if (static_cast<off_t>(newSize) != blockOffset && IsBlockLoaded(blockNo)) {
+      const shared_ptr<Page> &page = m_blocks[blockNo];
+      if (page->Next() > static_cast<off_t>(newSize)) {
+        size_t delta = page->Next() - newSize;
         m_dataSize -= delta;
-        // Lazy remove, no size change to cache
-        break;
+        page->ResizeToSmallerSize(page->Size() - delta);
       }
     }
+    if (cache) {
+      cache->SubtractSize(removedSizeInCache);
+    }
 
-    // If file has unloaded pages, add a dummy pages inorder to maintain file
-    // size
-    if (newSize > GetSize()) {
-      const char *dummy = "";
-      m_pages.insert(shared_ptr<Page>(new Page(newSize, 0, dummy)));
+    // content beyond new size in object storage is discarded too
+    m_size = newSize;
+    if (m_remoteSize > newSize) {
+      m_remoteSize = newSize;
     }
 
     if (dirTree) {
       shared_ptr<Node> node = dirTree->Find(GetFilePath());
       if (node) {
-        node->SetFileSize(GetSize());
+        node->SetFileSize(newSize);
       }
     }
+    lock.unlock();
   }
 
   Flush(newSize, transferManager, dirTree, cache, client, false, false, false);
@@ -808,24 +1301,54 @@ void File::Rename(const std::string &newFilePath) {
 }
 
 // --------------------------------------------------------------------------
-void File::RemoveDiskFileIfExists(bool logOn) const {
+const shared_ptr<DiskFile> &File::AskDiskFile() {
   lock_guard<recursive_mutex> lock(m_mutex);
-  if (UseDiskFile()) {
-    string diskFile = AskDiskFilePath();
+  if (!m_diskFile) {
+    CreateDirectoryIfNotExists(
+        QS::Configure::Options::Instance().GetDiskCacheDirectory());
+    m_diskFile = make_shared<DiskFile>(AskDiskFilePath());
+  }
+  return m_diskFile;
+}
+
+// --------------------------------------------------------------------------
+void File::RemoveDiskFileIfExists(bool logOn) {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  if (m_diskFile) {
+    // file descriptor is closed once the pages referring to it are gone
+    bool success = m_diskFile->Remove();
     if (logOn) {
-      if (QS::UtilsWithLog::FileExists(diskFile))
-        QS::UtilsWithLog::RemoveFileIfExists(diskFile);
-    } else {
-      if (QS::Utils::FileExists(diskFile))
-        QS::Utils::RemoveFileIfExists(diskFile);
+      DebugErrorIf(!success, "Fail to remove disk file " +
+                                 FormatPath(m_diskFile->GetPath()));
     }
+    m_diskFile.reset();
   }
 }
 
 // --------------------------------------------------------------------------
 void File::Clear() {
   lock_guard<recursive_mutex> lock(m_mutex);
-  m_pages.clear();
+  ++m_generation;
+  m_blocks.clear();
+  m_loadedBlocks.clear();
+  m_dirtyBlocks.clear();
+  m_accessedClocks.clear();
+  m_sessionBlocks.clear();
+  m_fetchingBlocks.clear();
+  if (m_streamUpload) {
+    m_streamUpload->Break();  // data of the parts is dropped
+    // abort the multipart upload in background, not to leave its parts
+    shared_ptr<TransferManager> transferManager =
+        m_streamTransferManager.lock();
+    shared_ptr<Client> client = m_streamClient.lock();
+    if (transferManager && client) {
+      transferManager->GetExecutor()->SubmitToThread(
+          bind(boost::type<void>(), &File::AbortStreamUpload,
+               shared_from_this(), m_streamUpload, client));
+    }
+    m_streamUpload.reset();
+  }
+  m_size = 0;
   m_dataSize = 0;
   m_cacheSize = 0;
   RemoveDiskFileIfExists(true);
@@ -835,6 +1358,9 @@ void File::Clear() {
 // --------------------------------------------------------------------------
 void File::SetOpen(bool open, shared_ptr<DirectoryTree> dirTree) {
   lock_guard<recursive_mutex> lock(m_mutex);
+  if (open) {
+    m_sessionBlocks.assign(m_sessionBlocks.size(), false);
+  }
   m_open = open;
   if (dirTree) {
     shared_ptr<Node> node = dirTree->Find(GetFilePath());
@@ -844,63 +1370,6 @@ void File::SetOpen(bool open, shared_ptr<DirectoryTree> dirTree) {
   }
 }
 
-// --------------------------------------------------------------------------
-PageSetConstIterator File::LowerBoundPage(off_t offset) const {
-  lock_guard<recursive_mutex> lock(m_mutex);
-  return LowerBoundPageNoLock(offset);
-}
-
-// --------------------------------------------------------------------------
-PageSetConstIterator File::LowerBoundPageNoLock(off_t offset) const {
-  shared_ptr<Page> tmpPage =
-      make_shared<Page>(offset, 0, make_shared<IOStream>(0));
-  return m_pages.lower_bound(tmpPage);
-}
-
-// --------------------------------------------------------------------------
-PageSetConstIterator File::UpperBoundPage(off_t offset) const {
-  lock_guard<recursive_mutex> lock(m_mutex);
-  return UpperBoundPageNoLock(offset);
-}
-
-// --------------------------------------------------------------------------
-PageSetConstIterator File::UpperBoundPageNoLock(off_t offset) const {
-  shared_ptr<Page> tmpPage =
-      make_shared<Page>(offset, 0, make_shared<IOStream>(0));
-  return m_pages.upper_bound(tmpPage);
-}
-
-// --------------------------------------------------------------------------
-pair<PageSetConstIterator, PageSetConstIterator> File::IntesectingRange(
-    off_t off1, off_t off2) const {
-  assert(off1 <= off2);
-  lock_guard<recursive_mutex> lock(m_mutex);
-  PageSetConstIterator it1 = LowerBoundPageNoLock(off1);
-  PageSetConstIterator it2 = LowerBoundPageNoLock(off2);
-  // Move backward it1 to pointing to the page which maybe intersect with
-  // 'offset'.
-  reverse_iterator<PageSetConstIterator> reverseIt(it1);
-  it1 = (reverseIt == m_pages.rend() || (*reverseIt)->Next() <= off1)
-            ? it1
-            : (++reverseIt).base();
-
-  return make_pair(it1, it2);
-}
-
-// --------------------------------------------------------------------------
-const shared_ptr<Page> &File::Front() {
-  lock_guard<recursive_mutex> lock(m_mutex);
-  assert(!m_pages.empty());
-  return *(m_pages.begin());
-}
-
-// --------------------------------------------------------------------------
-const shared_ptr<Page> &File::Back() {
-  lock_guard<recursive_mutex> lock(m_mutex);
-  assert(!m_pages.empty());
-  return *(m_pages.rbegin());
-}
-
 // --------------------------------------------------------------------------
 struct DownloadRangeCallback {
   string filePath;
@@ -909,43 +1378,117 @@ struct DownloadRangeCallback {
   shared_ptr<IOStream> stream;
   shared_ptr<Cache> cache;
   shared_ptr<DirectoryTree> dirTree;
-  File *file;
+  File *file;  // null if downloading in background
+  // set if downloading in background, as the file could be erased from cache
+  // before done
+  weak_ptr<File> weakFile;
+  string eTag;          // etag of the object when downloading
+  uint64_t generation;  // generation of the file content when downloading
+  bool claimed;         // blocks are claimed in flight
+  bool prefetch;        // submitted by prefetch
 
   DownloadRangeCallback(const string &filePath_, off_t offset_,
                         size_t downloadSize_,
                         const shared_ptr<IOStream> &stream_,
                         const shared_ptr<Cache> &cache_,
-                        const shared_ptr<DirectoryTree> &dirTree_, File *file_)
+                        const shared_ptr<DirectoryTree> &dirTree_, File *file_,
+                        const weak_ptr<File> &weakFile_, const string &eTag_,
+                        uint64_t generation_, bool claimed_ = false,
+                        bool prefetch_ = false)
       : filePath(filePath_),
         offset(offset_),
         downloadSize(downloadSize_),
         stream(stream_),
         cache(cache_),
         dirTree(dirTree_),
-        file(file_) {}
+        file(file_),
+        weakFile(weakFile_),
+        eTag(eTag_),
+        generation(generation_),
+        claimed(claimed_),
+        prefetch(prefetch_) {}
+
+  // Store the downloaded blocks into disk cache
+  void StoreDiskCache(File *file_) {
+    shared_ptr<DiskCache> diskCache = cache->GetDiskCache();
+    size_t blockSize = file_->GetBlockSize();
+    vector<char> buf(downloadSize);
+    stream->seekg(0, std::ios_base::beg);
+    stream->read(&buf[0], downloadSize);
+    // download range begins at the offset of a block
+    for (size_t pos = 0; pos < downloadSize; pos += blockSize) {
+      size_t len = min(blockSize, downloadSize - pos);
+      diskCache->WriteBlock(filePath, eTag, file_->GetBlockNo(offset + pos),
+                            &buf[pos], len);
+    }
+  }
+
+  // Whether the downloaded parts are all from the object of the etag
+  //
+  // @param  : transfer handle, flag to trust parts without etag
+  // @return : bool
+  bool MatchETag(const shared_ptr<TransferHandle> &handle,
+                 bool allowEmpty) const {
+    QS::Client::PartIdToPartMap parts = handle->GetCompletedParts();
+    BOOST_FOREACH (const QS::Client::PartIdToPartMap::value_type &p, parts) {
+      const string &partETag = p.second->GetETag();
+      if (partETag.empty() ? !allowEmpty : partETag != eTag) {
+        return false;
+      }
+    }
+    return true;
+  }
 
   void operator()(const shared_ptr<TransferHandle> &handle) {
+    // a file erased in the meantime is skipped, nobody waits for it
+    shared_ptr<File> holder = weakFile.lock();
+    File *file_ = holder ? holder.get() : file;
     if (handle) {
       handle->WaitUntilFinished();
-      if (handle->DoneTransfer() && !handle->HasFailedParts()) {
-        if (file) {
-          tuple<bool, size_t, size_t> res =
-              file->Write(offset, downloadSize, stream, dirTree, cache);
+      bool modified =
+          handle->GetError().GetError() == QSError::PRECONDITION_FAILED ||
+          (!eTag.empty() && !MatchETag(handle, true));
+      if (modified) {
+        // bytes of another object must not be mixed into the file
+        Error("Object has been modified [etag:" + eTag + ", offset:" +
+              to_string(offset) + ", len:" + to_string(downloadSize) + "] " +
+              FormatPath(filePath));
+        if (file_) {
+          file_->MarkRemoteMetaStale(eTag);
+        }
+      } else if (handle->DoneTransfer() && !handle->HasFailedParts()) {
+        if (file_) {
+          tuple<bool, size_t, size_t> res = file_->WriteDownloaded(
+              offset, downloadSize, stream, generation, dirTree, cache);
           ErrorIf(!boost::get<0>(res), "Fail to write cache [file:" + filePath +
                                            ", offset:" + to_string(offset) +
                                            ", len:" + to_string(downloadSize) +
                                            "]");
+          if (cache && cache->GetDiskCache() && !eTag.empty() &&
+              downloadSize > 0 && MatchETag(handle, false)) {
+            StoreDiskCache(file_);
+          }
+        } else {
+          DebugInfo("Drop downloaded range of file released [offset:" +
+                    to_string(offset) + ", len:" + to_string(downloadSize) +
+                    "] " + FormatPath(filePath));
         }
       } else {
         string msg = "Fail to download [offset:" + to_string(offset) +
                      ", len:" + to_string(downloadSize) + "]";
-        if (file) {
-          msg += file->ToString();
+        if (file_) {
+          msg += file_->ToString();
         }
         msg += FormatPath(filePath);
         Error(msg);
       }
     }
+    if (file_ && claimed) {
+      file_->FinishFetch(offset, downloadSize);
+    }
+    if (file_ && prefetch) {
+      file_->FinishPrefetch();
+    }
   }
 };
 
@@ -966,8 +1509,12 @@ void File::DownloadRanges(const ContentRangeDeque &ranges,
 void File::DownloadRange(off_t offset, size_t size,
                          shared_ptr<TransferManager> transferManager,
                          shared_ptr<DirectoryTree> dirTree,
-                         shared_ptr<Cache> cache, bool async) {
+                         shared_ptr<Cache> cache, bool async,
+                         bool prefetch) {
   lock_guard<recursive_mutex> lock(m_mutex);
+  if (size == 0) {
+    return;
+  }
   bool fileContentExist = HasData(offset, size);
   if (fileContentExist) {
     return;
@@ -975,113 +1522,538 @@ void File::DownloadRange(off_t offset, size_t size,
   if (!transferManager) {
     return;
   }
+  // download in unit of blocks
+  ContentRangeDeque ranges = GetUnloadedRanges(
+      GetBlockOffset(GetBlockNo(offset)),
+      GetBlockOffset(GetBlockNo(offset + size - 1) + 1) -
+          GetBlockOffset(GetBlockNo(offset)));
+  if (cache && cache->GetDiskCache() && !m_remoteETag.empty()) {
+    ranges = LoadFromDiskCache(ranges, dirTree, cache);
+  }
+  // blocks downloaded by others in background are skipped, as the lock is
+  // not held until they are done
+  if (async) {
+    ranges = ClaimRanges(ranges);
+  }
+  DownloadBlocks(ranges, transferManager, dirTree, cache, async, async,
+                 prefetch);
+}
+
+// --------------------------------------------------------------------------
+void File::DownloadBlocks(const ContentRangeDeque &ranges,
+                          const shared_ptr<TransferManager> &transferManager,
+                          const shared_ptr<DirectoryTree> &dirTree,
+                          const shared_ptr<Cache> &cache, bool async,
+                          bool claimed, bool prefetch) {
+  // transfer buffer is aligned to block size
   uint64_t bufSize =
       QS::Client::ClientConfiguration::Instance().GetTransferBufferSizeInMB() *
       QS::Size::MB1;
-  size_t remainingSize = size;
-  uint64_t downloadedSize = 0;
+  bufSize = max(bufSize / m_blockSize, static_cast<uint64_t>(1)) * m_blockSize;
+
+  // real size from the snapshot of object meta, the ranges are downloaded
+  // from the object the snapshot is taken from
+  off_t remoteStop = 0;
+  string eTag;
+  uint64_t generation = 0;
+  {
+    lock_guard<recursive_mutex> lock(m_mutex);
+    remoteStop = static_cast<off_t>(m_remoteSize);
+    eTag = m_remoteETag;
+    generation = m_generation;
+  }
+  BOOST_FOREACH (const ContentRangeDeque::value_type &range, ranges) {
+    off_t rangeStop =
+        min(range.first + static_cast<off_t>(range.second), remoteStop);
+    off_t offset_ = range.first;
+    while (offset_ < rangeStop) {
+      int64_t downloadSize_ =
+          min(static_cast<int64_t>(bufSize),
+              static_cast<int64_t>(rangeStop - offset_));
+
+      shared_ptr<IOStream> stream_ = make_shared<IOStream>(downloadSize_);
+      DownloadRangeCallback callback(
+          GetFilePath(), offset_, downloadSize_, stream_, cache, dirTree,
+          async ? NULL : this,
+          async ? weak_ptr<File>(shared_from_this()) : weak_ptr<File>(), eTag,
+          generation, claimed, prefetch);
+
+      if (async) {
+        if (prefetch) {
+          lock_guard<recursive_mutex> lock(m_mutex);
+          ++m_numPrefetching;
+        }
+        transferManager->GetExecutor()->SubmitAsync(
+            bind(boost::type<void>(), callback, _1),
+            bind(boost::type<shared_ptr<TransferHandle> >(),
+                 &QS::Client::TransferManager::DownloadFile,
+                 transferManager.get(), _1, offset_, downloadSize_, stream_,
+                 false, eTag),
+            GetFilePath());
+      } else {
+        shared_ptr<TransferHandle> handle = transferManager->DownloadFile(
+            GetFilePath(), offset_, downloadSize_, stream_, false, eTag);
+        callback(handle);
+      }
 
-  while (remainingSize > 0) {
-    off_t offset_ = offset + downloadedSize;
-    int64_t downloadSize_ = remainingSize > bufSize ? bufSize : remainingSize;
-    if (downloadSize_ <= 0) {
-      break;
+      offset_ += downloadSize_;
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+void File::Fetch(off_t offset, size_t size,
+                 const shared_ptr<TransferManager> &transferManager,
+                 const shared_ptr<DirectoryTree> &dirTree,
+                 const shared_ptr<Cache> &cache,
+                 const shared_ptr<Client> &client) {
+  if (size == 0 || !transferManager) {
+    return;
+  }
+  while (true) {
+    uint64_t remoteSize = AskRemoteSize(client, cache);
+    ContentRangeDeque ranges;
+    {
+      boost::unique_lock<recursive_mutex> lock(m_mutex);
+      off_t stop = min(offset + static_cast<off_t>(size),
+                       static_cast<off_t>(remoteSize));
+      if (offset >= stop) {
+        return;
+      }
+      off_t start = GetBlockOffset(GetBlockNo(offset));
+      ranges = GetUnloadedRanges(
+          start, GetBlockOffset(GetBlockNo(stop - 1) + 1) - start);
+      if (ranges.empty()) {
+        return;
+      }
+      if (cache && cache->GetDiskCache() && !m_remoteETag.empty()) {
+        ranges = LoadFromDiskCache(ranges, dirTree, cache);
+        if (ranges.empty()) {
+          continue;
+        }
+      }
+      ranges = ClaimRanges(ranges);
+      if (ranges.empty()) {
+        // nothing is downloading, the unloaded blocks are beyond the object
+        // which could be truncated since the size is got
+        if (!HasFetchingBlocks(offset, stop - offset)) {
+          return;
+        }
+        // all are downloading by others, wait for them
+        m_fetchDone.wait(lock);
+        continue;
+      }
     }
 
-    shared_ptr<IOStream> stream_ = make_shared<IOStream>(downloadSize_);
-    DownloadRangeCallback callback(GetFilePath(), offset_, downloadSize_,
-                                   stream_, cache, dirTree, this);
+    // download without holding the lock, so others could read loaded blocks
+    // or download other ranges of the file in parallel
+    DownloadBlocks(ranges, transferManager, dirTree, cache, false, true,
+                   false);
 
-    if (async) {
-      transferManager->GetExecutor()->SubmitAsync(
-          bind(boost::type<void>(), callback, _1),
-          bind(boost::type<shared_ptr<TransferHandle> >(),
-               &QS::Client::TransferManager::DownloadFile,
-               transferManager.get(), _1, offset_, downloadSize_, stream_,
-               false),
-          GetFilePath());
-    } else {
-      shared_ptr<TransferHandle> handle = transferManager->DownloadFile(
-          GetFilePath(), offset_, downloadSize_, stream_);
-      callback(handle);
+    // stop if fail to download, the blocks are left to the caller
+    BOOST_FOREACH (const ContentRangeDeque::value_type &range, ranges) {
+      if (!HasData(range.first, range.second)) {
+        return;
+      }
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+bool File::UploadStreamPart(const shared_ptr<StreamUpload> &streamUpload,
+                            int partId, off_t offset, size_t size,
+                            const shared_ptr<Client> &client) {
+  Buffer buf(new vector<char>(size));
+  pair<size_t, ContentRangeDeque> res =
+      ReadThrough(offset, size, &(*buf)[0], client);
+  if (res.first != size) {
+    DebugError("Fail to read, stop stream upload [partid:" +
+               to_string(partId) + ", offset:" + to_string(offset) +
+               ", len:" + to_string(size) +
+               ", readedsize:" + to_string(res.first) + "] " +
+               FormatPath(GetFilePath()));
+    return false;
+  }
+  // hash the part in place in this worker thread
+  string contentMD5;
+  if (QS::Client::ClientConfiguration::Instance().IsEnableContentMD5()) {
+    contentMD5 = md5(&(*buf)[0], size);
+  }
+  shared_ptr<IOStream> stream = make_shared<IOStream>(buf, size);
+  ClientError<QSError::Value> err =
+      client->UploadMultipart(GetFilePath(), streamUpload->GetUploadId(),
+                              partId, size, stream, contentMD5);
+  if (!IsGoodQSError(err)) {
+    Error(GetMessageForQSError(err));
+    return false;
+  }
+  DebugInfo("Done stream upload [partid:" + to_string(partId) + ", offset:" +
+            to_string(offset) + ", len:" + to_string(size) + "] " +
+            FormatPath(GetFilePath()));
+  return true;
+}
+
+// --------------------------------------------------------------------------
+bool File::FlushStream(const shared_ptr<StreamUpload> &streamUpload,
+                       size_t fileSize,
+                       const shared_ptr<TransferManager> &transferManager,
+                       const shared_ptr<Client> &client) {
+  // parts rewritten and the tail are uploaded by the flushing thread
+  streamUpload->WaitForParts();
+  StreamPartList parts = streamUpload->TakeFinalParts(fileSize);
+  BOOST_FOREACH (const StreamPart &part, parts) {
+    bool success = !streamUpload->IsBroken() &&
+                   UploadStreamPart(streamUpload, part.partId, part.offset,
+                                    part.size, client);
+    streamUpload->FinishPart(part.partId, success);
+  }
+
+  string uploadId = streamUpload->GetUploadId();
+  if (!streamUpload->IsBroken()) {
+    ClientError<QSError::Value> err = client->CompleteMultipartUpload(
+        GetFilePath(), uploadId, streamUpload->GetSortedPartIds());
+    if (IsGoodQSError(err)) {
+      return true;
     }
+    Error(GetMessageForQSError(err));
+  }
 
-    downloadedSize += downloadSize_;
-    remainingSize -= downloadSize_;
+  // fall back to upload the whole file
+  Warning("Stream upload is broken, upload the whole file " +
+          FormatPath(GetFilePath()));
+  if (!uploadId.empty()) {
+    ClientError<QSError::Value> err =
+        client->AbortMultipartUpload(GetFilePath(), uploadId);
+    if (!IsGoodQSError(err)) {
+      Error(GetMessageForQSError(err));
+    }
+  }
+  shared_ptr<TransferHandle> handle =
+      transferManager->UploadFile(GetFilePath(), fileSize, this);
+  if (!handle) {
+    return false;
+  }
+  handle->WaitUntilFinished();
+  bool uploaded = handle->DoneTransfer() && !handle->HasFailedParts();
+  if (!uploaded && handle->IsMultipart()) {
+    transferManager->m_unfinishedMultipartUploadHandles.emplace(
+        handle->GetObjectKey(), handle);
   }
+  return uploaded;
 }
 
 // --------------------------------------------------------------------------
-tuple<PageSetConstIterator, bool, size_t, size_t> File::UnguardedAddPage(
-    off_t offset, size_t len, const char *buffer) {
+ContentRangeDeque File::ClaimRanges(const ContentRangeDeque &ranges) {
   lock_guard<recursive_mutex> lock(m_mutex);
+  ContentRangeDeque claimedRanges;
+  off_t remoteStop = static_cast<off_t>(m_remoteSize);
+  BOOST_FOREACH (const ContentRangeDeque::value_type &range, ranges) {
+    off_t rangeStop =
+        min(range.first + static_cast<off_t>(range.second), remoteStop);
+    if (range.first >= rangeStop) {
+      continue;
+    }
+    size_t lastBlockNo = GetBlockNo(rangeStop - 1);
+    ReserveBlocks(lastBlockNo + 1);
+    for (size_t blockNo = GetBlockNo(range.first); blockNo <= lastBlockNo;
+         ++blockNo) {
+      if (IsBlockLoaded(blockNo) || m_fetchingBlocks[blockNo]) {
+        continue;
+      }
+      m_fetchingBlocks[blockNo] = true;
+      off_t off = max(GetBlockOffset(blockNo), range.first);
+      size_t len = static_cast<size_t>(
+          min(GetBlockOffset(blockNo + 1), rangeStop) - off);
+      // merge the consecutive blocks
+      if (!claimedRanges.empty() &&
+          claimedRanges.back().first +
+                  static_cast<off_t>(claimedRanges.back().second) ==
+              off) {
+        claimedRanges.back().second += len;
+      } else {
+        claimedRanges.push_back(make_pair(off, len));
+      }
+    }
+  }
+  return claimedRanges;
+}
 
-  // remove dummy page at first
-  const char *dummy = "";
-  PageSetConstIterator it =
-      m_pages.find(shared_ptr<Page>(new Page(offset, 0, dummy)));
-  if (it != m_pages.end()) {
-    m_pages.erase(it);
+// --------------------------------------------------------------------------
+bool File::HasFetchingBlocks(off_t offset, size_t len) const {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  size_t lastBlockNo = GetBlockNo(len > 0 ? offset + len - 1 : offset);
+  for (size_t blockNo = GetBlockNo(offset);
+       blockNo <= lastBlockNo && blockNo < m_fetchingBlocks.size();
+       ++blockNo) {
+    if (m_fetchingBlocks[blockNo]) {
+      return true;
+    }
   }
+  return false;
+}
 
-  pair<PageSetConstIterator, bool> res;
-  size_t addedSize = 0;
-  size_t addedSizeInCache = 0;
-  if (UseDiskFile()) {
-    res = m_pages.insert(
-        make_shared<Page>(offset, len, buffer, AskDiskFilePath()));
-  } else {
-    res = m_pages.insert(shared_ptr<Page>(new Page(offset, len, buffer)));
-    if (res.second) {
-      addedSizeInCache = len;
-      m_cacheSize += len;
+// --------------------------------------------------------------------------
+void File::FinishFetch(off_t offset, size_t len) {
+  {
+    lock_guard<recursive_mutex> lock(m_mutex);
+    size_t lastBlockNo = GetBlockNo(len > 0 ? offset + len - 1 : offset);
+    for (size_t blockNo = GetBlockNo(offset);
+         blockNo <= lastBlockNo && blockNo < m_fetchingBlocks.size();
+         ++blockNo) {
+      m_fetchingBlocks[blockNo] = false;
     }
   }
-  if (res.second) {
-    addedSize = len;
-    m_dataSize += len;
-  } else {
-    DebugError("Fail to new a page from a buffer " +
-               ToStringLine(offset, len, buffer) + ToString());
+  m_fetchDone.notify_all();
+}
+
+// --------------------------------------------------------------------------
+ContentRangeDeque File::LoadFromDiskCache(
+    const ContentRangeDeque &ranges, const shared_ptr<DirectoryTree> &dirTree,
+    const shared_ptr<Cache> &cache) {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  shared_ptr<DiskCache> diskCache = cache->GetDiskCache();
+  off_t remoteStop = static_cast<off_t>(m_remoteSize);
+  vector<char> buf;
+  size_t numLoaded = 0;
+  ContentRangeDeque missedRanges;
+  BOOST_FOREACH (const ContentRangeDeque::value_type &range, ranges) {
+    off_t rangeStop = range.first + static_cast<off_t>(range.second);
+    off_t offset = range.first;
+    while (offset < rangeStop) {
+      size_t blockNo = GetBlockNo(offset);
+      off_t blockStop = min(GetBlockOffset(blockNo + 1), rangeStop);
+      bool loaded = false;
+      if (offset < remoteStop) {
+        size_t len = static_cast<size_t>(min(blockStop, remoteStop) - offset);
+        buf.resize(len);
+        loaded = diskCache->ReadBlock(GetFilePath(), m_remoteETag, blockNo,
+                                      &buf[0], len) &&
+                 boost::get<0>(WriteUnloaded(offset, len, &buf[0], dirTree,
+                                             cache));
+      }
+      if (loaded) {
+        ++numLoaded;
+      } else {
+        if (!missedRanges.empty() &&
+            missedRanges.back().first +
+                    static_cast<off_t>(missedRanges.back().second) ==
+                offset) {
+          missedRanges.back().second += blockStop - offset;
+        } else {
+          missedRanges.push_back(make_pair(offset, blockStop - offset));
+        }
+      }
+      offset = blockStop;
+    }
   }
+  DebugInfoIf(numLoaded > 0, "Load " + to_string(numLoaded) +
+                                 " blocks from disk cache " +
+                                 FormatPath(GetFilePath()));
+  return missedRanges;
+}
 
-  return boost::make_tuple(res.first, res.second, addedSizeInCache, addedSize);
+// --------------------------------------------------------------------------
+void File::ReserveBlocks(size_t numBlocks) {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  if (m_blocks.size() < numBlocks) {
+    m_blocks.resize(numBlocks);
+    m_loadedBlocks.resize(numBlocks);
+    m_dirtyBlocks.resize(numBlocks);
+    m_accessedClocks.resize(numBlocks);
+    m_sessionBlocks.resize(numBlocks);
+    m_fetchingBlocks.resize(numBlocks);
+  }
 }
 
 // --------------------------------------------------------------------------
-tuple<PageSetConstIterator, bool, size_t, size_t> File::UnguardedAddPage(
-    off_t offset, size_t len, const shared_ptr<iostream> &stream) {
+void File::MarkAccessedBlocks(off_t offset, size_t len,
+                              const shared_ptr<Cache> &cache) {
   lock_guard<recursive_mutex> lock(m_mutex);
+  if (!cache) {
+    return;
+  }
+  uint64_t clock = cache->Tick();
+  size_t lastBlockNo = GetBlockNo(len > 0 ? offset + len - 1 : offset);
+  for (size_t blockNo = GetBlockNo(offset);
+       blockNo <= lastBlockNo && blockNo < m_accessedClocks.size();
+       ++blockNo) {
+    m_accessedClocks[blockNo] = clock;
+    if (!m_sessionBlocks[blockNo]) {
+      m_sessionBlocks[blockNo] = true;
+      cache->RecordBlockAccess(GetFilePath(), blockNo);
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+void File::CollectCleanBlocks(BlockAccessList *blocks) const {
+  boost::unique_lock<recursive_mutex> lock(m_mutex, boost::try_to_lock);
+  if (!lock.owns_lock() || m_numFlushing > 0 || blocks == NULL) {
+    return;
+  }
+  for (size_t blockNo = 0; blockNo < m_loadedBlocks.size(); ++blockNo) {
+    const shared_ptr<Page> &page = m_blocks[blockNo];
+    if (m_loadedBlocks[blockNo] && !m_dirtyBlocks[blockNo] && page &&
+        !page->UseDiskFile()) {
+      blocks->push_back(make_pair(m_accessedClocks[blockNo], blockNo));
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+size_t File::DiscardCleanBlock(size_t blockNo, uint64_t clock) {
+  boost::unique_lock<recursive_mutex> lock(m_mutex, boost::try_to_lock);
+  if (!lock.owns_lock() || m_numFlushing > 0 || !IsBlockLoaded(blockNo) ||
+      m_dirtyBlocks[blockNo] || m_accessedClocks[blockNo] != clock) {
+    return 0;
+  }
+  shared_ptr<Page> &page = m_blocks[blockNo];
+  if (!page || page->UseDiskFile()) {
+    return 0;
+  }
+  size_t removedSizeInCache = page->Capacity();
+  m_cacheSize -= removedSizeInCache;
+  m_dataSize -= page->Size();
+  page.reset();  // buffer is returned to arena
+  m_loadedBlocks[blockNo] = false;
+  return removedSizeInCache;
+}
 
-  // remove dummy page at first
-  const char *dummy = "";
-  PageSetConstIterator it =
-      m_pages.find(shared_ptr<Page>(new Page(offset, 0, dummy)));
-  if (it != m_pages.end()) {
-    m_pages.erase(it);
+// --------------------------------------------------------------------------
+void File::FinishFlush() {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  if (m_numFlushing > 0) {
+    --m_numFlushing;
   }
+}
+
+// --------------------------------------------------------------------------
+void File::FinishPrefetch() {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  if (m_numPrefetching > 0) {
+    --m_numPrefetching;
+  }
+}
+
+// --------------------------------------------------------------------------
+void File::MarkDirtyBlocks(off_t offset, size_t len) {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  size_t lastBlockNo = GetBlockNo(len > 0 ? offset + len - 1 : offset);
+  ReserveBlocks(lastBlockNo + 1);
+  for (size_t blockNo = GetBlockNo(offset); blockNo <= lastBlockNo;
+       ++blockNo) {
+    m_dirtyBlocks[blockNo] = true;
+  }
+}
 
-  pair<PageSetConstIterator, bool> res;
+// --------------------------------------------------------------------------
+void File::MarkDirtyBlocks(const BlockBitmap &blocks) {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  ReserveBlocks(blocks.size());
+  for (size_t blockNo = 0; blockNo < blocks.size(); ++blockNo) {
+    if (blocks[blockNo]) {
+      m_dirtyBlocks[blockNo] = true;
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+tuple<bool, size_t, size_t> File::UnguardedWriteBlock(size_t blockNo,
+                                                     off_t offset, size_t len,
+                                                     const char *buffer) {
+  lock_guard<recursive_mutex> lock(m_mutex);
   size_t addedSize = 0;
   size_t addedSizeInCache = 0;
+  shared_ptr<Page> &page = m_blocks[blockNo];
+  if (page) {
+    // in-memory page is moved to disk file when no free cache space
+    shared_ptr<DiskFile> diskFile;
+    if (UseDiskFile() && !page->UseDiskFile()) {
+      diskFile = AskDiskFile();
+      if (!diskFile->IsOpen()) {
+        return make_tuple(false, 0, 0);
+      }
+    }
+    size_t oldSize = page->Size();
+    size_t oldCapacity = page->Capacity();
+    bool success = page->Refresh(offset, len, buffer, diskFile);
+    if (success) {
+      addedSize = page->Size() - oldSize;
+      if (page->Capacity() >= oldCapacity) {
+        addedSizeInCache = page->Capacity() - oldCapacity;
+        m_cacheSize += addedSizeInCache;
+      } else {
+        // buffer is released, it is given back to cache by the caller
+        m_cacheSize -= oldCapacity - page->Capacity();
+      }
+      m_dataSize += addedSize;
+    } else {
+      DebugError("Fail to refresh block " + ToStringLine(offset, len, buffer) +
+                 ToString());
+    }
+    return make_tuple(success, addedSizeInCache, addedSize);
+  }
+
+  // page always starts from the beginning of the block, bytes ahead of
+  // offset are hole
+  off_t blockOffset = GetBlockOffset(blockNo);
+  const char *data = buffer;
+  size_t dataLen = len;
+  vector<char> buf;
+  if (offset > blockOffset) {
+    dataLen = static_cast<size_t>(offset - blockOffset) + len;
+    buf.resize(dataLen);  // value initialization with '\0'
+    memcpy(&buf[offset - blockOffset], buffer, len);
+    data = &buf[0];
+  }
   if (UseDiskFile()) {
-    res = m_pages.insert(
-        make_shared<Page>(offset, len, stream, AskDiskFilePath()));
+    const shared_ptr<DiskFile> &diskFile = AskDiskFile();
+    if (!diskFile->IsOpen()) {
+      return make_tuple(false, 0, 0);
+    }
+    page = make_shared<Page>(blockOffset, dataLen, data, diskFile);
   } else {
-    res = m_pages.insert(shared_ptr<Page>(new Page(offset, len, stream)));
-    if (res.second) {
-      addedSizeInCache = len;
-      m_cacheSize += len;
+    page = make_shared<Page>(blockOffset, dataLen, data, m_arena);
+  }
+  if (!page->IsGood()) {
+    // e.g. no disk space, nothing is stored for the block
+    DebugError("Fail to new page for block " +
+               ToStringLine(offset, len, buffer) + ToString());
+    page.reset();
+    return make_tuple(false, 0, 0);
+  }
+  addedSizeInCache = page->Capacity();
+  m_cacheSize += addedSizeInCache;
+  addedSize = dataLen;
+  m_dataSize += dataLen;
+  m_loadedBlocks[blockNo] = true;
+
+  return make_tuple(true, addedSizeInCache, addedSize);
+}
+
+// --------------------------------------------------------------------------
+pair<size_t, size_t> File::UnguardedRemoveBlocks(size_t fromBlockNo) {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  size_t removedSize = 0;
+  size_t removedSizeInCache = 0;
+  for (size_t blockNo = fromBlockNo; blockNo < m_blocks.size(); ++blockNo) {
+    const shared_ptr<Page> &page = m_blocks[blockNo];
+    if (page) {
+      removedSizeInCache += page->Capacity();
+      removedSize += page->Size();
     }
   }
-  if (res.second) {
-    addedSize = len;
-    m_dataSize += len;
-  } else {
-    DebugError("Fail to new a page from a stream " + ToStringLine(offset, len) +
-               ToString());
+  if (fromBlockNo < m_blocks.size()) {
+    m_blocks.resize(fromBlockNo);
+    m_loadedBlocks.resize(fromBlockNo);
+    m_dirtyBlocks.resize(fromBlockNo);
+    m_accessedClocks.resize(fromBlockNo);
+    m_sessionBlocks.resize(fromBlockNo);
+    m_fetchingBlocks.resize(fromBlockNo);
   }
-  return boost::make_tuple(res.first, res.second, addedSizeInCache, addedSize);
+  m_cacheSize -= removedSizeInCache;
+  m_dataSize -= removedSize;
+  return make_pair(removedSizeInCache, removedSize);
 }
 
 }  // namespace Data
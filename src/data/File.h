@@ -18,6 +18,7 @@
 #define QSFS_DATA_FILE_H_
 
 #include <stddef.h>  // for size_t
+#include <stdint.h>
 #include <time.h>
 
 #include <deque>
@@ -25,15 +26,20 @@
 #include <list>
 #include <string>
 #include <utility>
+#include <vector>
 
+#include "boost/enable_shared_from_this.hpp"
 #include "boost/noncopyable.hpp"
 #include "boost/shared_ptr.hpp"
+#include "boost/thread/condition_variable.hpp"
 #include "boost/thread/locks.hpp"
 #include "boost/thread/mutex.hpp"
 #include "boost/thread/recursive_mutex.hpp"
 #include "boost/tuple/tuple.hpp"
+#include "boost/weak_ptr.hpp"
 
 #include "data/Page.h"
+#include "data/StreamUpload.h"
 
 namespace QS {
 
@@ -48,23 +54,65 @@ class Drive;
 }
 
 namespace Data {
+class BufferArena;
 class Cache;
 class DirectoryTree;
+class DiskFile;
+class FileMetaData;
+class Readahead;
 struct DownloadRangeCallback;
+struct FlushCallback;
 
 // Range represented by a pair of {offset, size}
 typedef std::deque<std::pair<off_t, size_t> > ContentRangeDeque;
 
-class File : private boost::noncopyable {
+// Pages indexed by block number, a null page means the block is not loaded
+typedef std::vector<boost::shared_ptr<Page> > BlockIndex;
+
+// Flags indexed by block number
+typedef std::vector<bool> BlockBitmap;
+
+// Range of content stored in disk file, which is at the same offset of the
+// disk file as in the file
+struct DiskRange {
+  off_t offset;
+  size_t size;
+  boost::shared_ptr<DiskFile> diskFile;
+};
+typedef std::vector<DiskRange> DiskRangeList;
+
+// Block represented by a pair of {access clock, block number}
+typedef std::vector<std::pair<uint64_t, size_t> > BlockAccessList;
+
+class File : public boost::enable_shared_from_this<File>,
+             private boost::noncopyable {
  public:
-  explicit File(const std::string &filePath, size_t size = 0);
+  // Construct File
+  //
+  // @param  : file path, size, arena
+  // @return :
+  //
+  // Buffers of in-memory pages are allocated from arena, which is owned by
+  // cache. A private arena is used if it is not specified.
+  //
+  // File should be owned by shared_ptr for background transfers, which refer
+  // to it by the shared_ptr as it could be erased from cache before done.
+  explicit File(const std::string &filePath, size_t size = 0,
+                const boost::shared_ptr<BufferArena> &arena =
+                    boost::shared_ptr<BufferArena>());
 
   ~File();
 
  public:
   // Return file size
-  // Should be last page->Next()
-  size_t GetSize() const;
+  // Should be the end of the last written byte
+  size_t GetSize() const {
+    boost::lock_guard<boost::recursive_mutex> locker(m_mutex);
+    return m_size;
+  }
+
+  // Return size of block, which is power of 2
+  size_t GetBlockSize() const { return m_blockSize; }
 
   std::string GetFilePath() const {
     boost::lock_guard<boost::recursive_mutex> locker(m_mutex);
@@ -80,6 +128,8 @@ class File : private boost::noncopyable {
     boost::lock_guard<boost::recursive_mutex> locker(m_mutex);
     return m_cacheSize;
   }
+  // Return sum of size of pages stored in disk file
+  size_t GetDiskCachedSize() const;
   bool UseDiskFile() const {
     boost::lock_guard<boost::recursive_mutex> locker(m_mutex);
     return m_useDiskFile;
@@ -88,39 +138,72 @@ class File : private boost::noncopyable {
     boost::lock_guard<boost::recursive_mutex> locker(m_mutex);
     return m_open;
   }
+  bool HasRemoteMeta() const {
+    boost::lock_guard<boost::recursive_mutex> locker(m_mutex);
+    return m_hasRemoteMeta;
+  }
+  uint64_t GetRemoteSize() const {
+    boost::lock_guard<boost::recursive_mutex> locker(m_mutex);
+    return m_remoteSize;
+  }
+  std::string GetRemoteETag() const {
+    boost::lock_guard<boost::recursive_mutex> locker(m_mutex);
+    return m_remoteETag;
+  }
 
-  // return disk file path
-  std::string AskDiskFilePath() const;
-
-  // Return a pair of iterators pointing to the range of consecutive pages
-  // at the front of cache list
+  // Whether the snapshot of object meta is still trustable
   //
   // @param  : void
-  // @return : pair
-  // Notice: this return a half-closed half open range [page1, page2)
-  std::pair<PageSetConstIterator, PageSetConstIterator>
-  ConsecutivePageRangeAtFront() const;
+  // @return : bool
+  //
+  // The snapshot is expired according to the stat expire option.
+  bool IsRemoteMetaValid() const;
+
+  // Update the snapshot of object meta with the meta just headed
+  //
+  // @param  : object meta
+  // @return : true if object content has been changed since the previous
+  //           snapshot
+  bool UpdateRemoteMeta(const boost::shared_ptr<FileMetaData> &meta);
+
+  // return disk file path
+  std::string AskDiskFilePath() const;
 
   // Whether the file containing the content
   //
   // @param  : content range start, content range size
   // @return : bool
+  //
+  // Bytes in a loaded block but beyond its page are holes, which are taken
+  // as existing content.
   bool HasData(off_t start, size_t size) const;
 
   // Return the unexisting content ranges
   //
   // @param  : content range start, content range size
   // @return : a list of pair {range start, range size}
+  //
+  // Ranges are made of unloaded blocks, and are clipped by the input range.
   ContentRangeDeque GetUnloadedRanges(off_t start, size_t size) const;
 
-  // Return begin pos of pages
-  PageSetConstIterator BeginPage() const;
+  // Return num of loaded blocks
+  size_t GetNumBlocks() const;
 
-  // Return end pos of pages
-  PageSetConstIterator EndPage() const;
+  // Whether the file has blocks modified locally but not flushed yet
+  bool IsDirty() const;
+
+  // Return generation of the content, which is increased when the file is
+  // truncated to a smaller size or cleared
+  uint64_t GetGeneration() const {
+    boost::lock_guard<boost::recursive_mutex> locker(m_mutex);
+    return m_generation;
+  }
 
-  // Return num of pages
-  size_t GetNumPages() const;
+  // Whether any flush or prefetch is in progress, which refers to the file
+  bool HasTransfers() const {
+    boost::lock_guard<boost::recursive_mutex> locker(m_mutex);
+    return m_numFlushing > 0 || m_numPrefetching > 0;
+  }
 
   // To string
   std::string ToString() const;
@@ -136,47 +219,141 @@ class File : private boost::noncopyable {
   //
   // If any bytes is not present, download it as a new page.
   // Pagelist of outcome is sorted by page offset.
+  // If readahead of the file handle is given, data ahead of the read is
+  // downloaded in background according to the access pattern.
+  // If disk ranges is given and the content is entirely stored in disk file,
+  // the ranges of disk file are output instead of copying the content, and
+  // buf is left untouched.
   // Notes: buf at least has bytes of 'len' memory
   std::pair<size_t, ContentRangeDeque> Read(
       off_t offset, size_t len, char *buf,
       boost::shared_ptr<QS::Client::TransferManager> transferManager,
       boost::shared_ptr<QS::Data::DirectoryTree> dirTree,
       boost::shared_ptr<QS::Data::Cache> cache,
-      boost::shared_ptr<QS::Client::Client> client, bool async = false);
+      boost::shared_ptr<QS::Client::Client> client,
+      Readahead *readahead = NULL, DiskRangeList *diskRanges = NULL);
 
   // For internal use
   // Read from the cache with no load
-  // Notes: buf at least has bytes of 'len' memory
+  // Notes: buf at least has bytes of 'len' memory, bytes of unloaded blocks
+  // and holes are filled with zero.
   std::pair<size_t, ContentRangeDeque> ReadNoLoad(off_t offset, size_t len,
                                                   char *buf) const;
 
-  // Write a block of bytes into pages
+  // Return the ranges of disk file storing the content
+  //
+  // @param  : file offset, len, output ranges
+  // @return : true if the content is entirely stored in disk file
+  //
+  // Consecutive ranges are merged. Nothing is output if any block of the
+  // range is not loaded or is in memory, or if any byte is a hole.
+  bool GetDiskRanges(off_t offset, size_t len, DiskRangeList *ranges) const;
+
+  // Read the file to upload
+  //
+  // @param  : file offset, len, buffer, client
+  // @return : {size of bytes read, ranges failed to read}
+  //
+  // Blocks in cache are read from cache, unloaded ranges within the object
+  // are downloaded into the buffer directly without being cached. So only
+  // the modified blocks of a file need to be in cache to upload it.
+  // Downloads match the etag of the snapshot, the rest of the ranges fail
+  // once the object is found modified, so the upload fails.
+  std::pair<size_t, ContentRangeDeque> ReadThrough(
+      off_t offset, size_t len, char *buf,
+      const boost::shared_ptr<QS::Client::Client> &client) const;
+
+  // Whether the content in cache is identical to the object
+  //
+  // @param  : file size
+  // @return : bool
+  //
+  // Only files entirely loaded and no larger than the multipart threshold are
+  // compared, by the md5 of the blocks against the etag of the object, as
+  // objects uploaded in parts have an etag which is not the md5 of content.
+  bool IsSameAsRemote(size_t fileSize) const;
+
+  // Write a block of bytes into blocks
+  //
+  // @param  : file offset, len, buffer, transfer manager, dirtree, cache,
+  //           client
+  // @return : {success, added size in cache, added size}
+  //
+  // Blocks partially covered by the input and not loaded yet will be
+  // downloaded at first without holding the lock, as a block is always taken
+  // as a whole.
+  boost::tuple<bool, size_t, size_t> Write(
+      off_t offset, size_t len, const char *buffer,
+      const boost::shared_ptr<QS::Client::TransferManager> &transferManager,
+      const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree,
+      const boost::shared_ptr<QS::Data::Cache> &cache,
+      const boost::shared_ptr<QS::Client::Client> &client);
+
+  // Write a block of bytes into blocks with no load
   //
   // @param  : file offset, len, buffer
   // @return : {success, added size in cache, added size}
   //
   // From pointer of buffer, number of len bytes will be writen.
   // The owning file's offset is set with 'offset'.
+  // The written blocks are marked as dirty.
   boost::tuple<bool, size_t, size_t> Write(
       off_t offset, size_t len, const char *buffer,
       const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree,
       const boost::shared_ptr<QS::Data::Cache> &cache);
 
-  // Write stream into pages
+  // Write stream into blocks
   //
   // @param  : file offset, len of stream, stream
   // @return : {success, added size in cache, added size}
   //
-  // The stream will be moved to the pages.
+  // The stream is the downloaded content, which will only be moved to the
+  // blocks not loaded yet, as loaded blocks could be modified locally.
   // The owning file's offset is set with 'offset'.
   boost::tuple<bool, size_t, size_t> Write(
       off_t offset, size_t len, const boost::shared_ptr<std::iostream> &stream,
       const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree,
       const boost::shared_ptr<QS::Data::Cache> &cache);
 
+  // Write the downloaded content into blocks not loaded yet
+  //
+  // @param  : file offset, len of stream, stream, generation of the content
+  //           when the download is submitted, dirtree, cache
+  // @return : {success, added size in cache, added size}
+  //
+  // The content is dropped if the file has been truncated or cleared since
+  // the download is submitted, as it could be beyond the new end of file.
+  boost::tuple<bool, size_t, size_t> WriteDownloaded(
+      off_t offset, size_t len, const boost::shared_ptr<std::iostream> &stream,
+      uint64_t generation,
+      const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree,
+      const boost::shared_ptr<QS::Data::Cache> &cache);
+
+  // Write content of the object into blocks not loaded yet
+  //
+  // @param  : file offset, len, buffer, dirtree, cache
+  // @return : {success, added size in cache, added size}
+  //
+  // As the content is identical to the object, blocks are not marked as dirty.
+  boost::tuple<bool, size_t, size_t> WriteUnloaded(
+      off_t offset, size_t len, const char *buffer,
+      const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree,
+      const boost::shared_ptr<QS::Data::Cache> &cache);
+
+  // Return the cache size need to be allocated to write the range
+  //
+  // @param  : file offset, len, flag only count unloaded blocks
+  // @return : size in bytes
+  //
+  // This is the growth of the buffers of in-memory pages, bytes stored in
+  // disk file are not counted.
+  size_t GetCacheSizeToWrite(off_t offset, size_t len,
+                             bool onlyUnloaded = false) const;
+
   // Setup pre to write
   // For internal use
-  bool PreWrite(size_t len, const boost::shared_ptr<QS::Data::Cache> &cache);
+  bool PreWrite(size_t needSize,
+                const boost::shared_ptr<QS::Data::Cache> &cache);
 
   // Setup post to write
   // For internal use
@@ -185,13 +362,18 @@ class File : private boost::noncopyable {
                  const boost::shared_ptr<QS::Data::Cache> &cache);
 
   // For internal use
+  // If onlyUnloaded is true, loaded blocks will be kept unchanged.
   boost::tuple<bool, size_t, size_t> DoWrite(off_t offset, size_t len,
-                                             const char *buffer);
+                                             const char *buffer,
+                                             bool onlyUnloaded = false);
 
   // For internal use
   boost::tuple<bool, size_t, size_t> DoWrite(
       off_t offset, size_t len, const boost::shared_ptr<std::iostream> &stream);
 
+  // Network transfers of Flush and Load run without holding the lock, only
+  // the results are committed into blocks under the lock. So the lock should
+  // not be held by the calling thread, except for an asynchronous Load.
   void Flush(size_t fileSize,
              boost::shared_ptr<QS::Client::TransferManager> transferManager,
              boost::shared_ptr<QS::Data::DirectoryTree> dirTree,
@@ -204,13 +386,74 @@ class File : private boost::noncopyable {
             boost::shared_ptr<QS::Data::Cache> cache,
             boost::shared_ptr<QS::Client::Client> client, bool async = false);
 
-  void Prefetch(boost::shared_ptr<QS::Client::TransferManager> transferManager,
+  // Download ranges in background
+  //
+  // @param  : ranges to read ahead, transfer manager, dirtree, cache
+  // @return : void
+  //
+  // Only unloaded blocks within the object are downloaded. The object size
+  // is taken from the snapshot of object meta, the object is not headed.
+  void Prefetch(const ContentRangeDeque &ranges,
+                boost::shared_ptr<QS::Client::TransferManager> transferManager,
                 boost::shared_ptr<QS::Data::DirectoryTree> dirTree,
-                boost::shared_ptr<QS::Data::Cache> cache,
-                boost::shared_ptr<QS::Client::Client> client,
-                bool async = false);
+                boost::shared_ptr<QS::Data::Cache> cache);
+
+  // Upload the parts completed by sequential writes in background
+  //
+  // @param  : transfer manager, client
+  // @return : void
+  //
+  // Once the file grows beyond the multipart threshold, parts of the file are
+  // uploaded while it is still being written, so flush only uploads the rest
+  // of it.
+  // Notes: the lock should not be held by the calling thread.
+  void UploadStreamParts(
+      boost::shared_ptr<QS::Client::TransferManager> transferManager,
+      boost::shared_ptr<QS::Client::Client> client);
+
+  // Refresh the snapshot of object meta by heading the object
+  //
+  // @param  : client
+  // @return : true if object content has been changed, which means the etag
+  //           is different from the one in the previous snapshot
+  bool RefreshRemoteMeta(const boost::shared_ptr<QS::Client::Client> &client);
+
+  // Return the object size in snapshot
+  //
+  // @param  : client, cache
+  // @return : object size
+  //
+  // The object will only be headed when the snapshot is not valid. If the
+  // object has been changed since the previous snapshot, the cached content
+  // is dropped unless it is modified locally.
+  uint64_t AskRemoteSize(
+      const boost::shared_ptr<QS::Client::Client> &client,
+      const boost::shared_ptr<QS::Data::Cache> &cache =
+          boost::shared_ptr<QS::Data::Cache>());
+
+  // Drop the content of a stale object
+  //
+  // @param  : cache
+  // @return : void
+  //
+  // Nothing is dropped if the file is dirty or is in use by transfers.
+  void DropStaleContent(const boost::shared_ptr<QS::Data::Cache> &cache);
 
-  // Truncate
+  // Mark the snapshot of object meta as stale
+  //
+  // @param  : etag of the object when downloading
+  // @return : void
+  //
+  // Called when the object no longer matches the etag, so the snapshot is
+  // refreshed on next asking. Nothing is done if the snapshot has been
+  // retaken since.
+  void MarkRemoteMetaStale(const std::string &eTag);
+
+  // Set the snapshot of object meta
+  void SetRemoteMeta(const boost::shared_ptr<FileMetaData> &meta);
+  void SetRemoteMeta(uint64_t size, const std::string &eTag);
+
+  // Truncate, the lock should not be held by the calling thread
   void Truncate(
       size_t newSize,
       const boost::shared_ptr<QS::Client::TransferManager> &transferManager,
@@ -221,8 +464,12 @@ class File : private boost::noncopyable {
   // Rename
   void Rename(const std::string &newFilePath);
 
+  // Return disk file shared by the pages stored in disk,
+  // it is opened at the first time it is asked.
+  const boost::shared_ptr<DiskFile> &AskDiskFile();
+
   // Remove disk file
-  void RemoveDiskFileIfExists(bool logOn = true) const;
+  void RemoveDiskFileIfExists(bool logOn = true);
 
   // Set flag to use disk file
   void SetUseDiskFile(bool useDiskFile) {
@@ -233,38 +480,14 @@ class File : private boost::noncopyable {
   // Set file open state
   void SetOpen(bool open) {
     boost::lock_guard<boost::recursive_mutex> locker(m_mutex);
+    if (open) {
+      m_sessionBlocks.assign(m_sessionBlocks.size(), false);
+    }
     m_open = open;
   }
 
   void SetOpen(bool open, boost::shared_ptr<QS::Data::DirectoryTree> dirTree);
 
-  // Returns an iterator pointing to the first Page that is not ahead of offset.
-  // If no such Page is found, a past-the-end iterator is returned.
-  PageSetConstIterator LowerBoundPage(off_t offset) const;
-  // internal use only
-  PageSetConstIterator LowerBoundPageNoLock(off_t offset) const;
-
-  // Returns an iterator pointing to the first Page that is behind of offset.
-  // If no such Page is found, a past-the-end iterator is returned.
-  PageSetConstIterator UpperBoundPage(off_t offset) const;
-  // internal use only
-  PageSetConstIterator UpperBoundPageNoLock(off_t offset) const;
-
-  // Returns a pair iterators pointing the pages which intesecting with
-  // the range (from off1 to off2).
-  // The first member pointing to first page not ahead of (could be
-  // intersecting with) off1; the second member pointing to the first
-  // page not ahead of off2, same as LowerBoundPage(off2).
-  // Notice: this is a half-closed half open range [page1, page2)
-  std::pair<PageSetConstIterator, PageSetConstIterator> IntesectingRange(
-      off_t off1, off_t off2) const;
-
-  // Return the first key in the page set.
-  const boost::shared_ptr<Page> &Front();
-
-  // Return the last key in the page set.
-  const boost::shared_ptr<Page> &Back();
-
   void DownloadRanges(
       const ContentRangeDeque &ranges,
       boost::shared_ptr<QS::Client::TransferManager> transferManager,
@@ -274,15 +497,181 @@ class File : private boost::noncopyable {
       off_t offset, size_t len,
       boost::shared_ptr<QS::Client::TransferManager> transferManager,
       boost::shared_ptr<QS::Data::DirectoryTree> dirTree,
-      boost::shared_ptr<QS::Data::Cache> cache, bool async = false);
+      boost::shared_ptr<QS::Data::Cache> cache, bool async = false,
+      bool prefetch = false);
+
+  // Download ranges of blocks in unit of transfer buffer
+  //
+  // @param  : ranges of blocks, transfer manager, dirtree, cache, async,
+  //           whether blocks are claimed in flight, whether for prefetch
+  // @return : void
+  //
+  // The lock is not needed for synchronous downloads, the blocks are written
+  // into the file when done. Claimed blocks are released when done.
+  void DownloadBlocks(
+      const ContentRangeDeque &ranges,
+      const boost::shared_ptr<QS::Client::TransferManager> &transferManager,
+      const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree,
+      const boost::shared_ptr<QS::Data::Cache> &cache, bool async,
+      bool claimed, bool prefetch);
+
+  // Make the range loaded without holding the lock
+  //
+  // @param  : file offset, len, transfer manager, dirtree, cache, client
+  // @return : void
+  //
+  // Blocks downloading by others are waited for, other unloaded blocks are
+  // claimed and downloaded by the calling thread, so each block is only
+  // downloaded once by concurrent readers. Stop if any download fails.
+  // Notes: the lock should not be held by the calling thread.
+  void Fetch(
+      off_t offset, size_t len,
+      const boost::shared_ptr<QS::Client::TransferManager> &transferManager,
+      const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree,
+      const boost::shared_ptr<QS::Data::Cache> &cache,
+      const boost::shared_ptr<QS::Client::Client> &client);
+
+  // Initiate the multipart upload of stream upload, then upload the parts
+  //
+  // @param  : stream upload, parts taken, transfer manager, client
+  // @return : void
+  //
+  // The parts fail if the multipart upload cannot be initiated.
+  void StartStreamUpload(
+      const boost::shared_ptr<StreamUpload> &stream,
+      const StreamPartList &parts,
+      const boost::shared_ptr<QS::Client::TransferManager> &transferManager,
+      const boost::shared_ptr<QS::Client::Client> &client);
+
+  // Submit the parts of an initiated stream upload to upload in background
+  void SubmitStreamParts(
+      const boost::shared_ptr<StreamUpload> &stream,
+      const StreamPartList &parts,
+      const boost::shared_ptr<QS::Client::TransferManager> &transferManager,
+      const boost::shared_ptr<QS::Client::Client> &client);
+
+  // Abort the multipart upload of a dropped stream upload
+  //
+  // @param  : stream upload, client
+  // @return : void
+  //
+  // Wait until the parts in flight are finished before aborting.
+  void AbortStreamUpload(const boost::shared_ptr<StreamUpload> &stream,
+                         const boost::shared_ptr<QS::Client::Client> &client);
+
+  // Upload a part of stream upload, return true if success
+  bool UploadStreamPart(const boost::shared_ptr<StreamUpload> &stream,
+                        int partId, off_t offset, size_t size,
+                        const boost::shared_ptr<QS::Client::Client> &client);
+
+  // Upload the rest of the file and complete the stream upload
+  //
+  // @param  : stream upload, file size, transfer manager, client
+  // @return : true if the file is uploaded
+  //
+  // The stream upload is aborted if it is broken or fails to complete, and
+  // the file is uploaded as a whole instead.
+  bool FlushStream(
+      const boost::shared_ptr<StreamUpload> &stream, size_t fileSize,
+      const boost::shared_ptr<QS::Client::TransferManager> &transferManager,
+      const boost::shared_ptr<QS::Client::Client> &client);
+
+  // Claim the unloaded blocks which are not downloading by others
+  //
+  // @param  : ranges of blocks
+  // @return : ranges of the claimed blocks, clipped by the object size
+  ContentRangeDeque ClaimRanges(const ContentRangeDeque &ranges);
+
+  // Whether any block intersecting with the range is downloading
+  bool HasFetchingBlocks(off_t offset, size_t len) const;
+
+  // Release the claimed blocks intersecting with the range, and wake up
+  // the waiters
+  void FinishFetch(off_t offset, size_t len);
+
+  // Load blocks from the persistent disk cache of cache
+  //
+  // @param  : ranges of unloaded blocks, dirtree, cache
+  // @return : ranges of blocks which are not in disk cache
+  //
+  // Only blocks stored with the etag in snapshot of object meta are loaded.
+  ContentRangeDeque LoadFromDiskCache(
+      const ContentRangeDeque &ranges,
+      const boost::shared_ptr<QS::Data::DirectoryTree> &dirTree,
+      const boost::shared_ptr<QS::Data::Cache> &cache);
+
+  // Return the block number which the offset belongs to
+  size_t GetBlockNo(off_t offset) const {
+    return static_cast<size_t>(offset) / m_blockSize;
+  }
+
+  // Return the file offset of the block
+  off_t GetBlockOffset(size_t blockNo) const {
+    return static_cast<off_t>(blockNo * m_blockSize);
+  }
 
-  // Add a new page from a block of character without checking input.
-  // Return {pointer to addedpage, success, added size in cache, added size}
+  // Whether the block is loaded, internal use only
+  bool IsBlockLoaded(size_t blockNo) const {
+    return blockNo < m_loadedBlocks.size() && m_loadedBlocks[blockNo];
+  }
+
+  // Make block index be able to hold num of blocks, internal use only
+  void ReserveBlocks(size_t numBlocks);
+
+  // Record the access of blocks intersecting with the range
+  //
+  // @param  : file offset, len, cache
+  // @return : void
+  //
+  // Access clock of cache is recorded for the blocks, and the blocks are
+  // reported to the eviction policy of cache once since the file is opened.
+  void MarkAccessedBlocks(off_t offset, size_t len,
+                          const boost::shared_ptr<QS::Data::Cache> &cache);
+
+  // Collect the blocks which could be discarded to free cache
+  //
+  // @param  : output blocks
+  // @return : void
+  //
+  // Only clean blocks in memory are collected, as they could be loaded from
+  // object again. Nothing is collected if the file is in flushing or if the
+  // file is locked by others, the later means it is in use.
+  void CollectCleanBlocks(BlockAccessList *blocks) const;
+
+  // Discard a clean block in memory
+  //
+  // @param  : block number, access clock when the block is collected
+  // @return : removed size in cache
+  //
+  // The block is kept if it has been accessed or modified since it is
+  // collected, or if the file is locked by others.
+  size_t DiscardCleanBlock(size_t blockNo, uint64_t clock);
+
+  // Finish a flush, blocks could be discarded when no flush is in progress
+  void FinishFlush();
+
+  // Finish a download submitted by prefetch
+  void FinishPrefetch();
+
+  // Mark blocks intersecting with the range as dirty
+  void MarkDirtyBlocks(off_t offset, size_t len);
+  // Mark blocks as dirty, blocks are given by a bitmap
+  void MarkDirtyBlocks(const BlockBitmap &blocks);
+
+  // Write bytes into a single block without checking input.
+  // Added size in cache is the growth of the page's buffer.
+  // Return {success, added size in cache, added size}
   // internal use only
-  boost::tuple<PageSetConstIterator, bool, size_t, size_t> UnguardedAddPage(
-      off_t offset, size_t len, const char *buffer);
-  boost::tuple<PageSetConstIterator, bool, size_t, size_t> UnguardedAddPage(
-      off_t offset, size_t len, const boost::shared_ptr<std::iostream> &stream);
+  boost::tuple<bool, size_t, size_t> UnguardedWriteBlock(size_t blockNo,
+                                                         off_t offset,
+                                                         size_t len,
+                                                         const char *buffer);
+
+  // Remove blocks from the block number to the end without checking input.
+  // Removed size in cache is the size of the pages' buffer.
+  // Return {removed size in cache, removed size}
+  // internal use only
+  std::pair<size_t, size_t> UnguardedRemoveBlocks(size_t fromBlockNo);
 
  private:
   std::string m_filePath;
@@ -290,19 +679,49 @@ class File : private boost::noncopyable {
 
   size_t m_dataSize;   // record sum of all pages' size
                        // this will not include unload data size
-  size_t m_cacheSize;  // record sum of all pages' size
-                       // stored in cache not including disk file
+  size_t m_cacheSize;  // record sum of all pages' buffer size
+                       // allocated from arena not including disk file
+  size_t m_size;       // file size, the end of the last written byte
+  size_t m_blockSize;  // size of block, power of 2
 
   bool m_useDiskFile;  // use disk file when no free cache space
-  bool m_inPrefetching;
-  bool m_open;  // file open/close state
+  bool m_open;              // file open/close state
+  size_t m_numFlushing;     // num of flushes in progress, which read blocks
+  size_t m_numPrefetching;  // num of downloads in progress for prefetch
+
+  // Snapshot of the object meta, which is taken when opening the file, so
+  // reading need not to head the object every time
+  bool m_hasRemoteMeta;
+  uint64_t m_remoteSize;
+  std::string m_remoteETag;  // empty if unknown
+  time_t m_remoteMetaTime;   // time when snapshot is taken
+  bool m_remoteMetaStale;    // object is known to be modified since snapshot
+
+  // increased when the file is truncated to a smaller size or cleared, so
+  // downloads submitted before are dropped when done
+  uint64_t m_generation;
+
+  boost::shared_ptr<BufferArena> m_arena;  // buffers of in-memory pages
+  boost::shared_ptr<DiskFile> m_diskFile;  // null if no page in disk
 
   mutable boost::recursive_mutex m_mutex;
-  PageSet m_pages;  // a set of pages suppose to be successive
+  BlockIndex m_blocks;                     // pages keyed by block number
+  BlockBitmap m_loadedBlocks;              // blocks holding data
+  BlockBitmap m_dirtyBlocks;               // blocks modified locally
+  std::vector<uint64_t> m_accessedClocks;  // access clock of cache per block
+  BlockBitmap m_sessionBlocks;             // blocks accessed since opened
+  BlockBitmap m_fetchingBlocks;            // blocks claimed in flight
+  boost::condition_variable_any m_fetchDone;  // notify waiters of claimed
+  boost::shared_ptr<StreamUpload> m_streamUpload;  // null if not streaming
+  // used to abort the stream upload when the file is cleared
+  boost::weak_ptr<QS::Client::TransferManager> m_streamTransferManager;
+  boost::weak_ptr<QS::Client::Client> m_streamClient;
 
   friend class Cache;  // for Rename
+  friend class CacheTest;
   friend class FileTest;
   friend class QS::Data::DownloadRangeCallback;
+  friend class QS::Data::FlushCallback;
   friend class QS::FileSystem::Drive;
   friend class QS::Client::QSTransferManager;
 };
@@ -75,6 +75,7 @@ class FileMetaData {
   // accessor
   const std::string &GetFilePath() const { return m_filePath; }
   time_t GetMTime() const { return m_mtime; }
+  const std::string &GetETag() const { return m_eTag; }
   bool IsFileOpen() const { return m_fileOpen; }
 
  private:
@@ -223,6 +223,13 @@ void FileMetaDataManager::SetDirectoryTree(QS::Data::DirectoryTree *tree) {
     m_dirTree = tree;
 }
 
+// --------------------------------------------------------------------------
+void FileMetaDataManager::SetEvictCallback(
+    const boost::function<void(const string &)> &callback) {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  m_evictCallback = callback;
+}
+
 // --------------------------------------------------------------------------
 MetaDataListIterator FileMetaDataManager::UnguardedMakeMetaDataMostRecentlyUsed(
     MetaDataListIterator pos) {
@@ -283,7 +290,10 @@ bool FileMetaDataManager::FreeNoLock(size_t needCount, string fileUnfreeable) {
     // as directory node depend on the file meta data
     if (m_dirTree) {
       m_dirTree->Remove(fileId, RemoveNodeType::SelfOnly);
-    }    
+    }
+    if (m_evictCallback) {
+      m_evictCallback(fileId);
+    }
     // Node destructor will inovke FileMetaDataManger::Erase,
     // so double checking before earsing file meta
     FileIdToMetaDataMapIterator p = m_map.find(fileId);
@@ -114,6 +114,11 @@ class FileMetaDataManager : public Singleton<FileMetaDataManager> {
 
   void SetDirectoryTree(QS::Data::DirectoryTree *tree);
 
+  // Set callback invoked with the file path when a file meta is freed to make
+  // room for others, after its node is removed from the directory tree
+  void SetEvictCallback(
+      const boost::function<void(const std::string &)> &callback);
+
  private:
   // internal use only
   MetaDataListIterator UnguardedMakeMetaDataMostRecentlyUsed(
@@ -135,6 +140,7 @@ class FileMetaDataManager : public Singleton<FileMetaDataManager> {
   mutable boost::recursive_mutex m_mutex;
 
   QS::Data::DirectoryTree *m_dirTree;
+  boost::function<void(const std::string &)> m_evictCallback;
 
   friend class Singleton<FileMetaDataManager>;
   friend class QS::Data::Entry;
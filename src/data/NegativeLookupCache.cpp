@@ -0,0 +1,172 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include "data/NegativeLookupCache.h"
+
+#include <time.h>
+
+#include <string>
+#include <utility>
+
+#include "boost/thread/locks.hpp"
+
+namespace QS {
+
+namespace Data {
+
+using boost::lock_guard;
+using boost::mutex;
+using std::make_pair;
+using std::string;
+
+static const char PATH_DELIM = '/';
+
+// --------------------------------------------------------------------------
+NegativeLookupCache::NegativeLookupCache(size_t maxCount, uint32_t expireInSec)
+    : m_maxCount(maxCount),
+      m_expireInSec(static_cast<time_t>(expireInSec)),
+      m_numEvictions(0) {}
+
+// --------------------------------------------------------------------------
+bool NegativeLookupCache::Has(const string &path) {
+  lock_guard<mutex> lock(m_mutex);
+  return Has(&m_paths, path);
+}
+
+// --------------------------------------------------------------------------
+void NegativeLookupCache::Add(const string &path) {
+  lock_guard<mutex> lock(m_mutex);
+  Add(&m_paths, path);
+}
+
+// --------------------------------------------------------------------------
+bool NegativeLookupCache::IsListedDirectory(const string &dirPath) {
+  lock_guard<mutex> lock(m_mutex);
+  return Has(&m_listedDirs, dirPath);
+}
+
+// --------------------------------------------------------------------------
+void NegativeLookupCache::AddListedDirectory(const string &dirPath,
+                                             uint64_t numEvictions) {
+  lock_guard<mutex> lock(m_mutex);
+  // children listed could have been evicted
+  if (numEvictions == m_numEvictions) {
+    Add(&m_listedDirs, dirPath);
+  }
+}
+
+// --------------------------------------------------------------------------
+void NegativeLookupCache::OnNodeEvicted(const string &path) {
+  string file = path;
+  if (file.size() > 1 && file[file.size() - 1] == PATH_DELIM) {
+    file.erase(file.size() - 1);
+  }
+  string::size_type pos = file.rfind(PATH_DELIM);
+  string dir = pos == string::npos ? string() : file.substr(0, pos + 1);
+
+  lock_guard<mutex> lock(m_mutex);
+  ++m_numEvictions;
+  Erase(&m_listedDirs, dir);
+  Erase(&m_listedDirs, path);  // in case of a directory
+}
+
+// --------------------------------------------------------------------------
+uint64_t NegativeLookupCache::GetNumEvictions() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_numEvictions;
+}
+
+// --------------------------------------------------------------------------
+void NegativeLookupCache::Erase(const string &path) {
+  if (path.empty()) {
+    return;
+  }
+  string file = path;
+  if (file.size() > 1 && file[file.size() - 1] == PATH_DELIM) {
+    file.erase(file.size() - 1);
+  }
+  string dir = file[file.size() - 1] == PATH_DELIM ? file : file + PATH_DELIM;
+
+  lock_guard<mutex> lock(m_mutex);
+  Erase(&m_paths, file);
+  EraseUnder(&m_paths, dir);
+  Erase(&m_listedDirs, file);
+  EraseUnder(&m_listedDirs, dir);
+}
+
+// --------------------------------------------------------------------------
+size_t NegativeLookupCache::GetNumPaths() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_paths.m_map.size();
+}
+
+// --------------------------------------------------------------------------
+size_t NegativeLookupCache::GetNumListedDirectories() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_listedDirs.m_map.size();
+}
+
+// --------------------------------------------------------------------------
+bool NegativeLookupCache::Has(PathSet *set, const string &path) {
+  PathToTimeListIterMap::iterator it = set->m_map.find(path);
+  if (it == set->m_map.end()) {
+    return false;
+  }
+  if (time(NULL) - it->second->second >= m_expireInSec) {
+    set->m_list.erase(it->second);
+    set->m_map.erase(it);
+    return false;
+  }
+  return true;
+}
+
+// --------------------------------------------------------------------------
+void NegativeLookupCache::Add(PathSet *set, const string &path) {
+  if (m_maxCount == 0) {
+    return;
+  }
+  Erase(set, path);
+  set->m_list.push_back(make_pair(path, time(NULL)));
+  set->m_map[path] = --set->m_list.end();
+
+  // evict the oldest
+  while (set->m_map.size() > m_maxCount) {
+    set->m_map.erase(set->m_list.front().first);
+    set->m_list.pop_front();
+  }
+}
+
+// --------------------------------------------------------------------------
+void NegativeLookupCache::Erase(PathSet *set, const string &path) {
+  PathToTimeListIterMap::iterator it = set->m_map.find(path);
+  if (it != set->m_map.end()) {
+    set->m_list.erase(it->second);
+    set->m_map.erase(it);
+  }
+}
+
+// --------------------------------------------------------------------------
+void NegativeLookupCache::EraseUnder(PathSet *set, const string &dirPath) {
+  PathToTimeListIterMap::iterator it = set->m_map.lower_bound(dirPath);
+  while (it != set->m_map.end() &&
+         it->first.compare(0, dirPath.size(), dirPath) == 0) {
+    set->m_list.erase(it->second);
+    set->m_map.erase(it++);
+  }
+}
+
+}  // namespace Data
+}  // namespace QS
@@ -0,0 +1,127 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#ifndef QSFS_DATA_NEGATIVELOOKUPCACHE_H_
+#define QSFS_DATA_NEGATIVELOOKUPCACHE_H_
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>
+#include <time.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "boost/noncopyable.hpp"
+#include "boost/thread/mutex.hpp"
+
+namespace QS {
+
+namespace Data {
+
+/**
+ * Cache of paths known to be absent in object storage.
+ *
+ * It records paths which are not found by stat, and directories which are
+ * listed completely, whose children absent in the directory tree are absent
+ * too. Both are kept in insertion order, bounded by the max count and expired
+ * after the given time.
+ *
+ * A directory is trusted only while all its children listed are still in the
+ * directory tree. So the mark of a directory is dropped when a node under it
+ * is evicted, and a listing during which any node is evicted is not recorded.
+ *
+ * Paths should be erased when they are created by us.
+ */
+class NegativeLookupCache : private boost::noncopyable {
+ public:
+  // Construct negative lookup cache
+  //
+  // @param  : max count of each kind of paths, expire time in seconds
+  // @return :
+  NegativeLookupCache(size_t maxCount, uint32_t expireInSec);
+
+ public:
+  // Whether the path is known to be absent
+  bool Has(const std::string &path);
+
+  // Record a path not found
+  void Add(const std::string &path);
+
+  // Whether the directory has been listed completely
+  bool IsListedDirectory(const std::string &dirPath);
+
+  // Record a directory listed completely
+  //
+  // @param  : dir path, num of evictions got before listing
+  // @return : void
+  //
+  // The directory is not recorded if any node is evicted since then.
+  void AddListedDirectory(const std::string &dirPath, uint64_t numEvictions);
+
+  // Record a node evicted from the directory tree
+  //
+  // @param  : path of the node
+  // @return : void
+  void OnNodeEvicted(const std::string &path);
+
+  // Return the num of nodes evicted so far
+  uint64_t GetNumEvictions() const;
+
+  // Erase the path and paths under it
+  //
+  // @param  : path with or without trailing delimiter
+  // @return : void
+  //
+  // Directories listed which are the path or under it are erased too.
+  void Erase(const std::string &path);
+
+  size_t GetNumPaths() const;
+  size_t GetNumListedDirectories() const;
+
+ private:
+  NegativeLookupCache() {}
+
+  typedef std::list<std::pair<std::string, time_t> > PathTimeList;
+  typedef std::map<std::string, PathTimeList::iterator> PathToTimeListIterMap;
+
+  // Paths in insertion order with their recorded time
+  struct PathSet {
+    PathTimeList m_list;
+    PathToTimeListIterMap m_map;  // ordered to erase paths under a directory
+  };
+
+  // Following helpers expect lock is held
+  bool Has(PathSet *set, const std::string &path);
+  void Add(PathSet *set, const std::string &path);
+  void Erase(PathSet *set, const std::string &path);
+  void EraseUnder(PathSet *set, const std::string &dirPath);
+
+ private:
+  size_t m_maxCount;
+  time_t m_expireInSec;
+
+  mutable boost::mutex m_mutex;
+  PathSet m_paths;        // paths not found
+  PathSet m_listedDirs;   // directories listed completely
+  uint64_t m_numEvictions;
+};
+
+}  // namespace Data
+}  // namespace QS
+
+#endif  // QSFS_DATA_NEGATIVELOOKUPCACHE_H_
@@ -78,8 +78,8 @@ Node::~Node() {
 }
 
 // --------------------------------------------------------------------------
-shared_ptr<Node> Node::Find(const string &childFileName) const {
-  ChildrenMapConstIterator child = m_children.find(childFileName);
+shared_ptr<Node> Node::Find(const string &childFilePath) const {
+  ChildrenMapConstIterator child = m_children.find(GetChildName(childFilePath));
   if (child != m_children.end()) {
     return child->second;
   }
@@ -88,22 +88,22 @@ shared_ptr<Node> Node::Find(const string &childFileName) const {
 
 // --------------------------------------------------------------------------
 bool Node::HaveChild(const string &childFilePath) const {
-  return m_children.find(childFilePath) != m_children.end();
+  return m_children.find(GetChildName(childFilePath)) != m_children.end();
 }
 
 // --------------------------------------------------------------------------
-const FilePathToNodeUnorderedMap &Node::GetChildren() const {
+const ChildNameToNodeUnorderedMap &Node::GetChildren() const {
   return m_children;
 }
 
 // --------------------------------------------------------------------------
-FilePathToNodeUnorderedMap &Node::GetChildren() { return m_children; }
+ChildNameToNodeUnorderedMap &Node::GetChildren() { return m_children; }
 
 // --------------------------------------------------------------------------
 set<string> Node::GetChildrenIds() const {
   set<string> ids;
-  BOOST_FOREACH(const FilePathToNodeUnorderedMap::value_type &p, m_children) {
-    ids.insert(p.first);
+  BOOST_FOREACH(const ChildNameToNodeUnorderedMap::value_type &p, m_children) {
+    ids.insert(p.second->GetFilePath());
   }
   return ids;
 }
@@ -113,8 +113,8 @@ deque<string> Node::GetDescendantIds() const {
   deque<string> ids;
   deque<shared_ptr<Node> > childs;
 
-  BOOST_FOREACH(const FilePathToNodeUnorderedMap::value_type &p, m_children) {
-    ids.push_back(p.first);
+  BOOST_FOREACH(const ChildNameToNodeUnorderedMap::value_type &p, m_children) {
+    ids.push_back(p.second->GetFilePath());
     childs.push_back(p.second);
   }
 
@@ -123,9 +123,9 @@ deque<string> Node::GetDescendantIds() const {
     childs.pop_front();
 
     if (child->IsDirectory()) {
-      BOOST_FOREACH(const FilePathToNodeUnorderedMap::value_type &p,
+      BOOST_FOREACH(const ChildNameToNodeUnorderedMap::value_type &p,
                      child->GetChildren()) {
-        ids.push_back(p.first);
+        ids.push_back(p.second->GetFilePath());
         childs.push_back(p.second);
       }
     }
@@ -139,7 +139,7 @@ shared_ptr<Node> Node::Insert(const shared_ptr<Node> &child) {
   assert(IsDirectory());
   if (child) {
     pair<ChildrenMapIterator, bool> res =
-        m_children.emplace(child->GetFilePath(), child);
+        m_children.emplace(GetChildName(child->GetFilePath()), child);
     if (res.second) {
       if (child->IsDirectory()) {
         m_entry.IncreaseNumLink();
@@ -168,7 +168,7 @@ void Node::Remove(const string &childFilePath) {
   if (childFilePath.empty()) return;
 
   bool reset = m_children.size() == 1 ? true : false;
-  ChildrenMapIterator it = m_children.find(childFilePath);
+  ChildrenMapIterator it = m_children.find(GetChildName(childFilePath));
   if (it != m_children.end()) {
     m_children.erase(it);
     if (reset) m_children.clear();
@@ -184,32 +184,12 @@ void Node::Rename(const string &newFilePath) {
     if (oldFilePath == newFilePath) {
       return;
     }
-    if (m_children.find(newFilePath) != m_children.end()) {
-      DebugWarning("Cannot rename, target node already exist " +
-                   FormatPath(oldFilePath, newFilePath));
-      return;
-    }
 
     m_entry.Rename(newFilePath);
 
-    if (m_children.empty()) {
-      return;
-    }
-
-    deque<shared_ptr<Node> > childs;
-    BOOST_FOREACH(FilePathToNodeUnorderedMap::value_type &p, m_children) {
-      childs.push_back(p.second);
-    }
-    m_children.clear();
-    BOOST_FOREACH(shared_ptr<Node> &child, childs) {
-      string newPath = AppendPathDelim(newFilePath) + child->MyBaseName();
-      pair<ChildrenMapIterator, bool> res = m_children.emplace(newPath, child);
-      if (res.second) {
-        child->Rename(newPath);
-      } else {
-        DebugWarning("Node rename failed " +
-                     FormatPath(child->GetFilePath()));
-      }
+    // children keep their names, only their paths are changed
+    BOOST_FOREACH(ChildNameToNodeUnorderedMap::value_type &p, m_children) {
+      p.second->Rename(AppendPathDelim(newFilePath) + p.first);
     }
   }
 }
@@ -221,29 +201,37 @@ void Node::RenameChild(const string &oldFilePath, const string &newFilePath) {
     return;
   }
 
-  if (m_children.find(newFilePath) != m_children.end()) {
+  string oldName = GetChildName(oldFilePath);
+  string newName = GetChildName(newFilePath);
+  if (oldName != newName && m_children.find(newName) != m_children.end()) {
     DebugWarning("Cannot rename, target node already exist " +
                  FormatPath(oldFilePath, newFilePath));
     return;
   }
 
-  ChildrenMapIterator it = m_children.find(oldFilePath);
+  ChildrenMapIterator it = m_children.find(oldName);
   if (it != m_children.end()) {
-    shared_ptr<Node> &child = it->second;
+    shared_ptr<Node> child = it->second;
     child->Rename(newFilePath);
-
-    // Need to emplace before erase, otherwise the shared_ptr
-    // will probably get deleted when erasing cause its' reference
-    // count to be 0.
-    pair<ChildrenMapIterator, bool> res = m_children.emplace(newFilePath, child);
-    if (!res.second) {
-      DebugWarning("Fail to rename " + FormatPath(oldFilePath, newFilePath));
+    if (oldName != newName) {
+      m_children.erase(it);
+      m_children.emplace(newName, child);
     }
-    m_children.erase(it);
   } else {
     DebugWarning("Node not exist, no rename " + FormatPath(oldFilePath));
   }
 }
 
+// --------------------------------------------------------------------------
+string Node::GetChildName(const string &childFilePath) {
+  if (childFilePath.empty()) {
+    return childFilePath;
+  }
+  // skip the trailing "/" of a directory
+  string::size_type pos = childFilePath.find_last_of(
+      '/', childFilePath.size() >= 2 ? childFilePath.size() - 2 : 0);
+  return pos == string::npos ? childFilePath : childFilePath.substr(pos + 1);
+}
+
 }  // namespace Data
 }  // namespace QS
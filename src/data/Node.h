@@ -37,6 +37,10 @@
 
 namespace QS {
 
+namespace Client {
+class QSClient;
+}  // namespace Client
+
 namespace FileSystem {
 class Drive;
 }  // namespace FileSystem
@@ -50,8 +54,15 @@ class Node;
 typedef boost::unordered_map<std::string, boost::shared_ptr<Node>,
                              HashUtils::StringHash>
     FilePathToNodeUnorderedMap;
-typedef FilePathToNodeUnorderedMap::iterator ChildrenMapIterator;
-typedef FilePathToNodeUnorderedMap::const_iterator ChildrenMapConstIterator;
+
+// Children are keyed by name instead of file path, so the path of a child is
+// only stored in its meta data. The name is the last component of the file
+// path, with a trailing "/" for a directory.
+typedef boost::unordered_map<std::string, boost::shared_ptr<Node>,
+                             HashUtils::StringHash>
+    ChildNameToNodeUnorderedMap;
+typedef ChildNameToNodeUnorderedMap::iterator ChildrenMapIterator;
+typedef ChildNameToNodeUnorderedMap::const_iterator ChildrenMapConstIterator;
 
 
 /**
@@ -90,11 +101,11 @@ class Node : private boost::noncopyable {
   bool HaveChild(const std::string &childFilePath) const;
   boost::shared_ptr<Node> Find(const std::string &childFilePath) const;
 
-  // Get Children
+  // Get Children, which are keyed by name
   // DO NOT store the map
-  const FilePathToNodeUnorderedMap &GetChildren() const;
+  const ChildNameToNodeUnorderedMap &GetChildren() const;
 
-  // Get the children's id (one level)
+  // Get the children's file path (one level)
   std::set<std::string> GetChildrenIds() const;
 
   // Get the children file names recursively
@@ -119,6 +130,12 @@ class Node : private boost::noncopyable {
   void RenameChild(const std::string &oldFilePath,
                    const std::string &newFilePath);
 
+  // Return the name of a child in its directory
+  //
+  // @param  : child file path
+  // @return : last component of the path, ending with "/" for a directory
+  static std::string GetChildName(const std::string &childFilePath);
+
   // accessor
   const Entry &GetEntry() const { return m_entry; }
   boost::shared_ptr<Node> GetParent() const { return m_parent.lock(); }
@@ -157,7 +174,7 @@ class Node : private boost::noncopyable {
  private:
   Entry &GetEntry() { return m_entry; }
 
-  FilePathToNodeUnorderedMap &GetChildren();
+  ChildNameToNodeUnorderedMap &GetChildren();
 
   void SetFileOpen(bool fileOpen) {
     boost::lock_guard<boost::mutex> locker(m_fileOpenLock);
@@ -173,6 +190,13 @@ class Node : private boost::noncopyable {
     }
   }
 
+  // Mark the node as synchronized with the object storage at the given time
+  void SetCachedTime(time_t t) {
+    if (m_entry) {
+      m_entry.SetCachedTime(t);
+    }
+  }
+
   void SetEntry(const Entry &entry) { m_entry = entry; }
   void SetParent(const boost::shared_ptr<Node> &parent) { m_parent = parent; }
   void SetSymbolicLink(const std::string &symLnk) { m_symbolicLink = symLnk; }
@@ -191,8 +215,9 @@ class Node : private boost::noncopyable {
   std::string m_symbolicLink;
   // Node will control the life of its children, so only Node hold a shared_ptr
   // to its children, others should use weak_ptr instead
-  FilePathToNodeUnorderedMap m_children;
+  ChildNameToNodeUnorderedMap m_children;
 
+  friend class QS::Client::QSClient;  // for SetCachedTime
   friend class QS::Data::File;
   friend class QS::Data::DirectoryTree;
   friend class QS::FileSystem::Drive;  // for SetSymbolicLink, IncreaseNumLink
@@ -17,22 +17,18 @@
 #include "data/Page.h"
 
 #include <assert.h>
+#include <string.h>
 
-#include <fstream>
-#include <sstream>
 #include <string>
+#include <vector>
 
 #include "base/LogMacros.h"
 #include "base/StringUtils.h"
-#include "base/Utils.h"
-#include "base/UtilsWithLog.h"
-#include "configure/Options.h"
-#include "data/IOStream.h"
+#include "data/BufferArena.h"
+#include "data/DiskFile.h"
 #include "data/StreamUtils.h"
 
 #include "boost/exception/to_string.hpp"
-#include "boost/make_shared.hpp"
-#include "boost/noncopyable.hpp"
 #include "boost/shared_ptr.hpp"
 #include "boost/thread/locks.hpp"
 #include "boost/thread/recursive_mutex.hpp"
@@ -42,62 +38,28 @@ namespace QS {
 namespace Data {
 
 using boost::lock_guard;
-using boost::make_shared;
 using boost::recursive_mutex;
 using boost::shared_ptr;
 using boost::to_string;
-using QS::Data::IOStream;
 using QS::Data::StreamUtils::GetStreamSize;
 using QS::StringUtils::FormatPath;
 using QS::StringUtils::PointerAddress;
-using QS::Utils::GetDirName;
-using QS::UtilsWithLog::CreateDirectoryIfNotExists;
-using QS::UtilsWithLog::FileExists;
-using std::fstream;
 using std::iostream;
-using std::stringstream;
 using std::string;
-
-namespace {
-
-// RAII class to open file and close it in destructor
-class FileOpener : private boost::noncopyable {
- public:
-  explicit FileOpener(const shared_ptr<iostream> &body) {
-    m_file = dynamic_cast<fstream *>(body.get());
-  }
-
-  ~FileOpener() {
-    if (m_file != NULL && m_file->is_open()) {
-      m_file->flush();
-      m_file->close();
-    }
-  }
-
-  void DoOpen(const string &filename, std::ios_base::openmode mode) {
-    if (m_file != NULL && !filename.empty()) {
-      m_file->open(filename.c_str(), mode);
-      if (!m_file->is_open()) {
-        DebugError("Fail to open file " + FormatPath(filename));
-      }
-    } else {
-      DebugError("Invalid parameter");
-    }
-  }
-
- private:
-  FileOpener() : m_file(NULL) {}
-
-  fstream *m_file;
-};
-
-}  // namespace
+using std::vector;
 
 // --------------------------------------------------------------------------
-Page::Page(off_t offset, size_t len, const char *buffer)
-    : m_offset(offset), m_size(len), m_body(make_shared<IOStream>(len)) {
+Page::Page(off_t offset, size_t len, const char *buffer,
+           const shared_ptr<BufferArena> &arena)
+    : m_offset(offset),
+      m_size(len),
+      m_data(NULL),
+      m_capacity(0),
+      m_arena(arena),
+      m_diskReserved(0),
+      m_good(false) {
   lock_guard<recursive_mutex> lock(m_mutex);
-  bool isValidInput = offset >= 0 && len >= 0 && buffer != NULL;
+  bool isValidInput = offset >= 0 && len >= 0 && buffer != NULL && arena;
   assert(isValidInput);
   if (!isValidInput) {
     DebugError("Try to new a page with invalid input " +
@@ -105,14 +67,21 @@ Page::Page(off_t offset, size_t len, const char *buffer)
     return;
   }
 
-  UnguardedPutToBody(offset, len, buffer);
+  m_good = ReserveBuffer(len) && UnguardedPutToBody(offset, len, buffer);
 }
 
 // --------------------------------------------------------------------------
-Page::Page(off_t offset, size_t len, const char *buffer, const string &diskfile)
-    : m_offset(offset), m_size(len), m_diskFile(diskfile) {
+Page::Page(off_t offset, size_t len, const char *buffer,
+           const shared_ptr<DiskFile> &diskFile)
+    : m_offset(offset),
+      m_size(len),
+      m_data(NULL),
+      m_capacity(0),
+      m_diskFile(diskFile),
+      m_diskReserved(0),
+      m_good(false) {
   lock_guard<recursive_mutex> lock(m_mutex);
-  bool isValidInput = offset >= 0 && len >= 0 && buffer != NULL;
+  bool isValidInput = offset >= 0 && len >= 0 && buffer != NULL && diskFile;
   assert(isValidInput);
   if (!isValidInput) {
     DebugError("Try to new a page with invalid input " +
@@ -120,16 +89,21 @@ Page::Page(off_t offset, size_t len, const char *buffer, const string &diskfile)
     return;
   }
 
-  if (SetupDiskFile()) {
-    UnguardedPutToBody(offset, len, buffer);
-  }
+  m_good = UnguardedPutToBody(offset, len, buffer);
 }
 
 // --------------------------------------------------------------------------
-Page::Page(off_t offset, size_t len, const shared_ptr<iostream> &instream)
-    : m_offset(offset), m_size(len), m_body(make_shared<IOStream>(len)) {
+Page::Page(off_t offset, size_t len, const shared_ptr<iostream> &instream,
+           const shared_ptr<BufferArena> &arena)
+    : m_offset(offset),
+      m_size(len),
+      m_data(NULL),
+      m_capacity(0),
+      m_arena(arena),
+      m_diskReserved(0),
+      m_good(false) {
   lock_guard<recursive_mutex> lock(m_mutex);
-  bool isValidInput = offset >= 0 && len >= 0 && instream;
+  bool isValidInput = offset >= 0 && len >= 0 && instream && arena;
   assert(isValidInput);
   if (!isValidInput) {
     DebugError("Try to new a page with invalid input " +
@@ -137,15 +111,21 @@ Page::Page(off_t offset, size_t len, const shared_ptr<iostream> &instream)
     return;
   }
 
-  UnguardedPutToBody(offset, len, instream);
+  m_good = ReserveBuffer(len) && UnguardedPutToBody(offset, len, instream);
 }
 
 // --------------------------------------------------------------------------
 Page::Page(off_t offset, size_t len, const shared_ptr<iostream> &instream,
-           const string &diskfile)
-    : m_offset(offset), m_size(len), m_diskFile(diskfile) {
+           const shared_ptr<DiskFile> &diskFile)
+    : m_offset(offset),
+      m_size(len),
+      m_data(NULL),
+      m_capacity(0),
+      m_diskFile(diskFile),
+      m_diskReserved(0),
+      m_good(false) {
   lock_guard<recursive_mutex> lock(m_mutex);
-  bool isValidInput = offset >= 0 && len > 0 && instream;
+  bool isValidInput = offset >= 0 && len > 0 && instream && diskFile;
   assert(isValidInput);
   if (!isValidInput) {
     DebugError("Try to new a page with invalid input " +
@@ -153,11 +133,12 @@ Page::Page(off_t offset, size_t len, const shared_ptr<iostream> &instream,
     return;
   }
 
-  if (SetupDiskFile()) {
-    UnguardedPutToBody(offset, len, instream);
-  }
+  m_good = UnguardedPutToBody(offset, len, instream);
 }
 
+// --------------------------------------------------------------------------
+Page::~Page() { ReleaseBuffer(); }
+
 // --------------------------------------------------------------------------
 string Page::ToString() const {
   return "[" + to_string(m_offset) + ":" + to_string(m_size) + "]";
@@ -166,50 +147,43 @@ string Page::ToString() const {
 // --------------------------------------------------------------------------
 bool Page::UseDiskFile() {
   lock_guard<recursive_mutex> lock(m_mutex);
-  return !m_diskFile.empty();
+  return static_cast<bool>(m_diskFile);
 }
 
 // --------------------------------------------------------------------------
 bool Page::UseDiskFileNoLock() {
-  return !m_diskFile.empty();
+  return static_cast<bool>(m_diskFile);
 }
 
 // --------------------------------------------------------------------------
-void Page::UnguardedPutToBody(off_t offset, size_t len, const char *buffer) {
+bool Page::UnguardedPutToBody(off_t offset, size_t len, const char *buffer) {
   lock_guard<recursive_mutex> lock(m_mutex);
-  if (!m_body) {
-    DebugError("null body stream " + ToStringLine(offset, len, buffer));
-    return;
-  }
-  if(len ==0){
-    return;
-  }
-  FileOpener opener(m_body);
-  if (UseDiskFileNoLock()) {
-    // Notice: need to open in both output and input mode to avoid truncate file
-    // as open in out mode only will actually truncate file.
-    opener.DoOpen(m_diskFile, std::ios_base::binary | std::ios_base::ate |
-                  std::ios_base::in | std::ios_base::out);  // open for write
-    m_body->seekp(m_offset, std::ios_base::beg);
-  } else {
-    m_body->seekp(0, std::ios_base::beg);
+  if (len == 0) {
+    return true;
   }
-  if (!m_body->good()) {
-    DebugError("Fail to seek body " + ToStringLine(offset, len, buffer));
-  } else {
-    m_body->write(buffer, len);
-    if (!m_body->good()) {
-      DebugError("Fail to write buffer " + ToStringLine(offset, len, buffer));
+  if (!UseDiskFileNoLock()) {
+    if (m_data == NULL) {
+      DebugError("null buffer " + ToStringLine(offset, len, buffer));
+      return false;
     }
+    memcpy(m_data, buffer, len);
+    return true;
   }
+  // reserve disk space at first, so it fails early if disk is full
+  if (!ReserveDiskSpace(len) ||
+      !m_diskFile->Write(m_offset, len, buffer)) {
+    DebugError("Fail to write buffer " + ToStringLine(offset, len, buffer));
+    return false;
+  }
+  return true;
 }
 
 // --------------------------------------------------------------------------
-void Page::UnguardedPutToBody(off_t offset, size_t len,
+bool Page::UnguardedPutToBody(off_t offset, size_t len,
                               const shared_ptr<iostream> &instream) {
   lock_guard<recursive_mutex> lock(m_mutex);
   if (len == 0) {
-    return;
+    return true;
   }
   size_t instreamLen = GetStreamSize(instream);
   if (instreamLen < len) {
@@ -219,77 +193,91 @@ void Page::UnguardedPutToBody(off_t offset, size_t len,
     m_size = instreamLen;
   }
 
-  FileOpener opener(m_body);
-  if (UseDiskFileNoLock()) {
-    opener.DoOpen(m_diskFile, std::ios_base::binary | std::ios_base::ate |
-                  std::ios_base::in | std::ios_base::out);  // open for write
-    m_body->seekp(m_offset, std::ios_base::beg);
-  } else {
-    m_body->seekp(0, std::ios_base::beg);
-  }
-  if (!m_body->good()) {
-    DebugError("Fail to seek body " + ToStringLine(offset, len));
-  } else {
-    instream->seekg(0, std::ios_base::beg);
-    if (len == instreamLen) {
-      (*m_body) << instream->rdbuf();
-    } else if (len < instreamLen) {
-      stringstream ss;
-      ss << instream->rdbuf();
-      m_body->write(ss.str().c_str(), len);
+  instream->seekg(0, std::ios_base::beg);
+  if (!UseDiskFileNoLock()) {
+    if (m_data == NULL) {
+      DebugError("null buffer " + ToStringLine(offset, len));
+      return false;
     }
-    if (!m_body->good()) {
-      DebugError("Fail to write buffer " + ToStringLine(offset, len));
+    instream->read(m_data, len);
+    if (!instream->good()) {
+      DebugError("Fail to read input stream " + ToStringLine(offset, len));
+      return false;
     }
+    return true;
+  }
+
+  vector<char> buf(len);
+  instream->read(&buf[0], len);
+  if (!instream->good()) {
+    DebugError("Fail to read input stream " + ToStringLine(offset, len));
+    return false;
   }
+  return UnguardedPutToBody(offset, len, &buf[0]);
 }
 
 // --------------------------------------------------------------------------
-void Page::SetStream(const shared_ptr<iostream> &stream) {
+void Page::ResizeToSmallerSize(size_t smallerSize) {
+  // Do a lazy resize, just change size to 'samllerSize'.
+  // Buffer of in-memory page is kept, as it will be reused when page grows.
+  // Bytes of disk file page are kept, as they will be overwritten.
+  assert(0 <= smallerSize && smallerSize <= m_size);
   lock_guard<recursive_mutex> lock(m_mutex);
-  m_body = stream;
+  m_size = smallerSize;
 }
 
 // --------------------------------------------------------------------------
-bool Page::SetupDiskFile() {
+bool Page::ReserveBuffer(size_t size) {
   lock_guard<recursive_mutex> lock(m_mutex);
-  CreateDirectoryIfNotExists(
-      QS::Configure::Options::Instance().GetDiskCacheDirectory());
-
-  std::ios_base::openmode mode = std::ios_base::binary | std::ios_base::ate |
-                                 std::ios_base::in | std::ios_base::out;
-  if (!FileExists(m_diskFile)) {
-    // Notice: set open mode with std::ios_base::out to create file in disk if
-    // it is not exist
-    mode = std::ios_base::binary | std::ios_base::out;
+  if (size <= m_capacity) {
+    return true;
   }
-  shared_ptr<fstream> file = make_shared<fstream>(m_diskFile.c_str(), mode);
-  if (file && file->is_open()) {
-    DebugInfo("Open file " + FormatPath(m_diskFile));
+  if (!m_arena) {
+    DebugError("null arena " + ToStringLine(m_offset, size));
+    return false;
+  }
+  char *data = m_arena->Allocate(size);
+  if (data == NULL) {
+    DebugError("Fail to allocate buffer " + ToStringLine(m_offset, size));
+    return false;
   }
-  file->close();
-  m_body = file;
+  if (m_data != NULL) {
+    memcpy(data, m_data, m_size);
+    m_arena->Deallocate(m_data, m_capacity);
+  }
+  m_data = data;
+  m_capacity = BufferArena::GetAllocSize(size);
   return true;
 }
 
 // --------------------------------------------------------------------------
-void Page::ResizeToSmallerSize(size_t smallerSize) {
-  // Do a lazy resize:
-  // 1. Change size to 'samllerSize'.
-  // 2. Set output position indicator to 'samllerSize'.
-  assert(0 <= smallerSize && smallerSize <= m_size);
+bool Page::ReserveDiskSpace(size_t size) {
   lock_guard<recursive_mutex> lock(m_mutex);
-  m_size = smallerSize;
-  if (UseDiskFileNoLock()) {
-    m_body->seekp(m_offset + smallerSize, std::ios_base::beg);
-  } else {
-    m_body->seekp(smallerSize, std::ios_base::beg);
+  if (size <= m_diskReserved) {
+    return true;
+  }
+  // grow in size classes, so sequential appends only reserve a few times
+  size_t reserveSize = BufferArena::GetAllocSize(size);
+  if (!m_diskFile || !m_diskFile->Reserve(m_offset, reserveSize)) {
+    return false;
+  }
+  m_diskReserved = reserveSize;
+  return true;
+}
+
+// --------------------------------------------------------------------------
+void Page::ReleaseBuffer() {
+  lock_guard<recursive_mutex> lock(m_mutex);
+  if (m_data != NULL && m_arena) {
+    m_arena->Deallocate(m_data, m_capacity);
   }
+  m_data = NULL;
+  m_capacity = 0;
 }
 
 // --------------------------------------------------------------------------
 bool Page::Refresh(off_t offset, size_t len, const char *buffer,
-                   const string &diskfile) {
+                   const shared_ptr<DiskFile> &diskFile) {
   lock_guard<recursive_mutex> lock(m_mutex);
   if (len == 0) {
     return true;  // do nothing
@@ -303,71 +291,61 @@ bool Page::Refresh(off_t offset, size_t len, const char *buffer,
     return false;
   }
 
-  return UnguardedRefresh(offset, len, buffer, diskfile);
+  return UnguardedRefresh(offset, len, buffer, diskFile);
 }
 
 // --------------------------------------------------------------------------
 bool Page::UnguardedRefresh(off_t offset, size_t len, const char *buffer,
-                            const string &diskfile) {
+                            const shared_ptr<DiskFile> &diskFile) {
   lock_guard<recursive_mutex> lock(m_mutex);
-  size_t moreLen = offset + len - Next();
-  size_t dataLen = moreLen > 0 ? m_size + moreLen : m_size;
-  shared_ptr<IOStream> data = make_shared<IOStream>(dataLen);
-  {
-    FileOpener opener(m_body);
-    if (UseDiskFileNoLock()) {
-      opener.DoOpen(m_diskFile,
-                    std::ios_base::binary | std::ios_base::in);  // for read
-      m_body->seekg(offset, std::ios_base::beg);
-    } else {
-      m_body->seekg(0, std::ios_base::beg);
-    }
-    (*data) << m_body->rdbuf();
-  }
-
-  data->seekp(offset - m_offset, std::ios_base::beg);
-  data->write(buffer, len);
-
-  if (!data->good()) {
-    DebugError("Fail to refresh page(" + ToStringLine(m_offset, m_size) +
-               ") with input " + ToStringLine(offset, len, buffer));
-    return false;
-  }
-
-  if (!diskfile.empty()) {
-    m_diskFile = diskfile;
-    if (!SetupDiskFile()) {
-      DebugError("Unable to set up file " + FormatPath(m_diskFile));
+  off_t stop = offset + static_cast<off_t>(len);
+  size_t moreLen = stop > Next() ? static_cast<size_t>(stop - Next()) : 0;
+  bool moveToDisk = diskFile && !UseDiskFileNoLock();
+
+  if (!UseDiskFileNoLock() && !moveToDisk) {
+    // update in-memory buffer in place, enlarge it if not large enough
+    if (!ReserveBuffer(m_size + moreLen)) {
+      DebugError("Fail to refresh page(" + ToStringLine(m_offset, m_size) +
+                 ") with input " + ToStringLine(offset, len, buffer));
       return false;
     }
+    if (offset > Next()) {
+      // fill the hole between the page and the input
+      memset(m_data + m_size, 0, offset - Next());
+    }
+    memcpy(m_data + (offset - m_offset), buffer, len);
+    m_size += moreLen;
+    return true;
   }
 
-  FileOpener opener(m_body);
-  if (UseDiskFileNoLock()) {
-    opener.DoOpen(m_diskFile, std::ios_base::binary | std::ios_base::ate |
-                  std::ios_base::in | std::ios_base::out);  // open for write
-    m_body->seekp(m_offset, std::ios_base::beg);
-    if (!m_body->good()) {
-      DebugError("Fail to seek page(" + ToStringLine(m_offset, m_size) +
-                 ") with input " + ToStringLine(offset, len, buffer));
+  if (moveToDisk) {
+    // put page's content to disk file, then release the in-memory buffer
+    m_diskFile = diskFile;
+    if (!ReserveDiskSpace(m_size) ||
+        !diskFile->Write(m_offset, m_size, m_data)) {
+      DebugError("Fail to move page(" + ToStringLine(m_offset, m_size) +
+                 ") to disk file " + FormatPath(diskFile->GetPath()));
+      m_diskFile.reset();
       return false;
     }
-    data->seekg(0, std::ios_base::beg);
-    (*m_body) << data->rdbuf();  // put pages' all content into disk file
-  } else {
-    data->seekg(0, std::ios_base::beg);
-    m_body = data;
+    ReleaseBuffer();
   }
-  if (moreLen > 0) {
-    m_size += moreLen;
+
+  // disk file is an image of the whole file, so update it in place
+  bool success = ReserveDiskSpace(m_size + moreLen);
+  if (success && offset > Next()) {
+    // fill the hole between the page and the input
+    vector<char> hole(offset - Next());
+    success = m_diskFile->Write(Next(), hole.size(), &hole[0]);
   }
-  if (m_body->good()) {
-    return true;
-  } else {
+  success = success && m_diskFile->Write(offset, len, buffer);
+  if (!success) {
     DebugError("Fail to refresh page(" + ToStringLine(m_offset, m_size) +
                ") with input " + ToStringLine(offset, len, buffer));
     return false;
   }
+  m_size += moreLen;
+  return true;
 }
 
 // --------------------------------------------------------------------------
@@ -390,27 +368,18 @@ size_t Page::Read(off_t offset, size_t len, char *buffer) {
 
 // --------------------------------------------------------------------------
 size_t Page::UnguardedRead(off_t offset, size_t len, char *buffer) {
-  lock_guard<recursive_mutex> lock(m_mutex);  
-  if (!m_body) {
-    DebugError("null body stream " + ToStringLine(offset, len, buffer));
-    return 0;
-  }
-  FileOpener opener(m_body);
-  if (UseDiskFileNoLock()) {
-    opener.DoOpen(m_diskFile,
-                  std::ios_base::binary | std::ios_base::in);  // open for read
-    m_body->seekg(offset, std::ios_base::beg);
-  } else {
-    m_body->seekg(offset - m_offset, std::ios_base::beg);
-  }
-  if (!m_body->good()) {
-    DebugError("Fail to seek page(" + ToStringLine(m_offset, m_size) +
-               ") with input " + ToStringLine(offset, len, buffer));
-    return 0;
+  lock_guard<recursive_mutex> lock(m_mutex);
+  if (!UseDiskFileNoLock()) {
+    if (m_data == NULL) {
+      DebugError("null buffer " + ToStringLine(offset, len, buffer));
+      return 0;
+    }
+    memcpy(buffer, m_data + (offset - m_offset), len);
+    return len;
   }
 
-  m_body->read(buffer, len);
-  if (!m_body->good()) {
+  size_t readSize = m_diskFile->Read(offset, len, buffer);
+  if (readSize != len) {
     DebugError("Fail to read page(" + ToStringLine(m_offset, m_size) +
                ") with input " + ToStringLine(offset, len, buffer));
     return 0;
@@ -437,14 +406,5 @@ string ToStringLine(const string &fileId, off_t offset, size_t len,
          ", len:" + to_string(len) + ", buffer:" + PointerAddress(buffer) + "]";
 }
 
-// --------------------------------------------------------------------------
-string PageSetToString(const PageSet &pages) {
-  string str;
-  for (PageSetConstIterator p = pages.begin(); p != pages.end(); ++p) {
-    str.append((*p)->ToString());
-  }
-  return str;
-}
-
 }  // namespace Data
 }  // namespace QS
@@ -22,9 +22,9 @@
 #include <sys/types.h>  // for off_t
 
 #include <iostream>
-#include <set>
 #include <string>
 
+#include "boost/noncopyable.hpp"
 #include "boost/shared_ptr.hpp"
 #include "boost/thread/recursive_mutex.hpp"
 
@@ -32,9 +32,11 @@ namespace QS {
 
 namespace Data {
 
+class BufferArena;
+class DiskFile;
 class File;
 
-class Page {
+class Page : private boost::noncopyable {
  private:
   // Page attributes
   //
@@ -57,59 +59,70 @@ class Page {
   off_t m_offset;  // offset from the begin of owning File
   size_t m_size;   // size of bytes this page contains
 
-  // NOTICE: body stream should be QS::Data::IOStream which associated with
-  // QS::Data::StreamBuf when not use disk file; otherwise body stream is a
-  // fstream assoicated to a disk file.
-  // With the asssoicated stream buf or disk file, the body stream support to
-  // be read/write for multiple times, but keep in mind following things:
-  // 1) always seek to the right postion before to read/write body stream;
-  // 2) if use disk file, always use RAII FileOpener to open it for read/write
-  boost::shared_ptr<std::iostream> m_body;  // stream storing the bytes
+  // In-memory page stores the bytes in a buffer allocated from the arena,
+  // which is accessed with plain memcpy. The buffer's capacity is the size
+  // class of the arena, so the page can grow inside of it without copying.
+  char *m_data;
+  size_t m_capacity;  // size of buffer, zero for disk file page
+  boost::shared_ptr<BufferArena> m_arena;
 
-  std::string m_diskFile;  // disk file is used when in-memory cache is not
-                           // available, it is an absolute file path
+  // Disk file is used when in-memory cache is not available, it is shared by
+  // the pages of the owning File, and the page is stored at its file offset.
+  // Disk space is reserved in the size classes of the arena too, so appends
+  // to the page need not to reserve every time.
+  boost::shared_ptr<DiskFile> m_diskFile;
+  size_t m_diskReserved;  // size of disk space reserved from the offset
+
+  // Whether the content is stored when constructing, which fails if buffer
+  // could not be allocated or disk file could not be written, e.g. no space
+  bool m_good;
 
   mutable boost::recursive_mutex m_mutex;
 
  private:
-  Page() : m_offset(0), m_size(0) {}
+  Page()
+      : m_offset(0), m_size(0), m_data(NULL), m_capacity(0),
+        m_diskReserved(0), m_good(false) {}
 
  public:
   // Construct Page from a block of bytes
   //
-  // @param  : file offset, len of bytes, buffer
+  // @param  : file offset, len of bytes, buffer, arena
   // @return :
   //
-  // From pointer of buffer, number of len bytes will be writen.
+  // From pointer of buffer, number of len bytes will be writen to a buffer
+  // allocated from arena.
   // The owning file's offset is 'offset'.
-  Page(off_t offset, size_t len, const char *buffer);
+  Page(off_t offset, size_t len, const char *buffer,
+       const boost::shared_ptr<BufferArena> &arena);
 
   // Construct Page from a block of bytes (store it in disk file)
   //
-  // @param  : file offset, len, buffer, disk file path
+  // @param  : file offset, len, buffer, disk file
   // @return :
   Page(off_t offset, size_t len, const char *buffer,
-       const std::string &diskfile);
+       const boost::shared_ptr<DiskFile> &diskFile);
 
   // Construct Page from a stream
   //
-  // @param  : file offset, len of bytes, stream
+  // @param  : file offset, len of bytes, stream, arena
   // @return :
   //
-  // From stream, number of len bytes will be writen.
+  // From stream, number of len bytes will be writen to a buffer allocated
+  // from arena.
   // The owning file's offset is 'offset'.
-  Page(off_t offset, size_t len,
-       const boost::shared_ptr<std::iostream> &stream);
+  Page(off_t offset, size_t len, const boost::shared_ptr<std::iostream> &stream,
+       const boost::shared_ptr<BufferArena> &arena);
 
   // Construct Page from a stream (store it in disk file)
   //
   // @param  : file offset, len of bytes, stream, disk file
   // @return :
   Page(off_t offset, size_t len, const boost::shared_ptr<std::iostream> &stream,
-       const std::string &diskfile);
+       const boost::shared_ptr<DiskFile> &diskFile);
 
  public:
-  ~Page() {}
+  ~Page();
 
   // Return the stop position.
   off_t Stop() const { return 0 < m_size ? m_offset + m_size - 1 : 0; }
@@ -123,8 +136,15 @@ class Page {
   // Return the offset
   off_t Offset() const { return m_offset; }
 
-  // Return body
-  const boost::shared_ptr<std::iostream> &GetBody() const { return m_body; }
+  // Return size of the buffer allocated from arena
+  size_t Capacity() const { return m_capacity; }
+
+  // Return if the content is stored successfully when constructing
+  // A page which is not good should be dropped, as its content is lost.
+  bool IsGood() const { return m_good; }
+
+  // Return disk file, which is null for in-memory page
+  const boost::shared_ptr<DiskFile> &GetDiskFile() const { return m_diskFile; }
 
   // Retrun string of [offset:size]
   std::string ToString() const;
@@ -138,11 +158,12 @@ class Page {
   // @param  : file offset, len of bytes to update, buffer, disk file
   // @return : bool
   //
-  // May enlarge the page's size depended on 'len', and when the len
-  // is larger than page's size and using disk file, then all page's data
-  // will be put to disk file.
+  // May enlarge the page's size depended on 'len', bytes between the page's
+  // end and 'offset' will be filled with zero. When disk file is specified
+  // for an in-memory page, then all page's data will be put to disk file.
   bool Refresh(off_t offset, size_t len, const char *buffer,
-               const std::string &diskfile = std::string());
+               const boost::shared_ptr<DiskFile> &diskFile =
+                   boost::shared_ptr<DiskFile>());
 
   // Refresh the page's entire content
   //
@@ -169,28 +190,33 @@ class Page {
   size_t Read(char *buffer) { return Read(m_offset, m_size, buffer); }
 
  private:
-  // Set stream
-  void SetStream(const boost::shared_ptr<std::iostream> &stream);
-
-  // Setup disk file on disk
-  // - open the disk file
-  // - set stream to fstream assocating with disk file
-  bool SetupDiskFile();
-
   // Do a lazy resize for page.
   void ResizeToSmallerSize(size_t smallerSize);
 
-  // Put data to body
+  // Make the buffer be able to hold num of bytes, content is kept.
+  // For internal use only.
+  bool ReserveBuffer(size_t size);
+
+  // Make the disk space be able to hold num of bytes.
+  // For internal use only.
+  bool ReserveDiskSpace(size_t size);
+
+  // Give the buffer back to arena.
+  // For internal use only.
+  void ReleaseBuffer();
+
+  // Put data to body, return true if success
   // For internal use only
-  void UnguardedPutToBody(off_t offset, size_t len, const char *buffer);
-  void UnguardedPutToBody(off_t offset, size_t len,
+  bool UnguardedPutToBody(off_t offset, size_t len, const char *buffer);
+  bool UnguardedPutToBody(off_t offset, size_t len,
                           const boost::shared_ptr<std::iostream> &stream);
 
   // Refreseh the page's partial content without checking.
   // Starting from file offset, len of bytes will be updated.
   // For internal use only.
   bool UnguardedRefresh(off_t offset, size_t len, const char *buffer,
-                        const std::string &diskfile = std::string());
+                        const boost::shared_ptr<DiskFile> &diskFile =
+                            boost::shared_ptr<DiskFile>());
 
   // Refresh the page's partial content without checking.
   // Starting from file offset, all the page's remaining size will be updated.
@@ -234,17 +260,6 @@ class Page {
   friend class PageTest;
 };
 
-struct PageCmp {
-  bool operator()(const boost::shared_ptr<Page> &a,
-                  const boost::shared_ptr<Page> &b) const {
-    return a->Offset() < b->Offset();
-  }
-};
-
-typedef std::set<boost::shared_ptr<Page>, PageCmp> PageSet;
-typedef PageSet::const_iterator PageSetConstIterator;
-
-std::string PageSetToString(const PageSet &pages);
 std::string ToStringLine(const std::string &fileId, off_t offset, size_t len,
                          const char *buffer);
 std::string ToStringLine(off_t offset, size_t len, const char *buffer);
@@ -0,0 +1,161 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include "data/Readahead.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "boost/thread/locks.hpp"
+
+namespace QS {
+
+namespace Data {
+
+using boost::lock_guard;
+using boost::mutex;
+using std::max;
+using std::min;
+
+namespace {
+
+// max num of records read ahead for strided reads
+const int64_t kMaxStridedRecords = 16;
+
+}  // namespace
+
+// --------------------------------------------------------------------------
+const char *GetAccessPatternName(AccessPattern::Value pattern) {
+  switch (pattern) {
+    case AccessPattern::Sequential:
+      return "sequential";
+    case AccessPattern::Strided:
+      return "strided";
+    case AccessPattern::Random:
+      return "random";
+    default:
+      return "unknown";
+  }
+}
+
+// --------------------------------------------------------------------------
+Readahead::Readahead(size_t minWindowSize, size_t maxWindowSize)
+    : m_minWindowSize(minWindowSize),
+      m_maxWindowSize(max(minWindowSize, maxWindowSize)),
+      m_hasLastRead(false),
+      m_lastOffset(0),
+      m_lastLen(0),
+      m_stride(0),
+      m_pattern(AccessPattern::Unknown),
+      m_windowSize(0),
+      m_aheadStop(0) {}
+
+// --------------------------------------------------------------------------
+AccessPattern::Value Readahead::GetPattern() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_pattern;
+}
+
+// --------------------------------------------------------------------------
+size_t Readahead::GetWindowSize() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_windowSize;
+}
+
+// --------------------------------------------------------------------------
+ContentRangeDeque Readahead::OnRead(off_t offset, size_t len,
+                                    uint64_t fileSize) {
+  lock_guard<mutex> lock(m_mutex);
+  ContentRangeDeque ranges;
+  if (len == 0) {
+    return ranges;
+  }
+  AccessPattern::Value pattern = Detect(offset, len);
+  if (m_hasLastRead) {
+    m_stride = static_cast<int64_t>(offset - m_lastOffset);
+  }
+  m_hasLastRead = true;
+  m_lastOffset = offset;
+  m_lastLen = len;
+  m_pattern = pattern;
+
+  off_t stop = offset + static_cast<off_t>(len);
+  if (pattern == AccessPattern::Sequential) {
+    if (m_windowSize == 0) {
+      m_windowSize = m_minWindowSize;
+    }
+    m_aheadStop = max(m_aheadStop, stop);
+    // refill when half of the data read ahead is consumed
+    if (m_aheadStop - stop <= static_cast<off_t>(m_windowSize / 2)) {
+      AddRange(m_aheadStop, m_aheadStop + static_cast<off_t>(m_windowSize),
+               fileSize, &ranges);
+      m_windowSize = min(m_windowSize * 2, m_maxWindowSize);
+    }
+  } else if (pattern == AccessPattern::Strided) {
+    int64_t numRecords =
+        min(max(static_cast<int64_t>(m_minWindowSize / len),
+                static_cast<int64_t>(1)),
+            kMaxStridedRecords);
+    for (int64_t i = 1; i <= numRecords; ++i) {
+      off_t start = offset + static_cast<off_t>(i * m_stride);
+      if (start >= m_aheadStop) {
+        AddRange(start, start + static_cast<off_t>(len), fileSize, &ranges);
+      }
+    }
+    m_windowSize = 0;
+  } else {
+    m_windowSize = 0;
+    m_aheadStop = 0;
+  }
+  return ranges;
+}
+
+// --------------------------------------------------------------------------
+AccessPattern::Value Readahead::Detect(off_t offset, size_t len) const {
+  if (!m_hasLastRead) {
+    return offset == 0 ? AccessPattern::Sequential : AccessPattern::Unknown;
+  }
+  off_t lastStop = m_lastOffset + static_cast<off_t>(m_lastLen);
+  if (offset >= m_lastOffset && offset <= lastStop) {
+    return AccessPattern::Sequential;
+  }
+  // reads of a sequential reader could arrive out of order
+  if (m_pattern == AccessPattern::Sequential) {
+    off_t tolerance = static_cast<off_t>(max(m_windowSize, len));
+    if (offset + tolerance >= lastStop && offset <= lastStop + tolerance) {
+      return AccessPattern::Sequential;
+    }
+  }
+  int64_t stride = static_cast<int64_t>(offset - m_lastOffset);
+  if (stride > 0 && stride == m_stride) {
+    return AccessPattern::Strided;
+  }
+  return AccessPattern::Random;
+}
+
+// --------------------------------------------------------------------------
+void Readahead::AddRange(off_t start, off_t stop, uint64_t fileSize,
+                         ContentRangeDeque *ranges) {
+  stop = min(stop, static_cast<off_t>(fileSize));
+  if (start >= stop) {
+    return;
+  }
+  ranges->push_back(std::make_pair(start, static_cast<size_t>(stop - start)));
+  m_aheadStop = max(m_aheadStop, stop);
+}
+
+}  // namespace Data
+}  // namespace QS
@@ -0,0 +1,112 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#ifndef QSFS_DATA_READAHEAD_H_
+#define QSFS_DATA_READAHEAD_H_
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>
+
+#include <sys/types.h>  // for off_t
+
+#include <deque>
+#include <utility>
+
+#include "boost/noncopyable.hpp"
+#include "boost/thread/mutex.hpp"
+
+namespace QS {
+
+namespace Data {
+
+// Range represented by a pair of {offset, size}
+typedef std::deque<std::pair<off_t, size_t> > ContentRangeDeque;
+
+struct AccessPattern {
+  enum Value {
+    Unknown,     // not enough reads to tell
+    Sequential,  // read where the last read stops
+    Strided,     // skip the same distance between reads
+    Random
+  };
+};
+
+const char *GetAccessPatternName(AccessPattern::Value pattern);
+
+/**
+ * Readahead of an open file handle.
+ *
+ * The access pattern is detected from the reads of the handle. For sequential
+ * reads, a window of data ahead of the read is downloaded in background. The
+ * window starts at the min size and doubles every time it is refilled, up to
+ * the max size. A new window is issued when the reader has consumed half of
+ * the data read ahead, so downloads are pipelined with reading. For strided
+ * reads, the next records are read ahead. Random reads collapse the window
+ * and nothing is read ahead.
+ *
+ * Reads of a handle could arrive out of order with multi-threaded fuse, a
+ * read near the last one is still taken as sequential.
+ */
+class Readahead : private boost::noncopyable {
+ public:
+  // Construct readahead
+  //
+  // @param  : min window size, max window size
+  // @return :
+  Readahead(size_t minWindowSize, size_t maxWindowSize);
+
+ public:
+  AccessPattern::Value GetPattern() const;
+  size_t GetWindowSize() const;
+
+  // Detect the access pattern with a read
+  //
+  // @param  : read offset, read len, file size
+  // @return : ranges to read ahead, empty if none
+  //
+  // Ranges are clipped by file size, and never overlap with the ones
+  // returned before unless the window is collapsed.
+  ContentRangeDeque OnRead(off_t offset, size_t len, uint64_t fileSize);
+
+ private:
+  Readahead() {}
+
+  // Classify the read, lock should be held
+  AccessPattern::Value Detect(off_t offset, size_t len) const;
+
+  // Append range [start, stop) clipped by file size, lock should be held
+  void AddRange(off_t start, off_t stop, uint64_t fileSize,
+                ContentRangeDeque *ranges);
+
+ private:
+  mutable boost::mutex m_mutex;
+  size_t m_minWindowSize;
+  size_t m_maxWindowSize;
+
+  bool m_hasLastRead;
+  off_t m_lastOffset;
+  size_t m_lastLen;
+  int64_t m_stride;  // distance between offsets of the last two reads
+
+  AccessPattern::Value m_pattern;
+  size_t m_windowSize;  // 0 if collapsed
+  off_t m_aheadStop;    // end of data read ahead
+};
+
+}  // namespace Data
+}  // namespace QS
+
+#endif  // QSFS_DATA_READAHEAD_H_
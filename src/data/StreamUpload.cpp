@@ -0,0 +1,193 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include "data/StreamUpload.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "boost/foreach.hpp"
+#include "boost/thread/locks.hpp"
+
+namespace QS {
+
+namespace Data {
+
+using boost::lock_guard;
+using boost::mutex;
+using boost::unique_lock;
+using std::string;
+using std::vector;
+
+// --------------------------------------------------------------------------
+StreamUpload::StreamUpload(size_t partSize, size_t minPartSize,
+                           uint64_t threshold)
+    : m_partSize(std::max(partSize, minPartSize)),
+      m_minPartSize(minPartSize),
+      m_threshold(threshold),
+      m_initiating(false),
+      m_broken(false),
+      m_takenStop(0),
+      m_numPending(0) {}
+
+// --------------------------------------------------------------------------
+string StreamUpload::GetUploadId() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_uploadId;
+}
+
+// --------------------------------------------------------------------------
+bool StreamUpload::IsStarted() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_takenStop > 0;
+}
+
+// --------------------------------------------------------------------------
+bool StreamUpload::IsInitiated() const {
+  lock_guard<mutex> lock(m_mutex);
+  return !m_uploadId.empty();
+}
+
+// --------------------------------------------------------------------------
+bool StreamUpload::IsBroken() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_broken;
+}
+
+// --------------------------------------------------------------------------
+off_t StreamUpload::GetTakenStop() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_takenStop;
+}
+
+// --------------------------------------------------------------------------
+void StreamUpload::Break() {
+  lock_guard<mutex> lock(m_mutex);
+  m_broken = true;
+}
+
+// --------------------------------------------------------------------------
+StreamPartList StreamUpload::TakeReadyParts(uint64_t fileSize) {
+  lock_guard<mutex> lock(m_mutex);
+  StreamPartList parts;
+  if (m_broken || m_initiating || fileSize < m_threshold) {
+    return parts;
+  }
+  while (static_cast<uint64_t>(m_takenStop) + m_partSize + m_minPartSize <=
+         fileSize) {
+    parts.push_back(TakePart(m_partSize));
+  }
+  if (!parts.empty() && m_uploadId.empty()) {
+    m_initiating = true;
+  }
+  return parts;
+}
+
+// --------------------------------------------------------------------------
+void StreamUpload::FinishInitiate(const string &uploadId) {
+  lock_guard<mutex> lock(m_mutex);
+  m_initiating = false;
+  if (uploadId.empty()) {
+    m_broken = true;
+  } else {
+    m_uploadId = uploadId;
+  }
+  m_partDone.notify_all();
+}
+
+// --------------------------------------------------------------------------
+void StreamUpload::FinishPart(int partId, bool success) {
+  lock_guard<mutex> lock(m_mutex);
+  if (m_numPending > 0) {
+    --m_numPending;
+  }
+  if (success) {
+    m_uploadedParts.insert(partId);
+  } else {
+    m_broken = true;
+  }
+  m_partDone.notify_all();
+}
+
+// --------------------------------------------------------------------------
+void StreamUpload::OnWrite(off_t offset, size_t len) {
+  lock_guard<mutex> lock(m_mutex);
+  if (len == 0 || offset >= m_takenStop) {
+    return;
+  }
+  off_t stop = std::min(offset + static_cast<off_t>(len), m_takenStop);
+  int firstPartId = static_cast<int>(offset / m_partSize) + 1;
+  int lastPartId = static_cast<int>((stop - 1) / m_partSize) + 1;
+  for (int partId = firstPartId; partId <= lastPartId; ++partId) {
+    m_staleParts.insert(partId);
+  }
+}
+
+// --------------------------------------------------------------------------
+void StreamUpload::WaitForParts() {
+  unique_lock<mutex> lock(m_mutex);
+  while (m_numPending > 0 || m_initiating) {
+    m_partDone.wait(lock);
+  }
+}
+
+// --------------------------------------------------------------------------
+StreamPartList StreamUpload::TakeFinalParts(uint64_t fileSize) {
+  lock_guard<mutex> lock(m_mutex);
+  StreamPartList parts;
+  uint64_t takenStop = static_cast<uint64_t>(m_takenStop);
+  if (fileSize < takenStop ||
+      (fileSize > takenStop && fileSize - takenStop < m_minPartSize &&
+       takenStop > 0)) {
+    m_broken = true;
+  }
+  if (m_broken) {
+    return parts;
+  }
+  BOOST_FOREACH (int partId, m_staleParts) {
+    parts.push_back(StreamPart(
+        partId, static_cast<off_t>(partId - 1) * m_partSize, m_partSize));
+    ++m_numPending;
+  }
+  m_staleParts.clear();
+  while (static_cast<uint64_t>(m_takenStop) + m_partSize + m_minPartSize <=
+         fileSize) {
+    parts.push_back(TakePart(m_partSize));
+  }
+  if (fileSize > static_cast<uint64_t>(m_takenStop)) {
+    parts.push_back(TakePart(static_cast<size_t>(fileSize - m_takenStop)));
+  }
+  return parts;
+}
+
+// --------------------------------------------------------------------------
+vector<int> StreamUpload::GetSortedPartIds() const {
+  lock_guard<mutex> lock(m_mutex);
+  return vector<int>(m_uploadedParts.begin(), m_uploadedParts.end());
+}
+
+// --------------------------------------------------------------------------
+StreamPart StreamUpload::TakePart(size_t size) {
+  StreamPart part(static_cast<int>(m_takenStop / m_partSize) + 1, m_takenStop,
+                  size);
+  m_takenStop += static_cast<off_t>(size);
+  ++m_numPending;
+  return part;
+}
+
+}  // namespace Data
+}  // namespace QS
@@ -0,0 +1,157 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#ifndef QSFS_DATA_STREAMUPLOAD_H_
+#define QSFS_DATA_STREAMUPLOAD_H_
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>
+
+#include <sys/types.h>  // for off_t
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "boost/noncopyable.hpp"
+#include "boost/thread/condition_variable.hpp"
+#include "boost/thread/mutex.hpp"
+
+namespace QS {
+
+namespace Data {
+
+struct StreamPart {
+  int partId;  // start from 1
+  off_t offset;
+  size_t size;
+
+  StreamPart(int partId_, off_t offset_, size_t size_)
+      : partId(partId_), offset(offset_), size(size_) {}
+};
+
+typedef std::vector<StreamPart> StreamPartList;
+
+/**
+ * Bookkeeping of a multipart upload streamed while a file is being written.
+ *
+ * The file is cut into parts of the part size from the beginning. A part is
+ * ready once the file grows beyond its end by the min part size, so the rest
+ * of the file is never less than the min part size when it is closed. Parts
+ * are taken in order, and the multipart upload is initiated by the writer
+ * which takes the first parts.
+ *
+ * Parts rewritten after taken are uploaded again with the same part number at
+ * the end. The stream is broken if any part fails, or the file shrinks into
+ * the taken parts; the file should be uploaded as a whole then.
+ */
+class StreamUpload : private boost::noncopyable {
+ public:
+  // Construct stream upload
+  //
+  // @param  : part size, min part size, min file size to start streaming
+  // @return :
+  StreamUpload(size_t partSize, size_t minPartSize, uint64_t threshold);
+
+ public:
+  size_t GetPartSize() const { return m_partSize; }
+  std::string GetUploadId() const;
+
+  // Whether any part has been taken
+  bool IsStarted() const;
+
+  // Whether the multipart upload has been initiated successfully
+  bool IsInitiated() const;
+
+  // Whether the stream cannot be completed any more
+  bool IsBroken() const;
+
+  // Return the end of the taken parts
+  off_t GetTakenStop() const;
+
+  // Mark the stream as broken
+  void Break();
+
+  // Take the parts ready to upload
+  //
+  // @param  : file size
+  // @return : parts to upload
+  //
+  // If the multipart upload is not initiated yet, the caller should initiate
+  // it and call FinishInitiate before uploading the parts. Parts are not
+  // taken while another writer is initiating.
+  StreamPartList TakeReadyParts(uint64_t fileSize);
+
+  // Record the result of initiating multipart upload
+  //
+  // @param  : upload id, empty if fail to initiate
+  // @return : void
+  void FinishInitiate(const std::string &uploadId);
+
+  // Record the result of uploading a part taken
+  //
+  // @param  : part id, success or not
+  // @return : void
+  void FinishPart(int partId, bool success);
+
+  // Record a write of the file
+  //
+  // @param  : write offset, write len
+  // @return : void
+  //
+  // Parts taken which are rewritten will be uploaded again at the end.
+  void OnWrite(off_t offset, size_t len);
+
+  // Wait until all parts taken are finished
+  void WaitForParts();
+
+  // Take all parts left when the file is closed
+  //
+  // @param  : file size
+  // @return : rewritten parts and the rest of the file
+  //
+  // The stream is broken if the file shrinks into the taken parts.
+  StreamPartList TakeFinalParts(uint64_t fileSize);
+
+  // Return ids of uploaded parts in order
+  std::vector<int> GetSortedPartIds() const;
+
+ private:
+  StreamUpload() {}
+
+  // Take a part starting from the end of taken parts, lock should be held
+  StreamPart TakePart(size_t size);
+
+ private:
+  size_t m_partSize;
+  size_t m_minPartSize;
+  uint64_t m_threshold;
+
+  mutable boost::mutex m_mutex;
+  boost::condition_variable m_partDone;
+  std::string m_uploadId;
+  bool m_initiating;
+  bool m_broken;
+  off_t m_takenStop;            // end of taken parts
+  size_t m_numPending;          // num of parts taken but not finished
+  std::set<int> m_uploadedParts;
+  std::set<int> m_staleParts;   // taken parts rewritten since
+};
+
+}  // namespace Data
+}  // namespace QS
+
+#endif  // QSFS_DATA_STREAMUPLOAD_H_
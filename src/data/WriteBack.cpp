@@ -0,0 +1,254 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include "data/WriteBack.h"
+
+#include <algorithm>
+#include <exception>
+#include <string>
+
+#include "boost/bind.hpp"
+#include "boost/date_time/posix_time/posix_time_types.hpp"
+#include "boost/exception/to_string.hpp"
+#include "boost/thread/locks.hpp"
+
+#include "base/LogMacros.h"
+#include "base/StringUtils.h"
+
+namespace QS {
+
+namespace Data {
+
+using boost::lock_guard;
+using boost::mutex;
+using boost::to_string;
+using boost::unique_lock;
+using QS::StringUtils::FormatPath;
+using std::string;
+
+// --------------------------------------------------------------------------
+WriteBack::WriteBack(const FlushHandler &handler, time_t delay,
+                     uint64_t threshold)
+    : m_handler(handler),
+      m_delay(delay),
+      m_threshold(threshold),
+      m_dirtySize(0),
+      m_stop(false) {}
+
+// --------------------------------------------------------------------------
+WriteBack::~WriteBack() { Stop(); }
+
+// --------------------------------------------------------------------------
+bool WriteBack::IsPending(const string &filePath) const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_pendingFiles.find(filePath) != m_pendingFiles.end() ||
+         m_flushingFiles.find(filePath) != m_flushingFiles.end();
+}
+
+// --------------------------------------------------------------------------
+size_t WriteBack::GetNumPending() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_pendingFiles.size();
+}
+
+// --------------------------------------------------------------------------
+uint64_t WriteBack::GetDirtySize() const {
+  lock_guard<mutex> lock(m_mutex);
+  return m_dirtySize;
+}
+
+// --------------------------------------------------------------------------
+void WriteBack::Start() {
+  lock_guard<mutex> lock(m_mutex);
+  if (!m_thread) {
+    m_stop = false;
+    m_thread.reset(
+        new boost::thread(boost::bind(boost::type<void>(), &WriteBack::Run,
+                                      this)));
+    Info("Start write-back [delay(s):" + to_string(m_delay) +
+         ", threshold:" + to_string(m_threshold) + "]");
+  }
+}
+
+// --------------------------------------------------------------------------
+void WriteBack::Stop() {
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wakeUp.notify_all();
+  if (m_thread && m_thread->joinable()) {
+    m_thread->join();
+  }
+  m_thread.reset();
+  SyncAll();
+}
+
+// --------------------------------------------------------------------------
+void WriteBack::AddDirtyBytes(const string &filePath, size_t len) {
+  bool exceeded = false;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    PendingFileMap::iterator it = m_pendingFiles.find(filePath);
+    if (it == m_pendingFiles.end()) {
+      PendingFile file = {time(NULL), 0};
+      it = m_pendingFiles.insert(std::make_pair(filePath, file)).first;
+    }
+    it->second.dirtySize += len;
+    m_dirtySize += len;
+    exceeded = m_dirtySize >= m_threshold;
+  }
+  if (exceeded) {
+    m_wakeUp.notify_all();
+  }
+}
+
+// --------------------------------------------------------------------------
+void WriteBack::Sync(const string &filePath) {
+  {
+    unique_lock<mutex> lock(m_mutex);
+    if (!BeginFlush(&lock, filePath)) {
+      return;
+    }
+  }
+  DoFlush(filePath);
+}
+
+// --------------------------------------------------------------------------
+void WriteBack::SyncAll() {
+  while (true) {
+    string filePath;
+    {
+      lock_guard<mutex> lock(m_mutex);
+      if (m_pendingFiles.empty()) {
+        return;
+      }
+      filePath = m_pendingFiles.begin()->first;
+    }
+    Sync(filePath);
+  }
+}
+
+// --------------------------------------------------------------------------
+void WriteBack::Forget(const string &filePath) {
+  unique_lock<mutex> lock(m_mutex);
+  while (m_flushingFiles.find(filePath) != m_flushingFiles.end()) {
+    m_flushDone.wait(lock);
+  }
+  PendingFileMap::iterator it = m_pendingFiles.find(filePath);
+  if (it != m_pendingFiles.end()) {
+    m_dirtySize -= it->second.dirtySize;
+    m_pendingFiles.erase(it);
+  }
+}
+
+// --------------------------------------------------------------------------
+void WriteBack::Run() {
+  while (true) {
+    string filePath;
+    {
+      unique_lock<mutex> lock(m_mutex);
+      time_t wait = 0;
+      while (!m_stop && !FindDueFile(time(NULL), &filePath, &wait)) {
+        m_wakeUp.timed_wait(
+            lock, boost::posix_time::seconds(std::max<time_t>(wait, 1)));
+      }
+      if (m_stop) {
+        return;  // pending files are written back by Stop
+      }
+      if (!BeginFlush(&lock, filePath)) {
+        continue;
+      }
+    }
+    DoFlush(filePath);
+  }
+}
+
+// --------------------------------------------------------------------------
+bool WriteBack::FindDueFile(time_t now, string *filePath, time_t *wait) const {
+  // the file dirty for the longest time goes first
+  PendingFileMap::const_iterator oldest = m_pendingFiles.end();
+  for (PendingFileMap::const_iterator it = m_pendingFiles.begin();
+       it != m_pendingFiles.end(); ++it) {
+    if (m_flushingFiles.find(it->first) != m_flushingFiles.end()) {
+      continue;  // wait until the write-back in flight is done
+    }
+    if (oldest == m_pendingFiles.end() ||
+        it->second.dirtyTime < oldest->second.dirtyTime) {
+      oldest = it;
+    }
+  }
+  if (oldest == m_pendingFiles.end()) {
+    *wait = m_delay;
+    return false;
+  }
+  time_t dueTime = oldest->second.dirtyTime + m_delay;
+  if (now >= dueTime || m_dirtySize >= m_threshold) {
+    *filePath = oldest->first;
+    return true;
+  }
+  *wait = dueTime - now;
+  return false;
+}
+
+// --------------------------------------------------------------------------
+bool WriteBack::BeginFlush(unique_lock<mutex> *lock, const string &filePath) {
+  while (m_flushingFiles.find(filePath) != m_flushingFiles.end()) {
+    m_flushDone.wait(*lock);
+  }
+  PendingFileMap::iterator it = m_pendingFiles.find(filePath);
+  if (it == m_pendingFiles.end()) {
+    return false;
+  }
+  m_dirtySize -= it->second.dirtySize;
+  m_pendingFiles.erase(it);
+  m_flushingFiles.insert(filePath);
+  return true;
+}
+
+// --------------------------------------------------------------------------
+void WriteBack::EndFlush(const string &filePath, bool clean) {
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_flushingFiles.erase(filePath);
+    // retry after the delay, unless it is dirty again already or stopped
+    if (!clean && !m_stop &&
+        m_pendingFiles.find(filePath) == m_pendingFiles.end()) {
+      PendingFile file = {time(NULL), 0};
+      m_pendingFiles.insert(std::make_pair(filePath, file));
+    }
+  }
+  m_flushDone.notify_all();
+  m_wakeUp.notify_all();
+}
+
+// --------------------------------------------------------------------------
+void WriteBack::DoFlush(const string &filePath) {
+  DebugInfo("Write back file " + FormatPath(filePath));
+  bool clean = false;
+  try {
+    clean = m_handler ? m_handler(filePath) : true;
+  } catch (const std::exception &err) {
+    DebugError("Fail to write back file " + FormatPath(filePath) + " " +
+               err.what());
+  }
+  DebugWarningIf(!clean, "File is still dirty after write-back, will retry " +
+                             FormatPath(filePath));
+  EndFlush(filePath, clean);
+}
+
+}  // namespace Data
+}  // namespace QS
@@ -0,0 +1,165 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#ifndef QSFS_DATA_WRITEBACK_H_
+#define QSFS_DATA_WRITEBACK_H_
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>
+#include <time.h>
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "boost/function.hpp"
+#include "boost/noncopyable.hpp"
+#include "boost/scoped_ptr.hpp"
+#include "boost/thread/condition_variable.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/thread.hpp"
+
+namespace QS {
+
+namespace Data {
+
+/**
+ * Background write-back of dirty files.
+ *
+ * Writes register the dirty bytes of a file, a background thread uploads the
+ * file once it has been dirty for the delay, or at once when the total dirty
+ * bytes exceed the threshold. Writes to a file pending for write-back are
+ * coalesced into one upload.
+ *
+ * A file is written back by only one thread at a time. Sync writes back a
+ * file in the calling thread and waits for the write-back already in flight,
+ * so fsync only waits for the file it syncs.
+ */
+class WriteBack : private boost::noncopyable {
+ public:
+  // Upload a file, return false if the file is still dirty
+  typedef boost::function<bool(const std::string &)> FlushHandler;
+
+  // Construct write-back
+  //
+  // @param  : handler to upload a file, delay in seconds since a file gets
+  //           dirty, threshold of total dirty bytes
+  // @return :
+  WriteBack(const FlushHandler &handler, time_t delay, uint64_t threshold);
+
+  // Stop the thread and write back all pending files
+  ~WriteBack();
+
+ public:
+  time_t GetDelay() const { return m_delay; }
+  uint64_t GetThreshold() const { return m_threshold; }
+
+  // Whether the file is waiting for write-back
+  bool IsPending(const std::string &filePath) const;
+
+  // Return num of files waiting for write-back
+  size_t GetNumPending() const;
+
+  // Return total dirty bytes of files waiting for write-back
+  uint64_t GetDirtySize() const;
+
+  // Start the background thread
+  //
+  // @param  : void
+  // @return : void
+  //
+  // Threads should be started after fuse forks into background.
+  void Start();
+
+  // Stop the background thread and write back all pending files
+  //
+  // @param  : void
+  // @return : void
+  //
+  // Files failed to be written back are not retried any more.
+  void Stop();
+
+  // Record bytes written to a file
+  //
+  // @param  : file path, len of written bytes
+  // @return : void
+  //
+  // The delay of a file counts from the first write after its last
+  // write-back.
+  void AddDirtyBytes(const std::string &filePath, size_t len);
+
+  // Write back a file now and wait until done
+  //
+  // @param  : file path
+  // @return : void
+  //
+  // Do nothing if the file is neither pending nor being written back.
+  void Sync(const std::string &filePath);
+
+  // Write back all pending files now
+  void SyncAll();
+
+  // Stop tracking a file, e.g. the file is removed
+  //
+  // @param  : file path
+  // @return : void
+  //
+  // Wait for the write-back in flight, so the file is not uploaded after.
+  void Forget(const std::string &filePath);
+
+ private:
+  struct PendingFile {
+    time_t dirtyTime;    // time of first write since last write-back
+    uint64_t dirtySize;  // bytes written since last write-back
+  };
+  typedef std::map<std::string, PendingFile> PendingFileMap;
+
+  // Thread loop
+  void Run();
+
+  // Find the file should be written back first, lock should be held
+  //
+  // @param  : current time, file path found, seconds to wait if none is due
+  // @return : whether a file is due
+  bool FindDueFile(time_t now, std::string *filePath, time_t *wait) const;
+
+  // Move a pending file to flushing, lock should be held
+  bool BeginFlush(boost::unique_lock<boost::mutex> *lock,
+                  const std::string &filePath);
+  void EndFlush(const std::string &filePath, bool clean);
+
+  // Write back a pending file, lock should not be held
+  void DoFlush(const std::string &filePath);
+
+ private:
+  FlushHandler m_handler;
+  time_t m_delay;
+  uint64_t m_threshold;
+
+  mutable boost::mutex m_mutex;
+  boost::condition_variable m_wakeUp;     // wake up background thread
+  boost::condition_variable m_flushDone;  // notify waiters of Sync
+  PendingFileMap m_pendingFiles;
+  std::set<std::string> m_flushingFiles;
+  uint64_t m_dirtySize;
+  bool m_stop;
+  boost::scoped_ptr<boost::thread> m_thread;
+};
+
+}  // namespace Data
+}  // namespace QS
+
+#endif  // QSFS_DATA_WRITEBACK_H_
@@ -51,12 +51,19 @@
 #include "client/QSError.h"
 #include "client/TransferManager.h"
 #include "client/TransferManagerFactory.h"
+#include "configure/Default.h"
 #include "configure/Options.h"
 #include "data/Cache.h"
+#include "data/DirectoryListing.h"
 #include "data/DirectoryTree.h"
+#include "data/DiskCache.h"
+#include "data/EvictionPolicy.h"
 #include "data/File.h"
+#include "data/FileMetaData.h"
 #include "data/FileMetaDataManager.h"
+#include "data/NegativeLookupCache.h"
 #include "data/Node.h"
+#include "data/WriteBack.h"
 
 namespace QS {
 
@@ -76,14 +83,23 @@ using QS::Client::QSError;
 using QS::Client::TransferManager;
 using QS::Client::TransferManagerConfigure;
 using QS::Client::TransferManagerFactory;
+using QS::Configure::Default::GetMaxNegativeLookupCount;
 using QS::Data::Cache;
 using QS::Data::ContentRangeDeque;
+using QS::Data::DirectoryListing;
 using QS::Data::DirectoryTree;
+using QS::Data::DiskCache;
+using QS::Data::DiskRangeList;
 using QS::Data::Entry;
 using QS::Data::File;
+using QS::Data::FileMetaData;
 using QS::Data::FileType;
 using QS::Data::FilePathToNodeUnorderedMap;
+using QS::Data::MakeEvictionPolicy;
+using QS::Data::NegativeLookupCache;
 using QS::Data::Node;
+using QS::Data::Readahead;
+using QS::Data::WriteBack;
 using QS::Exception::QSException;
 using QS::StringUtils::FormatPath;
 using QS::StringUtils::ContentRangeDequeToString;
@@ -105,10 +121,46 @@ using std::vector;
 static boost::once_flag connectOnceFalg = BOOST_ONCE_INIT;
 
 // --------------------------------------------------------------------------
-struct PrintErrorMsg {
-  PrintErrorMsg() {}
+// Persistent disk cache is stored in a folder next to disk cache folder, as
+// files in disk cache folder are named by object base names which could be
+// any name
+static string GetPersistentDiskCacheDirectory() {
+  string diskCacheDir =
+      QS::Configure::Options::Instance().GetDiskCacheDirectory();
+  while (diskCacheDir.size() > 1 &&
+         diskCacheDir[diskCacheDir.size() - 1] == '/') {
+    diskCacheDir.erase(diskCacheDir.size() - 1);
+  }
+  return diskCacheDir + ".qsfs_persist/";
+}
+
+// --------------------------------------------------------------------------
+// Record the directory listed completely, so that names absent in it are
+// answered as not existing locally
+//
+// Should be constructed before listing, as evictions from the dir tree since
+// then make the listing untrusted.
+struct ListDirectoryCallback {
+  string dirPath;
+  shared_ptr<NegativeLookupCache> negativeLookupCache;
+  uint64_t numEvictions;
+
+  ListDirectoryCallback(const string &dirPath_,
+                        const shared_ptr<NegativeLookupCache> &cache_)
+      : dirPath(dirPath_),
+        negativeLookupCache(cache_),
+        numEvictions(cache_ ? cache_->GetNumEvictions() : 0) {}
+
   void operator()(const ClientError<QSError::Value> &err) {
-    ErrorIf(!IsGoodQSError(err), GetMessageForQSError(err));
+    if (IsGoodQSError(err)) {
+      // only all objects are listed when max list count is not set
+      if (negativeLookupCache &&
+          QS::Configure::Options::Instance().GetMaxListCount() <= 0) {
+        negativeLookupCache->AddListedDirectory(dirPath, numEvictions);
+      }
+    } else {
+      Error(GetMessageForQSError(err));
+    }
   }
 };
 
@@ -126,6 +178,18 @@ Drive::Drive()
   uint64_t cacheSize =
       static_cast<uint64_t>(options.GetMaxCacheSizeInMB() * QS::Size::MB1);
   m_cache = make_shared<Cache>(cacheSize);
+  m_cache->SetEvictionPolicy(MakeEvictionPolicy(
+      options.GetCachePolicy(),
+      static_cast<size_t>(cacheSize / (options.GetCacheBlockSizeInKB() *
+                                       QS::Size::KB1))));
+  if (options.IsPersistDiskCache()) {
+    shared_ptr<DiskCache> diskCache = make_shared<DiskCache>(
+        GetPersistentDiskCacheDirectory(),
+        options.GetCacheBlockSizeInKB() * QS::Size::KB1);
+    if (diskCache->Load()) {
+      m_cache->SetDiskCache(diskCache);
+    }
+  }
 
   uid_t uid =
       options.IsOverrideUID() ? options.GetUID() : GetProcessEffectiveUserID();
@@ -140,6 +204,22 @@ Drive::Drive()
 
   m_transferManager->SetClient(m_client);
 
+  if (options.GetWriteBackDelay() > 0) {
+    m_writeBack = make_shared<WriteBack>(
+        bind(boost::type<bool>(), &Drive::WriteBackFile, this, _1),
+        static_cast<time_t>(options.GetWriteBackDelay()),
+        static_cast<uint64_t>(options.GetWriteBackThresholdInMB()) *
+            QS::Size::MB1);
+  }
+
+  if (options.GetNegativeLookupExpire() > 0) {
+    m_negativeLookupCache = make_shared<NegativeLookupCache>(
+        GetMaxNegativeLookupCount(), options.GetNegativeLookupExpire());
+    // nodes evicted are not absent, their parents are not trusted any more
+    QS::Data::FileMetaDataManager::Instance().SetEvictCallback(
+        bind(&NegativeLookupCache::OnNodeEvicted, m_negativeLookupCache, _1));
+  }
+
   QS::Data::FileMetaDataManager::Instance().SetDirectoryTree(
       m_directoryTree.get());
 }
@@ -150,6 +230,19 @@ Drive::~Drive() { CleanUp(); }
 // --------------------------------------------------------------------------
 void Drive::CleanUp() {
   if (!GetCleanup()) {
+    // upload dirty files before cleaning up
+    if (m_writeBack) {
+      m_writeBack->Stop();
+      m_writeBack.reset();
+    }
+
+    // keep the persistent disk cache for next mount, or discard it
+    shared_ptr<DiskCache> diskCache =
+        m_cache ? m_cache->GetDiskCache() : shared_ptr<DiskCache>();
+    if (diskCache && !diskCache->Save()) {
+      DeleteFilesInDirectory(diskCache->GetDirectory(), true);
+    }
+
     // remove disk cache folder if existing
     // log off, to avoid dead reference to log (a singleton)
     if (QS::Utils::FileExists(m_diskCacheFolder) &&
@@ -207,6 +300,11 @@ void Drive::DoConnect() {
     m_connect = true;
   }
 
+  // Start write-back, as threads started before fuse forks will exit
+  if (m_writeBack) {
+    m_writeBack->Start();
+  }
+
   // Update root node of the tree
   if (!m_directoryTree->GetRoot()) {
     m_directoryTree->Grow(QS::Data::BuildDefaultDirectoryMeta("/", time(NULL)));
@@ -259,11 +357,21 @@ pair<shared_ptr<Node>, bool> Drive::GetNode(const string &path,
           if (m_cache->HasFile(path)) {
             m_cache->Erase(path);
           }
+          if (m_cache->GetDiskCache()) {
+            m_cache->GetDiskCache()->Erase(path);
+          }
         } else {
           Error(GetMessageForQSError(err));
         }
+      } else if (!modified && !node->IsDirectory()) {
+        // The file is not modified since the last stat, so the meta is valid
+        // again. Directory is excluded as its modified time does not reflect
+        // its children, it's refreshed when it's listed.
+        node->SetCachedTime(time(NULL));
       }
     }
+  } else if (!node && IsKnownAbsent(path)) {
+    DebugInfo("File not exist (negative lookup) " + FormatPath(path));
   } else {
     ClientError<QSError::Value> err =
         GetClient()->Stat(path, m_directoryTree);  // head it
@@ -272,6 +380,9 @@ pair<shared_ptr<Node>, bool> Drive::GetNode(const string &path,
     } else {
       if (err.GetError() == QSError::NOT_FOUND) {
         Info("File not exist " + FormatPath(path));
+        if (!node && m_negativeLookupCache) {
+          m_negativeLookupCache->Add(path);
+        }
       } else {
         Error(GetMessageForQSError(err));
       }
@@ -286,14 +397,15 @@ pair<shared_ptr<Node>, bool> Drive::GetNode(const string &path,
   if (node && *node && node->IsDirectory() && updateIfDirectory &&
       (QS::TimeUtils::IsExpire(node->GetCachedTime(), expireDurationInMin) ||
        forceUpdateNode)) {
-    PrintErrorMsg receivedHandler;
     string path_ = AppendPathDelim(path);
+    ListDirectoryCallback receivedHandler(path_, m_negativeLookupCache);
     if (updateDirAsync) {
       GetClient()->GetExecutor()->SubmitAsync(
           bind(boost::type<void>(), receivedHandler, _1),
           bind(boost::type<ClientError<QSError::Value> >(),
-               &QS::Client::Client::ListDirectory, m_client.get(), _1, _2),
-          path_, m_directoryTree);
+               &QS::Client::Client::ListDirectory, m_client.get(), _1, _2,
+               _3),
+          path_, m_directoryTree, shared_ptr<DirectoryListing>());
     } else {
       receivedHandler(GetClient()->ListDirectory(path_, m_directoryTree));
     }
@@ -322,9 +434,9 @@ vector<weak_ptr<Node> > Drive::FindChildren(const string &dirPath,
   if (node && *node) {
     if (node->IsDirectory() && updateIfDir) {
       // Update directory tree synchronously
-      ClientError<QSError::Value> err =
-          GetClient()->ListDirectory(dirPath, m_directoryTree);
-      ErrorIf(!IsGoodQSError(err), GetMessageForQSError(err));
+      ListDirectoryCallback receivedHandler(AppendPathDelim(dirPath),
+                                            m_negativeLookupCache);
+      receivedHandler(GetClient()->ListDirectory(dirPath, m_directoryTree));
     }
     return m_directoryTree->FindChildren(dirPath);
   } else {
@@ -333,6 +445,20 @@ vector<weak_ptr<Node> > Drive::FindChildren(const string &dirPath,
   }
 }
 
+// --------------------------------------------------------------------------
+shared_ptr<DirectoryListing> Drive::OpenDirectory(const string &dirPath) {
+  shared_ptr<DirectoryListing> listing = make_shared<DirectoryListing>();
+  ListDirectoryCallback receivedHandler(AppendPathDelim(dirPath),
+                                        m_negativeLookupCache);
+  // Prioritized as a reader is waiting for it
+  GetClient()->GetExecutor()->SubmitAsyncPrioritized(
+      bind(boost::type<void>(), receivedHandler, _1),
+      bind(boost::type<ClientError<QSError::Value> >(),
+           &QS::Client::Client::ListDirectory, m_client.get(), _1, _2, _3),
+      AppendPathDelim(dirPath), m_directoryTree, listing);
+  return listing;
+}
+
 // --------------------------------------------------------------------------
 void Drive::Chmod(const std::string &filePath, mode_t mode) {
   Warning("chmod not supported");
@@ -366,6 +492,9 @@ struct RemoveFileCallback {
       }
       if (cache) {
         cache->Erase(filePath);
+        if (cache->GetDiskCache()) {
+          cache->GetDiskCache()->Erase(filePath);
+        }
       }
       DebugInfo("Deleted file " + FormatPath(filePath));
     } else {
@@ -377,6 +506,10 @@ struct RemoveFileCallback {
 // --------------------------------------------------------------------------
 // Remove a file or an empty directory
 void Drive::RemoveFile(const string &filePath, bool async) {
+  // the file should not be uploaded again after removed
+  if (m_writeBack) {
+    m_writeBack->Forget(filePath);
+  }
   RemoveFileCallback receivedHandler(filePath, m_directoryTree, m_cache);
 
   if (async) {  // delete file asynchronously
@@ -405,11 +538,17 @@ struct MakeFileCallback {
   
   void operator() (const ClientError<QSError::Value> &err) {
     if(IsGoodQSError(err)) {
+      shared_ptr<FileMetaData> meta;
       if (dirTree && client) {
-        dirTree->Grow(client->GetObjectMeta(path));
+        meta = client->GetObjectMeta(path);
+        dirTree->Grow(meta);
       }
       if (cache) {
-        cache->MakeFile(path);
+        shared_ptr<File> file = cache->MakeFile(path);
+        if (file && meta) {
+          // writing will trust the snapshot instead of heading the object
+          file->UpdateRemoteMeta(meta);
+        }
       }
       DebugInfo("Created file" + FormatPath(path));
     } else {
@@ -440,6 +579,7 @@ void Drive::MakeFile(const string &filePath, mode_t mode, bool async) {
 
   if (type == FileType::File) {
     DebugInfo(FormatPath(filePath));
+    InvalidateNegativeLookup(filePath);
     MakeFileCallback receivedHandler(filePath, m_directoryTree, m_cache, m_client);
     if (async) {
       GetClient()->GetExecutor()->SubmitAsyncPrioritized(
@@ -480,6 +620,7 @@ struct MakeDirCallback {
 
 // --------------------------------------------------------------------------
 void Drive::MakeDir(const string &dirPath, mode_t mode, bool async) {
+  InvalidateNegativeLookup(dirPath);
   MakeDirCallback receivedHandler(dirPath, m_directoryTree, m_client);
   if (async) {
     GetClient()->GetExecutor()->SubmitAsyncPrioritized(
@@ -508,6 +649,28 @@ void Drive::OpenFile(const string &filePath, bool async) {
   } else {
     file = m_cache->MakeFile(filePath);
   }
+  if (file) {
+    // Take the snapshot of object meta from the node which has just been
+    // headed, reading will trust it instead of heading the object every time
+    bool modified = res.second;
+    if (modified || !file->IsRemoteMetaValid()) {
+      shared_ptr<FileMetaData> meta = node->GetEntry().GetMetaData().lock();
+      bool contentChanged = meta && !meta->GetETag().empty()
+                                ? file->UpdateRemoteMeta(meta)
+                                : file->RefreshRemoteMeta(GetClient());
+      if (contentChanged && !file->IsOpen() && !file->IsDirty()) {
+        // cached content is stale, as the object has been changed remotely
+        Info("Object has been modified, discard cache " + FormatPath(filePath));
+        uint64_t remoteSize = file->GetRemoteSize();
+        string remoteETag = file->GetRemoteETag();
+        m_cache->Erase(filePath);
+        file = m_cache->MakeFile(filePath);
+        if (file) {
+          file->SetRemoteMeta(remoteSize, remoteETag);
+        }
+      }
+    }
+  }
   if (file) {
     file->SetOpen(true, m_directoryTree);
   } else {
@@ -517,7 +680,8 @@ void Drive::OpenFile(const string &filePath, bool async) {
 
 // --------------------------------------------------------------------------
 size_t Drive::ReadFile(const string &filePath, off_t offset, size_t size,
-                       char *buf, bool async) {
+                       char *buf, Readahead *readahead,
+                       DiskRangeList *diskRanges) {
   // read is only called if the file has been opend with the correct flags
   // no need to head it for latest meta
   shared_ptr<Node> node = GetNodeSimple(filePath);
@@ -530,7 +694,7 @@ size_t Drive::ReadFile(const string &filePath, off_t offset, size_t size,
   if (file) {
     pair<size_t, ContentRangeDeque> outcome =
         file->Read(offset, size, buf, m_transferManager, m_directoryTree,
-                   m_cache, m_client, async);
+                   m_cache, m_client, readahead, diskRanges);
     if (!outcome.second.empty()) {
       DebugWarning("Unloaded ranges " +
                    ContentRangeDequeToString(outcome.second));
@@ -591,6 +755,11 @@ struct RenameFileCallback {
 
 // --------------------------------------------------------------------------
 void Drive::RenameFile(const string &filePath, const string &newFilePath, bool async) {
+  // object is moved remotely, so local changes should be uploaded before
+  if (m_writeBack) {
+    m_writeBack->Sync(filePath);
+  }
+  InvalidateNegativeLookup(newFilePath);
   RenameFileCallback receivedHandler(filePath, newFilePath, m_directoryTree, m_cache);
   if (async) {
     GetClient()->GetExecutor()->SubmitAsyncPrioritized(
@@ -659,6 +828,12 @@ struct RenameDirCallback {
 // --------------------------------------------------------------------------
 void Drive::RenameDir(const string &dirPath, const string &newDirPath,
                       bool async) {
+  // object is moved remotely, so local changes should be uploaded before
+  if (m_writeBack) {
+    m_writeBack->SyncAll();
+  }
+  InvalidateNegativeLookup(newDirPath);
+
   // Do Renaming
   RenameDirCallback receivedHandler(dirPath, newDirPath, m_directoryTree,
                                     m_cache, this);
@@ -679,6 +854,7 @@ void Drive::RenameDir(const string &dirPath, const string &newDirPath,
 // pathname resolution.
 void Drive::SymLink(const string &filePath, const string &linkPath) {
   assert(!filePath.empty() && !linkPath.empty());
+  InvalidateNegativeLookup(linkPath);
   ClientError<QSError::Value> err = GetClient()->SymLink(filePath, linkPath);
   if (!IsGoodQSError(err)) {
     Error("Fail to create a symbolic link [path:" + filePath +
@@ -735,11 +911,62 @@ void Drive::FlushFile(const string &filePath, bool releaseFile, bool updateMeta,
   }
 
   shared_ptr<File> file = m_cache->FindFile(filePath);
-  if (file) {
-    file->Flush(node->GetFileSize(), m_transferManager, m_directoryTree,
-                m_cache, m_client, releaseFile, updateMeta, async);
-  } else {
+  if (!file) {
     Error("File not exists in cache " + FormatPath(filePath));
+    return;
+  }
+  // nothing to upload if it is not modified since last flush
+  if (!file->IsDirty() && file->HasRemoteMeta() &&
+      file->GetRemoteSize() == node->GetFileSize()) {
+    DebugInfo("Skip flushing unmodified file " + FormatPath(filePath));
+    if (releaseFile) {
+      file->SetOpen(false, m_directoryTree);
+    }
+    return;
+  }
+  file->Flush(node->GetFileSize(), m_transferManager, m_directoryTree, m_cache,
+              m_client, releaseFile, updateMeta, async);
+}
+
+// --------------------------------------------------------------------------
+void Drive::SyncFile(const string &filePath, bool wait) {
+  if (!m_writeBack) {
+    return;
+  }
+  shared_ptr<File> file = m_cache->FindFile(filePath);
+  if (file && file->IsDirty() && !m_writeBack->IsPending(filePath)) {
+    // e.g. the last write-back failed
+    m_writeBack->AddDirtyBytes(filePath, 0);
+  }
+  if (wait) {
+    m_writeBack->Sync(filePath);
+  }
+}
+
+// --------------------------------------------------------------------------
+bool Drive::WriteBackFile(const string &filePath) {
+  FlushFile(filePath, false, true, false);
+  shared_ptr<File> file = m_cache->FindFile(filePath);
+  return !(file && file->IsDirty());
+}
+
+// --------------------------------------------------------------------------
+bool Drive::IsKnownAbsent(const string &path) {
+  if (!m_negativeLookupCache) {
+    return false;
+  }
+  // The caller has checked the path is not in the dir tree, which keeps all
+  // children of a directory listed, as the directory is dropped from the
+  // cache once any of them is evicted
+  return m_negativeLookupCache->Has(path) ||
+         (!IsRootDirectory(path) &&
+          m_negativeLookupCache->IsListedDirectory(GetDirName(path)));
+}
+
+// --------------------------------------------------------------------------
+void Drive::InvalidateNegativeLookup(const string &path) {
+  if (m_negativeLookupCache) {
+    m_negativeLookupCache->Erase(path);
   }
 }
 
@@ -756,6 +983,9 @@ void Drive::ReleaseFile(const string &filePath) {
   if (file) {
     file->SetOpen(false, m_directoryTree);
     if (QS::Configure::Options::Instance().IsNoDataCache()) {
+       if (m_writeBack) {
+         m_writeBack->Sync(filePath);  // dirty data should not be dropped
+       }
        m_cache->Erase(filePath);
     }
   }
@@ -784,8 +1014,18 @@ int Drive::WriteFile(const string &filePath, off_t offset, size_t size,
   shared_ptr<File> file = m_cache->FindFile(filePath);
   if (file) {
     boost::tuple<bool, size_t, size_t> res =
-        file->Write(offset, size, buf, m_directoryTree, m_cache);
-    return boost::get<2>(res);
+        file->Write(offset, size, buf, m_transferManager, m_directoryTree,
+                    m_cache, m_client);
+    if (!boost::get<0>(res)) {
+      return 0;
+    }
+    if (m_writeBack) {
+      m_writeBack->AddDirtyBytes(filePath, size);
+    }
+    if (QS::Configure::Options::Instance().IsStreamUpload()) {
+      file->UploadStreamParts(m_transferManager, m_client);
+    }
+    return size;
   } else {
     Error("File not exists in cache " + FormatPath(filePath));
     return 0;
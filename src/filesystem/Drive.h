@@ -32,6 +32,7 @@
 #include "base/Singleton.hpp"
 #include "data/Cache.h"
 #include "data/DirectoryTree.h"
+#include "data/File.h"
 
 namespace QS {
 
@@ -44,9 +45,13 @@ class TransferManager;
 }
 
 namespace Data {
+class DirectoryListing;
 class DirectoryTree;
+class NegativeLookupCache;
 class Node;
 class File;
+class Readahead;
+class WriteBack;
 }
 
 namespace FileSystem {
@@ -70,6 +75,11 @@ class Drive : public Singleton<Drive> {
   const boost::shared_ptr<QS::Data::DirectoryTree> &GetDirectoryTree() const {
     return m_directoryTree;
   }
+  const boost::shared_ptr<QS::Data::WriteBack> &GetWriteBack() const {
+    return m_writeBack;
+  }
+  // Whether written files are uploaded by background write-back
+  bool IsWriteBackEnabled() const { return m_writeBack.get() != NULL; }
 
   bool GetMountable() const {
     boost::lock_guard<boost::mutex> locker(m_mountableLock);
@@ -107,6 +117,9 @@ class Drive : public Singleton<Drive> {
   //
   // Notes: If forceUpdateNode or time is expired, GetNode will connect to object storage 
   // to retrive the object and update the local dir tree
+  //
+  // A path not in the dir tree is answered as not existing without connecting
+  // to object storage, if it's known absent by the negative lookup cache.
   std::pair<boost::shared_ptr<QS::Data::Node>, bool> GetNode(
       const std::string &path, bool forceUpdateNode,
       bool updateIfDirectory = false, bool updateDirAsync = false);
@@ -139,6 +152,16 @@ class Drive : public Singleton<Drive> {
   std::vector<boost::weak_ptr<QS::Data::Node> > FindChildren(
       const std::string &dirPath, bool updateIfDir);
 
+  // Open a directory to read
+  //
+  // @param  : dir path
+  // @return : listing of the directory
+  //
+  // The directory is listed in background, the listing is filled page by page
+  // as the pages arrive, and the directory tree is updated meanwhile.
+  boost::shared_ptr<QS::Data::DirectoryListing> OpenDirectory(
+      const std::string &dirPath);
+
   // Change the permission bits of a file
   //
   // @param  : file path, mode
@@ -179,11 +202,16 @@ class Drive : public Singleton<Drive> {
 
   // Read data from a file
   //
-  // @param  : file path to read data from, offset, size, buf
+  // @param  : file path to read data from, offset, size, buf, readahead of
+  //           the file handle, null to disable readahead, output ranges of
+  //           disk file, null to always read into buf
   // @return : number of bytes has been read
   //
+  // If the content is entirely stored in disk file, the ranges of disk file
+  // are output instead of reading the content into buf.
   size_t ReadFile(const std::string &filePath, off_t offset, size_t size,
-                  char *buf, bool async = false);
+                  char *buf, QS::Data::Readahead *readahead = NULL,
+                  QS::Data::DiskRangeList *diskRanges = NULL);
 
   // Read target of a symlink file
   //
@@ -231,6 +259,15 @@ class Drive : public Singleton<Drive> {
   void FlushFile(const std::string &filePath, bool releaseFile, bool updateMeta,
                  bool async = false);
 
+  // Sync a file with write-back
+  //
+  // @param  : file path, flag wait until the file is written back
+  // @return : void
+  //
+  // If not wait, a dirty file is uploaded later by the write-back thread.
+  // Do nothing if write-back is not enabled.
+  void SyncFile(const std::string &filePath, bool wait);
+
   // Release a file
   void ReleaseFile(const std::string &filePath);
 
@@ -277,6 +314,22 @@ class Drive : public Singleton<Drive> {
   void DoConnect();
   Drive();
 
+  // Upload a file for write-back
+  //
+  // @param  : file path
+  // @return : false if the file is still dirty
+  bool WriteBackFile(const std::string &filePath);
+
+  // Whether a path not in the dir tree is known absent
+  //
+  // @param  : file path
+  // @return : true if the path is not found recently, or its parent dir is
+  //           listed completely
+  bool IsKnownAbsent(const std::string &path);
+
+  // Invalidate the negative lookup of a path which is being created
+  void InvalidateNegativeLookup(const std::string &path);
+
   mutable boost::mutex m_mountableLock;
   bool m_mountable;
 
@@ -291,6 +344,9 @@ class Drive : public Singleton<Drive> {
   boost::shared_ptr<QS::Client::TransferManager> m_transferManager;
   boost::shared_ptr<QS::Data::Cache> m_cache;
   boost::shared_ptr<QS::Data::DirectoryTree> m_directoryTree;
+  boost::shared_ptr<QS::Data::WriteBack> m_writeBack;  // null if disabled
+  // null if disabled
+  boost::shared_ptr<QS::Data::NegativeLookupCache> m_negativeLookupCache;
 
   friend class Singleton<Drive>;
   friend void qsfs_destroy(void *userdata);
@@ -45,6 +45,11 @@ using QS::Configure::Default::GetDefaultParallelTransfers;
 using QS::Configure::Default::GetDefaultTransactionRetries;
 using QS::Configure::Default::GetDefaultTransferBufSize;
 using QS::Configure::Default::GetDefaultPrefetchSizeInMB;
+using QS::Configure::Default::GetDefaultCacheBlockSizeInKB;
+using QS::Configure::Default::GetDefaultCachePolicyName;
+using QS::Configure::Default::GetDefaultWriteBackDelay;
+using QS::Configure::Default::GetDefaultWriteBackThresholdInMB;
+using QS::Configure::Default::GetDefaultNegativeLookupExpire;
 using QS::Configure::Default::GetMaxCacheSize;
 using QS::Configure::Default::GetMaxListObjectsCount;
 using QS::Configure::Default::GetMaxStatCount;
@@ -111,7 +116,20 @@ void ShowQSFSHelp() {
   "  -b, --bufsize      File transfer buffer size (MB), this should be larger than 8 MB,\n"
   "                     default value is " 
                         << to_string(GetDefaultTransferBufSize() / QS::Size::MB1) << " MB\n"
-  "  -j, --prefetchsize Read prefetch size (MB), default value is " << GetDefaultPrefetchSizeInMB() << " MB\n"
+  "  -j, --prefetchsize Max readahead window size (MB), default value is " << GetDefaultPrefetchSizeInMB() << " MB\n"
+  "  -B, --blocksize    File data cache block size (KB), should be power of 2 from\n"
+  "                     64 KB to 4096 KB, default value is " << GetDefaultCacheBlockSizeInKB() << " KB\n"
+  "  -Y, --cachepolicy  File data cache eviction policy, could be lru or tinylfu, tinylfu\n"
+  "                     keeps frequently used data from scans, default value is "
+                        << GetDefaultCachePolicyName() << "\n"
+  "  -w, --writeback    Delay (seconds) to upload written files in background, close\n"
+  "                     does not wait for uploading, fsync does. A value of zero will\n"
+  "                     upload files at close, default value is " << GetDefaultWriteBackDelay() << "\n"
+  "  -W, --writebackmb  Upload written files at once when dirty data exceeds the value\n"
+  "                     (MB), default value is " << GetDefaultWriteBackThresholdInMB() << " MB\n"
+  "  -N, --negexpire    Expire time (seconds) for nonexistent paths, which are answered\n"
+  "                     locally, a value of zero will disable it, default value is "
+                        << GetDefaultNegativeLookupExpire() << "\n"
   "  -H, --host         Host name, default value is " << GetDefaultHostName() << "\n" <<
   "  -p, --protocol     Protocol could be https or http, default value is " <<
                                               GetDefaultProtocolName() << "\n" <<
@@ -119,10 +137,14 @@ void ShowQSFSHelp() {
   //"  -a, --agent        Additional user agent\n"
   "\n"
   " Miscellaneous Options:\n"
-  "  -J, --prefetch     Enable prefetch at read\n"
+  "  -J, --prefetch     Enable adaptive readahead for sequential and strided reads\n"
   "  -m, --contentMD5   Enable writes with MD5 hashs to ensure data integrity\n"
   "  -K, --keeplogdir   Do not clear log directory at beginning\n"
   "  -C, --nodatacache  Clear the file data cache\n"
+  "  -E, --persistcache Keep file data cached across remounts, which is stored\n"
+  "                     in <diskdir>.qsfs_persist/\n"
+  "  -O, --streamupload Upload parts of large files being written sequentially,\n"
+  "                     close only uploads the rest of the file\n"
   "  -f, --forground    Turn on log to STDERR and enable FUSE foreground mode\n"
   "  -s, --single       Turn on FUSE single threaded option - disable multi-threaded\n"
   //"  -S, --Single       Turn on qsfs single threaded option - disable multi-threaded\n"
@@ -152,11 +174,17 @@ void ShowQSFSUsage() {
   "       [-i|--maxlist=[value]]\n"
   "       [-y|--fscap=[value]]\n"
   "       [-n|--numtransfer=[value]] [-b|--bufsize=value]]\n"
+  "       [-j|--prefetchsize=[value]] [-B|--blocksize=[value]]\n"
+  "       [-Y|--cachepolicy=[lru|tinylfu]]\n"
+  "       [-w|--writeback=[value]] [-W|--writebackmb=[value]]\n"
+  "       [-N|--negexpire=[value]]\n"
   "       [-H|--host=[value]] [-p|--protocol=[value]]\n"
   "       [-P|--port=[value]]\n"
   "       [-m|--contentMD5]\n"
   "       [-K|--keeplogdir]\n"
   "       [-C|--nofilecache]\n"
+  "       [-E|--persistcache]\n"
+  "       [-O|--streamupload]\n"
   "       [-f|--foreground]\n"
   "       [-s|--single]\n"
   //"     [-s|--single] [-S|--Single]\n"
@@ -17,14 +17,17 @@
 #include "filesystem/Operations.h"
 
 #include <assert.h>
+#include <stdlib.h>  // for malloc
 #include <string.h>  // for memset, strlen
 
 #include <errno.h>
+#include <stdint.h>  // for uintptr_t
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <sys/types.h>  // for uid_t
 #include <unistd.h>     // for R_OK
 
+#include <algorithm>
 #include <sstream>
 #include <string>
 #include <utility>
@@ -32,18 +35,24 @@
 
 #include "boost/exception/to_string.hpp"
 #include "boost/shared_ptr.hpp"
+#include "boost/thread/tss.hpp"
 #include "boost/tuple/tuple.hpp"
 #include "boost/weak_ptr.hpp"
 
 #include "base/Exception.h"
 #include "base/LogMacros.h"
+#include "base/Size.h"
 #include "base/StringUtils.h"
 #include "base/ThreadPoolInitializer.h"
 #include "base/Utils.h"
 #include "configure/Default.h"
 #include "configure/Options.h"
+#include "data/Cache.h"
+#include "data/DirectoryListing.h"
 #include "data/DirectoryTree.h"
+#include "data/DiskFile.h"
 #include "data/Node.h"
+#include "data/Readahead.h"
 #include "filesystem/Drive.h"
 
 namespace QS {
@@ -54,7 +63,11 @@ using boost::shared_ptr;
 using boost::to_string;
 using boost::tuple;
 using boost::weak_ptr;
+using QS::Data::Cache;
+using QS::Data::DirectoryListing;
+using QS::Data::DiskRangeList;
 using QS::Data::Node;
+using QS::Data::Readahead;
 using QS::Exception::QSException;
 using QS::Configure::Default::GetNameMaxLen;
 using QS::Configure::Default::GetPathMaxLen;
@@ -68,12 +81,22 @@ using QS::Utils::GetBaseName;
 using QS::Utils::GetDirName;
 using QS::Utils::IsRootDirectory;
 using std::make_pair;
+using std::max;
 using std::pair;
 using std::string;
 using std::vector;
 
 namespace {
 
+// Max num of entries taken from the listing for a readdir, more than a fuse
+// readdir buffer can hold mostly
+static const size_t READDIR_BATCH_SIZE = 512;
+
+// Disk file ranges referred by the buffers which read_buf of this thread
+// returned last time. Fuse replies the buffers after read_buf returns, so
+// the disk files are kept open until the next read_buf of the same thread.
+static boost::thread_specific_ptr<DiskRangeList> repliedDiskRanges;
+
 // --------------------------------------------------------------------------
 bool IsValidPath(const char* path) { return path != NULL && path[0] != '\0'; }
 
@@ -254,6 +277,94 @@ tuple<shared_ptr<Node>, bool, string> GetFile(const char* path,
   }
 }
 
+// --------------------------------------------------------------------------
+// Create readahead for an open file handle if prefetch is enabled
+//
+// The window starts at 1MB, or one block if it is larger, and grows up to the
+// prefetch size.
+void CreateReadahead(struct fuse_file_info* fi) {
+  QS::Configure::Options& options = QS::Configure::Options::Instance();
+  if (fi == NULL || !options.IsEnablePrefetch()) {
+    return;
+  }
+  size_t blockSize = options.GetCacheBlockSizeInKB() * QS::Size::KB1;
+  size_t minWindowSize = max(blockSize, static_cast<size_t>(QS::Size::MB1));
+  size_t maxWindowSize = options.GetPrefetchSizeInMB() * QS::Size::MB1;
+  fi->fh = reinterpret_cast<uintptr_t>(
+      new Readahead(minWindowSize, maxWindowSize));
+}
+
+// --------------------------------------------------------------------------
+// Return readahead of an open file handle, null if there is none
+Readahead* GetReadahead(const struct fuse_file_info* fi) {
+  return fi != NULL
+             ? reinterpret_cast<Readahead*>(static_cast<uintptr_t>(fi->fh))
+             : NULL;
+}
+
+// --------------------------------------------------------------------------
+void DestroyReadahead(struct fuse_file_info* fi) {
+  delete GetReadahead(fi);
+  if (fi != NULL) {
+    fi->fh = 0;
+  }
+}
+
+// --------------------------------------------------------------------------
+// Attach the listing to an open directory handle
+//
+// The listing is shared with the background listing task which could outlive
+// the handle, so the handle holds a shared_ptr to it.
+void AttachDirectoryListing(struct fuse_file_info* fi,
+                            const shared_ptr<DirectoryListing>& listing) {
+  if (fi != NULL) {
+    fi->fh = reinterpret_cast<uintptr_t>(
+        new shared_ptr<DirectoryListing>(listing));
+  }
+}
+
+// --------------------------------------------------------------------------
+// Return listing of an open directory handle, null if there is none
+shared_ptr<DirectoryListing> GetDirectoryListing(
+    const struct fuse_file_info* fi) {
+  shared_ptr<DirectoryListing>* listing =
+      fi != NULL ? reinterpret_cast<shared_ptr<DirectoryListing>*>(
+                       static_cast<uintptr_t>(fi->fh))
+                 : NULL;
+  return listing != NULL ? *listing : shared_ptr<DirectoryListing>();
+}
+
+// --------------------------------------------------------------------------
+void DestroyDirectoryListing(struct fuse_file_info* fi) {
+  if (fi != NULL) {
+    delete reinterpret_cast<shared_ptr<DirectoryListing>*>(
+        static_cast<uintptr_t>(fi->fh));
+    fi->fh = 0;
+  }
+}
+
+// --------------------------------------------------------------------------
+// Put a child into filler with the attributes from the directory tree
+//
+// @param  : filler, buffer, child node, offset of next entry
+// @return : 1 if the buffer is full, 0 otherwise
+int FillDirEntry(fuse_fill_dir_t filler, void* buf,
+                 const shared_ptr<Node>& node, off_t nextOffset) {
+  if (!(node && *node)) {
+    return 0;  // removed since listed
+  }
+  string filename = node->MyBaseName();
+  assert(!filename.empty());
+  if (filename.empty()) {
+    return 0;
+  }
+  // Hand the attributes of the listing over with the name
+  struct stat st;
+  memset(&st, 0, sizeof(st));
+  FillStat(const_cast<const Node&>(*node).GetEntry().ToStat(), &st);
+  return filler(buf, filename.c_str(), &st, nextOffset);
+}
+
 }  // namespace
 
 // --------------------------------------------------------------------------
@@ -287,7 +398,7 @@ void InitializeFUSECallbacks(struct fuse_operations* fuseOps) {
   // fuseOps->removexattr = NULL;
   fuseOps->opendir = qsfs_opendir;
   fuseOps->readdir = qsfs_readdir;
-  // fuseOps->releasedir = NULL;
+  fuseOps->releasedir = qsfs_releasedir;
   // fuseOps->fsyncdir = NULL;
   fuseOps->init = qsfs_init;
   fuseOps->destroy = qsfs_destroy;
@@ -298,7 +409,7 @@ void InitializeFUSECallbacks(struct fuse_operations* fuseOps) {
   // fuseOps->lock = NULL;
   fuseOps->utimens = qsfs_utimens;  // TODO(jim):
   // fuseOps->write_buf = NULL;
-  // fuseOps->read_buf = NULL;
+  fuseOps->read_buf = qsfs_read_buf;
   // fuseOps->fallocate = NULL;
 }
 
@@ -1021,6 +1132,7 @@ int qsfs_open(const char* path, struct fuse_file_info* fi) {
     return ret;
   }
 
+  CreateReadahead(fi);
   return ret;
 }
 
@@ -1055,9 +1167,9 @@ int qsfs_read(const char* path, char* buf, size_t size, off_t offset,
     // For such case, just return
     return 0;
   }
-  
-  memset(buf, 0, size);
 
+  // No need to clear buf, as file holes are filled with zero by reading, and
+  // fuse will substitute the rest of the data with zeroes.
   int readSize = 0;
   Drive& drive = Drive::Instance();
   try {
@@ -1076,7 +1188,7 @@ int qsfs_read(const char* path, char* buf, size_t size, off_t offset,
 
     // Do Read
     try {
-      readSize = drive.ReadFile(path, offset, size, buf);
+      readSize = drive.ReadFile(path, offset, size, buf, GetReadahead(fi));
     } catch (const QSException& err) {
       errno = EAGAIN;  // try again
       throw;           // rethrow
@@ -1221,10 +1333,16 @@ int qsfs_flush(const char* path, struct fuse_file_info* fi) {
 
     // Write the file to object storage
     try {
-      bool releasefile = false;
-      bool updatemeta = true;
-      bool async = !QS::Configure::Options::Instance().IsQsfsSingleThread();
-      Drive::Instance().FlushFile(path_, releasefile, updatemeta, async);
+      Drive& drive = Drive::Instance();
+      if (drive.IsWriteBackEnabled()) {
+        // uploaded in background, close does not wait for it
+        drive.SyncFile(path_, false);
+      } else {
+        bool releasefile = false;
+        bool updatemeta = true;
+        bool async = !QS::Configure::Options::Instance().IsQsfsSingleThread();
+        drive.FlushFile(path_, releasefile, updatemeta, async);
+      }
     } catch (const QSException& err) {
       Warning(err.get());
       return -EAGAIN;  // Try again
@@ -1254,6 +1372,7 @@ int qsfs_flush(const char* path, struct fuse_file_info* fi) {
 // reads/writes will happen on the file.
 int qsfs_release(const char* path, struct fuse_file_info* fi) {
   DebugInfo(FormatPath(path));
+  DestroyReadahead(fi);
   if (!IsValidPath(path)) {
     Error("Null path parameter from fuse");
     return -EINVAL;
@@ -1311,10 +1430,16 @@ int qsfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
     }
     // Write the file to object storage
     try {
-      bool releasefile = false;
-      bool updatemeta = datasync == 0;
-      bool async = !QS::Configure::Options::Instance().IsQsfsSingleThread();
-      Drive::Instance().FlushFile(path_, releasefile, updatemeta, async);
+      Drive& drive = Drive::Instance();
+      if (drive.IsWriteBackEnabled()) {
+        // wait for write-back of this file only
+        drive.SyncFile(path_, true);
+      } else {
+        bool releasefile = false;
+        bool updatemeta = datasync == 0;
+        bool async = !QS::Configure::Options::Instance().IsQsfsSingleThread();
+        drive.FlushFile(path_, releasefile, updatemeta, async);
+      }
     } catch (const QSException& err) {
       Warning(err.get());
       return -EAGAIN;  // Try again
@@ -1404,7 +1529,8 @@ int qsfs_opendir(const char* path, struct fuse_file_info* fi) {
       throw QSException("No read permission " + FormatPath(dirPath));
     }
 
-    drive.GetNode(dirPath, true, true);  // update dir synchronizely
+    // Update dir in background, readdir is served as the pages arrive
+    AttachDirectoryListing(fi, drive.OpenDirectory(dirPath));
   } catch (const QSException& err) {
     Warning(err.get());
     if (ret == 0) {
@@ -1419,9 +1545,20 @@ int qsfs_opendir(const char* path, struct fuse_file_info* fi) {
 // --------------------------------------------------------------------------
 // Read directory.
 //
-// Ignores the offset parameter, and passes zero to the filler function's
-// offset. The filler function will not return '1' (unless an error happens),
-// so the whole directory is read in a single readdir operation.
+// The directory is listed in background since opendir. Each readdir puts the
+// entries listed so far from the offset into the filler, waiting only if none
+// is available yet, and passes the position of the next entry as the offset.
+// So the first entries are returned as soon as the first page arrives, and
+// the later pages are read by the following readdir calls. Offset 1 and 2
+// are taken by '.' and '..'.
+//
+// Without the listing (e.g. opened before), ignores the offset parameter and
+// passes zero to the filler function's offset, so the whole directory is
+// read from the dir tree in a single readdir operation.
+//
+// The attributes of children are passed to the filler, they are taken from
+// the listing which refreshes the children, so the getattr following on each
+// entry (e.g. ls -l) is served from the dir tree without heading it.
 //
 // FUSE Invariants (https://github.com/libfuse/libfuse/wiki/Invariants)
 // Readdir is only called with an existing directory name
@@ -1461,6 +1598,25 @@ int qsfs_readdir(const char* path, void* buf, fuse_fill_dir_t filler,
       throw QSException("No acess permission " + FormatPath(dirPath));
     }
 
+    shared_ptr<DirectoryListing> listing = GetDirectoryListing(fi);
+    if (listing) {
+      // Put the . and .. entries in the filler
+      if ((offset < 1 && filler(buf, ".", NULL, 1) == 1) ||
+          (offset < 2 && filler(buf, "..", NULL, 2) == 1)) {
+        return ret;
+      }
+      size_t pos = offset < 2 ? 0 : static_cast<size_t>(offset - 2);
+      vector<string> entries = listing->WaitForEntries(pos, READDIR_BATCH_SIZE);
+      BOOST_FOREACH (const string& filePath, entries) {
+        ++pos;
+        if (FillDirEntry(filler, buf, drive.GetNodeSimple(filePath),
+                         static_cast<off_t>(pos + 2)) == 1) {
+          break;  // buffer is full, continue from here in next readdir
+        }
+      }
+      return ret;
+    }
+
     // Put the . and .. entries in the filler
     if (filler(buf, ".", NULL, 0) == 1 || filler(buf, "..", NULL, 0) == 1) {
       ret = -ENOMEM;  // out of memeory
@@ -1472,13 +1628,10 @@ int qsfs_readdir(const char* path, void* buf, fuse_fill_dir_t filler,
     BOOST_FOREACH (weak_ptr<Node>& child, childs) {
       if (!child.expired()) {
         shared_ptr<Node> childNode = child.lock();
-        string filename = childNode->MyBaseName();
-        assert(!filename.empty());
-        if (filename.empty()) continue;
-        if (filler(buf, filename.c_str(), NULL, 0) == 1) {
+        if (FillDirEntry(filler, buf, childNode, 0) == 1) {
           ret = -ENOMEM;  // out of memory
           throw QSException("Fuse filler is full! dir: " + dirPath +
-                            "child: " + filename);
+                            "child: " + childNode->MyBaseName());
         }
       }
     }
@@ -1496,7 +1649,8 @@ int qsfs_readdir(const char* path, void* buf, fuse_fill_dir_t filler,
 // --------------------------------------------------------------------------
 // Release a directory.
 int qsfs_releasedir(const char* path, struct fuse_file_info* fi) {
-  // Currently no implementation.
+  DebugInfo(FormatPath(path));
+  DestroyDirectoryListing(fi);
   return 0;
 }
 
@@ -1545,6 +1699,13 @@ void* qsfs_init(struct fuse_conn_info* conn) {
   // before fuse_main will exit when the process goes into the background.
   QS::Threading::ThreadPoolInitializer::Instance().DoInitialize();
 
+#ifdef FUSE_CAP_SPLICE_WRITE
+  // Splice the disk file buffers returned by read_buf to the device
+  if (conn != NULL && (conn->capable & FUSE_CAP_SPLICE_WRITE)) {
+    conn->want |= FUSE_CAP_SPLICE_WRITE;
+  }
+#endif
+
   return static_cast<QS::FileSystem::Drive*>(fuse_get_context()->private_data);
 }
 
@@ -1555,6 +1716,11 @@ void* qsfs_init(struct fuse_conn_info* conn) {
 void qsfs_destroy(void* userdata) {
   // Drive get clean by itself. Just print an info here.
   Info("Disconnecting qsfs...");
+  // log is not available any more when drive is destructed
+  const shared_ptr<Cache> &cache = Drive::Instance().GetCache();
+  if (cache) {
+    Info("Cache statistics " + cache->StatisticsToString());
+  }
 
   // Drive will get clean itself by its static destructor, comment following line
   // is no harm. And it helps to avoid starce error out at destroying drive
@@ -1783,10 +1949,118 @@ int qsfs_write_buf(const char* path, struct fuse_bufvec* buf, off_t off,
 // The buffer must be allocated dynamically and stored at the location pointed
 // to by bufp. If the buffer contains memory regions, they too must be allocated
 // using malloc(). The allocated memory will be freed by the caller.
+//
+// If the content is entirely stored in the disk files of cache, the buffers
+// refer to the file descriptors of the disk files, so fuse can splice them to
+// the device without copying into user space. Otherwise data is read from
+// cache into a single memory region with one copy per block.
 int qsfs_read_buf(const char* path, struct fuse_bufvec** bufp, size_t size,
                   off_t off, struct fuse_file_info* fi) {
-  // Currently no implementation.
-  return 0;
+  DebugInfo("[offset:" + to_string(off) + ", size:" + to_string(size) + "] " +
+            FormatPath(path));
+  if (!IsValidPath(path)) {
+    Error("Null path parameter from fuse");
+    return -EINVAL;
+  }
+  if (bufp == NULL) {
+    Error("Null bufp parameter from fuse");
+    return -EINVAL;
+  }
+
+  struct fuse_bufvec* bufv =
+      static_cast<struct fuse_bufvec*>(malloc(sizeof(struct fuse_bufvec)));
+  if (bufv == NULL) {
+    Error("Fail to allocate buffer vector " + FormatPath(path));
+    return -ENOMEM;
+  }
+  memset(bufv, 0, sizeof(*bufv));
+  bufv->count = 1;
+  bufv->buf[0].fd = -1;
+  *bufp = bufv;
+
+  if (repliedDiskRanges.get() == NULL) {
+    repliedDiskRanges.reset(new DiskRangeList);
+  }
+  DiskRangeList& diskRanges = *repliedDiskRanges;
+  diskRanges.clear();  // last reply has been sent
+
+  if (size == 0) {
+    // Test shows fuse may call read with size = 0, offset = file size
+    // For such case, just return
+    return 0;
+  }
+  char* mem = static_cast<char*>(malloc(size));
+  if (mem == NULL) {
+    Error("Fail to allocate buffer [size:" + to_string(size) + "] " +
+          FormatPath(path));
+    return -ENOMEM;
+  }
+  bufv->buf[0].mem = mem;  // freed by fuse
+
+  int ret = 0;
+  Drive& drive = Drive::Instance();
+  try {
+    // Check if file exists
+    shared_ptr<Node> node = drive.GetNodeSimple(path);
+    if (!(node && *node)) {
+      ret = -ENOENT;
+      throw QSException("No such file " + FormatPath(path));
+    }
+
+    // Check if it is a directory
+    if (node->IsDirectory()) {
+      ret = -EPERM;
+      throw QSException("Not a file, but a directory " + FormatPath(path));
+    }
+
+    // Do Read
+    size_t readSize = 0;
+    try {
+      readSize = drive.ReadFile(path, off, size, mem, GetReadahead(fi),
+                                &diskRanges);
+    } catch (const QSException& err) {
+      ret = -EAGAIN;  // try again
+      throw;          // rethrow
+    }
+
+    if (diskRanges.empty()) {
+      bufv->buf[0].size = readSize;
+      return ret;
+    }
+
+    // Refer to the disk files instead of the memory region
+    size_t count = diskRanges.size();
+    struct fuse_bufvec* fdBufv = static_cast<struct fuse_bufvec*>(
+        malloc(sizeof(struct fuse_bufvec) +
+               (count - 1) * sizeof(struct fuse_buf)));
+    if (fdBufv == NULL) {
+      diskRanges.clear();
+      ret = -ENOMEM;
+      throw QSException("Fail to allocate buffer vector " + FormatPath(path));
+    }
+    memset(fdBufv, 0, sizeof(struct fuse_bufvec) +
+                          (count - 1) * sizeof(struct fuse_buf));
+    fdBufv->count = count;
+    for (size_t i = 0; i < count; ++i) {
+      struct fuse_buf& buf = fdBufv->buf[i];
+      buf.flags = static_cast<enum fuse_buf_flags>(FUSE_BUF_IS_FD |
+                                                   FUSE_BUF_FD_SEEK);
+      buf.fd = diskRanges[i].diskFile->GetFd();
+      buf.pos = diskRanges[i].offset;
+      buf.size = diskRanges[i].size;
+    }
+    free(mem);
+    free(bufv);
+    *bufp = fdBufv;
+  } catch (const QSException& err) {
+    Warning(err.get());
+    if (ret == 0) {
+      ret = -errno;
+    }
+    return ret;
+  }
+
+  return ret;
 }
 
 // --------------------------------------------------------------------------
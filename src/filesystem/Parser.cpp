@@ -38,6 +38,7 @@
 #include "configure/Default.h"
 #include "configure/IncludeFuse.h"  // for fuse.h
 #include "configure/Options.h"
+#include "data/EvictionPolicy.h"
 
 namespace QS {
 
@@ -66,11 +67,19 @@ using QS::Configure::Default::GetDefaultProtocolName;
 using QS::Configure::Default::GetDefaultParallelTransfers;
 using QS::Configure::Default::GetDefaultTransferBufSize;
 using QS::Configure::Default::GetDefaultPrefetchSizeInMB;
+using QS::Configure::Default::GetDefaultCacheBlockSizeInKB;
+using QS::Configure::Default::GetDefaultCachePolicyName;
+using QS::Configure::Default::GetDefaultWriteBackDelay;
+using QS::Configure::Default::GetDefaultWriteBackThresholdInMB;
+using QS::Configure::Default::GetDefaultNegativeLookupExpire;
+using QS::Configure::Default::GetMinCacheBlockSizeInKB;
+using QS::Configure::Default::GetMaxCacheBlockSizeInKB;
 using QS::Configure::Default::GetFsCapacity;
 using QS::Configure::Default::GetMaxCacheSize;
 using QS::Configure::Default::GetMaxListObjectsCount;
 using QS::Configure::Default::GetMaxStatCount;
 using QS::Configure::Default::GetMaxLogSize;
+using QS::Data::IsValidEvictionPolicyName;
 using QS::Utils::GetProcessEffectiveUserID;
 using QS::Utils::GetProcessEffectiveGroupID;
 using std::string;
@@ -116,6 +125,11 @@ static struct options {
   int numtransfer;
   int bufsize;       // transfer buffer in MB
   int prefetchsize;  // prefetch size in MB
+  int blocksize;     // cache block size in KB
+  const char *cachePolicy;  // eviction policy of data cache
+  int writeback;     // write-back delay in seconds, 0 disables write-back
+  int writebackmb;   // write-back threshold of dirty data in MB
+  int negexpire;     // negative lookup expire in seconds, 0 disables it
   int threads;
   const char *host;
   const char *protocol;
@@ -125,6 +139,8 @@ static struct options {
   int contentMD5;          // default not enable content MD5
   int keepLogDir;          // default not keep log dir content
   int noDataCache;         // default not clear file data cache
+  int persistCache;        // default not keep disk cache at unmount
+  int streamUpload;        // default upload files at flush
   int foreground;          // default not foreground
   int singleThread;        // default FUSE multi-thread
   int qsSingleThread;      // default qsfs single-thread
@@ -167,6 +183,11 @@ static const struct fuse_opt optionSpec[] = {
     OPTION("-b=%i", bufsize),        OPTION("--bufsize=%i",     bufsize),
     OPTION("-T=%i", threads),        OPTION("--threads=%i",     threads),
     OPTION("-j=%i", prefetchsize),   OPTION("--prefetchsize=%i", prefetchsize),
+    OPTION("-B=%i", blocksize),      OPTION("--blocksize=%i",   blocksize),
+    OPTION("-Y=%s", cachePolicy),    OPTION("--cachepolicy=%s", cachePolicy),
+    OPTION("-w=%i", writeback),      OPTION("--writeback=%i",   writeback),
+    OPTION("-W=%i", writebackmb),    OPTION("--writebackmb=%i", writebackmb),
+    OPTION("-N=%i", negexpire),      OPTION("--negexpire=%i",   negexpire),
     OPTION("-H=%s", host),           OPTION("--host=%s",        host),
     OPTION("-p=%s", protocol),       OPTION("--protocol=%s",    protocol),
     OPTION("-P=%i", port),           OPTION("--port=%i",        port),
@@ -176,6 +197,8 @@ static const struct fuse_opt optionSpec[] = {
     OPTION("-m",    contentMD5),     OPTION("--contentMD5",     contentMD5),
     OPTION("-K",    keepLogDir),     OPTION("--keeplogdir",     keepLogDir),
     OPTION("-C",    noDataCache),    OPTION("--nodatacache",    noDataCache),
+    OPTION("-E",    persistCache),   OPTION("--persistcache",   persistCache),
+    OPTION("-O",    streamUpload),   OPTION("--streamupload",   streamUpload),
     OPTION("-f",    foreground),     OPTION("--foreground",     foreground),
     OPTION("-s",    singleThread),   OPTION("--single",         singleThread),
     OPTION("-S",    qsSingleThread), OPTION("--Single",         qsSingleThread),
@@ -272,6 +295,11 @@ void Parse(int argc, char **argv) {
   options.numtransfer    = GetDefaultParallelTransfers();
   options.bufsize        = GetDefaultTransferBufSize() / QS::Size::MB1;
   options.prefetchsize   = GetDefaultPrefetchSizeInMB();
+  options.blocksize      = GetDefaultCacheBlockSizeInKB();
+  options.cachePolicy    = strdup(GetDefaultCachePolicyName().c_str());
+  options.writeback      = GetDefaultWriteBackDelay();
+  options.writebackmb    = GetDefaultWriteBackThresholdInMB();
+  options.negexpire      = GetDefaultNegativeLookupExpire();
   options.threads        = GetClientDefaultPoolSize();
   options.host           = strdup(GetDefaultHostName().c_str());
   options.protocol       = strdup(GetDefaultProtocolName().c_str());
@@ -281,6 +309,8 @@ void Parse(int argc, char **argv) {
   options.contentMD5     = 0;
   options.keepLogDir     = 0;  // default not keep log dir content
   options.noDataCache    = 0;  // default not clear file data cache
+  options.persistCache   = 0;  // default not keep disk cache at unmount
+  options.streamUpload   = 0;  // default upload files at flush
   options.foreground     = 0;
   options.singleThread   = 0;
   options.qsSingleThread = 1;  // default qsfs single
@@ -401,6 +431,51 @@ void Parse(int argc, char **argv) {
     qsOptions.SetPrefetchSizeInMB(options.prefetchsize);
   }
 
+  // block size should be power of 2
+  if (options.blocksize < static_cast<int>(GetMinCacheBlockSizeInKB()) ||
+      options.blocksize > static_cast<int>(GetMaxCacheBlockSizeInKB()) ||
+      (options.blocksize & (options.blocksize - 1)) != 0) {
+    PrintWarnMsg("-B|--blocksize", options.blocksize,
+                 GetDefaultCacheBlockSizeInKB(),
+                 "Block size should be power of 2, from 64 KB to 4096 KB.");
+    qsOptions.SetCacheBlockSizeInKB(GetDefaultCacheBlockSizeInKB());
+  } else {
+    qsOptions.SetCacheBlockSizeInKB(options.blocksize);
+  }
+
+  if (!IsValidEvictionPolicyName(options.cachePolicy)) {
+    std::cerr << "[qsfs] invalid parameter in option -Y|--cachepolicy="
+              << options.cachePolicy << ", " << GetDefaultCachePolicyName()
+              << " is used. Policy should be lru or tinylfu." << std::endl;
+    qsOptions.SetCachePolicy(GetDefaultCachePolicyName().c_str());
+  } else {
+    qsOptions.SetCachePolicy(options.cachePolicy);
+  }
+
+  if (options.writeback < 0) {
+    PrintWarnMsg("-w|--writeback", options.writeback,
+                 GetDefaultWriteBackDelay());
+    qsOptions.SetWriteBackDelay(GetDefaultWriteBackDelay());
+  } else {
+    qsOptions.SetWriteBackDelay(options.writeback);
+  }
+
+  if (options.writebackmb <= 0) {
+    PrintWarnMsg("-W|--writebackmb", options.writebackmb,
+                 GetDefaultWriteBackThresholdInMB());
+    qsOptions.SetWriteBackThresholdInMB(GetDefaultWriteBackThresholdInMB());
+  } else {
+    qsOptions.SetWriteBackThresholdInMB(options.writebackmb);
+  }
+
+  if (options.negexpire < 0) {
+    PrintWarnMsg("-N|--negexpire", options.negexpire,
+                 GetDefaultNegativeLookupExpire());
+    qsOptions.SetNegativeLookupExpire(GetDefaultNegativeLookupExpire());
+  } else {
+    qsOptions.SetNegativeLookupExpire(options.negexpire);
+  }
+
   if (options.threads <= 0) {
     PrintWarnMsg("-T|--threads", options.threads, GetClientDefaultPoolSize());
     qsOptions.SetClientPoolSize(GetClientDefaultPoolSize());
@@ -424,6 +499,8 @@ void Parse(int argc, char **argv) {
   qsOptions.SetEnableContentMD5(options.contentMD5 !=0);
   qsOptions.SetClearLogDir(options.keepLogDir == 0);
   qsOptions.SetNoDataCache(options.noDataCache != 0);
+  qsOptions.SetPersistDiskCache(options.persistCache != 0);
+  qsOptions.SetStreamUpload(options.streamUpload != 0);
   qsOptions.SetForeground(options.foreground != 0);
   qsOptions.SetSingleThread(options.singleThread != 0);
   qsOptions.SetQsfsSingleThread(options.qsSingleThread != 0);
@@ -0,0 +1,121 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <string.h>
+
+#include "gtest/gtest.h"
+
+#include "base/Logging.h"
+#include "base/Size.h"
+#include "base/Utils.h"
+#include "configure/Default.h"
+#include "data/BufferArena.h"
+
+namespace QS {
+
+namespace Data {
+
+using QS::Configure::Default::GetMaxCacheBlockSizeInKB;
+using ::testing::Test;
+
+// default log dir
+static const char *defaultLogDir = "/tmp/qsfs.test.logs/";
+void InitLog() {
+  QS::Utils::CreateDirectoryIfNotExists(defaultLogDir);
+  QS::Logging::Log::Instance().Initialize(defaultLogDir);
+}
+
+class BufferArenaTest : public Test {
+ protected:
+  static void SetUpTestCase() { InitLog(); }
+};
+
+// --------------------------------------------------------------------------
+TEST_F(BufferArenaTest, AllocSize) {
+  size_t maxClass = GetMaxCacheBlockSizeInKB() * QS::Size::KB1;
+  EXPECT_EQ(BufferArena::GetAllocSize(0), QS::Size::KB4);
+  EXPECT_EQ(BufferArena::GetAllocSize(1), QS::Size::KB4);
+  EXPECT_EQ(BufferArena::GetAllocSize(QS::Size::KB4), QS::Size::KB4);
+  EXPECT_EQ(BufferArena::GetAllocSize(QS::Size::KB4 + 1), QS::Size::KB8);
+  EXPECT_EQ(BufferArena::GetAllocSize(QS::Size::KB256 - 1), QS::Size::KB256);
+  EXPECT_EQ(BufferArena::GetAllocSize(maxClass), maxClass);
+  // not pooled, round up to min class
+  EXPECT_EQ(BufferArena::GetAllocSize(maxClass + 1),
+            maxClass + QS::Size::KB4);
+}
+
+// --------------------------------------------------------------------------
+TEST_F(BufferArenaTest, AllocateAndReuse) {
+  BufferArena arena(QS::Size::MB1);
+  char *buf1 = arena.Allocate(10);
+  ASSERT_TRUE(buf1 != NULL);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(buf1) % QS::Size::KB4, 0u);
+  EXPECT_EQ(arena.GetSizeInUse(), QS::Size::KB4);
+  memset(buf1, 'a', QS::Size::KB4);
+
+  arena.Deallocate(buf1, 10);
+  EXPECT_EQ(arena.GetSizeInUse(), 0u);
+  EXPECT_EQ(arena.GetPooledSize(), QS::Size::KB4);
+
+  // buffer of the same size class is reused
+  char *buf2 = arena.Allocate(QS::Size::KB4);
+  EXPECT_EQ(buf2, buf1);
+  EXPECT_EQ(arena.GetSizeInUse(), QS::Size::KB4);
+  EXPECT_EQ(arena.GetPooledSize(), 0u);
+
+  // buffer of other size class is not reused
+  char *buf3 = arena.Allocate(QS::Size::KB8);
+  EXPECT_EQ(arena.GetSizeInUse(), QS::Size::KB4 + QS::Size::KB8);
+
+  arena.Deallocate(buf2, QS::Size::KB4);
+  arena.Deallocate(buf3, QS::Size::KB8);
+  EXPECT_EQ(arena.GetSizeInUse(), 0u);
+  EXPECT_EQ(arena.GetPooledSize(), QS::Size::KB4 + QS::Size::KB8);
+  arena.Trim();
+  EXPECT_EQ(arena.GetPooledSize(), 0u);
+}
+
+// --------------------------------------------------------------------------
+TEST_F(BufferArenaTest, Limit) {
+  // no pooled buffer without limit
+  BufferArena arena1;
+  char *buf = arena1.Allocate(QS::Size::KB4);
+  arena1.Deallocate(buf, QS::Size::KB4);
+  EXPECT_EQ(arena1.GetPooledSize(), 0u);
+
+  // pooled buffers are released to make room for new allocation
+  BufferArena arena2(QS::Size::KB8);
+  char *buf1 = arena2.Allocate(QS::Size::KB4);
+  char *buf2 = arena2.Allocate(QS::Size::KB4);
+  arena2.Deallocate(buf1, QS::Size::KB4);
+  arena2.Deallocate(buf2, QS::Size::KB4);
+  EXPECT_EQ(arena2.GetPooledSize(), QS::Size::KB8);
+  char *buf3 = arena2.Allocate(QS::Size::KB8);
+  EXPECT_EQ(arena2.GetSizeInUse(), QS::Size::KB8);
+  EXPECT_EQ(arena2.GetPooledSize(), 0u);
+  arena2.Deallocate(buf3, QS::Size::KB8);
+  EXPECT_EQ(arena2.GetPooledSize(), QS::Size::KB8);
+}
+
+}  // namespace Data
+}  // namespace QS
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  int code = RUN_ALL_TESTS();
+  return code;
+}
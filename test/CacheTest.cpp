@@ -23,12 +23,18 @@
 
 #include "gtest/gtest.h"
 
+#include "boost/bind.hpp"
 #include "boost/make_shared.hpp"
 #include "boost/shared_ptr.hpp"
+#include "boost/thread/barrier.hpp"
+#include "boost/thread/locks.hpp"
+#include "boost/thread/recursive_mutex.hpp"
+#include "boost/thread/thread.hpp"
 
 #include "base/Logging.h"
 #include "base/Utils.h"
 #include "configure/Options.h"
+#include "data/BufferArena.h"
 #include "data/Cache.h"
 #include "data/DirectoryTree.h"
 #include "data/File.h"
@@ -58,6 +64,13 @@ gid_t gid_ = 1000U;
 mode_t fileMode_ = S_IRWXU | S_IRWXG | S_IROTH;
 shared_ptr<DirectoryTree> dirTree = shared_ptr<DirectoryTree>();
 
+// Hold the lock until the barrier is passed twice
+void HoldLock(boost::recursive_mutex *mutex, boost::barrier *barrier) {
+  boost::lock_guard<boost::recursive_mutex> lock(*mutex);
+  barrier->wait();  // locked
+  barrier->wait();  // to unlock
+}
+
 class CacheTest : public Test {
  protected:
   static void SetUpTestCase() { InitLog(); }
@@ -71,7 +84,6 @@ class CacheTest : public Test {
     EXPECT_EQ(cache.GetSize(), 0u);
     EXPECT_EQ(cache.GetCapacity(), cacheCap);
     EXPECT_EQ(cache.GetNumFile(), 0u);
-    EXPECT_TRUE(cache.Begin() == cache.End());
     cache.Free(10, "");
     EXPECT_EQ(cache.GetSize(), 0u);
     EXPECT_EQ(cache.GetCapacity(), cacheCap);
@@ -134,8 +146,8 @@ class CacheTest : public Test {
   }
 
   // --------------------------------------------------------------------------
-  void TestMakeFileMostRecently() {
-    uint64_t cacheCap = 100;
+  void TestFreeSkipDirtyFile() {
+    uint64_t cacheCap = 1024 * 1024;
     Cache cache(cacheCap);
 
     const char *filename1 = "file1";
@@ -148,11 +160,118 @@ class CacheTest : public Test {
         AppendPathDelim(
             QS::Configure::Options::Instance().GetDiskCacheDirectory()) +
         filename2;
-    cache.MakeFile(filepath1);
-    cache.MakeFile(filepath2);
-    EXPECT_EQ(cache.Begin()->first, filepath2);
+    shared_ptr<File> file1 = cache.MakeFile(filepath1);
+    shared_ptr<File> file2 = cache.MakeFile(filepath2);
+    file1->DoWrite(0, 3, "abc");
+    file1->MarkDirtyBlocks(0, 3);
+    cache.AddSize(file1->GetCachedSize());
+    file2->DoWrite(0, 3, "abc");
+    file2->MarkDirtyBlocks(0, 3);
+    cache.AddSize(file2->GetCachedSize());
     cache.MakeFileMostRecentlyUsed(filepath1);
-    EXPECT_EQ(cache.Begin()->first, filepath1);
+
+    // dirty files are kept until written back, even if they are closed
+    EXPECT_FALSE(cache.Free(cacheCap - cache.GetSize() + 1, ""));
+    EXPECT_TRUE(cache.HasFile(filepath1));
+    EXPECT_TRUE(cache.HasFile(filepath2));
+
+    // blocks written back could be discarded
+    file2->m_dirtyBlocks.assign(file2->m_dirtyBlocks.size(), false);
+    EXPECT_TRUE(cache.Free(cacheCap - cache.GetSize() + 1, ""));
+    EXPECT_EQ(file2->GetCachedSize(), 0u);
+    EXPECT_EQ(cache.GetSize(), file1->GetCachedSize());
+  }
+
+  // --------------------------------------------------------------------------
+  void TestFreeSkipOpenFile() {
+    uint64_t cacheCap = 1024 * 1024;
+    Cache cache(cacheCap);
+
+    vector<shared_ptr<File> > files;
+    for (int i = 0; i < 20; ++i) {
+      stringstream ss;
+      ss << "file" << i;
+      string filepath =
+          AppendPathDelim(
+              QS::Configure::Options::Instance().GetDiskCacheDirectory()) +
+          ss.str();
+      shared_ptr<File> file = cache.MakeFile(filepath);
+      file->DoWrite(0, 1, "a");
+      cache.AddSize(file->GetCachedSize());
+      files.push_back(file);
+    }
+    files[0]->SetOpen(true, dirTree);
+    string unfreeable = files[1]->GetFilePath();
+
+    // files of all shards are discarded except the open and unfreeable one
+    EXPECT_FALSE(cache.Free(cacheCap, unfreeable));
+    EXPECT_EQ(cache.GetNumFile(), 2u);
+    EXPECT_TRUE(cache.HasFile(files[0]->GetFilePath()));
+    EXPECT_TRUE(cache.HasFile(unfreeable));
+    EXPECT_EQ(cache.GetSize(),
+              files[0]->GetCachedSize() + files[1]->GetCachedSize());
+  }
+
+  // --------------------------------------------------------------------------
+  void TestFreeSkipLockedFile() {
+    uint64_t cacheCap = 1024 * 1024;
+    Cache cache(cacheCap);
+    string filepath =
+        AppendPathDelim(
+            QS::Configure::Options::Instance().GetDiskCacheDirectory()) +
+        "file1";
+    shared_ptr<File> file = cache.MakeFile(filepath);
+    file->DoWrite(0, 1, "a");
+    cache.AddSize(file->GetCachedSize());
+
+    // file locked by others is in use, e.g. it is freeing cache to write
+    boost::barrier barrier(2);
+    boost::thread holder(boost::bind(&HoldLock, &file->m_mutex, &barrier));
+    barrier.wait();
+    EXPECT_FALSE(cache.Free(cacheCap, ""));
+    EXPECT_TRUE(cache.HasFile(filepath));
+    barrier.wait();
+    holder.join();
+
+    EXPECT_TRUE(cache.Free(cacheCap, ""));
+    EXPECT_EQ(file->GetCachedSize(), 0u);
+    EXPECT_EQ(cache.GetSize(), 0u);
+  }
+
+  // --------------------------------------------------------------------------
+  void TestFreeCleanBlocksOfOpenFile() {
+    size_t allocSize = BufferArena::GetAllocSize(3);
+    uint64_t cacheCap = 4 * allocSize;
+    shared_ptr<Cache> cache = make_shared<Cache>(cacheCap);
+    string filepath =
+        AppendPathDelim(
+            QS::Configure::Options::Instance().GetDiskCacheDirectory()) +
+        "file1";
+    shared_ptr<File> file = cache->MakeFile(filepath);
+    file->SetOpen(true, dirTree);
+    off_t bs = static_cast<off_t>(file->GetBlockSize());
+    // block 0 and 1 are loaded from object, block 2 is modified locally
+    file->WriteUnloaded(0, 3, "abc", dirTree, cache);
+    file->WriteUnloaded(bs, 3, "abc", dirTree, cache);
+    file->Write(2 * bs, 3, "abc", dirTree, cache);
+    EXPECT_EQ(cache->GetSize(), 3 * allocSize);
+
+    // the least recently used clean block is discarded
+    EXPECT_TRUE(cache->Free(2 * allocSize, ""));
+    EXPECT_TRUE(cache->HasFile(filepath));
+    EXPECT_FALSE(file->IsBlockLoaded(0));
+    EXPECT_TRUE(file->IsBlockLoaded(1));
+    EXPECT_TRUE(file->IsBlockLoaded(2));
+    EXPECT_EQ(cache->GetSize(), 2 * allocSize);
+    EXPECT_EQ(file->GetCachedSize(), 2 * allocSize);
+
+    // dirty block is kept, and open file is not discarded
+    EXPECT_FALSE(cache->Free(cacheCap, ""));
+    EXPECT_FALSE(file->IsBlockLoaded(1));
+    EXPECT_TRUE(file->IsBlockLoaded(2));
+    EXPECT_TRUE(file->IsDirty());
+    EXPECT_EQ(cache->GetSize(), allocSize);
+    EXPECT_EQ(cache->GetNumDiscardedBlocks(), 2u);
   }
 };
 
@@ -164,7 +283,15 @@ TEST_F(CacheTest, EraseFile) { TestEraseFile(false); }
 
 TEST_F(CacheTest, RenameFile) { TestRenameFile(false); }
 
-TEST_F(CacheTest, MakeFileMostRecently) { TestMakeFileMostRecently(); }
+TEST_F(CacheTest, FreeSkipDirtyFile) { TestFreeSkipDirtyFile(); }
+
+TEST_F(CacheTest, FreeSkipOpenFile) { TestFreeSkipOpenFile(); }
+
+TEST_F(CacheTest, FreeSkipLockedFile) { TestFreeSkipLockedFile(); }
+
+TEST_F(CacheTest, FreeCleanBlocksOfOpenFile) {
+  TestFreeCleanBlocksOfOpenFile();
+}
 
 }  // namespace Data
 }  // namespace QS
@@ -0,0 +1,96 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "boost/bind.hpp"
+#include "boost/thread/thread.hpp"
+
+#include "data/DirectoryListing.h"
+
+namespace QS {
+
+namespace Data {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+vector<string> MakePage(const string &prefix, int count) {
+  vector<string> page;
+  for (int i = 0; i < count; ++i) {
+    page.push_back(prefix + static_cast<char>('a' + i));
+  }
+  return page;
+}
+
+void ListPages(DirectoryListing *listing) {
+  boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  listing->AddEntries(MakePage("/dir/x", 3));
+  boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  listing->Finish();
+}
+
+}  // namespace
+
+TEST(DirectoryListingTest, ReadByPosition) {
+  DirectoryListing listing;
+  listing.AddEntries(MakePage("/dir/a", 4));
+  EXPECT_EQ(listing.GetNumEntries(), 4u);
+
+  // entries available are returned without waiting for the rest
+  vector<string> entries = listing.WaitForEntries(0, 3);
+  ASSERT_EQ(entries.size(), 3u);
+  EXPECT_EQ(entries[0], "/dir/aa");
+  entries = listing.WaitForEntries(3, 3);
+  ASSERT_EQ(entries.size(), 1u);
+  EXPECT_EQ(entries[0], "/dir/ad");
+
+  // positions are kept as pages are added
+  listing.AddEntries(MakePage("/dir/b", 2));
+  entries = listing.WaitForEntries(4, 10);
+  ASSERT_EQ(entries.size(), 2u);
+  EXPECT_EQ(entries[0], "/dir/ba");
+
+  listing.Finish();
+  EXPECT_TRUE(listing.IsFinished());
+  EXPECT_TRUE(listing.WaitForEntries(6, 10).empty());
+}
+
+TEST(DirectoryListingTest, WaitForPages) {
+  DirectoryListing listing;
+  boost::thread lister(boost::bind(ListPages, &listing));
+  vector<string> entries = listing.WaitForEntries(0, 10);
+  ASSERT_EQ(entries.size(), 3u);
+  EXPECT_EQ(entries[2], "/dir/xc");
+  // wait until the listing is finished
+  EXPECT_TRUE(listing.WaitForEntries(3, 10).empty());
+  EXPECT_TRUE(listing.IsFinished());
+  lister.join();
+}
+
+}  // namespace Data
+}  // namespace QS
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  int code = RUN_ALL_TESTS();
+  return code;
+}
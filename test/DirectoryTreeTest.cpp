@@ -18,12 +18,22 @@
 
 #include <unistd.h>
 
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif  // __GLIBC__
+
+#include <iostream>
+#include <set>
+#include <string>
 #include <vector>
 
 #include "gtest/gtest.h"
 
+#include "boost/exception/to_string.hpp"
 #include "boost/make_shared.hpp"
+#include "boost/bind.hpp"
 #include "boost/shared_ptr.hpp"
+#include "boost/thread/thread.hpp"
 #include "boost/weak_ptr.hpp"
 
 #include "base/Logging.h"
@@ -37,8 +47,10 @@ namespace QS {
 namespace Data {
 
 using boost::make_shared;
+using boost::to_string;
 using boost::shared_ptr;
 using boost::weak_ptr;
+using std::string;
 using std::vector;
 using ::testing::Test;
 
@@ -166,6 +178,119 @@ class DirectoryTreeTest : public Test {
     EXPECT_FALSE(tree.Has("/folder1/folder1/file1"));
     EXPECT_EQ(tree.FindChildren("/").size(), 1U);
     EXPECT_EQ(tree.FindChildren("/folder1/").size(), 2U);
+
+    // children not listed are pruned
+    std::set<string> listedIds;
+    listedIds.insert("/folder1/file2");
+    tree.PruneDirectory("/folder1", listedIds);
+    EXPECT_FALSE(tree.Has("/folder1/file1"));
+    EXPECT_TRUE(tree.Has("/folder1/file2"));
+    EXPECT_EQ(tree.FindChildren("/folder1/").size(), 1U);
+  }
+
+  void OrphansTest() {
+    DirectoryTree tree(mtime_, uid_, gid_, rootMode_);
+    // children are added before their parent
+    tree.Grow(make_shared<FileMetaData>("/folder1/file1", 10, mtime_, mtime_,
+                                        uid_, gid_, fileMode_,
+                                        FileType::File));
+    tree.Grow(make_shared<FileMetaData>("/folder1/folder2", 1024, mtime_,
+                                        mtime_, uid_, gid_, dirMode_,
+                                        FileType::Directory));
+    EXPECT_EQ(tree.FindChildren("/folder1/").size(), 2U);
+    EXPECT_EQ(tree.GetOrphanIds().size(), 2U);
+
+    shared_ptr<Node> dir1 = tree.Grow(
+        make_shared<FileMetaData>("/folder1", 1024, mtime_, mtime_, uid_, gid_,
+                                  dirMode_, FileType::Directory));
+    EXPECT_TRUE(tree.GetOrphanIds().empty());
+    EXPECT_TRUE(dir1->HaveChild("/folder1/file1"));
+    EXPECT_TRUE(dir1->HaveChild("/folder1/folder2/"));
+    EXPECT_EQ(tree.FindChildren("/folder1/").size(), 2U);
+
+    // move to another directory
+    tree.Rename("/folder1/folder2/", "/folder2/");
+    EXPECT_TRUE(tree.Has("/folder2/"));
+    EXPECT_FALSE(dir1->HaveChild("/folder1/folder2/"));
+    EXPECT_TRUE(tree.GetRoot()->HaveChild("/folder2/"));
+    EXPECT_EQ(tree.FindChildren("/folder1/").size(), 1U);
+    EXPECT_EQ(tree.FindChildren("/").size(), 2U);
+
+    // children are hooked up again after parent is added back
+    tree.Remove("/folder1/", QS::Data::RemoveNodeType::SelfOnly);
+    EXPECT_TRUE(tree.Has("/folder1/file1"));
+    EXPECT_EQ(tree.FindChildren("/folder1/").size(), 1U);
+    dir1 = tree.Grow(make_shared<FileMetaData>("/folder1", 1024, mtime_,
+                                               mtime_, uid_, gid_, dirMode_,
+                                               FileType::Directory));
+    EXPECT_TRUE(dir1->HaveChild("/folder1/file1"));
+    EXPECT_EQ(tree.Find("/folder1/file1")->GetParent(), dir1);
+  }
+
+  // Lookups run while a listing is being applied
+  void ConcurrentLookupsTest() {
+    DirectoryTree tree(mtime_, uid_, gid_, rootMode_);
+    tree.Grow(make_shared<FileMetaData>("/folder1", 1024, mtime_, mtime_, uid_,
+                                        gid_, dirMode_, FileType::Directory));
+    vector<shared_ptr<FileMetaData> > metas;
+    for (int i = 0; i < 1000; ++i) {
+      metas.push_back(boost::make_shared<FileMetaData>(
+          "/folder1/file" + to_string(i), 10, mtime_, mtime_, uid_, gid_,
+          fileMode_, FileType::File));
+    }
+
+    boost::thread_group readers;
+    for (int i = 0; i < 4; ++i) {
+      readers.create_thread(boost::bind(&DirectoryTreeTest::Lookup, &tree));
+    }
+    tree.UpdateDirectory("/folder1/", metas);
+    readers.join_all();
+    EXPECT_EQ(tree.FindChildren("/folder1/").size(), 1000U);
+    EXPECT_TRUE(tree.Has("/folder1/file999"));
+  }
+
+  static void Lookup(const DirectoryTree *tree) {
+    for (int i = 0; i < 1000; ++i) {
+      EXPECT_TRUE(tree->Find("/folder1/"));
+      tree->Has("/folder1/file" + to_string(i));
+      tree->FindChildren("/folder1/");
+    }
+  }
+
+  // Benchmark of heap bytes taken by an entry in directory tree, including
+  // its meta data. Entries are kept below the max stat count, so none of
+  // them are freed by meta data manager.
+  void MemoryPerEntryTest() {
+#ifdef __GLIBC__
+    const int numDirs = 15;
+    const int numFilesPerDir = 100;
+    int before = mallinfo().uordblks;
+    vector<shared_ptr<FileMetaData> > metas;
+    for (int i = 0; i < numDirs; ++i) {
+      string dir = "/datasets/images-2017/category-" + to_string(i) + "/";
+      metas.push_back(boost::make_shared<FileMetaData>(
+          dir, 0, mtime_, mtime_, uid_, gid_, dirMode_, FileType::Directory));
+      for (int j = 0; j < numFilesPerDir; ++j) {
+        metas.push_back(boost::make_shared<FileMetaData>(
+            dir + "sample-image-" + to_string(j) + ".jpg", 1024, mtime_,
+            mtime_, uid_, gid_, fileMode_, FileType::File));
+      }
+    }
+    int numEntries = static_cast<int>(metas.size());
+    {
+      DirectoryTree tree(mtime_, uid_, gid_, rootMode_);
+      tree.Grow(metas);
+      // metas are owned by meta data manager once added
+      vector<shared_ptr<FileMetaData> >().swap(metas);
+      int after = mallinfo().uordblks;
+      EXPECT_TRUE(tree.Has("/datasets/images-2017/category-0/"));
+      EXPECT_EQ(tree.FindChildren("/datasets/images-2017/category-0/").size(),
+                static_cast<size_t>(numFilesPerDir));
+      std::cout << "directory tree bytes per entry: "
+                << (after - before) / numEntries
+                << std::endl;
+    }
+#endif  // __GLIBC__
   }
 };
 
@@ -184,6 +309,12 @@ TEST_F(DirectoryTreeTest, Operations1) { OperationsTest1(); }
 
 TEST_F(DirectoryTreeTest, Operations2) { OperationsTest2(); }
 
+TEST_F(DirectoryTreeTest, Orphans) { OrphansTest(); }
+
+TEST_F(DirectoryTreeTest, ConcurrentLookups) { ConcurrentLookupsTest(); }
+
+TEST_F(DirectoryTreeTest, MemoryPerEntry) { MemoryPerEntryTest(); }
+
 }  // namespace Data
 }  // namespace QS
 
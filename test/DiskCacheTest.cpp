@@ -0,0 +1,169 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "base/Logging.h"
+#include "base/Size.h"
+#include "base/Utils.h"
+#include "data/DiskCache.h"
+
+namespace QS {
+
+namespace Data {
+
+using std::string;
+using std::vector;
+using ::testing::Test;
+
+// default log dir
+static const char *defaultLogDir = "/tmp/qsfs.test.logs/";
+void InitLog() {
+  QS::Utils::CreateDirectoryIfNotExists(defaultLogDir);
+  QS::Logging::Log::Instance().Initialize(defaultLogDir);
+}
+
+static const char *diskCacheDir = "/tmp/qsfs.test.diskcache/";
+static const size_t blockSize = QS::Size::KB4;
+
+class DiskCacheTest : public Test {
+ protected:
+  static void SetUpTestCase() { InitLog(); }
+
+  void SetUp() {
+    QS::Utils::CreateDirectoryIfNotExists(diskCacheDir);
+    QS::Utils::DeleteFilesInDirectory(diskCacheDir, false);
+  }
+
+  void TearDown() { QS::Utils::DeleteFilesInDirectory(diskCacheDir, true); }
+};
+
+// --------------------------------------------------------------------------
+TEST_F(DiskCacheTest, WriteAndRead) {
+  DiskCache cache(diskCacheDir, blockSize);
+  ASSERT_TRUE(cache.Load());
+  vector<char> block(blockSize, 'a');
+  vector<char> buf(blockSize);
+  EXPECT_FALSE(cache.ReadBlock("/file", "etag1", 1, &buf[0], blockSize));
+
+  EXPECT_TRUE(cache.WriteBlock("/file", "etag1", 1, &block[0], blockSize));
+  EXPECT_TRUE(cache.HasBlock("/file", "etag1", 1));
+  EXPECT_FALSE(cache.HasBlock("/file", "etag1", 0));
+  EXPECT_FALSE(cache.HasBlock("/file", "etag2", 1));
+  EXPECT_TRUE(cache.ReadBlock("/file", "etag1", 1, &buf[0], blockSize));
+  EXPECT_EQ(memcmp(&buf[0], &block[0], blockSize), 0);
+  EXPECT_EQ(cache.GetSize(), blockSize);
+
+  // last block of object is shorter than block size
+  EXPECT_TRUE(cache.WriteBlock("/file", "etag1", 2, "abc", 3));
+  EXPECT_TRUE(cache.ReadBlock("/file", "etag1", 2, &buf[0], 3));
+  EXPECT_EQ(memcmp(&buf[0], "abc", 3), 0);
+  EXPECT_EQ(cache.GetSize(), blockSize + 3);
+
+  // object has been changed, old blocks are discarded
+  EXPECT_TRUE(cache.WriteBlock("/file", "etag2", 0, &block[0], blockSize));
+  EXPECT_FALSE(cache.HasBlock("/file", "etag1", 1));
+  EXPECT_FALSE(cache.ReadBlock("/file", "etag2", 1, &buf[0], blockSize));
+  EXPECT_EQ(cache.GetSize(), blockSize);
+
+  // unknown etag is not cached
+  EXPECT_FALSE(cache.WriteBlock("/file2", "", 0, &block[0], blockSize));
+  EXPECT_EQ(cache.GetNumObjects(), 1u);
+}
+
+// --------------------------------------------------------------------------
+TEST_F(DiskCacheTest, EraseAndRename) {
+  DiskCache cache(diskCacheDir, blockSize);
+  ASSERT_TRUE(cache.Load());
+  vector<char> block(blockSize, 'b');
+  EXPECT_TRUE(cache.WriteBlock("/file1", "etag", 0, &block[0], blockSize));
+  EXPECT_TRUE(cache.WriteBlock("/file2", "etag", 0, &block[0], blockSize));
+
+  cache.Rename("/file1", "/file3");
+  EXPECT_FALSE(cache.HasBlock("/file1", "etag", 0));
+  EXPECT_TRUE(cache.HasBlock("/file3", "etag", 0));
+
+  cache.Erase("/file2");
+  EXPECT_FALSE(cache.HasBlock("/file2", "etag", 0));
+  EXPECT_EQ(cache.GetNumObjects(), 1u);
+  EXPECT_EQ(cache.GetSize(), blockSize);
+}
+
+// --------------------------------------------------------------------------
+TEST_F(DiskCacheTest, SaveAndLoad) {
+  vector<char> block(blockSize, 'c');
+  {
+    DiskCache cache(diskCacheDir, blockSize);
+    ASSERT_TRUE(cache.Load());
+    EXPECT_TRUE(cache.WriteBlock("/file1", "etag1", 0, &block[0], blockSize));
+    EXPECT_TRUE(cache.WriteBlock("/file1", "etag1", 3, &block[0], 10));
+    EXPECT_TRUE(cache.WriteBlock("/file2", "etag2", 1, &block[0], blockSize));
+    EXPECT_TRUE(cache.Save());
+  }
+
+  // blocks are reused after remount
+  {
+    DiskCache cache(diskCacheDir, blockSize);
+    ASSERT_TRUE(cache.Load());
+    EXPECT_EQ(cache.GetNumObjects(), 2u);
+    EXPECT_EQ(cache.GetSize(), 2 * blockSize + 10);
+    vector<char> buf(blockSize);
+    EXPECT_TRUE(cache.ReadBlock("/file1", "etag1", 3, &buf[0], 10));
+    EXPECT_EQ(memcmp(&buf[0], &block[0], 10), 0);
+    EXPECT_FALSE(cache.HasBlock("/file1", "etag1", 1));
+    EXPECT_TRUE(cache.HasBlock("/file2", "etag2", 1));
+    // write after load, without saving
+    EXPECT_TRUE(cache.WriteBlock("/file3", "etag3", 0, &block[0], blockSize));
+  }
+
+  // index is consumed by loading, nothing is trusted after unclean shutdown
+  {
+    DiskCache cache(diskCacheDir, blockSize);
+    ASSERT_TRUE(cache.Load());
+    EXPECT_EQ(cache.GetNumObjects(), 0u);
+    EXPECT_EQ(cache.GetSize(), 0u);
+    EXPECT_TRUE(QS::Utils::IsDirectoryEmpty(diskCacheDir).first);
+  }
+}
+
+// --------------------------------------------------------------------------
+TEST_F(DiskCacheTest, LoadWithOtherBlockSize) {
+  vector<char> block(blockSize, 'd');
+  {
+    DiskCache cache(diskCacheDir, blockSize);
+    ASSERT_TRUE(cache.Load());
+    EXPECT_TRUE(cache.WriteBlock("/file", "etag", 0, &block[0], blockSize));
+    EXPECT_TRUE(cache.Save());
+  }
+  DiskCache cache(diskCacheDir, 2 * blockSize);
+  ASSERT_TRUE(cache.Load());
+  EXPECT_EQ(cache.GetNumObjects(), 0u);
+  EXPECT_FALSE(cache.HasBlock("/file", "etag", 0));
+}
+
+}  // namespace Data
+}  // namespace QS
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  int code = RUN_ALL_TESTS();
+  return code;
+}
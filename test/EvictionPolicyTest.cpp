@@ -0,0 +1,110 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "data/EvictionPolicy.h"
+
+using QS::Data::EvictionCandidate;
+using QS::Data::EvictionCandidates;
+using QS::Data::LRUPolicy;
+using QS::Data::MakeEvictionPolicy;
+using QS::Data::TinyLFUPolicy;
+using std::string;
+
+namespace {
+
+EvictionCandidate MakeCandidate(const string &fileId, size_t blockNo,
+                                uint64_t lastAccess) {
+  EvictionCandidate candidate;
+  candidate.fileId = fileId;
+  candidate.blockNo = blockNo;
+  candidate.lastAccess = lastAccess;
+  return candidate;
+}
+
+// Working set of 10 blocks is used by 3 times, then 200 blocks are scanned
+void MakeScanCandidates(QS::Data::EvictionPolicy *policy,
+                        EvictionCandidates *candidates) {
+  uint64_t clock = 0;
+  for (int i = 0; i < 3; ++i) {
+    for (size_t blockNo = 0; blockNo < 10; ++blockNo) {
+      policy->RecordAccess("/hot", blockNo);
+    }
+  }
+  for (size_t blockNo = 0; blockNo < 10; ++blockNo) {
+    candidates->push_back(MakeCandidate("/hot", blockNo, ++clock));
+  }
+  for (size_t blockNo = 0; blockNo < 200; ++blockNo) {
+    policy->RecordAccess("/scan", blockNo);
+    candidates->push_back(MakeCandidate("/scan", blockNo, ++clock));
+  }
+}
+
+}  // namespace
+
+TEST(EvictionPolicyTest, MakeByName) {
+  EXPECT_STREQ(MakeEvictionPolicy("lru", 100)->GetName(), "lru");
+  EXPECT_STREQ(MakeEvictionPolicy("tinylfu", 100)->GetName(), "tinylfu");
+  EXPECT_FALSE(MakeEvictionPolicy("unknown", 100));
+}
+
+TEST(EvictionPolicyTest, LRU) {
+  LRUPolicy policy;
+  EvictionCandidates candidates;
+  MakeScanCandidates(&policy, &candidates);
+  policy.Sort(&candidates);
+  // working set is discarded by the scan
+  EXPECT_EQ(candidates.front().fileId, "/hot");
+  EXPECT_EQ(candidates.back().fileId, "/scan");
+}
+
+TEST(EvictionPolicyTest, TinyLFUFrequency) {
+  TinyLFUPolicy policy(100);
+  EXPECT_EQ(policy.Frequency("/file", 0), 0u);
+  policy.RecordAccess("/file", 0);
+  policy.RecordAccess("/file", 0);
+  EXPECT_GE(policy.Frequency("/file", 0), 2u);
+  for (int i = 0; i < 100; ++i) {
+    policy.RecordAccess("/file", 1);
+  }
+  EXPECT_EQ(policy.Frequency("/file", 1), 15u);
+}
+
+TEST(EvictionPolicyTest, TinyLFUScanResistant) {
+  TinyLFUPolicy policy(100);
+  EvictionCandidates candidates;
+  MakeScanCandidates(&policy, &candidates);
+  policy.Sort(&candidates);
+  // scanned blocks are discarded first, except the most recent window
+  size_t windowSize = candidates.size() / 100;
+  size_t numScanned = 200 - windowSize;
+  for (size_t i = 0; i < numScanned; ++i) {
+    EXPECT_EQ(candidates[i].fileId, "/scan");
+  }
+  for (size_t i = numScanned; i < numScanned + 10; ++i) {
+    EXPECT_EQ(candidates[i].fileId, "/hot");
+  }
+  EXPECT_EQ(candidates.back().fileId, "/scan");
+  EXPECT_EQ(candidates.back().blockNo, 199u);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -16,6 +16,8 @@
 
 #include "gtest/gtest.h"
 
+#include "boost/bind.hpp"
+#include "boost/function.hpp"
 #include "boost/make_shared.hpp"
 
 #include "base/Logging.h"
@@ -23,6 +25,7 @@
 #include "configure/Options.h"
 #include "data/FileMetaData.h"
 #include "data/FileMetaDataManager.h"
+#include "data/NegativeLookupCache.h"
 
 namespace QS {
 
@@ -132,6 +135,32 @@ class FileMetaDataManagerTest : public Test {
 
     manager.Clear();
   }
+
+  void TestEvictCallback() {
+    FileMetaDataManager &manager = FileMetaDataManager::Instance();
+    NegativeLookupCache cache(10, 100);
+    manager.SetEvictCallback(
+        boost::bind(&NegativeLookupCache::OnNodeEvicted, &cache, _1));
+    cache.AddListedDirectory("/dir/", cache.GetNumEvictions());
+    FileMetaData file1("/dir/file1", 2, mtime_, mtime_, uid_, gid_, fileMode_,
+                       FileType::File);
+    FileMetaData file2("/other/file2", 2, mtime_, mtime_, uid_, gid_,
+                       fileMode_, FileType::File);
+    FileMetaData file3("/other/file3", 2, mtime_, mtime_, uid_, gid_,
+                       fileMode_, FileType::File);
+    manager.Add(make_shared<FileMetaData>(file1));
+    manager.Add(make_shared<FileMetaData>(file2));
+    EXPECT_TRUE(cache.IsListedDirectory("/dir/"));
+
+    // file1 is evicted but still exists, so the listing of its parent cannot
+    // answer it as absent any more
+    manager.Add(make_shared<FileMetaData>(file3));
+    EXPECT_FALSE(manager.Has("/dir/file1"));
+    EXPECT_FALSE(cache.IsListedDirectory("/dir/"));
+
+    manager.SetEvictCallback(boost::function<void(const std::string &)>());
+    manager.Clear();
+  }
 };
 
 TEST_F(FileMetaDataManagerTest, Default) { TestDefault(); }
@@ -142,6 +171,8 @@ TEST_F(FileMetaDataManagerTest, Rename) { TestRename(); }
 
 TEST_F(FileMetaDataManagerTest, Overflow) { TestOverflow(); }
 
+TEST_F(FileMetaDataManagerTest, EvictCallback) { TestEvictCallback(); }
+
 }  // namespace Data
 }  // namespace QS
 
@@ -15,11 +15,13 @@
 // +-------------------------------------------------------------------------
 
 #include <string.h>
+#include <unistd.h>  // for pread
 
 #include <list>
 #include <sstream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -29,13 +31,20 @@
 #include "boost/tuple/tuple.hpp"
 
 #include "base/Logging.h"
+#include "base/Size.h"
 #include "base/Utils.h"
 #include "client/Client.h"
+#include "client/NullClient.h"
+#include "client/QSError.h"
 #include "client/TransferManager.h"
+#include "client/Utils.h"
 #include "configure/Options.h"
+#include "data/BufferArena.h"
 #include "data/Cache.h"
 #include "data/DirectoryTree.h"
+#include "data/DiskFile.h"
 #include "data/File.h"
+#include "data/FileMetaData.h"
 #include "data/Page.h"
 
 namespace QS {
@@ -46,12 +55,15 @@ using boost::array;
 using boost::make_shared;
 using boost::shared_ptr;
 using boost::tuple;
+using QS::Client::ClientError;
+using QS::Client::QSError;
 using QS::Utils::AppendPathDelim;
 using std::list;
 using std::make_pair;
 using std::pair;
 using std::string;
 using std::stringstream;
+using std::vector;
 using ::testing::Test;
 
 // default log dir
@@ -69,82 +81,108 @@ shared_ptr<QS::Client::TransferManager> nullTransferManager =
     shared_ptr<QS::Client::TransferManager>();
 shared_ptr<QS::Client::Client> nullClient = shared_ptr<QS::Client::Client>();
 
+// Client downloading the ranges of an object, which fails if the etag to
+// match is not the one of the object
+class ObjectClient : public QS::Client::NullClient {
+ public:
+  ObjectClient(const string &content, const string &eTag)
+      : m_content(content), m_eTag(eTag) {}
+
+  ClientError<QSError::Value> DownloadFile(const string &filePath,
+                                           shared_ptr<std::iostream> buffer,
+                                           const string &range, string *eTag,
+                                           const string &ifMatch) {
+    m_ifMatches.push_back(ifMatch);
+    if (!ifMatch.empty() && ifMatch != m_eTag) {
+      return ClientError<QSError::Value>(QSError::PRECONDITION_FAILED, false);
+    }
+    pair<off_t, size_t> r =
+        QS::Client::Utils::ParseRequestContentRange(range);
+    buffer->write(m_content.data() + r.first, r.second);
+    return ClientError<QSError::Value>(QSError::GOOD, false);
+  }
+
+  void SetETag(const string &eTag) { m_eTag = eTag; }
+  const vector<string> &GetIfMatches() const { return m_ifMatches; }
+
+ private:
+  string m_content;
+  string m_eTag;
+  vector<string> m_ifMatches;
+};
+
 class FileTest : public Test {
  protected:
   static void SetUpTestCase() { InitLog(); }
 
-  void TestUnloadedPages() {
-    string filename = "File_TestUnloadedPages";
-    string filepath =
-        AppendPathDelim(
-            QS::Configure::Options::Instance().GetDiskCacheDirectory()) +
-        filename;
-    File file1(filepath);  // empty file
+  string MakeFilePath(const string &filename) {
+    return AppendPathDelim(
+               QS::Configure::Options::Instance().GetDiskCacheDirectory()) +
+           filename;
+  }
+
+  string ReadNoLoadToString(const File &file, off_t offset, size_t len) {
+    vector<char> buf(len);
+    file.ReadNoLoad(offset, len, &buf[0]);
+    return string(buf.begin(), buf.end());
+  }
+
+  void TestUnloadedBlocks() {
+    File file1(MakeFilePath("File_TestUnloadedBlocks"));  // empty file
+    size_t bs = file1.GetBlockSize();
 
     ContentRangeDeque d0;
     d0.push_back(make_pair(0, 2u));
     EXPECT_EQ(file1.GetUnloadedRanges(0, 2u), d0);
 
     const char *page1 = "01";
-    off_t off1 = 2;
+    off_t off1 = bs + 2;
     size_t len1 = strlen(page1);
     file1.DoWrite(off1, len1, page1);
     // file1 content
-    // col :0123456789
-    //
-    // data:  01
+    // block:  0  |  1  |  2  |  3
+    // data :     |  01 |     |
     EXPECT_EQ(file1.GetSize(), off1 + len1);
-    EXPECT_FALSE(file1.GetUnloadedRanges(0, off1 + len1).empty());
+    EXPECT_EQ(file1.GetNumBlocks(), 1u);
+    // page starts from the beginning of block
+    EXPECT_EQ(file1.GetDataSize(), 2 + len1);
     ContentRangeDeque d1;
-    d1.push_back(make_pair(0, size_t(off1)));
+    d1.push_back(make_pair(0, bs));
     EXPECT_EQ(file1.GetUnloadedRanges(0, off1 + len1), d1);
+    EXPECT_TRUE(file1.GetUnloadedRanges(bs, bs).empty());
 
     const char *page2 = "34";
-    off_t off2 = 6;
+    off_t off2 = 3 * bs;
     size_t len2 = strlen(page2);
     file1.DoWrite(off2, len2, page2);
     // file1 content
-    // col :0123456789
-    //
-    // data:  01  34
+    // block:  0  |  1  |  2  |  3
+    // data :     |  01 |     | 34
     EXPECT_EQ(file1.GetSize(), off2 + len2);
+    EXPECT_EQ(file1.GetNumBlocks(), 2u);
     ContentRangeDeque d2;
-    d2.push_back(make_pair(0, size_t(off1)));
-    d2.push_back(make_pair(off1 + len1, size_t(off2 - off1 - len1)));
+    d2.push_back(make_pair(0, bs));
+    d2.push_back(make_pair(2 * bs, bs));
     EXPECT_EQ(file1.GetUnloadedRanges(0, off2 + len2), d2);
-  }
-
-  void TestUnguardedAddPages() {
-    string filename = "File_TestUnloadedPages";
-    string filepath =
-        AppendPathDelim(
-            QS::Configure::Options::Instance().GetDiskCacheDirectory()) +
-        filename;
-    File file1(filepath);  // empty file
 
-    const char *dummy = "";
-    file1.UnguardedAddPage(2, 0, dummy);
-    EXPECT_EQ(file1.GetSize(), 2u);
-
-    const char *page = "12";
-    size_t len = strlen(page);
-    file1.UnguardedAddPage(2, len, page);
-    EXPECT_EQ(file1.GetSize(), 4u);
-    ContentRangeDeque d0;
-    d0.push_back(make_pair(0, 2u));
-    EXPECT_EQ(file1.GetUnloadedRanges(0, 4u), d0);
+    // ranges are clipped by input
+    ContentRangeDeque d3;
+    d3.push_back(make_pair(bs / 2, bs / 2));
+    d3.push_back(make_pair(2 * bs, bs));
+    EXPECT_EQ(file1.GetUnloadedRanges(bs / 2, 3 * bs), d3);
+
+    // consecutive unloaded blocks are merged
+    ContentRangeDeque d4;
+    d4.push_back(make_pair(4 * bs, 2 * bs + 1));
+    EXPECT_EQ(file1.GetUnloadedRanges(4 * bs, 2 * bs + 1), d4);
   }
 
   void TestWrite(bool useDisk) {
-    string filename = "File_TestWrite";
-    string filepath =
-        AppendPathDelim(
-            QS::Configure::Options::Instance().GetDiskCacheDirectory()) +
-        filename;
-    File file1(filepath);  // empty file
+    File file1(MakeFilePath("File_TestWrite"));  // empty file
     if (useDisk) {
       file1.SetUseDiskFile(true);
     }
+    size_t bs = file1.GetBlockSize();
 
     const char *page1 = "012";
     size_t len1 = 3;
@@ -154,128 +192,82 @@ class FileTest : public Test {
     EXPECT_EQ(file1.GetDataSize(), len1);
     if (useDisk) {
       EXPECT_EQ(file1.GetCachedSize(), 0u);
+      EXPECT_EQ(file1.GetDiskCachedSize(), len1);
     } else {
-      EXPECT_EQ(file1.GetCachedSize(), len1);
+      EXPECT_EQ(file1.GetCachedSize(), BufferArena::GetAllocSize(len1));
+      EXPECT_EQ(file1.GetDiskCachedSize(), 0u);
     }
+    EXPECT_EQ(file1.m_arena->GetSizeInUse(), file1.GetCachedSize());
     EXPECT_EQ(file1.UseDiskFile(), useDisk);
     EXPECT_TRUE(file1.HasData(0, len1 - 1));
     EXPECT_TRUE(file1.HasData(0, len1));
-    EXPECT_FALSE(file1.HasData(0, len1 + 1));
+    // bytes beyond page in the loaded block are hole
+    EXPECT_TRUE(file1.HasData(0, bs));
+    EXPECT_FALSE(file1.HasData(0, bs + 1));
     EXPECT_TRUE(file1.GetUnloadedRanges(0, len1).empty());
-    EXPECT_FALSE(file1.GetUnloadedRanges(0, len1 + 1).empty());
-    EXPECT_EQ(file1.GetNumPages(), 1u);
+    ContentRangeDeque d0;
+    d0.push_back(make_pair(bs, 1u));
+    EXPECT_EQ(file1.GetUnloadedRanges(0, bs + 1), d0);
+    EXPECT_EQ(file1.GetNumBlocks(), 1u);
+    EXPECT_EQ(ReadNoLoadToString(file1, 0, len1), "012");
 
+    // stream only goes to unloaded blocks
     const char *data = "abc";
     size_t len2 = 3;
-    off_t off2 = off_t(len1);
     shared_ptr<stringstream> page2 = make_shared<stringstream>(data);
-    file1.DoWrite(off2, len2, page2);
-    EXPECT_EQ(file1.GetSize(), len1 + len2);
+    file1.DoWrite(0, len2, page2);
+    EXPECT_EQ(ReadNoLoadToString(file1, 0, len1), "012");
+    EXPECT_EQ(file1.GetDataSize(), len1);
+    off_t off2 = bs;
+    shared_ptr<stringstream> page2_ = make_shared<stringstream>(data);
+    file1.DoWrite(off2, len2, page2_);
+    EXPECT_EQ(file1.GetSize(), bs + len2);
     EXPECT_EQ(file1.GetDataSize(), len1 + len2);
     if (useDisk) {
       EXPECT_EQ(file1.GetCachedSize(), 0u);
     } else {
-      EXPECT_EQ(file1.GetCachedSize(), len1 + len2);
+      EXPECT_EQ(file1.GetCachedSize(), BufferArena::GetAllocSize(len1) +
+                                           BufferArena::GetAllocSize(len2));
     }
-    EXPECT_TRUE(file1.HasData(0, len1 + len2 - 1));
-    EXPECT_TRUE(file1.HasData(0, len1 + len2));
-    EXPECT_FALSE(file1.HasData(0, len1 + len2 + 1));
-    EXPECT_TRUE(file1.GetUnloadedRanges(0, len1 + len2).empty());
-    EXPECT_FALSE(file1.GetUnloadedRanges(0, len1 + len2 + 1).empty());
-    EXPECT_EQ(file1.GetNumPages(), 2u);
-
-    pair<PageSetConstIterator, PageSetConstIterator> consecutivePages =
-        file1.ConsecutivePageRangeAtFront();
-    EXPECT_TRUE(consecutivePages.first == file1.BeginPage());
-    EXPECT_TRUE(consecutivePages.second == file1.EndPage());
-
-    array<char, 3> arr1;
-    arr1[0] = '0';
-    arr1[1] = '1';
-    arr1[2] = '2';
-    array<char, 3> buf1;
-    file1.Front()->Read(&buf1[0]);
-    EXPECT_EQ(buf1, arr1);
-
-    array<char, 3> arr2;
-    arr2[0] = 'a';
-    arr2[1] = 'b';
-    arr2[2] = 'c';
-    array<char, 3> buf2;
-    file1.Back()->Read(&buf2[0]);
-    EXPECT_EQ(buf2, arr2);
-
-    EXPECT_TRUE(file1.LowerBoundPage(0) == file1.BeginPage());
-    EXPECT_TRUE(file1.LowerBoundPage(len1 - 1) == ++file1.BeginPage());
-    EXPECT_TRUE(file1.LowerBoundPage(len1) == ++file1.BeginPage());
-    EXPECT_TRUE(file1.LowerBoundPage(len1 + 1) == file1.EndPage());
-    EXPECT_TRUE(file1.LowerBoundPage(len1 + len2) == file1.EndPage());
-
-    pair<PageSetConstIterator, PageSetConstIterator> range =
-        file1.IntesectingRange(0, len1);
-    EXPECT_TRUE(range.first == file1.BeginPage());
-    EXPECT_TRUE(range.second == ++file1.BeginPage());
-    pair<PageSetConstIterator, PageSetConstIterator> range1 =
-        file1.IntesectingRange(len1 - 1, len1);
-    EXPECT_TRUE(range1.first == file1.BeginPage());
-    EXPECT_TRUE(range1.second == ++file1.BeginPage());
-    pair<PageSetConstIterator, PageSetConstIterator> range2 =
-        file1.IntesectingRange(len1, len1 + 1);
-    EXPECT_TRUE(range2.first == ++file1.BeginPage());
-    EXPECT_TRUE(range2.second == file1.EndPage());
+    EXPECT_TRUE(file1.HasData(0, bs + len2));
+    EXPECT_TRUE(file1.GetUnloadedRanges(0, 2 * bs).empty());
+    EXPECT_EQ(file1.GetNumBlocks(), 2u);
+    EXPECT_EQ(ReadNoLoadToString(file1, off2, len2), "abc");
 
+    // write across blocks
     const char *page3 = "ABC";
     size_t len3 = 3;
-    size_t holeLen = 10;
-    off_t off3 = off2 + holeLen + len3;
+    off_t off3 = bs - 1;
     file1.DoWrite(off3, len3, page3);
-    EXPECT_EQ(file1.GetDataSize(), len1 + len2 + len3);
-    EXPECT_EQ(file1.GetSize(), len1 + len2 + holeLen + len3);
+    EXPECT_EQ(file1.GetSize(), bs + len2);
+    EXPECT_EQ(file1.GetDataSize(), bs + len2);
     if (useDisk) {
       EXPECT_EQ(file1.GetCachedSize(), 0u);
     } else {
-      EXPECT_EQ(file1.GetCachedSize(), len1 + len2 + len3);
+      EXPECT_EQ(file1.GetCachedSize(), BufferArena::GetAllocSize(bs) +
+                                           BufferArena::GetAllocSize(len2));
     }
-    EXPECT_TRUE(file1.HasData(off2, len2));
-    EXPECT_TRUE(file1.HasData(off3, len3));
-    EXPECT_FALSE(file1.HasData(off2 + len3, len3));
-    EXPECT_FALSE(file1.HasData(off3 - 1, len3));
-    EXPECT_TRUE(file1.GetUnloadedRanges(0, len1 + len2).empty());
+    EXPECT_EQ(file1.m_arena->GetSizeInUse(), file1.GetCachedSize());
+    EXPECT_EQ(ReadNoLoadToString(file1, off3, 4), "ABCc");
+    EXPECT_EQ(ReadNoLoadToString(file1, 0, len1), "012");
+    EXPECT_EQ(file1.GetNumBlocks(), 2u);
+
+    // write to a far block
+    const char *page4 = "xyz";
+    size_t len4 = 3;
+    off_t off4 = 3 * bs;
+    file1.DoWrite(off4, len4, page4);
+    EXPECT_EQ(file1.GetSize(), off4 + len4);
+    EXPECT_EQ(file1.GetNumBlocks(), 3u);
+    EXPECT_TRUE(file1.HasData(off4, len4));
+    EXPECT_FALSE(file1.HasData(off4 - 1, len4));
     ContentRangeDeque d1;
-    d1.push_back(make_pair(len1 + len2, len3));
-    EXPECT_EQ(file1.GetUnloadedRanges(0, len1 + len2 + len3), d1);
-    ContentRangeDeque d2;
-    d2.push_back(make_pair(len1 + len2, holeLen));
-    d2.push_back(make_pair(off3 + len3, 1));
-    EXPECT_EQ(file1.GetUnloadedRanges(0, off3 + len3 + 1), d2);
-    ContentRangeDeque d3;
-    d3.push_back(make_pair(len1 + len2, 1));
-    EXPECT_EQ(file1.GetUnloadedRanges(len1 + len2, 1), d3);
-    EXPECT_FALSE(file1.HasData(len1 + len2, 1));
-
-    EXPECT_TRUE(file1.LowerBoundPage(len1 + len2 + len3) == --file1.EndPage());
-    EXPECT_TRUE(file1.LowerBoundPage(off3) == --file1.EndPage());
-    EXPECT_TRUE(file1.LowerBoundPage(off3 + len3) == file1.EndPage());
-    EXPECT_TRUE(file1.UpperBoundPage(off2) == --file1.EndPage());
-    EXPECT_TRUE(file1.UpperBoundPage(off2 + len2) == --file1.EndPage());
-    EXPECT_TRUE(file1.UpperBoundPage(off3) == file1.EndPage());
-    pair<PageSetConstIterator, PageSetConstIterator> range3 =
-        file1.IntesectingRange(off2 + 1, off3 - 1);
-    EXPECT_TRUE(range3.first == ++file1.BeginPage());
-    EXPECT_TRUE(range3.second == --file1.EndPage());
-    pair<PageSetConstIterator, PageSetConstIterator> range4 =
-        file1.IntesectingRange(off3 + 1, off3 + 1);
-    EXPECT_TRUE(range4.first == --file1.EndPage());
-    EXPECT_TRUE(range4.second == file1.EndPage());
+    d1.push_back(make_pair(2 * bs, bs));
+    EXPECT_EQ(file1.GetUnloadedRanges(0, off4 + len4), d1);
   }
 
   void TestWriteOverlapped(bool useDisk) {
-    string filename = "File_TestWriteOverlapped";
-    string filepath =
-        AppendPathDelim(
-            QS::Configure::Options::Instance().GetDiskCacheDirectory()) +
-        filename;
-    File file1(filepath);  // empty file
+    File file1(MakeFilePath("File_TestWriteOverlapped"));  // empty file
     if (useDisk) {
       file1.SetUseDiskFile(true);
     }
@@ -289,237 +281,480 @@ class FileTest : public Test {
     if (useDisk) {
       EXPECT_EQ(file1.GetCachedSize(), 0u);
     } else {
-      EXPECT_EQ(file1.GetCachedSize(), len1);
+      EXPECT_EQ(file1.GetCachedSize(), BufferArena::GetAllocSize(len1));
     }
 
-    const char *data2 = "abc";
-    size_t len2 = strlen(data2);
+    const char *page2 = "abc";
+    size_t len2 = strlen(page2);
     off_t off2 = 0;
-    shared_ptr<stringstream> page2 = make_shared<stringstream>(data2);
     file1.DoWrite(off2, len2, page2);
     EXPECT_EQ(file1.GetSize(), off2 + len2);
     EXPECT_EQ(file1.GetDataSize(), off2 + len2);
-    if (useDisk) {
-      EXPECT_EQ(file1.GetCachedSize(), 0u);
-    } else {
-      EXPECT_EQ(file1.GetCachedSize(), off2 + len2);
-    }
+    EXPECT_EQ(ReadNoLoadToString(file1, 0, off2 + len2), "abc");
 
-    const char *data3 = "ABC";
-    size_t len3 = strlen(data3);
+    const char *page3 = "ABC";
+    size_t len3 = strlen(page3);
     off_t off3 = 1;
-    shared_ptr<stringstream> page3 = make_shared<stringstream>(data3);
     file1.DoWrite(off3, len3, page3);
     EXPECT_EQ(file1.GetSize(), off3 + len3);
     EXPECT_EQ(file1.GetDataSize(), off3 + len3);
-    if (useDisk) {
-      EXPECT_EQ(file1.GetCachedSize(), 0u);
-    } else {
-      EXPECT_EQ(file1.GetCachedSize(), off3 + len3);
-    }
+    EXPECT_EQ(ReadNoLoadToString(file1, 0, off3 + len3), "aABC");
 
-    const char *page4 = "XYZ";
+    // write inside of page
+    const char *page4 = "X";
     size_t len4 = strlen(page4);
     off_t off4 = 1;
     file1.DoWrite(off4, len4, page4);
-    EXPECT_EQ(file1.GetSize(), off4 + len4);
-    EXPECT_EQ(file1.GetDataSize(), off4 + len4);
+    EXPECT_EQ(file1.GetSize(), off3 + len3);
+    EXPECT_EQ(file1.GetDataSize(), off3 + len3);
     if (useDisk) {
       EXPECT_EQ(file1.GetCachedSize(), 0u);
     } else {
-      EXPECT_EQ(file1.GetCachedSize(), off4 + len4);
+      EXPECT_EQ(file1.GetCachedSize(), BufferArena::GetAllocSize(off3 + len3));
     }
+    EXPECT_EQ(ReadNoLoadToString(file1, 0, off3 + len3), "aXBC");
   }
 
   void TestRead(bool useDisk) {
-    string filename = "File_TestRead";
-    string filepath =
-        AppendPathDelim(
-            QS::Configure::Options::Instance().GetDiskCacheDirectory()) +
-        filename;
-
-    File file1(filepath);  // empty file
+    File file1(MakeFilePath("File_TestRead"));  // empty file
     if (useDisk) {
       file1.SetUseDiskFile(true);
     }
+    size_t bs = file1.GetBlockSize();
 
-    const char *page1 = "012";
-    size_t len1 = 3;
+    const char *page1 = "012abc";
+    size_t len1 = 6;
     off_t off1 = 0;
     file1.DoWrite(off1, len1, page1);
 
-    const char *page2 = "abc";
+    const char *page2 = "ABC";
     size_t len2 = 3;
-    off_t off2 = off_t(len1);
+    size_t holeLen = 10;
+    off_t off2 = off1 + len1 + holeLen;
     file1.DoWrite(off2, len2, page2);
 
-    const char *page3 = "ABC";
+    const char *page3 = "xyz";
     size_t len3 = 3;
-    size_t holeLen = 10;
-    off_t off3 = off2 + len2 + holeLen;
+    off_t off3 = 2 * bs;
     file1.DoWrite(off3, len3, page3);
     // now file1 data should be
-    // column: 01234567890123456789
-    //
-    // data:   012abc          ABC
-    //
+    // block : 0                     | 1 | 2
+    // data  : 012abc          ABC   |   | xyz
     {
       array<char, 3> buf;
-      pair<size_t, ContentRangeDeque> res =
-          file1.ReadNoLoad(off1, len1, &buf[0]);
-      EXPECT_EQ(res.first, len1);
-      array<char, 3> arr;
-      arr[0] = '0';
-      arr[1] = '1';
-      arr[2] = '2';
+      pair<size_t, ContentRangeDeque> res = file1.ReadNoLoad(0, 3, &buf[0]);
+      EXPECT_EQ(res.first, 3u);
+      array<char, 3> arr = {{'0', '1', '2'}};
       EXPECT_EQ(buf, arr);
-      ContentRangeDeque &unloadPages = res.second;
-      EXPECT_TRUE(unloadPages.empty());
+      EXPECT_TRUE(res.second.empty());
     }
     {
       array<char, 3> buf;
-      pair<size_t, ContentRangeDeque> res =
-          file1.ReadNoLoad(off2, len2, &buf[0]);
-      EXPECT_EQ(res.first, 3);
-      array<char, 3> arr;
-      arr[0] = 'a';
-      arr[1] = 'b';
-      arr[2] = 'c';
+      pair<size_t, ContentRangeDeque> res = file1.ReadNoLoad(1, 3, &buf[0]);
+      EXPECT_EQ(res.first, 3u);
+      array<char, 3> arr = {{'1', '2', 'a'}};
       EXPECT_EQ(buf, arr);
-      ContentRangeDeque &unloadPages = res.second;
-      EXPECT_TRUE(unloadPages.empty());
+      EXPECT_TRUE(res.second.empty());
     }
     {
-      array<char, 3> buf;
-      pair<size_t, ContentRangeDeque> res =
-          file1.ReadNoLoad(off1 + 1, 3, &buf[0]);
-      EXPECT_EQ(res.first, 3);
-      array<char, 3> arr;
-      arr[0] = '1';
-      arr[1] = '2';
-      arr[2] = 'a';
-      EXPECT_EQ(buf, arr);
-      ContentRangeDeque &unloadPages = res.second;
-      EXPECT_TRUE(unloadPages.empty());
-
-      pair<size_t, ContentRangeDeque> res_ =
-          file1.ReadNoLoad(off2 + len2, holeLen, NULL);
-      EXPECT_EQ(res_.first, 0u);
-      ContentRangeDeque &unloadPages_ = res_.second;
-      EXPECT_FALSE(unloadPages_.empty());
-    }
-    {
-      array<char, 3> buf;
+      // hole in block
+      array<char, 13> buf;
       pair<size_t, ContentRangeDeque> res =
-          file1.ReadNoLoad(off3, len3, &buf[0]);
-      EXPECT_EQ(res.first, len3);
-      array<char, 3> arr;
-      arr[0] = 'A';
-      arr[1] = 'B';
-      arr[2] = 'C';
+          file1.ReadNoLoad(off1 + len1, holeLen + len2, &buf[0]);
+      EXPECT_EQ(res.first, holeLen + len2);
+      array<char, 13> arr;
+      arr.assign('\0');
+      arr[10] = 'A';
+      arr[11] = 'B';
+      arr[12] = 'C';
       EXPECT_EQ(buf, arr);
-      ContentRangeDeque &unloadPages = res.second;
-      EXPECT_TRUE(unloadPages.empty());
+      EXPECT_TRUE(res.second.empty());
     }
     {
-      array<char, 3> buf;
+      // hole beyond page
+      array<char, 4> buf;
       pair<size_t, ContentRangeDeque> res =
           file1.ReadNoLoad(off2, len2 + 1, &buf[0]);
-      EXPECT_EQ(res.first, len2);
-      array<char, 3> arr;
-      arr[0] = 'a';
-      arr[1] = 'b';
-      arr[2] = 'c';
+      EXPECT_EQ(res.first, len2 + 1);
+      array<char, 4> arr = {{'A', 'B', 'C', '\0'}};
       EXPECT_EQ(buf, arr);
-      ContentRangeDeque &unloadPages = res.second;
-      EXPECT_EQ(unloadPages.size(), 1u);
-      EXPECT_EQ(unloadPages.front(), make_pair(off_t(off2 + len2), 1ul));
+      EXPECT_TRUE(res.second.empty());
     }
     {
-      array<char, 13> buf;
+      // unloaded block
+      vector<char> buf(bs + 2, 'u');
       pair<size_t, ContentRangeDeque> res =
-          file1.ReadNoLoad(off2 + len2, holeLen + len3, &buf[0]);
-      EXPECT_EQ(res.first, len3);
-      array<char, 13> arr;
-      for (int i = 0; i < 10; ++i) {
-        arr[i] = '\0';
-      }
-      arr[10] = 'A';
-      arr[11] = 'B';
-      arr[12] = 'C';
-      EXPECT_EQ(buf, arr);
-      ContentRangeDeque &unloadPages = res.second;
-      EXPECT_EQ(unloadPages.size(), 1u);
-      EXPECT_EQ(unloadPages.front(),
-                make_pair(off_t(off2 + len2), size_t(holeLen)));
+          file1.ReadNoLoad(bs - 1, bs + 2, &buf[0]);
+      EXPECT_EQ(res.first, 2u);
+      EXPECT_EQ(buf[0], '\0');
+      EXPECT_EQ(buf[1], '\0');
+      EXPECT_EQ(buf[bs], '\0');
+      EXPECT_EQ(buf[bs + 1], 'x');
+      ContentRangeDeque &unloadRanges = res.second;
+      EXPECT_EQ(unloadRanges.size(), 1u);
+      EXPECT_EQ(unloadRanges.front(), make_pair(off_t(bs), bs));
+
+      pair<size_t, ContentRangeDeque> res_ = file1.ReadNoLoad(bs, bs, NULL);
+      EXPECT_EQ(res_.first, 0u);
+      EXPECT_EQ(res_.second.size(), 1u);
+      EXPECT_EQ(res_.second.front(), make_pair(off_t(bs), bs));
     }
-
-    {
-        array<char, 13> buf;
-        pair<size_t, ContentRangeDeque> res =
-            file1.ReadNoLoad(off2 + len2, holeLen + len3 + 1, &buf[0]);
-        EXPECT_EQ(res.first, len3);
-        array<char, 13> arr;
-        for (int i = 0; i < 10; ++i) {
-          arr[i] = '\0';
-        }
-        arr[10] = 'A';
-        arr[11] = 'B';
-        arr[12] = 'C';
-        EXPECT_EQ(buf, arr);
-        ContentRangeDeque &unloadPages = res.second;
-        EXPECT_EQ(unloadPages.size(), 2u);
-        EXPECT_EQ(unloadPages.front(),
-                  make_pair(off_t(off2 + len2), size_t(holeLen)));
-        EXPECT_EQ(unloadPages.back(),
-                  make_pair(off_t(off3 + len3), size_t(1u)));
-      }
   }
 
   void TestResize(bool useDisk) {
-    uint64_t cacheCap = 100;
+    uint64_t cacheCap = QS::Size::MB1;
     if (useDisk) {
       cacheCap = 3;
     }
     shared_ptr<Cache> cache = shared_ptr<Cache>(new Cache(cacheCap));
 
     const char *filename = "File_TestResize";
+    shared_ptr<File> file = cache->MakeFile(filename);
+    size_t bs = file->GetBlockSize();
     const char *page1 = "012";
     size_t len1 = strlen(page1);
     off_t off1 = 0;
-    shared_ptr<File> file = cache->MakeFile(filename);
     file->Write(off1, len1, page1, nullDirTree, cache);
-    const char *data = "abc";
-    size_t len2 = strlen(data);
+    const char *page2 = "abc";
+    size_t len2 = strlen(page2);
     off_t off2 = off_t(len1);
-    shared_ptr<stringstream> page2 = make_shared<stringstream>(data);
     file->Write(off2, len2, page2, nullDirTree, cache);
     const char *page3 = "ABC";
     size_t len3 = strlen(page3);
-    size_t holeLen = 10;
-    off_t off3 = off2 + holeLen + len3;
-    file->Write(off3, len3, page3, nullDirTree,cache);
+    off_t off3 = bs;
+    file->Write(off3, len3, page3, nullDirTree, cache);
 
-    EXPECT_EQ(file->GetSize(), len1 + len2 + holeLen + len3);
+    EXPECT_EQ(file->GetSize(), bs + len3);
     EXPECT_EQ(file->GetDataSize(), len1 + len2 + len3);
+    EXPECT_EQ(file->GetNumBlocks(), 2u);
+    EXPECT_TRUE(file->IsDirty());
+    if (!useDisk) {
+      EXPECT_EQ(cache->GetSize(), file->GetCachedSize());
+      EXPECT_EQ(cache->GetSize(), cache->GetArena()->GetSizeInUse());
+    }
 
-    size_t newFileSz = len1 + len2 + holeLen + len3 + 1;
+    size_t newFileSz = bs + len3 + 1;
     file->Truncate(newFileSz, nullTransferManager, nullDirTree, cache,
-                 nullClient);
+                   nullClient);
     EXPECT_EQ(file->GetDataSize(), len1 + len2 + len3 + 1);
     EXPECT_EQ(file->GetSize(), newFileSz);
 
-    size_t newFileSz1 = len1 + len2 + 1;
+    size_t newFileSz1 = len1 + len2 - 1;
     file->Truncate(newFileSz1, nullTransferManager, nullDirTree, cache,
-                 nullClient);
-    EXPECT_EQ(file->GetDataSize(), len1 + len2);
+                   nullClient);
+    EXPECT_EQ(file->GetDataSize(), newFileSz1);
     EXPECT_EQ(file->GetSize(), newFileSz1);
+    EXPECT_EQ(file->GetNumBlocks(), 1u);
+    EXPECT_EQ(ReadNoLoadToString(*file, 0, newFileSz1), "012ab");
+    if (!useDisk) {
+      EXPECT_EQ(cache->GetSize(), file->GetCachedSize());
+      EXPECT_EQ(cache->GetSize(), cache->GetArena()->GetSizeInUse());
+    }
 
-    size_t newFileSz2 = len1 + 1;
+    // grow in the same block
+    size_t newFileSz2 = len1 + len2 + 1;
     file->Truncate(newFileSz2, nullTransferManager, nullDirTree, cache,
-                 nullClient);
-    EXPECT_EQ(file->GetDataSize(), newFileSz2);
+                   nullClient);
     EXPECT_EQ(file->GetSize(), newFileSz2);
+    EXPECT_EQ(ReadNoLoadToString(*file, 0, newFileSz2),
+              string("012ab\0\0", newFileSz2));
+
+    file->Truncate(0, nullTransferManager, nullDirTree, cache, nullClient);
+    EXPECT_EQ(file->GetDataSize(), 0u);
+    EXPECT_EQ(file->GetSize(), 0u);
+    EXPECT_EQ(file->GetNumBlocks(), 0u);
+    if (!useDisk) {
+      EXPECT_EQ(cache->GetSize(), 0u);
+      EXPECT_EQ(cache->GetArena()->GetSizeInUse(), 0u);
+    }
+  }
+
+  void TestWriteLoadEdgeBlocks() {
+    shared_ptr<Cache> cache = shared_ptr<Cache>(new Cache(QS::Size::MB1));
+    shared_ptr<File> file = cache->MakeFile("File_TestWriteLoadEdgeBlocks");
+    size_t bs = file->GetBlockSize();
+    const char *page = "abc";
+    size_t len = strlen(page);
+
+    // no content in object storage
+    file->SetRemoteMeta(0, "etag");
+    EXPECT_TRUE(boost::get<0>(file->Write(1, len, page, nullTransferManager,
+                                          nullDirTree, cache, nullClient)));
+    EXPECT_TRUE(file->IsDirty());
+    EXPECT_EQ(ReadNoLoadToString(*file, 0, len + 1), string("\0abc", 4));
+    file->Clear();
+
+    // partially covered block need to be loaded at first, fail without
+    // transfer manager
+    file->SetRemoteMeta(2 * bs, "etag");
+    EXPECT_FALSE(boost::get<0>(file->Write(1, len, page, nullTransferManager,
+                                           nullDirTree, cache, nullClient)));
+    EXPECT_EQ(file->GetNumBlocks(), 0u);
+    EXPECT_FALSE(file->IsDirty());
+
+    // fully covered block need not to be loaded
+    vector<char> block(bs, 'b');
+    EXPECT_TRUE(boost::get<0>(file->Write(bs, bs, &block[0],
+                                          nullTransferManager, nullDirTree,
+                                          cache, nullClient)));
+    EXPECT_EQ(file->GetNumBlocks(), 1u);
+
+    // block beyond object size need not to be loaded
+    EXPECT_TRUE(boost::get<0>(file->Write(2 * bs + 1, len, page,
+                                          nullTransferManager, nullDirTree,
+                                          cache, nullClient)));
+    EXPECT_EQ(file->GetNumBlocks(), 2u);
+    ContentRangeDeque d0;
+    d0.push_back(make_pair(0, bs));
+    EXPECT_EQ(file->GetUnloadedRanges(0, 3 * bs), d0);
+  }
+
+  void TestSmallAppends() {
+    shared_ptr<Cache> cache = shared_ptr<Cache>(new Cache(QS::Size::MB1 * 4));
+    shared_ptr<File> file = cache->MakeFile("File_TestSmallAppends");
+    size_t bs = file->GetBlockSize();
+    size_t fileSize = 2 * bs + bs / 2;
+    vector<char> buf(QS::Size::KB4, 'a');
+    for (size_t off = 0; off < fileSize; off += buf.size()) {
+      EXPECT_TRUE(boost::get<0>(file->Write(off, buf.size(), &buf[0],
+                                            nullDirTree, cache)));
+    }
+    // one page per block, which is extended in place
+    EXPECT_EQ(file->GetNumBlocks(), 3u);
+    EXPECT_EQ(file->GetDataSize(), fileSize);
+    EXPECT_EQ(file->GetCachedSize(),
+              2 * bs + BufferArena::GetAllocSize(bs / 2));
+  }
+
+  void TestMovePageToDisk() {
+    shared_ptr<Cache> cache =
+        shared_ptr<Cache>(new Cache(BufferArena::GetAllocSize(1)));
+    shared_ptr<File> file = cache->MakeFile("File_TestMovePageToDisk");
+    const char *page = "abc";
+    size_t len = strlen(page);
+    EXPECT_TRUE(boost::get<0>(file->Write(0, len, page, nullDirTree, cache)));
+    EXPECT_FALSE(file->UseDiskFile());
+    EXPECT_EQ(cache->GetSize(), file->GetCachedSize());
+
+    // no free cache space to grow the page, it is moved to disk file
+    vector<char> buf(cache->GetCapacity(), 'a');
+    EXPECT_TRUE(boost::get<0>(file->Write(len, buf.size(), &buf[0],
+                                          nullDirTree, cache)));
+    EXPECT_TRUE(file->UseDiskFile());
+    EXPECT_EQ(file->GetDiskCachedSize(), len + buf.size());
+    EXPECT_EQ(file->GetCachedSize(), 0u);
+    EXPECT_EQ(cache->GetSize(), 0u);
+    EXPECT_EQ(ReadNoLoadToString(*file, 0, len), "abc");
+    file->Clear();
+  }
+
+  void TestGetDiskRanges() {
+    shared_ptr<Cache> cache =
+        shared_ptr<Cache>(new Cache(BufferArena::GetAllocSize(1)));
+    shared_ptr<File> file = cache->MakeFile("File_TestGetDiskRanges");
+    const char *page = "abc";
+    size_t len = strlen(page);
+    EXPECT_TRUE(boost::get<0>(file->Write(0, len, page, nullDirTree, cache)));
+    // in-memory content is not referred by disk file
+    DiskRangeList ranges;
+    EXPECT_FALSE(file->GetDiskRanges(0, len, &ranges));
+    EXPECT_TRUE(ranges.empty());
+
+    vector<char> buf(cache->GetCapacity(), 'a');
+    EXPECT_TRUE(boost::get<0>(file->Write(len, buf.size(), &buf[0],
+                                          nullDirTree, cache)));
+    EXPECT_TRUE(file->UseDiskFile());
+    size_t size = len + buf.size();
+    EXPECT_TRUE(file->GetDiskRanges(0, size, &ranges));
+    ASSERT_EQ(ranges.size(), 1u);
+    EXPECT_EQ(ranges[0].offset, 0);
+    EXPECT_EQ(ranges[0].size, size);
+    char content[4] = {0};
+    EXPECT_EQ(pread(ranges[0].diskFile->GetFd(), content, len, 0),
+              static_cast<ssize_t>(len));
+    EXPECT_STREQ(content, "abc");
+
+    // bytes beyond the content are not stored in disk file
+    EXPECT_FALSE(file->GetDiskRanges(0, size + 1, &ranges));
+    EXPECT_TRUE(ranges.empty());
+    file->Clear();
+  }
+
+  void TestClaimRanges() {
+    shared_ptr<Cache> cache = shared_ptr<Cache>(new Cache(QS::Size::MB1));
+    shared_ptr<File> file = cache->MakeFile("File_TestClaimRanges");
+    size_t bs = file->GetBlockSize();
+    file->SetRemoteMeta(3 * bs + 10, "etag");
+    vector<char> block(bs, 'b');
+    EXPECT_TRUE(boost::get<0>(file->Write(bs, bs, &block[0], nullDirTree,
+                                          cache)));
+
+    // loaded blocks are skipped, and ranges are clipped by object size
+    ContentRangeDeque ranges;
+    ranges.push_back(make_pair(0, 5 * bs));
+    ContentRangeDeque d0;
+    d0.push_back(make_pair(0, bs));
+    d0.push_back(make_pair(2 * bs, bs + 10));
+    EXPECT_EQ(file->ClaimRanges(ranges), d0);
+
+    // blocks in flight are skipped
+    EXPECT_TRUE(file->ClaimRanges(ranges).empty());
+    EXPECT_TRUE(file->HasFetchingBlocks(0, 5 * bs));
+    EXPECT_FALSE(file->HasFetchingBlocks(bs, bs));
+    // blocks beyond the object are never claimed
+    EXPECT_FALSE(file->HasFetchingBlocks(4 * bs, bs));
+    file->FinishFetch(0, bs);
+    EXPECT_FALSE(file->HasFetchingBlocks(0, bs));
+    ContentRangeDeque d1;
+    d1.push_back(make_pair(0, bs));
+    EXPECT_EQ(file->ClaimRanges(ranges), d1);
+  }
+
+  void TestDropTruncatedDownload() {
+    shared_ptr<Cache> cache = shared_ptr<Cache>(new Cache(QS::Size::MB1));
+    shared_ptr<File> file = cache->MakeFile("File_TestDropTruncatedDownload");
+    size_t bs = file->GetBlockSize();
+    file->SetRemoteMeta(2 * bs, "etag");
+    vector<char> block(bs, 'b');
+    EXPECT_TRUE(boost::get<0>(file->Write(0, bs, &block[0], nullDirTree,
+                                          cache)));
+    uint64_t generation = file->GetGeneration();
+
+    // download of the second block is done after the file is truncated
+    file->Truncate(bs / 2, nullTransferManager, nullDirTree, cache,
+                   nullClient);
+    EXPECT_NE(file->GetGeneration(), generation);
+    shared_ptr<stringstream> stream = make_shared<stringstream>();
+    *stream << string(bs, 'r');
+    EXPECT_TRUE(boost::get<0>(file->WriteDownloaded(
+        bs, bs, stream, generation, nullDirTree, cache)));
+    EXPECT_EQ(file->GetNumBlocks(), 1u);
+    EXPECT_EQ(file->GetSize(), bs / 2);
+    EXPECT_EQ(cache->GetSize(), file->GetCachedSize());
+
+    // download since truncated is written
+    file->SetRemoteMeta(2 * bs, "etag");
+    EXPECT_TRUE(boost::get<0>(file->WriteDownloaded(
+        bs, bs, stream, file->GetGeneration(), nullDirTree, cache)));
+    EXPECT_EQ(file->GetNumBlocks(), 2u);
+    EXPECT_EQ(file->GetSize(), 2 * bs);
+  }
+
+  void TestRemoteMeta() {
+    string filename = "File_TestRemoteMeta";
+    File file1(filename);
+    EXPECT_FALSE(file1.HasRemoteMeta());
+    EXPECT_FALSE(file1.IsRemoteMetaValid());
+    EXPECT_EQ(file1.AskRemoteSize(nullClient), 0u);
+
+    file1.SetRemoteMeta(10u, "etag");
+    EXPECT_TRUE(file1.HasRemoteMeta());
+    EXPECT_TRUE(file1.IsRemoteMetaValid());
+    EXPECT_EQ(file1.GetRemoteETag(), "etag");
+    // no head as snapshot is valid
+    EXPECT_EQ(file1.AskRemoteSize(nullClient), 10u);
+    EXPECT_FALSE(file1.RefreshRemoteMeta(nullClient));
+    EXPECT_EQ(file1.GetRemoteSize(), 10u);
+
+    // snapshot taken from the meta headed by others
+    EXPECT_FALSE(file1.UpdateRemoteMeta(shared_ptr<FileMetaData>()));
+    EXPECT_FALSE(file1.UpdateRemoteMeta(make_shared<FileMetaData>(
+        filename, 20u, 0, 0, 0, 0, 0, FileType::File, "", "etag")));
+    EXPECT_EQ(file1.AskRemoteSize(nullClient), 20u);
+    EXPECT_TRUE(file1.UpdateRemoteMeta(make_shared<FileMetaData>(
+        filename, 30u, 0, 0, 0, 0, 0, FileType::File, "", "etag2")));
+    EXPECT_EQ(file1.GetRemoteETag(), "etag2");
+    EXPECT_EQ(file1.AskRemoteSize(nullClient), 30u);
+
+    // download fails on a precondition of the snapshot
+    file1.MarkRemoteMetaStale("etag");
+    EXPECT_TRUE(file1.IsRemoteMetaValid());
+    file1.MarkRemoteMetaStale("etag2");
+    EXPECT_FALSE(file1.IsRemoteMetaValid());
+    EXPECT_EQ(file1.AskRemoteSize(nullClient), 30u);
+    file1.SetRemoteMeta(40u, "etag3");
+    EXPECT_TRUE(file1.IsRemoteMetaValid());
+  }
+
+  void TestReadThroughIfMatch() {
+    shared_ptr<Cache> cache = shared_ptr<Cache>(new Cache(QS::Size::MB1));
+    shared_ptr<File> file = cache->MakeFile("File_TestReadThroughIfMatch");
+    size_t bs = file->GetBlockSize();
+    string content(3 * bs, 'a');
+    shared_ptr<ObjectClient> client =
+        boost::make_shared<ObjectClient>(content, "etag1");
+    file->SetRemoteMeta(content.size(), "etag1");
+    // block:    0 |  1  | 2
+    // content:    | bbb |
+    vector<char> block(bs, 'b');
+    EXPECT_TRUE(boost::get<0>(file->Write(bs, bs, &block[0], nullDirTree,
+                                          cache)));
+    vector<char> buf(content.size());
+    pair<size_t, ContentRangeDeque> res =
+        file->ReadThrough(0, buf.size(), &buf[0], client);
+    EXPECT_EQ(res.first, buf.size());
+    EXPECT_TRUE(res.second.empty());
+    EXPECT_EQ(string(&buf[0], bs), string(bs, 'a'));
+    EXPECT_EQ(string(&buf[bs], bs), string(bs, 'b'));
+    ASSERT_EQ(client->GetIfMatches().size(), 2u);
+    EXPECT_EQ(client->GetIfMatches()[0], "etag1");
+    EXPECT_EQ(client->GetIfMatches()[1], "etag1");
+
+    // object is modified since the snapshot, the rest of ranges fail
+    client->SetETag("etag2");
+    res = file->ReadThrough(0, buf.size(), &buf[0], client);
+    EXPECT_EQ(res.first, bs);
+    ContentRangeDeque failed;
+    failed.push_back(make_pair(0, bs));
+    failed.push_back(make_pair(2 * bs, bs));
+    EXPECT_EQ(res.second, failed);
+    EXPECT_EQ(client->GetIfMatches().size(), 3u);
+    file->Clear();
+  }
+
+  void TestDropStaleContent() {
+    shared_ptr<Cache> cache = shared_ptr<Cache>(new Cache(QS::Size::MB1));
+    shared_ptr<File> file = cache->MakeFile("File_TestDropStaleContent");
+    const char *page = "abc";
+    size_t len = strlen(page);
+    EXPECT_TRUE(boost::get<0>(file->Write(0, len, page, nullDirTree, cache)));
+    file->SetRemoteMeta(len, "etag");
+
+    // modified content is kept
+    file->DropStaleContent(cache);
+    EXPECT_EQ(file->GetNumBlocks(), 1u);
+    EXPECT_GT(cache->GetSize(), 0u);
+
+    // clean content is dropped
+    file->m_dirtyBlocks.assign(file->m_dirtyBlocks.size(), false);
+    file->DropStaleContent(cache);
+    EXPECT_EQ(file->GetNumBlocks(), 0u);
+    EXPECT_EQ(file->GetCachedSize(), 0u);
+    EXPECT_EQ(cache->GetSize(), 0u);
+    EXPECT_EQ(file->GetRemoteSize(), len);
+  }
+
+  void TestSameAsRemote() {
+    shared_ptr<Cache> cache = shared_ptr<Cache>(new Cache(QS::Size::MB1));
+    shared_ptr<File> file = cache->MakeFile("File_TestSameAsRemote");
+    const char *page = "abc";
+    size_t len = strlen(page);
+    EXPECT_TRUE(boost::get<0>(file->Write(0, len, page, nullDirTree, cache)));
+
+    // quoted etag is the md5 of the content
+    file->SetRemoteMeta(len, "\"900150983cd24fb0d6963f7d28e17f72\"");
+    EXPECT_TRUE(file->IsSameAsRemote(len));
+    EXPECT_FALSE(file->IsSameAsRemote(len + 1));
+    file->SetRemoteMeta(len, "d41d8cd98f00b204e9800998ecf8427e");
+    EXPECT_FALSE(file->IsSameAsRemote(len));
+    // etag which is not an md5, e.g. of a multipart object
+    file->SetRemoteMeta(len, "etag");
+    EXPECT_FALSE(file->IsSameAsRemote(len));
+
+    // unloaded content could not be compared
+    size_t bs = file->GetBlockSize();
+    file->SetRemoteMeta(bs + len, "900150983cd24fb0d6963f7d28e17f72");
+    EXPECT_FALSE(file->IsSameAsRemote(bs + len));
   }
 };
 
@@ -539,17 +774,15 @@ TEST_F(FileTest, Default) {
   EXPECT_FALSE(file1.HasData(0, 1));
   EXPECT_TRUE(file1.GetUnloadedRanges(0, 0).empty());
   EXPECT_FALSE(file1.GetUnloadedRanges(0, 1).empty());
-  pair<PageSetConstIterator, PageSetConstIterator> consecutivePagesAtFront =
-      file1.ConsecutivePageRangeAtFront();
-  EXPECT_TRUE(consecutivePagesAtFront.first == file1.BeginPage());
-  EXPECT_TRUE(consecutivePagesAtFront.second == file1.EndPage());
-  EXPECT_TRUE(file1.EndPage() == file1.BeginPage());
-  EXPECT_EQ(file1.GetNumPages(), 0u);
+  EXPECT_EQ(file1.GetNumBlocks(), 0u);
+  EXPECT_FALSE(file1.IsDirty());
+  size_t bs = file1.GetBlockSize();
+  EXPECT_EQ(bs, QS::Configure::Options::Instance().GetCacheBlockSizeInKB() *
+                    QS::Size::KB1);
+  EXPECT_EQ(bs & (bs - 1), 0u);
 }
 
-TEST_F(FileTest, UnloadedPages) { TestUnloadedPages(); }
-
-TEST_F(FileTest, UnguardedAddPages) { TestUnguardedAddPages(); }
+TEST_F(FileTest, UnloadedBlocks) { TestUnloadedBlocks(); }
 
 TEST_F(FileTest, Write) { TestWrite(false); }
 
@@ -567,6 +800,26 @@ TEST_F(FileTest, Resize) { TestResize(false); }
 
 TEST_F(FileTest, ResizeDiskFile) { TestResize(true); }
 
+TEST_F(FileTest, WriteLoadEdgeBlocks) { TestWriteLoadEdgeBlocks(); }
+
+TEST_F(FileTest, SmallAppends) { TestSmallAppends(); }
+
+TEST_F(FileTest, MovePageToDisk) { TestMovePageToDisk(); }
+
+TEST_F(FileTest, GetDiskRanges) { TestGetDiskRanges(); }
+
+TEST_F(FileTest, ClaimRanges) { TestClaimRanges(); }
+
+TEST_F(FileTest, DropTruncatedDownload) { TestDropTruncatedDownload(); }
+
+TEST_F(FileTest, RemoteMeta) { TestRemoteMeta(); }
+
+TEST_F(FileTest, ReadThroughIfMatch) { TestReadThroughIfMatch(); }
+
+TEST_F(FileTest, DropStaleContent) { TestDropStaleContent(); }
+
+TEST_F(FileTest, SameAsRemote) { TestSameAsRemote(); }
+
 }  // namespace Data
 }  // namespace QS
 
@@ -0,0 +1,99 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include <stddef.h>  // for size_t
+#include <sys/time.h>  // for gettimeofday
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "boost/shared_ptr.hpp"
+
+#include "gtest/gtest.h"
+
+#include "base/MD5.h"
+
+using boost::shared_ptr;
+using std::iostream;
+using std::string;
+using std::stringstream;
+using std::vector;
+
+namespace {
+
+vector<char> MakeData(size_t len) {
+  vector<char> data(len);
+  for (size_t i = 0; i < len; ++i) {
+    data[i] = static_cast<char>((i * 31 + i / 7) & 0xff);
+  }
+  return data;
+}
+
+}  // namespace
+
+TEST(MD5Test, RFC1321) {
+  EXPECT_EQ(md5(string()), "d41d8cd98f00b204e9800998ecf8427e");
+  EXPECT_EQ(md5(string("a")), "0cc175b9c0f1b6a831c399e269772661");
+  EXPECT_EQ(md5(string("abc")), "900150983cd24fb0d6963f7d28e17f72");
+  EXPECT_EQ(md5(string("message digest")),
+            "f96b697d7cb7938d525a2f31aaf161d0");
+  EXPECT_EQ(md5(string("abcdefghijklmnopqrstuvwxyz")),
+            "c3fcd3d76192e4007dfb496cca67e13b");
+  EXPECT_EQ(md5(string("1234567890123456789012345678901234567890"
+                       "1234567890123456789012345678901234567890")),
+            "57edf4a22be3c955ac49da2e2107b67a");
+}
+
+TEST(MD5Test, BufferStreamEqual) {
+  vector<char> data = MakeData(1024 * 1024 + 3);
+  string str(data.begin(), data.end());
+  string expected = md5(str);
+
+  EXPECT_EQ(md5(&data[0], data.size()), expected);
+  // unaligned buffer
+  EXPECT_EQ(md5(&data[1], data.size() - 1),
+            md5(string(data.begin() + 1, data.end())));
+
+  shared_ptr<iostream> stream(new stringstream(str));
+  EXPECT_EQ(md5(stream), expected);
+  // stream is rewound and could be hashed again
+  EXPECT_EQ(stream->tellg(), 0);
+  EXPECT_EQ(md5(stream), expected);
+}
+
+TEST(MD5Test, Throughput) {
+  const size_t len = 64 * 1024 * 1024;
+  vector<char> data = MakeData(len);
+  struct timeval start, stop;
+  gettimeofday(&start, NULL);
+  string digest = md5(&data[0], len);
+  gettimeofday(&stop, NULL);
+  double seconds = (stop.tv_sec - start.tv_sec) +
+                   (stop.tv_usec - start.tv_usec) / 1e6;
+  EXPECT_EQ(digest.size(), 32u);
+  if (seconds > 0) {
+    std::cout << "md5 throughput: " << len / seconds / (1024 * 1024)
+              << " MB/s" << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  int code = RUN_ALL_TESTS();
+  return code;
+}
@@ -0,0 +1,116 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "data/NegativeLookupCache.h"
+
+namespace QS {
+
+namespace Data {
+
+TEST(NegativeLookupCacheTest, AddAndEvict) {
+  NegativeLookupCache cache(2, 100);
+  cache.Add("/a");
+  cache.Add("/b");
+  EXPECT_TRUE(cache.Has("/a"));
+  EXPECT_FALSE(cache.Has("/a/"));
+
+  // the oldest is evicted
+  cache.Add("/c");
+  EXPECT_EQ(cache.GetNumPaths(), 2u);
+  EXPECT_FALSE(cache.Has("/a"));
+  EXPECT_TRUE(cache.Has("/b"));
+  EXPECT_TRUE(cache.Has("/c"));
+
+  cache.AddListedDirectory("/d/", 0);
+  EXPECT_TRUE(cache.IsListedDirectory("/d/"));
+  EXPECT_FALSE(cache.Has("/d/"));
+}
+
+TEST(NegativeLookupCacheTest, Erase) {
+  NegativeLookupCache cache(10, 100);
+  cache.Add("/a");
+  cache.Add("/a/");
+  cache.Add("/a/b");
+  cache.Add("/ab");
+  cache.AddListedDirectory("/a/", 0);
+  cache.AddListedDirectory("/a/c/", 0);
+  cache.AddListedDirectory("/", 0);
+
+  // paths under the directory are erased, but not the siblings
+  cache.Erase("/a/");
+  EXPECT_FALSE(cache.Has("/a"));
+  EXPECT_FALSE(cache.Has("/a/"));
+  EXPECT_FALSE(cache.Has("/a/b"));
+  EXPECT_TRUE(cache.Has("/ab"));
+  EXPECT_FALSE(cache.IsListedDirectory("/a/"));
+  EXPECT_FALSE(cache.IsListedDirectory("/a/c/"));
+  EXPECT_TRUE(cache.IsListedDirectory("/"));
+
+  // a file path erases the directory of the same name
+  cache.Add("/x/");
+  cache.Erase("/x");
+  EXPECT_FALSE(cache.Has("/x/"));
+
+  cache.Erase("/");
+  EXPECT_EQ(cache.GetNumPaths(), 0u);
+  EXPECT_EQ(cache.GetNumListedDirectories(), 0u);
+}
+
+TEST(NegativeLookupCacheTest, Evict) {
+  NegativeLookupCache cache(10, 100);
+  uint64_t numEvictions = cache.GetNumEvictions();
+  cache.AddListedDirectory("/a/", numEvictions);
+  cache.AddListedDirectory("/b/", numEvictions);
+  cache.AddListedDirectory("/b/c/", numEvictions);
+
+  // a child evicted is no longer known by the listing of its parent
+  cache.OnNodeEvicted("/a/x");
+  EXPECT_FALSE(cache.IsListedDirectory("/a/"));
+  EXPECT_TRUE(cache.IsListedDirectory("/b/"));
+  cache.OnNodeEvicted("/b/c/");
+  EXPECT_FALSE(cache.IsListedDirectory("/b/"));
+  EXPECT_FALSE(cache.IsListedDirectory("/b/c/"));
+
+  // a listing which eviction happens during is not recorded
+  EXPECT_EQ(cache.GetNumEvictions(), numEvictions + 2);
+  cache.AddListedDirectory("/a/", numEvictions);
+  EXPECT_FALSE(cache.IsListedDirectory("/a/"));
+  cache.AddListedDirectory("/a/", cache.GetNumEvictions());
+  EXPECT_TRUE(cache.IsListedDirectory("/a/"));
+}
+
+TEST(NegativeLookupCacheTest, Expire) {
+  NegativeLookupCache cache(10, 1);
+  cache.Add("/a");
+  cache.AddListedDirectory("/d/", 0);
+  sleep(2);
+  EXPECT_FALSE(cache.Has("/a"));
+  EXPECT_FALSE(cache.IsListedDirectory("/d/"));
+  EXPECT_EQ(cache.GetNumPaths(), 0u);
+}
+
+}  // namespace Data
+}  // namespace QS
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  int code = RUN_ALL_TESTS();
+  return code;
+}
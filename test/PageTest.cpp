@@ -31,8 +31,9 @@
 #include "base/Utils.h"
 #include "base/UtilsWithLog.h"
 #include "configure/Options.h"
+#include "data/BufferArena.h"
+#include "data/DiskFile.h"
 #include "data/Page.h"
-#include "data/StreamUtils.h"
 
 namespace QS {
 
@@ -41,7 +42,6 @@ namespace Data {
 using boost::array;
 using boost::make_shared;
 using boost::shared_ptr;
-using QS::Data::StreamUtils::GetStreamSize;
 using QS::UtilsWithLog::RemoveFileIfExists;
 using std::string;
 using std::stringstream;
@@ -54,16 +54,23 @@ void InitLog() {
   QS::Logging::Log::Instance().Initialize(defaultLogDir);
 }
 
+shared_ptr<BufferArena> arena_ = make_shared<BufferArena>();
+
 class PageTest : public Test {
  protected:
-  static void SetUpTestCase() { InitLog(); }
+  static void SetUpTestCase() {
+    InitLog();
+    QS::Utils::CreateDirectoryIfNotExists(
+        QS::Configure::Options::Instance().GetDiskCacheDirectory());
+  }
 
   void TestCtorWithDiskFile() {
     string str("123");
     size_t len = str.size();
     string file1 = QS::Configure::Options::Instance().GetDiskCacheDirectory() +
                    "test_page1";
-    Page p1(0, len, str.c_str(), file1);
+    shared_ptr<DiskFile> diskFile1 = boost::make_shared<DiskFile>(file1);
+    Page p1(0, len, str.c_str(), diskFile1);
     EXPECT_EQ(p1.Stop(), (off_t)(len - 1));
     EXPECT_EQ(p1.Next(), (off_t)len);
     EXPECT_EQ(p1.Size(), len);
@@ -81,7 +88,8 @@ class PageTest : public Test {
     shared_ptr<stringstream> ss = shared_ptr<stringstream>(new stringstream(str));
     string file2 = QS::Configure::Options::Instance().GetDiskCacheDirectory() +
                    "test_page2";
-    Page p2(0, len, ss, file2);
+    shared_ptr<DiskFile> diskFile2 = boost::make_shared<DiskFile>(file2);
+    Page p2(0, len, ss, diskFile2);
     EXPECT_EQ(p2.Stop(), (off_t)(len - 1));
     EXPECT_EQ(p2.Next(), (off_t)len);
     EXPECT_EQ(p2.Size(), len);
@@ -93,7 +101,7 @@ class PageTest : public Test {
   void TestResize() {
     const char *str = "123";
     size_t len = 3;
-    Page p1(0, len, str);
+    Page p1(0, len, str, arena_);
 
     array<char, 2> arrSmaller;
     arrSmaller[0] = '1';
@@ -109,7 +117,8 @@ class PageTest : public Test {
     size_t len = 3;
     string file1 = QS::Configure::Options::Instance().GetDiskCacheDirectory() +
                    "test_page1";
-    Page p1(0, len, str, file1);
+    shared_ptr<DiskFile> diskFile1 = boost::make_shared<DiskFile>(file1);
+    Page p1(0, len, str, diskFile1);
 
     array<char, 2> arrSmaller;
     arrSmaller[0] = '1';
@@ -120,35 +129,74 @@ class PageTest : public Test {
     EXPECT_TRUE(buf1 == arrSmaller);
     RemoveFileIfExists(file1);
   }
+
+  // Append small writes to a page, the buffer and the disk space grow in
+  // size classes instead of every append
+  void TestAppend(bool useDisk) {
+    string file1 = QS::Configure::Options::Instance().GetDiskCacheDirectory() +
+                   "test_page_append";
+    shared_ptr<DiskFile> diskFile1 = boost::make_shared<DiskFile>(file1);
+    string data(100, 'a');
+    shared_ptr<Page> page =
+        useDisk ? boost::make_shared<Page>(0, data.size(), data.c_str(),
+                                           diskFile1)
+                : boost::make_shared<Page>(0, data.size(), data.c_str(),
+                                           arena_);
+    Page &p1 = *page;
+    size_t numGrowth = 0;
+    size_t reserved = useDisk ? p1.m_diskReserved : p1.m_capacity;
+    for (int i = 1; i < 1000; ++i) {
+      char c = static_cast<char>('a' + i % 26);
+      string str(100, c);
+      ASSERT_TRUE(p1.Refresh(p1.Next(), str.size(), str.c_str()));
+      data += str;
+      size_t newReserved = useDisk ? p1.m_diskReserved : p1.m_capacity;
+      if (newReserved != reserved) {
+        ++numGrowth;
+        reserved = newReserved;
+      }
+    }
+    EXPECT_EQ(p1.Size(), data.size());
+    EXPECT_EQ(reserved, BufferArena::GetAllocSize(data.size()));
+    EXPECT_LE(numGrowth, 5u);  // 4KB to 128KB
+
+    string buf(data.size(), '\0');
+    p1.Read(&buf[0]);
+    EXPECT_EQ(buf, data);
+    RemoveFileIfExists(file1);
+  }
 };
 
 // --------------------------------------------------------------------------
 TEST_F(PageTest, Ctor) {
   string str("123");
   size_t len = str.size();
-  Page p1(0, len, str.c_str());
+  Page p1(0, len, str.c_str(), arena_);
   EXPECT_EQ(p1.Stop(), (off_t)(len - 1));
   EXPECT_EQ(p1.Next(), (off_t)len);
   EXPECT_EQ(p1.Size(), len);
   EXPECT_EQ(p1.Offset(), (off_t)0);
-  EXPECT_EQ(GetStreamSize(p1.GetBody()), len);
+  EXPECT_EQ(p1.Capacity(), BufferArena::GetAllocSize(len));
   EXPECT_FALSE(p1.UseDiskFile());
 
   shared_ptr<stringstream> ss = shared_ptr<stringstream>(new stringstream(str));
-  Page p2(0, len, ss);
+  Page p2(0, len, ss, arena_);
   EXPECT_EQ(p2.Stop(), (off_t)(len - 1));
   EXPECT_EQ(p2.Next(), (off_t)len);
   EXPECT_EQ(p2.Size(), len);
   EXPECT_EQ(p2.Offset(), (off_t)0);
-  EXPECT_EQ(GetStreamSize(p2.GetBody()), len);
+  EXPECT_EQ(p2.Capacity(), BufferArena::GetAllocSize(len));
   EXPECT_FALSE(p2.UseDiskFile());
+  array<char, 3> buf2;
+  p2.Read(&buf2[0]);
+  EXPECT_EQ(string(buf2.begin(), buf2.end()), str);
 
-  Page p3(0, len, ss);
+  Page p3(0, len, ss, arena_);
   EXPECT_EQ(p3.Stop(), (off_t)(len - 1));
   EXPECT_EQ(p3.Next(), (off_t)len);
   EXPECT_EQ(p3.Size(), len);
   EXPECT_EQ(p3.Offset(), (off_t)0);
-  EXPECT_EQ(GetStreamSize(p3.GetBody()), len);
+  EXPECT_EQ(p3.Capacity(), BufferArena::GetAllocSize(len));
   EXPECT_FALSE(p3.UseDiskFile());
 }
 
@@ -163,7 +211,7 @@ TEST_F(PageTest, Read) {
   arr[0] = '1';
   arr[1] = '2';
   arr[2] = '3';
-  Page p1(0, len, str);
+  Page p1(0, len, str, arena_);
 
   array<char, 3> buf1;
   p1.Read(0, len, &buf1[0]);
@@ -216,7 +264,8 @@ TEST_F(PageTest, ReadDiskFile) {
   arr[2] = '3';
   string file1 =
       QS::Configure::Options::Instance().GetDiskCacheDirectory() + "test_page1";
-  Page p1(0, len, str, file1);
+  shared_ptr<DiskFile> diskFile1 = boost::make_shared<DiskFile>(file1);
+  Page p1(0, len, str, diskFile1);
 
   array<char, 3> buf1;
   p1.Read(0, len, &buf1[0]);
@@ -229,7 +278,7 @@ TEST_F(PageTest, ReadDiskFile) {
 TEST_F(PageTest, Refresh) {
   const char *str = "123";
   size_t len = 3;
-  Page p1(0, len, str);
+  Page p1(0, len, str, arena_);
 
   array<char, 3> arrNew1;
   arrNew1[0] = '4';
@@ -256,7 +305,8 @@ TEST_F(PageTest, RefreshDiskFile) {
   size_t len = 3;
   string file1 =
       QS::Configure::Options::Instance().GetDiskCacheDirectory() + "test_page1";
-  Page p1(0, len, str, file1);
+  shared_ptr<DiskFile> diskFile1 = boost::make_shared<DiskFile>(file1);
+  Page p1(0, len, str, diskFile1);
 
   array<char, 3> arrNew1;
   arrNew1[0] = '4';
@@ -279,12 +329,120 @@ TEST_F(PageTest, RefreshDiskFile) {
   RemoveFileIfExists(file1);
 }
 
+// --------------------------------------------------------------------------
+TEST_F(PageTest, RefreshPartial) {
+  const char *str = "123";
+  size_t len = 3;
+  Page p1(0, len, str, arena_);
+
+  // refresh inside of page keeps page size
+  p1.Refresh(off_t(1), 1, "x");
+  EXPECT_EQ(p1.Size(), len);
+  array<char, 3> buf1;
+  p1.Read(0, len, &buf1[0]);
+  array<char, 3> arr1 = {{'1', 'x', '3'}};
+  EXPECT_TRUE(buf1 == arr1);
+
+  // refresh beyond page fills the gap with zero
+  p1.Refresh(off_t(4), 1, "y");
+  EXPECT_EQ(p1.Size(), 5u);
+  array<char, 5> buf2;
+  p1.Read(0, 5, &buf2[0]);
+  array<char, 5> arr2 = {{'1', 'x', '3', '\0', 'y'}};
+  EXPECT_TRUE(buf2 == arr2);
+
+  // refresh beyond buffer moves content to a larger buffer
+  size_t capacity = p1.Capacity();
+  p1.Refresh(off_t(capacity), 1, "z");
+  EXPECT_EQ(p1.Size(), capacity + 1);
+  EXPECT_EQ(p1.Capacity(), BufferArena::GetAllocSize(capacity + 1));
+  array<char, 5> buf3;
+  p1.Read(0, 5, &buf3[0]);
+  EXPECT_TRUE(buf3 == arr2);
+  char c = '\0';
+  p1.Read(off_t(capacity), 1, &c);
+  EXPECT_EQ(c, 'z');
+}
+
+// --------------------------------------------------------------------------
+TEST_F(PageTest, RefreshPartialDiskFile) {
+  const char *str = "123";
+  size_t len = 3;
+  string file1 =
+      QS::Configure::Options::Instance().GetDiskCacheDirectory() + "test_page1";
+  shared_ptr<DiskFile> diskFile1 = boost::make_shared<DiskFile>(file1);
+  Page p1(1, len, str, diskFile1);
+
+  p1.Refresh(off_t(2), 1, "x");
+  EXPECT_EQ(p1.Size(), len);
+  array<char, 3> buf1;
+  p1.Read(1, len, &buf1[0]);
+  array<char, 3> arr1 = {{'1', 'x', '3'}};
+  EXPECT_TRUE(buf1 == arr1);
+
+  p1.Refresh(off_t(5), 1, "y");
+  EXPECT_EQ(p1.Size(), 5u);
+  array<char, 5> buf2;
+  p1.Read(1, 5, &buf2[0]);
+  array<char, 5> arr2 = {{'1', 'x', '3', '\0', 'y'}};
+  EXPECT_TRUE(buf2 == arr2);
+
+  RemoveFileIfExists(file1);
+}
+
+// --------------------------------------------------------------------------
+TEST_F(PageTest, SharedDiskFile) {
+  string file1 =
+      QS::Configure::Options::Instance().GetDiskCacheDirectory() + "test_page1";
+  shared_ptr<DiskFile> diskFile1 = boost::make_shared<DiskFile>(file1);
+  ASSERT_TRUE(diskFile1->IsOpen());
+  // pages are stored at their offset in the same disk file
+  Page p1(0, 3, "123", diskFile1);
+  Page p2(8, 3, "456", diskFile1);
+  EXPECT_EQ(p1.GetDiskFile(), p2.GetDiskFile());
+
+  p1.Refresh(off_t(1), 1, "x");
+  array<char, 3> buf1;
+  p2.Read(8, 3, &buf1[0]);
+  array<char, 3> arr1 = {{'4', '5', '6'}};
+  EXPECT_TRUE(buf1 == arr1);
+  p1.Read(0, 3, &buf1[0]);
+  array<char, 3> arr2 = {{'1', 'x', '3'}};
+  EXPECT_TRUE(buf1 == arr2);
+
+  // disk file is still readable after it is removed from disk
+  EXPECT_TRUE(diskFile1->Remove());
+  EXPECT_FALSE(QS::Utils::FileExists(file1));
+  p2.Read(8, 3, &buf1[0]);
+  EXPECT_TRUE(buf1 == arr1);
+}
+
+// --------------------------------------------------------------------------
+TEST_F(PageTest, FailToStore) {
+  Page p1(0, 3, "123", arena_);
+  EXPECT_TRUE(p1.IsGood());
+
+  // disk file could not be opened, content is lost
+  string file1 = QS::Configure::Options::Instance().GetDiskCacheDirectory() +
+                 "not_existing_dir/test_page1";
+  shared_ptr<DiskFile> diskFile1 = boost::make_shared<DiskFile>(file1);
+  ASSERT_FALSE(diskFile1->IsOpen());
+  Page p2(0, 3, "123", diskFile1);
+  EXPECT_FALSE(p2.IsGood());
+}
+
 // --------------------------------------------------------------------------
 TEST_F(PageTest, Resize) { TestResize(); }
 
 // --------------------------------------------------------------------------
 TEST_F(PageTest, ResizeDiskFile) { TestResizeDiskFile(); }
 
+// --------------------------------------------------------------------------
+TEST_F(PageTest, Append) { TestAppend(false); }
+
+// --------------------------------------------------------------------------
+TEST_F(PageTest, AppendDiskFile) { TestAppend(true); }
+
 }  // namespace Data
 }  // namespace QS
 
@@ -0,0 +1,335 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include <stdio.h>  // for snprintf
+#include <time.h>
+
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "boost/bind.hpp"
+#include "boost/date_time/posix_time/posix_time_types.hpp"
+#include "boost/foreach.hpp"
+#include "boost/make_shared.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/thread/condition_variable.hpp"
+#include "boost/thread/locks.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/thread.hpp"
+
+#include "client/PartitionedListing.h"
+#include "data/FileMetaData.h"
+
+namespace QS {
+
+namespace Client {
+
+using boost::lock_guard;
+using boost::make_shared;
+using boost::mutex;
+using boost::shared_ptr;
+using boost::unique_lock;
+using QS::Data::FileMetaData;
+using std::deque;
+using std::set;
+using std::string;
+using std::vector;
+using ::testing::Test;
+
+// Bucket listing the keys after the marker in pages
+class FakeBucket {
+ public:
+  FakeBucket(const set<string> &keys, size_t pageSize)
+      : m_keys(keys), m_pageSize(pageSize) {}
+
+  ClientError<QSError::Value> ListPage(const string &marker,
+                                       FileMetaDataList *metas,
+                                       string *nextMarker, bool *truncated) {
+    if (m_onList) {
+      m_onList(marker);
+    }
+    lock_guard<mutex> lock(m_mutex);
+    if (!m_failMarker.empty() && marker >= m_failMarker) {
+      return ClientError<QSError::Value>(QSError::NO_SUCH_LIST_OBJECTS, true);
+    }
+    set<string>::const_iterator it = m_keys.upper_bound(marker);
+    for (size_t i = 0; i < m_pageSize && it != m_keys.end(); ++i, ++it) {
+      metas->push_back(
+          make_shared<FileMetaData>("/" + *it, 0, 0, 0, 0, 0, 0));
+      *nextMarker = *it;
+    }
+    *truncated = it != m_keys.end();
+    return ClientError<QSError::Value>(QSError::GOOD, false);
+  }
+
+  void SetOnList(const boost::function<void(const string &)> &onList) {
+    m_onList = onList;
+  }
+  void SetFailMarker(const string &marker) { m_failMarker = marker; }
+
+ private:
+  set<string> m_keys;
+  size_t m_pageSize;
+  mutex m_mutex;
+  string m_failMarker;
+  boost::function<void(const string &)> m_onList;
+};
+
+// Keys listed by all the listers
+class ListedKeys {
+ public:
+  void Apply(const FileMetaDataList &metas) {
+    lock_guard<mutex> lock(m_mutex);
+    BOOST_FOREACH (const shared_ptr<FileMetaData> &meta, metas) {
+      m_keys.push_back(meta->GetFilePath().substr(1));
+    }
+  }
+
+  vector<string> GetKeys() const {
+    lock_guard<mutex> lock(m_mutex);
+    return m_keys;
+  }
+
+ private:
+  mutable mutex m_mutex;
+  vector<string> m_keys;
+};
+
+shared_ptr<PartitionedListing> MakeListing(
+    const string &prefix, const string &marker,
+    const shared_ptr<FakeBucket> &bucket,
+    const shared_ptr<ListedKeys> &listed) {
+  return make_shared<PartitionedListing>(
+      prefix, marker,
+      boost::bind(&FakeBucket::ListPage, bucket, _1, _2, _3, _4),
+      boost::bind(&ListedKeys::Apply, listed, _1));
+}
+
+void ListAsHelper(shared_ptr<PartitionedListing> listing) {
+  listing->ListRanges(false);
+}
+
+class PartitionedListingTest : public Test {
+ protected:
+  // Wait until num of idle listers reaches the num, return false if timeout
+  static bool WaitForIdle(PartitionedListing *listing, int numIdle) {
+    for (int i = 0; i < 500; ++i) {
+      {
+        lock_guard<mutex> lock(listing->m_mutex);
+        if (listing->m_numIdle >= numIdle) {
+          return true;
+        }
+      }
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+    return false;
+  }
+
+  // Wait until num of ranges being listed reaches the num
+  static void WaitForRunning(PartitionedListing *listing, int numRunning) {
+    while (true) {
+      {
+        lock_guard<mutex> lock(listing->m_mutex);
+        if (listing->m_numRunning >= numRunning) {
+          return;
+        }
+      }
+      boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+  }
+
+  // Hold the first page of the owner until the helper is idle, and hold the
+  // second page of it until the helper returns
+  struct HoldOwner {
+    PartitionedListing *listing;
+    mutex *mtx;
+    boost::condition_variable *cond;
+    bool *helperStarted;
+    bool *helperDone;
+    bool *helperReturnedEarly;
+
+    void operator()(const string &marker) {
+      if (marker == "a") {
+        unique_lock<mutex> lock(*mtx);
+        while (!*helperStarted) {
+          cond->wait(lock);
+        }
+        lock.unlock();
+        EXPECT_TRUE(WaitForIdle(listing, 1));
+      } else if (marker == "a\xf4x") {
+        unique_lock<mutex> lock(*mtx);
+        cond->timed_wait(lock, boost::posix_time::seconds(5),
+                         boost::bind(&HoldOwner::IsHelperDone, this));
+        *helperReturnedEarly = *helperDone;
+      }
+    }
+
+    bool IsHelperDone() const { return *helperDone; }
+  };
+
+  void TestHelperReturns() {
+    set<string> keys;
+    keys.insert("a\xf4x");
+    keys.insert("c1");
+    shared_ptr<FakeBucket> bucket = make_shared<FakeBucket>(keys, 1);
+    shared_ptr<ListedKeys> listed = make_shared<ListedKeys>();
+    shared_ptr<PartitionedListing> listing =
+        MakeListing("", "a", bucket, listed);
+
+    mutex mtx;
+    boost::condition_variable cond;
+    bool helperStarted = false;
+    bool helperDone = false;
+    bool helperReturnedEarly = false;
+    HoldOwner hold = {listing.get(), &mtx, &cond, &helperStarted, &helperDone,
+                      &helperReturnedEarly};
+    bucket->SetOnList(hold);
+
+    // the owner takes the first range ['a', 'b') and is held in it
+    boost::thread owner(
+        boost::bind(&PartitionedListing::ListRanges, listing.get(), true));
+    WaitForRunning(listing.get(), 1);
+    {
+      lock_guard<mutex> lock(mtx);
+      helperStarted = true;
+    }
+    cond.notify_all();
+    // the rest of the owner's range could not be split after 'a\xf4x'
+    ListAsHelper(listing);
+    {
+      lock_guard<mutex> lock(mtx);
+      helperDone = true;
+    }
+    cond.notify_all();
+    owner.join();
+
+    EXPECT_TRUE(helperReturnedEarly);
+    EXPECT_TRUE(IsGoodQSError(listing->GetError()));
+    vector<string> listedKeys = listed->GetKeys();
+    EXPECT_EQ(set<string>(listedKeys.begin(), listedKeys.end()), keys);
+    EXPECT_EQ(listedKeys.size(), keys.size());
+  }
+};
+
+TEST_F(PartitionedListingTest, MarkerBefore) {
+  string marker = MarkerBefore("img_1");
+  EXPECT_EQ(marker, "img_0\xf4\x8f\xbf\xbf");
+  EXPECT_LT(string("img_0"), marker);
+  EXPECT_LT(string("img_0999\xe4\xb8\xad"), marker);
+  EXPECT_LT(marker, string("img_1"));
+}
+
+TEST_F(PartitionedListingTest, SplitListRanges) {
+  deque<ListRange> ranges = SplitListRanges("img_", "img_0005000", "");
+  ASSERT_GT(ranges.size(), 1u);
+  EXPECT_EQ(ranges.front().startKey, "img_0005000");
+  EXPECT_EQ(ranges.front().marker, "img_0005000");
+  EXPECT_EQ(ranges.front().stopKey, "img_00051");
+  EXPECT_TRUE(ranges.back().stopKey.empty());
+  for (size_t i = 1; i < ranges.size(); ++i) {
+    // ranges are adjacent in order, and listed from right before the start
+    EXPECT_EQ(ranges[i].startKey, ranges[i - 1].stopKey);
+    EXPECT_LT(ranges[i - 1].startKey, ranges[i].startKey);
+    EXPECT_EQ(ranges[i].marker, MarkerBefore(ranges[i].startKey));
+    // ranges never go beyond the prefix
+    EXPECT_EQ(ranges[i].startKey.substr(0, 4), "img_");
+  }
+  EXPECT_EQ(ranges.back().startKey, "img_\xf4");
+
+  // ranges stop at the stop key
+  ranges = SplitListRanges("img_", "img_0005000", "img_01");
+  ASSERT_GT(ranges.size(), 1u);
+  EXPECT_EQ(ranges.back().stopKey, "img_01");
+  for (size_t i = 1; i < ranges.size(); ++i) {
+    EXPECT_EQ(ranges[i].startKey, ranges[i - 1].stopKey);
+    EXPECT_LT(ranges[i].startKey, string("img_01"));
+  }
+
+  // nothing to split right before the stop key
+  ranges = SplitListRanges("", "a\xf4x", "b");
+  ASSERT_EQ(ranges.size(), 1u);
+  EXPECT_EQ(ranges[0].startKey, "a\xf4x");
+  EXPECT_EQ(ranges[0].stopKey, "b");
+}
+
+TEST_F(PartitionedListingTest, ListAllKeys) {
+  set<string> keys;
+  char key[32];
+  for (int i = 0; i < 2000; ++i) {
+    snprintf(key, sizeof(key), "img_%07d", i * 7);
+    keys.insert(key);
+  }
+  keys.insert("img_a");
+  keys.insert("img_\xe4\xb8\xad");
+  shared_ptr<FakeBucket> bucket = make_shared<FakeBucket>(keys, 10);
+  shared_ptr<ListedKeys> listed = make_shared<ListedKeys>();
+  shared_ptr<PartitionedListing> listing =
+      MakeListing("img_", "img_0000700", bucket, listed);
+
+  boost::thread_group helpers;
+  for (int i = 0; i < 3; ++i) {
+    helpers.create_thread(boost::bind(ListAsHelper, listing));
+  }
+  listing->ListRanges();
+  helpers.join_all();
+
+  EXPECT_TRUE(IsGoodQSError(listing->GetError()));
+  set<string> expected(keys.upper_bound("img_0000700"), keys.end());
+  vector<string> listedKeys = listed->GetKeys();
+  // every key is listed once
+  EXPECT_EQ(listedKeys.size(), expected.size());
+  EXPECT_EQ(set<string>(listedKeys.begin(), listedKeys.end()), expected);
+}
+
+TEST_F(PartitionedListingTest, StopOnError) {
+  set<string> keys;
+  char key[32];
+  for (int i = 0; i < 500; ++i) {
+    snprintf(key, sizeof(key), "img_%07d", i);
+    keys.insert(key);
+  }
+  shared_ptr<FakeBucket> bucket = make_shared<FakeBucket>(keys, 10);
+  bucket->SetFailMarker("img_0000300");
+  shared_ptr<ListedKeys> listed = make_shared<ListedKeys>();
+  shared_ptr<PartitionedListing> listing =
+      MakeListing("img_", "img_0000100", bucket, listed);
+
+  boost::thread_group helpers;
+  for (int i = 0; i < 2; ++i) {
+    helpers.create_thread(boost::bind(ListAsHelper, listing));
+  }
+  listing->ListRanges();
+  helpers.join_all();
+
+  ClientError<QSError::Value> err = listing->GetError();
+  EXPECT_FALSE(IsGoodQSError(err));
+  EXPECT_EQ(err.GetError(), QSError::NO_SUCH_LIST_OBJECTS);
+}
+
+TEST_F(PartitionedListingTest, HelperReturns) { TestHelperReturns(); }
+
+}  // namespace Client
+}  // namespace QS
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  int code = RUN_ALL_TESTS();
+  return code;
+}
@@ -0,0 +1,115 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include <utility>
+
+#include "gtest/gtest.h"
+
+#include "data/Readahead.h"
+
+namespace QS {
+
+namespace Data {
+
+using std::make_pair;
+
+TEST(ReadaheadTest, SequentialWindowGrows) {
+  Readahead readahead(100, 400);
+  ContentRangeDeque ranges = readahead.OnRead(0, 10, 10000);
+  EXPECT_EQ(readahead.GetPattern(), AccessPattern::Sequential);
+  ASSERT_EQ(ranges.size(), 1u);
+  EXPECT_EQ(ranges[0], make_pair(off_t(10), size_t(100)));
+  EXPECT_EQ(readahead.GetWindowSize(), 200u);
+
+  // refill when half of the window is consumed
+  ranges = readahead.OnRead(10, 10, 10000);
+  ASSERT_EQ(ranges.size(), 1u);
+  EXPECT_EQ(ranges[0], make_pair(off_t(110), size_t(200)));
+  EXPECT_EQ(readahead.GetWindowSize(), 400u);
+
+  for (off_t off = 20; off < 100; off += 10) {
+    EXPECT_TRUE(readahead.OnRead(off, 10, 10000).empty());
+  }
+
+  // window is capped by the max size
+  ranges = readahead.OnRead(100, 10, 10000);
+  ASSERT_EQ(ranges.size(), 1u);
+  EXPECT_EQ(ranges[0], make_pair(off_t(310), size_t(400)));
+  EXPECT_EQ(readahead.GetWindowSize(), 400u);
+}
+
+TEST(ReadaheadTest, ClipByFileSize) {
+  Readahead readahead(100, 400);
+  ContentRangeDeque ranges = readahead.OnRead(0, 10, 50);
+  ASSERT_EQ(ranges.size(), 1u);
+  EXPECT_EQ(ranges[0], make_pair(off_t(10), size_t(40)));
+  EXPECT_TRUE(readahead.OnRead(10, 10, 50).empty());
+}
+
+TEST(ReadaheadTest, RandomCollapse) {
+  Readahead readahead(100, 400);
+  readahead.OnRead(0, 10, 10000);
+  readahead.OnRead(10, 10, 10000);
+  EXPECT_EQ(readahead.GetWindowSize(), 400u);
+
+  EXPECT_TRUE(readahead.OnRead(5000, 10, 10000).empty());
+  EXPECT_EQ(readahead.GetPattern(), AccessPattern::Random);
+  EXPECT_EQ(readahead.GetWindowSize(), 0u);
+
+  // window restarts at the current offset
+  ContentRangeDeque ranges = readahead.OnRead(5010, 10, 10000);
+  EXPECT_EQ(readahead.GetPattern(), AccessPattern::Sequential);
+  ASSERT_EQ(ranges.size(), 1u);
+  EXPECT_EQ(ranges[0], make_pair(off_t(5020), size_t(100)));
+}
+
+TEST(ReadaheadTest, Strided) {
+  Readahead readahead(100, 400);
+  EXPECT_TRUE(readahead.OnRead(1000, 10, 100000).empty());
+  EXPECT_EQ(readahead.GetPattern(), AccessPattern::Unknown);
+  EXPECT_TRUE(readahead.OnRead(2000, 10, 100000).empty());
+
+  ContentRangeDeque ranges = readahead.OnRead(3000, 10, 100000);
+  EXPECT_EQ(readahead.GetPattern(), AccessPattern::Strided);
+  ASSERT_EQ(ranges.size(), 10u);
+  EXPECT_EQ(ranges.front(), make_pair(off_t(4000), size_t(10)));
+  EXPECT_EQ(ranges.back(), make_pair(off_t(13000), size_t(10)));
+
+  // records read ahead already are not issued again
+  ranges = readahead.OnRead(4000, 10, 100000);
+  ASSERT_EQ(ranges.size(), 1u);
+  EXPECT_EQ(ranges[0], make_pair(off_t(14000), size_t(10)));
+}
+
+TEST(ReadaheadTest, OutOfOrderSequential) {
+  Readahead readahead(100, 400);
+  readahead.OnRead(0, 10, 10000);
+  readahead.OnRead(10, 10, 10000);
+  readahead.OnRead(40, 10, 10000);
+  readahead.OnRead(20, 10, 10000);
+  readahead.OnRead(30, 10, 10000);
+  EXPECT_EQ(readahead.GetPattern(), AccessPattern::Sequential);
+  EXPECT_EQ(readahead.GetWindowSize(), 400u);
+}
+
+}  // namespace Data
+}  // namespace QS
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  int code = RUN_ALL_TESTS();
+  return code;
+}
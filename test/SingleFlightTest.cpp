@@ -0,0 +1,142 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include <stdexcept>
+#include <utility>
+
+#include "gtest/gtest.h"
+
+#include "boost/bind.hpp"
+#include "boost/thread/condition_variable.hpp"
+#include "boost/thread/locks.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/thread.hpp"
+
+#include "base/SingleFlight.hpp"
+
+namespace QS {
+
+namespace Threading {
+
+using std::pair;
+
+namespace {
+
+// The first call blocks until it is released, the later ones return at once
+class Request {
+ public:
+  Request() : m_numCalls(0), m_released(false) {}
+
+  int operator()() {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    int num = ++m_numCalls;
+    m_cond.notify_all();
+    while (num == 1 && !m_released) {
+      m_cond.wait(lock);
+    }
+    return num;
+  }
+
+  void WaitForFirstCall() {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    while (m_numCalls == 0) {
+      m_cond.wait(lock);
+    }
+  }
+
+  void Release() {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    m_released = true;
+    m_cond.notify_all();
+  }
+
+  int GetNumCalls() {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_numCalls;
+  }
+
+ private:
+  boost::mutex m_mutex;
+  boost::condition_variable m_cond;
+  int m_numCalls;
+  bool m_released;
+};
+
+void Call(SingleFlight<int> *flight, Request *request, pair<int, bool> *res) {
+  *res = flight->Do("/a", boost::bind(&Request::operator(), request));
+}
+
+int Throw() { throw std::runtime_error("fail"); }
+
+}  // namespace
+
+TEST(SingleFlightTest, ShareCallInFlight) {
+  SingleFlight<int> flight;
+  Request request;
+  pair<int, bool> res[3];
+  boost::thread leader(boost::bind(Call, &flight, &request, &res[0]));
+  request.WaitForFirstCall();
+  boost::thread follower1(boost::bind(Call, &flight, &request, &res[1]));
+  boost::thread follower2(boost::bind(Call, &flight, &request, &res[2]));
+  boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+  EXPECT_EQ(flight.GetNumCalls(), 1u);
+  request.Release();
+  leader.join();
+  follower1.join();
+  follower2.join();
+
+  EXPECT_EQ(request.GetNumCalls(), 1);
+  EXPECT_EQ(res[0], std::make_pair(1, false));
+  EXPECT_EQ(res[1], std::make_pair(1, true));
+  EXPECT_EQ(res[2], std::make_pair(1, true));
+  EXPECT_EQ(flight.GetNumCalls(), 0u);
+
+  // a call finished is not shared
+  EXPECT_EQ(flight.Do("/a", boost::bind(&Request::operator(), &request)),
+            std::make_pair(2, false));
+}
+
+TEST(SingleFlightTest, Forget) {
+  SingleFlight<int> flight;
+  Request request;
+  pair<int, bool> res;
+  boost::thread leader(boost::bind(Call, &flight, &request, &res));
+  request.WaitForFirstCall();
+
+  // callers after forgetting run again
+  flight.Forget("/a");
+  EXPECT_EQ(flight.GetNumCalls(), 0u);
+  EXPECT_EQ(flight.Do("/a", boost::bind(&Request::operator(), &request)),
+            std::make_pair(2, false));
+  request.Release();
+  leader.join();
+  EXPECT_EQ(res, std::make_pair(1, false));
+}
+
+TEST(SingleFlightTest, Throw) {
+  SingleFlight<int> flight;
+  EXPECT_THROW(flight.Do("/a", Throw), std::runtime_error);
+  EXPECT_EQ(flight.GetNumCalls(), 0u);
+}
+
+}  // namespace Threading
+}  // namespace QS
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  int code = RUN_ALL_TESTS();
+  return code;
+}
@@ -0,0 +1,119 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "data/StreamUpload.h"
+
+namespace QS {
+
+namespace Data {
+
+using std::vector;
+
+TEST(StreamUploadTest, TakeReadyParts) {
+  // part size 100, min part size 40, threshold 200
+  StreamUpload upload(100, 40, 200);
+  EXPECT_TRUE(upload.TakeReadyParts(190).empty());  // under threshold
+  EXPECT_FALSE(upload.IsStarted());
+
+  // the last part is kept until the file grows by min part size beyond it
+  StreamPartList parts = upload.TakeReadyParts(239);
+  ASSERT_EQ(parts.size(), 1u);
+  EXPECT_EQ(parts[0].partId, 1);
+  EXPECT_EQ(parts[0].offset, 0);
+  EXPECT_EQ(parts[0].size, 100u);
+  EXPECT_TRUE(upload.IsStarted());
+
+  // no part is taken while initiating
+  EXPECT_TRUE(upload.TakeReadyParts(1000).empty());
+  upload.FinishInitiate("id");
+  EXPECT_TRUE(upload.IsInitiated());
+
+  parts = upload.TakeReadyParts(340);
+  ASSERT_EQ(parts.size(), 2u);
+  EXPECT_EQ(parts[0].partId, 2);
+  EXPECT_EQ(parts[1].partId, 3);
+  EXPECT_EQ(parts[1].offset, 200);
+  EXPECT_EQ(upload.GetTakenStop(), 300);
+}
+
+TEST(StreamUploadTest, TakeFinalParts) {
+  StreamUpload upload(100, 40, 0);
+  StreamPartList parts = upload.TakeReadyParts(250);
+  ASSERT_EQ(parts.size(), 2u);
+  upload.FinishInitiate("id");
+  upload.FinishPart(1, true);
+  upload.FinishPart(2, true);
+  upload.WaitForParts();
+
+  // a part uploaded is rewritten
+  upload.OnWrite(150, 10);
+  upload.OnWrite(200, 10);  // not taken yet
+  parts = upload.TakeFinalParts(330);
+  ASSERT_EQ(parts.size(), 2u);
+  EXPECT_EQ(parts[0].partId, 2);
+  EXPECT_EQ(parts[0].offset, 100);
+  EXPECT_EQ(parts[0].size, 100u);
+  // the tail could be larger than part size
+  EXPECT_EQ(parts[1].partId, 3);
+  EXPECT_EQ(parts[1].offset, 200);
+  EXPECT_EQ(parts[1].size, 130u);
+  upload.FinishPart(2, true);
+  upload.FinishPart(3, true);
+  upload.WaitForParts();
+  EXPECT_FALSE(upload.IsBroken());
+
+  vector<int> partIds = upload.GetSortedPartIds();
+  ASSERT_EQ(partIds.size(), 3u);
+  EXPECT_EQ(partIds[0], 1);
+  EXPECT_EQ(partIds[2], 3);
+}
+
+TEST(StreamUploadTest, Broken) {
+  StreamUpload upload(100, 40, 0);
+  upload.TakeReadyParts(150);
+  upload.FinishInitiate("id");
+  upload.FinishPart(1, false);
+  EXPECT_TRUE(upload.IsBroken());
+  EXPECT_TRUE(upload.TakeReadyParts(1000).empty());
+  EXPECT_TRUE(upload.TakeFinalParts(1000).empty());
+
+  // fail to initiate
+  StreamUpload upload1(100, 40, 0);
+  upload1.TakeReadyParts(150);
+  upload1.FinishInitiate("");
+  EXPECT_TRUE(upload1.IsBroken());
+
+  // shrink into the taken parts
+  StreamUpload upload2(100, 40, 0);
+  upload2.TakeReadyParts(150);
+  upload2.FinishInitiate("id");
+  upload2.FinishPart(1, true);
+  EXPECT_TRUE(upload2.TakeFinalParts(120).empty());
+  EXPECT_TRUE(upload2.IsBroken());
+}
+
+}  // namespace Data
+}  // namespace QS
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  int code = RUN_ALL_TESTS();
+  return code;
+}
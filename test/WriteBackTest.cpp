@@ -0,0 +1,183 @@
+// +-------------------------------------------------------------------------
+// | Copyright (C) 2017 Yunify, Inc.
+// +-------------------------------------------------------------------------
+// | Licensed under the Apache License, Version 2.0 (the "License");
+// | You may not use this work except in compliance with the License.
+// | You may obtain a copy of the License in the LICENSE file, or at:
+// |
+// | http://www.apache.org/licenses/LICENSE-2.0
+// |
+// | Unless required by applicable law or agreed to in writing, software
+// | distributed under the License is distributed on an "AS IS" BASIS,
+// | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// | See the License for the specific language governing permissions and
+// | limitations under the License.
+// +-------------------------------------------------------------------------
+
+#include <string>
+#include <vector>
+
+#include "boost/bind.hpp"
+#include "boost/thread/locks.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/thread.hpp"
+#include "gtest/gtest.h"
+
+#include "base/Logging.h"
+#include "base/Utils.h"
+#include "data/WriteBack.h"
+
+namespace QS {
+
+namespace Data {
+
+using boost::lock_guard;
+using boost::mutex;
+using std::string;
+using std::vector;
+using ::testing::Test;
+
+// default log dir
+static const char *defaultLogDir = "/tmp/qsfs.test.logs/";
+void InitLog() {
+  QS::Utils::CreateDirectoryIfNotExists(defaultLogDir);
+  QS::Logging::Log::Instance().Initialize(defaultLogDir);
+}
+
+// Record files written back
+class Uploader {
+ public:
+  Uploader() : m_clean(true) {}
+
+  bool Upload(const string &filePath) {
+    lock_guard<mutex> lock(m_mutex);
+    m_files.push_back(filePath);
+    return m_clean;
+  }
+
+  vector<string> GetFiles() const {
+    lock_guard<mutex> lock(m_mutex);
+    return m_files;
+  }
+
+  // Wait until num of files are written back or timeout
+  bool WaitFor(size_t numFiles, int timeoutInMs) const {
+    for (int i = 0; i < timeoutInMs / 10; ++i) {
+      if (GetFiles().size() >= numFiles) {
+        return true;
+      }
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+    return GetFiles().size() >= numFiles;
+  }
+
+  void SetClean(bool clean) {
+    lock_guard<mutex> lock(m_mutex);
+    m_clean = clean;
+  }
+
+  WriteBack::FlushHandler GetHandler() {
+    return boost::bind(boost::type<bool>(), &Uploader::Upload, this, _1);
+  }
+
+ private:
+  mutable mutex m_mutex;
+  vector<string> m_files;
+  bool m_clean;
+};
+
+class WriteBackTest : public Test {
+ protected:
+  static void SetUpTestCase() { InitLog(); }
+};
+
+TEST_F(WriteBackTest, Sync) {
+  Uploader uploader;
+  WriteBack writeBack(uploader.GetHandler(), 3600, 1024);
+  writeBack.AddDirtyBytes("/a", 10);
+  writeBack.AddDirtyBytes("/a", 20);
+  EXPECT_TRUE(writeBack.IsPending("/a"));
+  EXPECT_EQ(writeBack.GetDirtySize(), 30u);
+
+  writeBack.Sync("/b");  // not dirty
+  EXPECT_TRUE(uploader.GetFiles().empty());
+
+  // writes are coalesced into one upload
+  writeBack.Sync("/a");
+  ASSERT_EQ(uploader.GetFiles().size(), 1u);
+  EXPECT_EQ(uploader.GetFiles()[0], "/a");
+  EXPECT_FALSE(writeBack.IsPending("/a"));
+  EXPECT_EQ(writeBack.GetDirtySize(), 0u);
+
+  // nothing to do as it is clean
+  writeBack.Sync("/a");
+  EXPECT_EQ(uploader.GetFiles().size(), 1u);
+}
+
+TEST_F(WriteBackTest, Delay) {
+  Uploader uploader;
+  WriteBack writeBack(uploader.GetHandler(), 1, 1024);
+  writeBack.Start();
+  writeBack.AddDirtyBytes("/a", 10);
+  EXPECT_TRUE(uploader.WaitFor(1, 5000));
+  EXPECT_FALSE(writeBack.IsPending("/a"));
+  writeBack.Stop();
+  EXPECT_EQ(uploader.GetFiles().size(), 1u);
+}
+
+TEST_F(WriteBackTest, Threshold) {
+  Uploader uploader;
+  WriteBack writeBack(uploader.GetHandler(), 3600, 100);
+  writeBack.Start();
+  writeBack.AddDirtyBytes("/a", 50);
+  EXPECT_FALSE(uploader.WaitFor(1, 200));
+
+  // the oldest file is written back until it is under the threshold
+  writeBack.AddDirtyBytes("/b", 60);
+  EXPECT_TRUE(uploader.WaitFor(1, 5000));
+  EXPECT_FALSE(uploader.WaitFor(2, 200));
+  EXPECT_EQ(uploader.GetFiles()[0], "/a");
+  EXPECT_TRUE(writeBack.IsPending("/b"));
+  EXPECT_EQ(writeBack.GetDirtySize(), 60u);
+}
+
+TEST_F(WriteBackTest, StopWritesBackAll) {
+  Uploader uploader;
+  {
+    WriteBack writeBack(uploader.GetHandler(), 3600, 1024);
+    writeBack.Start();
+    writeBack.AddDirtyBytes("/a", 10);
+    writeBack.AddDirtyBytes("/b", 10);
+    writeBack.AddDirtyBytes("/c", 10);
+    writeBack.Forget("/c");  // removed
+    EXPECT_EQ(writeBack.GetNumPending(), 2u);
+  }
+  vector<string> files = uploader.GetFiles();
+  ASSERT_EQ(files.size(), 2u);
+  EXPECT_EQ(files[0], "/a");
+  EXPECT_EQ(files[1], "/b");
+}
+
+TEST_F(WriteBackTest, RetryDirtyFile) {
+  Uploader uploader;
+  WriteBack writeBack(uploader.GetHandler(), 3600, 1024);
+  uploader.SetClean(false);
+  writeBack.AddDirtyBytes("/a", 10);
+  writeBack.Sync("/a");
+  EXPECT_EQ(uploader.GetFiles().size(), 1u);
+  EXPECT_TRUE(writeBack.IsPending("/a"));
+
+  uploader.SetClean(true);
+  writeBack.Sync("/a");
+  EXPECT_EQ(uploader.GetFiles().size(), 2u);
+  EXPECT_FALSE(writeBack.IsPending("/a"));
+}
+
+}  // namespace Data
+}  // namespace QS
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  int code = RUN_ALL_TESTS();
+  return code;
+}